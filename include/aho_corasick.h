@@ -0,0 +1,171 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * aho_corasick.h
+ *
+ * @file
+ * @brief An Aho-Corasick automaton for finding many DNA patterns in a
+ * single pass over a sequence.
+ */
+
+#ifndef SAMTOOLS_AHO_CORASICK_H
+#define SAMTOOLS_AHO_CORASICK_H
+
+#include "samtools_service.h"
+
+
+/**
+ * The number of letters in the automaton's alphabet, A, C, G and T.
+ */
+#define AC_ALPHABET_SIZE (4)
+
+
+/**
+ * An Aho-Corasick automaton over A, C, G and T. Any other base in
+ * the scanned sequence takes it back to its root state.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct AhoCorasickAutomaton
+{
+	/**
+	 * The next state for each state and base, with AC_ALPHABET_SIZE
+	 * entries per state. This is the complete transition function so
+	 * scanning never needs to follow the failure links.
+	 */
+	int32 *aca_transitions_p;
+
+	/** The failure link for each state. */
+	int32 *aca_failures_p;
+
+	/**
+	 * The first pattern that ends at each state or -1. Further patterns
+	 * with the same bases follow on through aca_next_patterns_p.
+	 */
+	int32 *aca_patterns_p;
+
+	/**
+	 * The nearest state along the failure links that has a pattern
+	 * ending at it or -1.
+	 */
+	int32 *aca_output_links_p;
+
+	/** The number of states. */
+	uint32 aca_num_states;
+
+	/** The number of states that the arrays have space for. */
+	uint32 aca_max_states;
+
+	/** The next pattern with the same bases for each pattern or -1. */
+	int32 *aca_next_patterns_p;
+
+	/** The length of each pattern. */
+	uint32 *aca_pattern_lengths_p;
+
+	/** The number of patterns. */
+	uint32 aca_num_patterns;
+
+	/** The number of patterns that the arrays have space for. */
+	uint32 aca_max_patterns;
+} AhoCorasickAutomaton;
+
+
+/**
+ * The function called for each match found by ScanWithAhoCorasick.
+ *
+ * @param pattern_index The index of the matching pattern.
+ * @param start The position in the scanned sequence where the match starts.
+ * @param data_p The data passed to ScanWithAhoCorasick.
+ * @return <code>true</code> to carry on scanning, <code>false</code> to stop.
+ * @ingroup samtools_service
+ */
+typedef bool (*AhoCorasickMatch) (const uint32 pattern_index, const size_t start, void *data_p);
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate an empty AhoCorasickAutomaton.
+ *
+ * @return The AhoCorasickAutomaton or <code>NULL</code> upon error.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL AhoCorasickAutomaton *AllocateAhoCorasickAutomaton (void);
+
+
+/**
+ * Free an AhoCorasickAutomaton.
+ *
+ * @param automaton_p The AhoCorasickAutomaton to free.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void FreeAhoCorasickAutomaton (AhoCorasickAutomaton *automaton_p);
+
+
+/**
+ * Add a pattern to an AhoCorasickAutomaton. All of the patterns must be
+ * added before FinishAhoCorasickAutomaton is called.
+ *
+ * @param automaton_p The AhoCorasickAutomaton.
+ * @param pattern_s The pattern which must only contain A, C, G and T in
+ * either case.
+ * @param length The length of the pattern.
+ * @return The index of the pattern, which is passed to the AhoCorasickMatch
+ * function when it is found, or -1 upon error.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL int32 AddAhoCorasickPattern (AhoCorasickAutomaton *automaton_p, const char *pattern_s, const size_t length);
+
+
+/**
+ * Build the failure links and transitions once all of the patterns
+ * have been added.
+ *
+ * @param automaton_p The AhoCorasickAutomaton.
+ * @return <code>true</code> if the automaton was built successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool FinishAhoCorasickAutomaton (AhoCorasickAutomaton *automaton_p);
+
+
+/**
+ * Find every occurrence of the patterns in a sequence in a single pass.
+ * A finished automaton is not changed by scanning, so several threads
+ * can scan with it at once.
+ *
+ * @param automaton_p The finished AhoCorasickAutomaton.
+ * @param sequence_s The sequence. This does not need to be terminated.
+ * @param length The length of the sequence.
+ * @param match_fn The function to call for each match.
+ * @param data_p The data to pass to match_fn.
+ * @return <code>true</code> if the whole sequence was scanned, <code>false</code>
+ * if match_fn stopped the scan.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool ScanWithAhoCorasick (const AhoCorasickAutomaton *automaton_p, const char *sequence_s, const size_t length, AhoCorasickMatch match_fn, void *data_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_AHO_CORASICK_H */
@@ -0,0 +1,221 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * alignment_data.h
+ *
+ * @file
+ * @brief The configured alignment files along with their cached
+ * file, header and index handles.
+ */
+
+#ifndef SAMTOOLS_ALIGNMENT_DATA_H
+#define SAMTOOLS_ALIGNMENT_DATA_H
+
+#include <pthread.h>
+
+#include "index_data.h"
+#include "read_name_index.h"
+#include "parameter_set.h"
+
+#include "htslib/sam.h"
+
+
+/**
+ * The details of a configured alignment file.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct AlignmentData
+{
+	/** The sample name that the alignments are for. */
+	const char *ad_name_s;
+
+	/** The BAM or CRAM file. */
+	const char *ad_filename_s;
+
+	/**
+	 * The configured reference that the alignments are against. This is
+	 * used to decode CRAM files. It can be <code>NULL</code>.
+	 */
+	IndexData *ad_reference_p;
+
+	/** The open alignment file. */
+	htsFile *ad_file_p;
+
+	/** The header of the alignment file. */
+	sam_hdr_t *ad_header_p;
+
+	/** The index of the alignment file. */
+	hts_idx_t *ad_index_p;
+
+	/**
+	 * The read name index used to find mates. This is only loaded
+	 * when it is first needed.
+	 */
+	ReadNameIndex *ad_read_names_p;
+
+	/**
+	 * The mutex guarding the file handles, since they can only be
+	 * used by one thread at a time.
+	 */
+	pthread_mutex_t ad_mutex;
+} AlignmentData;
+
+
+/* forward declaration */
+struct SamToolsServiceData;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Initialise an AlignmentData. The alignment file is not opened until
+ * it is first used.
+ *
+ * @param alignment_data_p The AlignmentData to initialise.
+ * @param name_s The sample name for the alignments.
+ * @param filename_s The BAM or CRAM file.
+ * @param reference_p The configured reference for the alignments. This can
+ * be <code>NULL</code>.
+ * @return <code>true</code> if the AlignmentData was initialised successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool InitAlignmentData (AlignmentData *alignment_data_p, const char *name_s, const char *filename_s, IndexData *reference_p);
+
+
+/**
+ * Close any handles that an AlignmentData has open.
+ *
+ * @param alignment_data_p The AlignmentData to clear.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void ClearAlignmentData (AlignmentData *alignment_data_p);
+
+
+/**
+ * Get exclusive access to the file, header and index handles of an
+ * AlignmentData, opening them if this is the first time that they have
+ * been requested. Each successful call must be followed by a call to
+ * UnlockAlignmentData.
+ *
+ * @param alignment_data_p The AlignmentData to lock.
+ * @return <code>true</code> if the handles are open and locked,
+ * <code>false</code> upon error in which case the AlignmentData is not
+ * left locked.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool LockAlignmentData (AlignmentData *alignment_data_p);
+
+
+/**
+ * Release the access to the handles that was acquired by LockAlignmentData.
+ *
+ * @param alignment_data_p The AlignmentData to unlock.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void UnlockAlignmentData (AlignmentData *alignment_data_p);
+
+
+/**
+ * Get the read name index for a locked AlignmentData, mapping it the
+ * first time that it is available. This never builds the index.
+ *
+ * @param alignment_data_p The AlignmentData which must have been locked
+ * by LockAlignmentData.
+ * @param sidecar_directory_s The directory that the index is kept in. If
+ * this is <code>NULL</code>, it is looked for next to the alignment file.
+ * @return The ReadNameIndex or <code>NULL</code> if the background builder
+ * has not written it yet or upon error.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL ReadNameIndex *GetAlignmentReadNameIndex (AlignmentData *alignment_data_p, const char *sidecar_directory_s);
+
+
+/**
+ * Add the parameters that are shared by all of the alignment-based modes.
+ *
+ * @param data_p The configuration data for the SamTools service.
+ * @param param_set_p The ParameterSet to add the parameters to.
+ * @return <code>true</code> if the parameters were added successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool AddAlignmentParameters (struct SamToolsServiceData *data_p, ParameterSet *param_set_p);
+
+
+/**
+ * Get the ParameterType for one of the parameters that are shared by all of
+ * the alignment-based modes.
+ *
+ * @param param_name_s The name of the parameter.
+ * @param pt_p Where the ParameterType will be stored if the parameter is
+ * one of the alignment parameters.
+ * @return <code>true</code> if the parameter was found, <code>false</code>
+ * otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool GetAlignmentParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p);
+
+
+/**
+ * Get the alignment files for the samples requested in a ParameterSet.
+ *
+ * @param data_p The configuration data for the SamTools service.
+ * @param param_set_p The parameters for the job.
+ * @param samples_ppp Where the newly-allocated array of the matching
+ * AlignmentData pointers will be stored. This should be freed with
+ * FreeMemory.
+ * @return The number of matching samples.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL size_t GetRequestedSamples (const struct SamToolsServiceData *data_p, const ParameterSet *param_set_p, AlignmentData ***samples_ppp);
+
+
+/**
+ * Get the read filtering thresholds from a ParameterSet.
+ *
+ * @param param_set_p The parameters for the job.
+ * @param min_mapping_quality_p Where the minimum mapping quality will be stored.
+ * @param min_base_quality_p Where the minimum base quality will be stored.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void GetAlignmentQualityThresholds (const ParameterSet *param_set_p, uint32 *min_mapping_quality_p, uint32 *min_base_quality_p);
+
+
+/**
+ * Check whether a read should be used according to its flags and
+ * mapping quality.
+ *
+ * @param read_p The read to check.
+ * @param min_mapping_quality The minimum mapping quality.
+ * @return <code>true</code> if the read should be used, <code>false</code>
+ * otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool IsUsableRead (const bam1_t *read_p, const uint32 min_mapping_quality);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_ALIGNMENT_DATA_H */
@@ -0,0 +1,79 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * allele_counter.h
+ *
+ * @file
+ * @brief Count the alleles at a panel of known SNP positions across
+ * the configured alignment files.
+ */
+
+#ifndef SAMTOOLS_ALLELE_COUNTER_H
+#define SAMTOOLS_ALLELE_COUNTER_H
+
+#include "samtools_service_data.h"
+#include "parameter_set.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Add the parameters used by the allele counting mode.
+ *
+ * @param data_p The configuration data for the SamTools service.
+ * @param param_set_p The ParameterSet to add the parameters to.
+ * @return <code>true</code> if the parameters were added successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool AddAlleleCountsParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p);
+
+
+/**
+ * Get the ParameterType for one of the allele counting parameters.
+ *
+ * @param param_name_s The name of the parameter.
+ * @param pt_p Where the ParameterType will be stored if the parameter is
+ * one of the allele counting parameters.
+ * @return <code>true</code> if the parameter was found, <code>false</code>
+ * otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool GetAlleleCountsParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p);
+
+
+/**
+ * Run a job that counts the alleles at each of the requested SNP positions
+ * for each of the requested samples. Each alignment file is walked once,
+ * in sorted order, and the samples are processed concurrently.
+ *
+ * @param service_p The SamTools Service.
+ * @param param_set_p The parameters for the job.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void RunAlleleCountsJob (Service *service_p, ParameterSet *param_set_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_ALLELE_COUNTER_H */
@@ -0,0 +1,115 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * composition.h
+ *
+ * @file
+ * @brief Get the base composition of a region in fixed-size windows.
+ */
+
+#ifndef SAMTOOLS_COMPOSITION_H
+#define SAMTOOLS_COMPOSITION_H
+
+#include "samtools_service_data.h"
+#include "sequence_kernels.h"
+#include "parameter_set.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Add the parameters used by the composition mode.
+ *
+ * @param data_p The configuration data for the SamTools service.
+ * @param param_set_p The ParameterSet to add the parameters to.
+ * @return <code>true</code> if the parameters were added successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool AddCompositionParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p);
+
+
+/**
+ * Get the ParameterType for one of the composition parameters.
+ *
+ * @param param_name_s The name of the parameter.
+ * @param pt_p Where the ParameterType will be stored if the parameter is
+ * one of the composition parameters.
+ * @return <code>true</code> if the parameter was found, <code>false</code>
+ * otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool GetCompositionParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p);
+
+
+/**
+ * Count the base composition of a region of a scaffold in windows. The
+ * region is fetched in blocks which are counted concurrently.
+ *
+ * @param index_data_p The IndexData to get the sequence from.
+ * @param scaffold_name_s The name of the scaffold.
+ * @param start The 0-based start of the region.
+ * @param end The 0-based, exclusive end of the region.
+ * @param scaffold_length The length of the scaffold, so a CpG spanning the
+ * end of the region can be counted.
+ * @param window_size The size of each window. The last window may be shorter.
+ * @param num_threads The maximum number of threads to use.
+ * @param windows_p The zeroed array to add the counts for each window to.
+ * This must have an entry for every window in the region.
+ * @return <code>true</code> if the region was counted successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool CountRegionComposition (IndexData *index_data_p, const char *scaffold_name_s, const hts_pos_t start, const hts_pos_t end, const hts_pos_t scaffold_length, const uint32 window_size, const uint32 num_threads, BaseComposition *windows_p);
+
+
+/**
+ * Get the counts for a set of windows as a JSON object with an array
+ * of each type of count.
+ *
+ * @param scaffold_name_s The name of the scaffold.
+ * @param start The 0-based start of the region.
+ * @param end The 0-based, exclusive end of the region.
+ * @param window_size The size of each window.
+ * @param windows_p The counts for each window.
+ * @param num_windows The number of windows.
+ * @return The JSON object or <code>NULL</code> upon error.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL json_t *GetCompositionAsJSON (const char *scaffold_name_s, const hts_pos_t start, const hts_pos_t end, const uint32 window_size, const BaseComposition *windows_p, const size_t num_windows);
+
+
+/**
+ * Run a job that gets the GC, AT, N, soft-masked and CpG counts for
+ * each window of the region given by the Scaffold parameter.
+ *
+ * @param service_p The SamTools Service.
+ * @param param_set_p The parameters for the job.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void RunCompositionJob (Service *service_p, ParameterSet *param_set_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_COMPOSITION_H */
@@ -0,0 +1,174 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * composition_track.h
+ *
+ * @file
+ * @brief Precomputed base composition summaries for each configured
+ * FASTA file. These are built in the background and stored in a
+ * memory-mapped sidecar file at several resolutions so that zoomed-out
+ * composition requests do not need to read the sequence.
+ */
+
+#ifndef SAMTOOLS_COMPOSITION_TRACK_H
+#define SAMTOOLS_COMPOSITION_TRACK_H
+
+#include "samtools_service_data.h"
+#include "sequence_kernels.h"
+#include "sidecar_file.h"
+
+
+/**
+ * The number of resolutions stored in each composition track.
+ */
+#define CT_NUM_LEVELS (3)
+
+
+/**
+ * The counts for one bin of a composition track. Every bin size
+ * is small enough for these to fit into 16 bits.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct CompositionBin
+{
+	/** The number of G and C bases. */
+	uint16 cb_gc;
+
+	/** The number of A and T bases. */
+	uint16 cb_at;
+
+	/** The number of gap bases. */
+	uint16 cb_n;
+
+	/** The number of soft-masked bases. */
+	uint16 cb_soft_masked;
+
+	/** The number of CpG dinucleotides that start in the bin. */
+	uint16 cb_cpg;
+} CompositionBin;
+
+
+/**
+ * Where a scaffold's bins are within a composition track. The bins for
+ * each resolution follow each other, finest first.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct CompositionTrackScaffold
+{
+	/** The length of the scaffold. */
+	uint64 cts_length;
+
+	/** The index of the scaffold's first bin. */
+	uint64 cts_first_bin;
+} CompositionTrackScaffold;
+
+
+/**
+ * A memory-mapped composition track.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct CompositionTrack
+{
+	/** The mapped sidecar file. */
+	MappedFile ct_file;
+
+	/** The number of scaffolds, in the same order as the FASTA index. */
+	size_t ct_num_scaffolds;
+
+	/** The bin size for each resolution, finest first. */
+	const uint32 *ct_bin_sizes_p;
+
+	/** The details for each scaffold. */
+	const CompositionTrackScaffold *ct_scaffolds_p;
+
+	/** The bins for all of the scaffolds. */
+	const CompositionBin *ct_bins_p;
+} CompositionTrack;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Build the composition track for an IndexData if it does not have an
+ * up-to-date one. This reads the whole FASTA file so it is run by the
+ * background SidecarBuilder rather than by a job.
+ *
+ * @param index_data_p The IndexData.
+ * @param sidecar_directory_s The directory for the sidecar files or
+ * <code>NULL</code> to keep them next to the FASTA file.
+ * @param stop_flag_p If this becomes <code>true</code>, the build stops
+ * and any partially-built track is discarded.
+ * @return <code>true</code> if the track is up to date, <code>false</code>
+ * otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool BuildIndexCompositionTrack (IndexData *index_data_p, const char *sidecar_directory_s, volatile bool *stop_flag_p);
+
+
+/**
+ * Get the composition track for an IndexData, mapping it the first time
+ * that it is available. This never builds the track.
+ *
+ * @param index_data_p The IndexData.
+ * @param sidecar_directory_s The directory for the sidecar files or
+ * <code>NULL</code> to keep them next to the FASTA file.
+ * @return The CompositionTrack or <code>NULL</code> if it has not been
+ * built yet.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL const CompositionTrack *GetIndexCompositionTrack (IndexData *index_data_p, const char *sidecar_directory_s);
+
+
+/**
+ * Free a CompositionTrack.
+ *
+ * @param track_p The CompositionTrack to free.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void FreeCompositionTrack (CompositionTrack *track_p);
+
+
+/**
+ * Get the windowed composition of a region from a composition track. This
+ * only works if the windows and the region line up with the bins of one
+ * of the resolutions.
+ *
+ * @param track_p The CompositionTrack.
+ * @param scaffold_index The index of the scaffold within the FASTA index.
+ * @param start The 0-based start of the region.
+ * @param end The 0-based, exclusive end of the region.
+ * @param window_size The size of each window.
+ * @param windows_p The zeroed array to add the counts for each window to.
+ * @return <code>true</code> if the counts were taken from the track,
+ * <code>false</code> if the region needs to be counted from the sequence.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool GetCompositionFromTrack (const CompositionTrack *track_p, const int scaffold_index, const hts_pos_t start, const hts_pos_t end, const uint32 window_size, BaseComposition *windows_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_COMPOSITION_TRACK_H */
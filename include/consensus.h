@@ -0,0 +1,57 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * consensus.h
+ *
+ * @file
+ * @brief Build a majority-consensus sequence from the reads aligned
+ * over a region.
+ */
+
+#ifndef SAMTOOLS_CONSENSUS_H
+#define SAMTOOLS_CONSENSUS_H
+
+#include "samtools_service_data.h"
+#include "parameter_set.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Run a job that builds the majority-consensus sequence of the reads from
+ * a single sample over a region. Each column is called as the most common
+ * base among the reads that pass the quality thresholds, <code>N</code>
+ * where there is no coverage or a tie and <code>-</code> where most of the
+ * reads have a deletion. Insertions are not included so the consensus keeps
+ * the coordinates of the reference.
+ *
+ * @param service_p The SamTools Service.
+ * @param param_set_p The parameters for the job.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void RunConsensusJob (Service *service_p, ParameterSet *param_set_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_CONSENSUS_H */
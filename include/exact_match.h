@@ -0,0 +1,90 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * exact_match.h
+ *
+ * @file
+ * @brief Count and locate the exact matches of a sequence in the
+ * assemblies that have an FM-index.
+ */
+
+#ifndef SAMTOOLS_EXACT_MATCH_H
+#define SAMTOOLS_EXACT_MATCH_H
+
+#include "samtools_service_data.h"
+#include "parameter_set.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Check whether any of the configured FASTA files has an FM-index.
+ *
+ * @param data_p The configuration data for the SamTools service.
+ * @return <code>true</code> if the exact match mode can be used,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool HasFmIndexes (const SamToolsServiceData *data_p);
+
+
+/**
+ * Add the parameters used by the exact match mode.
+ *
+ * @param data_p The configuration data for the SamTools service.
+ * @param param_set_p The ParameterSet to add the parameters to.
+ * @return <code>true</code> if the parameters were added successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool AddExactMatchParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p);
+
+
+/**
+ * Get the ParameterType for one of the exact match parameters.
+ *
+ * @param param_name_s The name of the parameter.
+ * @param pt_p Where the ParameterType will be stored if the parameter is
+ * one of the exact match parameters.
+ * @return <code>true</code> if the parameter was found, <code>false</code>
+ * otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool GetExactMatchParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p);
+
+
+/**
+ * Run a job that counts the exact matches of a sequence, on both strands,
+ * using the FM-index of the selected FASTA file or of all of them, and
+ * gets the coordinates of up to a maximum number of them.
+ *
+ * @param service_p The SamTools Service.
+ * @param param_set_p The parameters for the job.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void RunExactMatchJob (Service *service_p, ParameterSet *param_set_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_EXACT_MATCH_H */
@@ -0,0 +1,67 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * fasta_export.h
+ *
+ * @file
+ * @brief Export a subset of the scaffolds in a reference sequence file
+ * as a new FASTA file.
+ */
+
+#ifndef SAMTOOLS_FASTA_EXPORT_H
+#define SAMTOOLS_FASTA_EXPORT_H
+
+#include "samtools_service_data.h"
+#include "parameter_set.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Run a job that writes the selected scaffolds to a new bgzipped FASTA
+ * file in the configured output directory along with its .fai and .gzi
+ * indexes. The scaffolds are streamed in blocks so the memory used
+ * doesn't depend on their size. The result is a file DataResource.
+ *
+ * @param service_p The SamTools Service.
+ * @param param_set_p The parameters for the job.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void RunExportJob (Service *service_p, ParameterSet *param_set_p);
+
+
+/**
+ * Run a job that streams the selected scaffolds, wrapped and in the order
+ * that they are in the reference file, into a single plain multi-FASTA file
+ * in the configured output directory. The result is a file DataResource.
+ *
+ * @param service_p The SamTools Service.
+ * @param param_set_p The parameters for the job.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void RunMultiFastaJob (Service *service_p, ParameterSet *param_set_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_FASTA_EXPORT_H */
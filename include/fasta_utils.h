@@ -0,0 +1,111 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * fasta_utils.h
+ *
+ * @file
+ * @brief Helper functions for writing FASTA data and manipulating
+ * sequences.
+ */
+
+#ifndef SAMTOOLS_FASTA_UTILS_H
+#define SAMTOOLS_FASTA_UTILS_H
+
+#include "samtools_service.h"
+#include "byte_buffer.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Append a block of sequence to a ByteBuffer, adding a newline after
+ * every line_length letters. The sequence can be appended in consecutive
+ * blocks and the line breaks will be placed as if it had been appended
+ * all at once.
+ *
+ * @param buffer_p The ByteBuffer to append to.
+ * @param sequence_s The sequence data to append. This does not need to
+ * be terminated.
+ * @param length The number of letters to append.
+ * @param line_length The number of letters to write on each line. If this
+ * is 0, then no newlines are added.
+ * @param column_p The number of letters already written on the current line.
+ * This will be updated by this function and should be initialised to 0 before
+ * appending the first block of a sequence.
+ * @return <code>true</code> if the sequence was appended successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool AppendWrappedSequence (ByteBuffer *buffer_p, const char *sequence_s, size_t length, const uint32 line_length, uint32 *column_p);
+
+
+/**
+ * Finish a sequence that was written with AppendWrappedSequence by adding
+ * a final newline if the last line was not already terminated.
+ *
+ * @param buffer_p The ByteBuffer to append to.
+ * @param column_p The current column that was updated by AppendWrappedSequence.
+ * This will be reset to 0.
+ * @return <code>true</code> if successful, <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool FinishWrappedSequence (ByteBuffer *buffer_p, uint32 *column_p);
+
+
+/**
+ * Get the complement of a base. IUPAC ambiguity codes are complemented
+ * too and the case of the base is kept.
+ *
+ * @param base The base.
+ * @return The complementary base or the base itself if it is not a letter.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL char ComplementBase (const char base);
+
+
+/**
+ * Write the reverse complement of a sequence.
+ *
+ * @param dest_s Where to write the reverse complement. This must have
+ * space for length bases and must not overlap sequence_s. It is not terminated.
+ * @param sequence_s The sequence.
+ * @param length The length of the sequence.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void ReverseComplementSequence (char *dest_s, const char *sequence_s, const size_t length);
+
+
+/**
+ * Get the bases that an IUPAC code stands for.
+ *
+ * @param base The upper case IUPAC code.
+ * @return The bases, in the order A, C, G and T, or <code>NULL</code> if
+ * the code is not a valid one.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL const char *GetIUPACBases (const char base);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_FASTA_UTILS_H */
@@ -0,0 +1,160 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * fasta_writer.h
+ *
+ * @file
+ * @brief Write FASTA files, optionally with bgzip compression, building
+ * their .fai and .gzi indexes as the sequences are written.
+ */
+
+#ifndef SAMTOOLS_FASTA_WRITER_H
+#define SAMTOOLS_FASTA_WRITER_H
+
+#include "samtools_service.h"
+#include "byte_buffer.h"
+
+#include "htslib/bgzf.h"
+
+
+/**
+ * A FASTA file that is being written.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct FastaWriter
+{
+	/** The FASTA filename. */
+	char *faw_filename_s;
+
+	/** The output. This is only compressed if faw_compress_flag is set. */
+	BGZF *faw_bgzf_p;
+
+	/** Is the output bgzipped? */
+	bool faw_compress_flag;
+
+	/**
+	 * The formatted data that has not been passed to faw_bgzf_p yet.
+	 * Sequences are wrapped into this so that the compressor gets
+	 * large blocks rather than single lines.
+	 */
+	ByteBuffer *faw_buffer_p;
+
+	/** The lines of the .fai index. */
+	ByteBuffer *faw_fai_buffer_p;
+
+	/** The number of uncompressed bytes passed to faw_bgzf_p so far. */
+	uint64 faw_offset;
+
+	/** The number of letters on each line. */
+	uint32 faw_line_length;
+
+	/** The number of letters on the current line. */
+	uint32 faw_column;
+
+	/** The name of the current sequence. */
+	char *faw_sequence_name_s;
+
+	/** The uncompressed offset of the start of the current sequence. */
+	uint64 faw_sequence_offset;
+
+	/** The length of the current sequence so far. */
+	uint64 faw_sequence_length;
+} FastaWriter;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create a new FASTA file.
+ *
+ * @param filename_s The file to write.
+ * @param line_length The number of letters to write on each line. If this
+ * is 0, each sequence is written on a single line.
+ * @param compress_flag If this is <code>true</code> the file is bgzipped,
+ * otherwise it is written as plain text.
+ * @param num_threads The number of threads to compress with.
+ * @return The FastaWriter which should be freed with FreeFastaWriter or
+ * <code>NULL</code> upon error.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL FastaWriter *AllocateFastaWriter (const char *filename_s, const uint32 line_length, const bool compress_flag, const uint32 num_threads);
+
+
+/**
+ * Free a FastaWriter. If CloseFastaWriter has not been called, the
+ * partially-written files are removed.
+ *
+ * @param writer_p The FastaWriter to free.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void FreeFastaWriter (FastaWriter *writer_p);
+
+
+/**
+ * Start writing a new sequence.
+ *
+ * @param writer_p The FastaWriter to use.
+ * @param name_s The name of the sequence.
+ * @return <code>true</code> if successful, <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool StartFastaWriterSequence (FastaWriter *writer_p, const char *name_s);
+
+
+/**
+ * Write the next block of the current sequence.
+ *
+ * @param writer_p The FastaWriter to use.
+ * @param sequence_s The sequence data. This does not need to be terminated.
+ * @param length The number of letters to write.
+ * @return <code>true</code> if successful, <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool WriteFastaWriterSequence (FastaWriter *writer_p, const char *sequence_s, const size_t length);
+
+
+/**
+ * Finish the current sequence and add its entry to the .fai index.
+ *
+ * @param writer_p The FastaWriter to use.
+ * @return <code>true</code> if successful, <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool FinishFastaWriterSequence (FastaWriter *writer_p);
+
+
+/**
+ * Finish the FASTA file and write its .fai index and, if it is
+ * compressed, its .gzi index.
+ *
+ * @param writer_p The FastaWriter to close.
+ * @return <code>true</code> if successful, <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool CloseFastaWriter (FastaWriter *writer_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_FASTA_WRITER_H */
@@ -0,0 +1,251 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * fm_index.h
+ *
+ * @file
+ * @brief The FM-indexes, a BWT with a sampled suffix array, that
+ * can be built offline for the configured FASTA files so that exact
+ * matches can be counted and located without scanning the sequences.
+ */
+
+#ifndef SAMTOOLS_FM_INDEX_H
+#define SAMTOOLS_FM_INDEX_H
+
+#include "samtools_service.h"
+#include "sidecar_file.h"
+
+
+/**
+ * The suffix added to a FASTA file's name for its FM-index.
+ */
+#define FM_INDEX_SUFFIX_S ".fmi"
+
+
+/**
+ * The number of rows of the BWT in each FmIndexBlock.
+ */
+#define FM_INDEX_BLOCK_SIZE (64)
+
+
+/**
+ * The codes used for the indexed text. The scaffolds are joined with
+ * FM_N between them so that no match can span two scaffolds and the
+ * text ends with FM_TERMINATOR, which sorts before everything else.
+ */
+#define FM_TERMINATOR (0)
+#define FM_A (1)
+#define FM_C (2)
+#define FM_G (3)
+#define FM_T (4)
+#define FM_N (5)
+
+#define FM_ALPHABET_SIZE (6)
+
+
+/**
+ * The start of each FM-index file. This is followed by the scaffold
+ * starts, padding up to a multiple of 64 bytes, the blocks, the number
+ * of sampled rows before each block and then the samples themselves.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct FmIndexHeader
+{
+	/** Identifies the file as an FM-index. */
+	char fmh_magic [8];
+
+	/** The length of the indexed text, including the separators and terminator. */
+	uint64 fmh_text_length;
+
+	/** The number of scaffolds, in the same order as the FASTA index. */
+	uint64 fmh_num_scaffolds;
+
+	/** The suffix array is sampled at every text position that is a multiple of this. */
+	uint64 fmh_sample_rate;
+
+	/** The number of sampled suffix array entries. */
+	uint64 fmh_num_samples;
+
+	/** The row of the BWT that holds the terminator. */
+	uint64 fmh_terminator_row;
+
+	/**
+	 * For each code from FM_A to FM_N, the first row of the BWT whose
+	 * suffix starts with it.
+	 */
+	uint64 fmh_first_rows [FM_ALPHABET_SIZE - 1];
+} FmIndexHeader;
+
+
+/**
+ * FM_INDEX_BLOCK_SIZE rows of the BWT along with the occurrence counts
+ * up to them, laid out to fill a single cache line.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct FmIndexBlock
+{
+	/** The number of each of A, C, G and T in the BWT before this block. */
+	uint64 fmb_counts [4];
+
+	/** The low bits of the 2-bit codes of the A, C, G and T symbols. */
+	uint64 fmb_low_bits;
+
+	/** The high bits of the 2-bit codes of the A, C, G and T symbols. */
+	uint64 fmb_high_bits;
+
+	/** The rows whose symbol is N or the terminator. */
+	uint64 fmb_other_bits;
+
+	/** The rows whose suffix array entry is sampled. */
+	uint64 fmb_sampled_bits;
+} FmIndexBlock;
+
+
+/**
+ * A memory-mapped FM-index for a FASTA file.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct FmIndex
+{
+	/** The mapped FM-index file. */
+	MappedFile fi_file;
+
+	/** The header at the start of fi_file. */
+	const FmIndexHeader *fi_header_p;
+
+	/**
+	 * The position of each scaffold within the text. There is an extra
+	 * entry at the end with the length of the text.
+	 */
+	const uint64 *fi_scaffold_starts_p;
+
+	/** The blocks of the BWT. */
+	const FmIndexBlock *fi_blocks_p;
+
+	/** For each block, the number of sampled rows before it. */
+	const uint64 *fi_sample_ranks_p;
+
+	/** The sampled suffix array entries, in row order. */
+	const uint64 *fi_samples_p;
+} FmIndex;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Get the number of bytes at the start of an FM-index file before
+ * its blocks.
+ *
+ * @param num_scaffolds The number of scaffolds in the index.
+ * @return The size of the header, the scaffold starts and the padding.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL size_t GetFmIndexPreambleSize (const uint64 num_scaffolds);
+
+
+/**
+ * Fill in the magic bytes at the start of an FmIndexHeader.
+ *
+ * @param header_p The FmIndexHeader.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void SetFmIndexMagic (FmIndexHeader *header_p);
+
+
+/**
+ * Get the code used in the indexed text for a base.
+ *
+ * @param base The base. Case is ignored.
+ * @return The code, which is FM_N for anything other than A, C, G and T.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL uint32 GetFmIndexCode (const char base);
+
+
+/**
+ * Map the FM-index for a FASTA file if one has been built for it.
+ *
+ * @param fasta_filename_s The FASTA file.
+ * @param sidecar_directory_s The directory that the FM-index was built in. If
+ * this is <code>NULL</code>, it is looked for next to the FASTA file.
+ * @return The FmIndex or <code>NULL</code> if there isn't an up to date one.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL FmIndex *LoadFmIndex (const char *fasta_filename_s, const char *sidecar_directory_s);
+
+
+/**
+ * Unmap and free an FmIndex.
+ *
+ * @param fm_index_p The FmIndex to free.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void FreeFmIndex (FmIndex *fm_index_p);
+
+
+/**
+ * Find the rows of the BWT whose suffixes start with a sequence, using
+ * backward search. The number of exact matches is the size of the range.
+ *
+ * @param fm_index_p The FmIndex to search.
+ * @param sequence_s The sequence to find. Case is ignored.
+ * @param length The length of the sequence.
+ * @param start_row_p Where the first row of the range will be stored.
+ * @param end_row_p Where the row after the end of the range will be stored.
+ * @return <code>true</code> if the search ran, <code>false</code> if the sequence
+ * has bases other than A, C, G and T.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool FindFmIndexRows (const FmIndex *fm_index_p, const char *sequence_s, const size_t length, uint64 *start_row_p, uint64 *end_row_p);
+
+
+/**
+ * Get the position within the text of the suffix for a row of the BWT.
+ *
+ * @param fm_index_p The FmIndex.
+ * @param row The row.
+ * @return The 0-based position within the text.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL uint64 LocateFmIndexRow (const FmIndex *fm_index_p, uint64 row);
+
+
+/**
+ * Convert a position within the text of an FmIndex to a scaffold position.
+ *
+ * @param fm_index_p The FmIndex.
+ * @param text_position The 0-based position within the text.
+ * @param scaffold_index_p Where the index of the scaffold within the FASTA
+ * index will be stored.
+ * @return The 0-based position within the scaffold.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL uint64 GetFmIndexScaffoldPosition (const FmIndex *fm_index_p, const uint64 text_position, size_t *scaffold_index_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_FM_INDEX_H */
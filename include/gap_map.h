@@ -0,0 +1,297 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * gap_map.h
+ *
+ * @file
+ * @brief Find the runs of N, the gaps, in the scaffolds of a reference
+ * sequence file and keep them in a memory-mapped sidecar file.
+ */
+
+#ifndef SAMTOOLS_GAP_MAP_H
+#define SAMTOOLS_GAP_MAP_H
+
+#include "samtools_service_data.h"
+#include "sidecar_file.h"
+#include "soft_mask.h"
+#include "parameter_set.h"
+
+
+/**
+ * A gap within a scaffold.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct GapInterval
+{
+	/** The 0-based start of the gap. */
+	uint64 gi_start;
+
+	/** The 0-based, exclusive end of the gap. */
+	uint64 gi_end;
+} GapInterval;
+
+
+/**
+ * A growable list of gaps.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct GapList
+{
+	/** The gaps. */
+	GapInterval *gl_gaps_p;
+
+	/** The number of gaps in gl_gaps_p. */
+	size_t gl_num_gaps;
+
+	/** The number of gaps that gl_gaps_p has space for. */
+	size_t gl_max_gaps;
+} GapList;
+
+
+/**
+ * The state for finding the gaps in a sequence that is
+ * scanned in consecutive blocks.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct GapScanner
+{
+	/** The start of the gap that the last block ended in or -1. */
+	hts_pos_t gs_gap_start;
+
+	/** The gaps that have been found so far. */
+	GapList gs_gaps;
+} GapScanner;
+
+
+/**
+ * The gaps of every scaffold in a reference sequence file.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct GapMap
+{
+	/** The mapped sidecar file. */
+	MappedFile gm_file;
+
+	/** The number of scaffolds, in the same order as the FASTA index. */
+	size_t gm_num_scaffolds;
+
+	/**
+	 * For each scaffold, the index in gm_gaps_p of its first gap. There is
+	 * an extra entry at the end so the gaps of scaffold i run from
+	 * gm_offsets_p [i] up to gm_offsets_p [i + 1].
+	 */
+	const uint64 *gm_offsets_p;
+
+	/** The gaps for all of the scaffolds. */
+	const GapInterval *gm_gaps_p;
+} GapMap;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Initialise a GapScanner ready to scan a new sequence.
+ *
+ * @param scanner_p The GapScanner to initialise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void InitGapScanner (GapScanner *scanner_p);
+
+
+/**
+ * Free the gaps that a GapScanner has found.
+ *
+ * @param scanner_p The GapScanner to clear.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void ClearGapScanner (GapScanner *scanner_p);
+
+
+/**
+ * Find the gaps in the next block of a sequence. Gaps that span the
+ * boundary between blocks are joined together.
+ *
+ * @param scanner_p The GapScanner to use.
+ * @param sequence_s The block of the sequence. This does not need to be terminated.
+ * @param length The number of bases in the block.
+ * @param block_start The position of the start of the block within the sequence.
+ * @return <code>true</code> if successful, <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool ScanGapsInBlock (GapScanner *scanner_p, const char *sequence_s, const size_t length, const hts_pos_t block_start);
+
+
+/**
+ * Finish scanning a sequence, closing any gap that runs up to its end.
+ *
+ * @param scanner_p The GapScanner to use.
+ * @param end The position of the end of the scanned sequence.
+ * @return <code>true</code> if successful, <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool FinishGapScan (GapScanner *scanner_p, const hts_pos_t end);
+
+
+/**
+ * Build the gap map sidecar file for an IndexData if it does not have
+ * an up-to-date one. This reads the whole FASTA file so it is run by the
+ * background SidecarBuilder rather than by a job.
+ *
+ * @param index_data_p The IndexData.
+ * @param sidecar_directory_s The directory for the sidecar files or
+ * <code>NULL</code> to keep them next to the FASTA file.
+ * @param stop_flag_p If this becomes <code>true</code>, the build stops
+ * and any partially-built file is discarded.
+ * @return <code>true</code> if the file is up to date, <code>false</code>
+ * otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool BuildIndexGapMap (IndexData *index_data_p, const char *sidecar_directory_s, volatile bool *stop_flag_p);
+
+
+/**
+ * Get the GapMap for an IndexData, mapping its sidecar file the first
+ * time that it is available. This never builds the file.
+ *
+ * @param index_data_p The IndexData to get the GapMap for.
+ * @param sidecar_directory_s The directory that the sidecar file is kept
+ * in. If this is <code>NULL</code>, it is next to the FASTA file.
+ * @return The GapMap, which belongs to the IndexData, or <code>NULL</code>
+ * if the sidecar file has not been built yet.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL const GapMap *GetIndexGapMap (IndexData *index_data_p, const char *sidecar_directory_s);
+
+
+/**
+ * Free a GapMap.
+ *
+ * @param gap_map_p The GapMap to free.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void FreeGapMap (GapMap *gap_map_p);
+
+
+/**
+ * Add the parameters used by the gap map mode.
+ *
+ * @param data_p The configuration data for the SamTools service.
+ * @param param_set_p The ParameterSet to add the parameters to.
+ * @return <code>true</code> if the parameters were added successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool AddGapParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p);
+
+
+/**
+ * Get the ParameterType for one of the gap map parameters.
+ *
+ * @param param_name_s The name of the parameter.
+ * @param pt_p Where the ParameterType will be stored if the parameter is
+ * one of the gap map parameters.
+ * @return <code>true</code> if the parameter was found, <code>false</code>
+ * otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool GetGapParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p);
+
+
+/**
+ * Get the minimum gap length requested by a job.
+ *
+ * @param param_set_p The parameters for the job.
+ * @return The minimum gap length.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL uint32 GetMinGapLength (const ParameterSet *param_set_p);
+
+
+/**
+ * Get the length of gap that a job wants its scaffolds split into
+ * contigs at.
+ *
+ * @param param_set_p The parameters for the job.
+ * @return The minimum gap length to split at or 0 if the scaffolds
+ * should not be split.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL uint32 GetSplitGapLength (const ParameterSet *param_set_p);
+
+
+/**
+ * Split a sequence into contigs at its gaps and append them to a
+ * ByteBuffer as FASTA. Each contig is named after the scaffold
+ * along with its 1-based coordinates, <i>e.g.</i> <code>chr1:10001-207666</code>.
+ * Gaps at either end of the sequence are always trimmed.
+ *
+ * @param buffer_p The ByteBuffer to append the contigs to.
+ * @param scaffold_name_s The name of the scaffold.
+ * @param sequence_s The sequence. The soft-masked bases in each contig are
+ * converted in place according to mask_mode as it is copied.
+ * @param length The length of the sequence.
+ * @param offset The 0-based position of the start of sequence_s within the scaffold.
+ * @param min_gap_length The minimum length of the gaps to split at.
+ * @param line_length The number of bases per line or 0 for no wrapping.
+ * @param mask_mode What to do with the soft-masked bases.
+ * @return <code>true</code> if the contigs were appended successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool AppendContigs (ByteBuffer *buffer_p, const char *scaffold_name_s, char *sequence_s, const size_t length, const hts_pos_t offset, const uint32 min_gap_length, const uint32 line_length, const MaskMode mask_mode);
+
+
+/**
+ * Append the name of a contig, the scaffold name with the contig's
+ * 1-based coordinates, to a ByteBuffer.
+ *
+ * @param buffer_p The ByteBuffer to append the name to.
+ * @param scaffold_name_s The name of the scaffold.
+ * @param start The 0-based start of the contig.
+ * @param end The 0-based, exclusive end of the contig.
+ * @return <code>true</code> if the name was appended successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool AppendContigName (ByteBuffer *buffer_p, const char *scaffold_name_s, const hts_pos_t start, const hts_pos_t end);
+
+
+/**
+ * Run a job that gets the gaps in the scaffold or region given by the
+ * Scaffold parameter, or in every scaffold if that is <code>*</code>, as
+ * BED along with a summary of their number and total length.
+ *
+ * @param service_p The SamTools Service.
+ * @param param_set_p The parameters for the job.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void RunGapsJob (Service *service_p, ParameterSet *param_set_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_GAP_MAP_H */
@@ -0,0 +1,267 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * index_data.h
+ *
+ * @file
+ * @brief The configured reference sequence files along with their
+ * cached index handles.
+ */
+
+#ifndef SAMTOOLS_INDEX_DATA_H
+#define SAMTOOLS_INDEX_DATA_H
+
+#include <pthread.h>
+
+#include "samtools_service.h"
+
+#include "htslib/faidx.h"
+#include "htslib/cram.h"
+
+
+struct GapMap;
+struct CompositionTrack;
+struct FmIndex;
+struct ScaffoldSketches;
+struct WindowPrefetcher;
+
+/**
+ * The details of a configured reference sequence file.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct IndexData
+{
+	/** The name of the BLAST database generated from the FASTA file. */
+	const char *id_blast_db_name_s;
+
+	/** The FASTA file. */
+	const char *id_fasta_filename_s;
+
+	/**
+	 * The index for the FASTA file. This is loaded the first time that
+	 * it is needed and then kept open until the service is closed.
+	 */
+	faidx_t *id_fai_p;
+
+	/**
+	 * The reference sequences that htslib has decoded for the CRAM files
+	 * aligned against this FASTA file. The first CRAM file that is opened
+	 * successfully loads these and every later one shares them, so each
+	 * reference block is only read and decoded once.
+	 */
+	refs_t *id_cram_refs_p;
+
+	/**
+	 * A handle on the CRAM file that id_cram_refs_p came from which shares
+	 * them. htslib counts the files using a set of references, so this
+	 * keeps them alive after the CRAM files that use them are closed.
+	 */
+	htsFile *id_cram_refs_holder_p;
+
+	/**
+	 * The mutex guarding id_fai_p, since a faidx_t can only be used
+	 * by one thread at a time, and id_cram_refs_p.
+	 */
+	pthread_mutex_t id_mutex;
+
+	/**
+	 * The map of the runs of N in the FASTA file. This is loaded from its
+	 * sidecar file, building that if needed, the first time that it is
+	 * needed.
+	 */
+	struct GapMap *id_gap_map_p;
+
+	/**
+	 * The precomputed composition summaries for the FASTA file. This is
+	 * mapped once the background builder has written its sidecar file.
+	 */
+	struct CompositionTrack *id_composition_track_p;
+
+	/**
+	 * The FM-index for the FASTA file or <code>NULL</code> if one has not
+	 * been built. These are built offline by the fm_index_builder tool
+	 * and mapped when the service starts.
+	 */
+	struct FmIndex *id_fm_index_p;
+
+	/**
+	 * The MinHash sketches of the scaffolds in the FASTA file. These are
+	 * loaded from their sidecar file, building that if needed, the first
+	 * time that they are needed.
+	 */
+	struct ScaffoldSketches *id_sketches_p;
+
+	/**
+	 * The mutex guarding the sidecar data. This is separate from id_mutex
+	 * since building a sidecar file needs to read through the faidx_t.
+	 */
+	pthread_mutex_t id_sidecar_mutex;
+
+	/**
+	 * The tracker that prefetches the next window for clients panning
+	 * along a scaffold or <code>NULL</code> if prefetching is off.
+	 */
+	struct WindowPrefetcher *id_prefetcher_p;
+} IndexData;
+
+
+/**
+ * A region of one of the scaffolds in an IndexData.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct IndexRegion
+{
+	/**
+	 * The name of the scaffold. This belongs to the IndexData's
+	 * FASTA index so it must not be freed.
+	 */
+	const char *ir_scaffold_name_s;
+
+	/** The index of the scaffold within the FASTA index. */
+	int ir_scaffold_index;
+
+	/** The 0-based start of the region. */
+	hts_pos_t ir_start;
+
+	/** The 0-based, exclusive end of the region. */
+	hts_pos_t ir_end;
+
+	/** The length of the whole scaffold. */
+	hts_pos_t ir_scaffold_length;
+} IndexRegion;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Initialise an IndexData.
+ *
+ * @param index_data_p The IndexData to initialise.
+ * @param blast_db_s The name of the BLAST database. This can be <code>NULL</code>.
+ * @param fasta_filename_s The FASTA filename. This can be <code>NULL</code>.
+ * @return <code>true</code> if the IndexData was initialised successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool InitIndexData (IndexData *index_data_p, const char *blast_db_s, const char *fasta_filename_s);
+
+
+/**
+ * Release any resources that an IndexData is using.
+ *
+ * @param index_data_p The IndexData to clear.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void ClearIndexData (IndexData *index_data_p);
+
+
+/**
+ * Get exclusive access to the cached FASTA index for an IndexData, loading
+ * it if this is the first time that it has been requested. Each successful
+ * call must be followed by a call to UnlockIndexFaidx.
+ *
+ * @param index_data_p The IndexData to get the FASTA index for.
+ * @return The FASTA index or <code>NULL</code> upon error in which case the
+ * IndexData is not left locked.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL faidx_t *LockIndexFaidx (IndexData *index_data_p);
+
+
+/**
+ * Release the access to the FASTA index that was acquired by LockIndexFaidx.
+ *
+ * @param index_data_p The IndexData to unlock.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void UnlockIndexFaidx (IndexData *index_data_p);
+
+
+/**
+ * Fetch part of a sequence using the cached FASTA index.
+ *
+ * @param index_data_p The IndexData to fetch the sequence from.
+ * @param name_s The name of the sequence.
+ * @param beg The 0-based start of the region to fetch.
+ * @param end The 0-based, exclusive end of the region to fetch. This will be
+ * truncated to the length of the sequence.
+ * @param length_p Where the length of the fetched sequence will be stored.
+ * @return The sequence which should be freed with free() or <code>NULL</code>
+ * upon error.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL char *FetchIndexSequence (IndexData *index_data_p, const char *name_s, hts_pos_t beg, hts_pos_t end, hts_pos_t *length_p);
+
+
+/**
+ * Parse a region such as <code>chr3B:1000000-1050000</code>, or a whole
+ * scaffold name, against the scaffolds of an IndexData.
+ *
+ * @param index_data_p The IndexData.
+ * @param region_s The region.
+ * @param region_p Where the parsed region will be stored. Its end is
+ * truncated to the length of the scaffold.
+ * @return <code>true</code> if the region is a non-empty part of one of
+ * the scaffolds, <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool ParseIndexRegion (IndexData *index_data_p, const char *region_s, IndexRegion *region_p);
+
+
+/**
+ * Use an IndexData as the reference source for decoding a CRAM file.
+ * The CRAM file will share the reference sequences already decoded for any
+ * other CRAM file that uses the same IndexData rather than searching
+ * <code>REF_PATH</code> or reloading the FASTA file.
+ *
+ * @param index_data_p The IndexData for the FASTA file that the reads
+ * are aligned against.
+ * @param cram_file_p The open CRAM file. This must be called before any
+ * reads have been decoded from it.
+ * @return <code>true</code> if the reference was set successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool SetIndexAsCramReference (IndexData *index_data_p, htsFile *cram_file_p);
+
+
+/**
+ * Keep the reference sequences that a CRAM file has loaded so that the
+ * CRAM files opened after it can share them. This does nothing if the
+ * IndexData already has a set of references.
+ *
+ * @param index_data_p The IndexData for the FASTA file that the reads
+ * are aligned against.
+ * @param cram_file_p The CRAM file. This should only be called once the
+ * file has been opened successfully, including its header and index.
+ * @param cram_filename_s The name of the CRAM file.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void KeepIndexCramReference (IndexData *index_data_p, htsFile *cram_file_p, const char *cram_filename_s);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_INDEX_DATA_H */
@@ -0,0 +1,158 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * low_complexity.h
+ *
+ * @file
+ * @brief Find the low-complexity regions of a scaffold's sequence with
+ * SDUST along with its homopolymers and microsatellites.
+ */
+
+#ifndef SAMTOOLS_LOW_COMPLEXITY_H
+#define SAMTOOLS_LOW_COMPLEXITY_H
+
+#include "samtools_service_data.h"
+#include "byte_buffer.h"
+#include "parameter_set.h"
+
+
+/**
+ * What to do with the low-complexity regions of a sequence.
+ *
+ * @ingroup samtools_service
+ */
+typedef enum LowComplexityMode
+{
+	/** Don't look for them. */
+	LC_NONE,
+
+	/** Convert their bases to lower case. */
+	LC_SOFT,
+
+	/** Replace their bases with N. */
+	LC_HARD,
+
+	/** Get their intervals as BED rather than the sequence. */
+	LC_INTERVALS
+} LowComplexityMode;
+
+
+/**
+ * How to find the low-complexity regions of a sequence and what to do
+ * with them.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct LowComplexitySettings
+{
+	/** What to do with the regions. */
+	LowComplexityMode lcs_mode;
+
+	/**
+	 * The SDUST score threshold, or 0 to not run SDUST. This is ten times
+	 * the average number of times that each triplet in a region repeats.
+	 */
+	uint32 lcs_dust_threshold;
+
+	/** The shortest homopolymer to report, or 0 to not report them. */
+	uint32 lcs_min_homopolymer_length;
+
+	/** The shortest microsatellite to report, or 0 to not report them. */
+	uint32 lcs_min_microsatellite_length;
+} LowComplexitySettings;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Add the parameters used for finding low-complexity regions.
+ *
+ * @param data_p The configuration data for the SamTools service.
+ * @param param_set_p The ParameterSet to add the parameters to.
+ * @return <code>true</code> if the parameters were added successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool AddLowComplexityParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p);
+
+
+/**
+ * Get the ParameterType for one of the low-complexity parameters.
+ *
+ * @param param_name_s The name of the parameter.
+ * @param pt_p Where the ParameterType will be stored if the parameter is
+ * one of the low-complexity parameters.
+ * @return <code>true</code> if the parameter was found, <code>false</code>
+ * otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool GetLowComplexityParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p);
+
+
+/**
+ * Get the requested LowComplexitySettings from a ParameterSet.
+ *
+ * @param param_set_p The parameters for the job.
+ * @param settings_p Where the settings will be stored. The mode is
+ * LC_NONE if none was given.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void GetLowComplexitySettings (const ParameterSet *param_set_p, LowComplexitySettings *settings_p);
+
+
+/**
+ * Mask the low-complexity regions of a sequence in place for LC_SOFT or
+ * LC_HARD. For the other modes this does nothing.
+ *
+ * @param sequence_s The sequence. This does not need to be terminated.
+ * @param length The length of the sequence.
+ * @param settings_p The LowComplexitySettings to use.
+ * @return <code>true</code> if the sequence was masked successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool ApplyLowComplexityMask (char *sequence_s, const size_t length, const LowComplexitySettings *settings_p);
+
+
+/**
+ * Append the low-complexity regions of a sequence to a ByteBuffer as BED
+ * lines. The name column is <code>dust</code> for the SDUST regions and
+ * the repeated unit, <i>e.g.</i> <code>(CA)n</code>, for the homopolymers
+ * and microsatellites.
+ *
+ * @param buffer_p The ByteBuffer to append to.
+ * @param scaffold_name_s The name to use for the BED chromosome column.
+ * @param sequence_s The sequence. This does not need to be terminated.
+ * @param length The length of the sequence.
+ * @param offset The 0-based position of the start of sequence_s within the scaffold.
+ * @param settings_p The LowComplexitySettings to use.
+ * @return <code>true</code> if the intervals were appended successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool AppendLowComplexityIntervals (ByteBuffer *buffer_p, const char *scaffold_name_s, const char *sequence_s, const size_t length, const uint64 offset, const LowComplexitySettings *settings_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_LOW_COMPLEXITY_H */
@@ -0,0 +1,153 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * minhash_sketch.h
+ *
+ * @file
+ * @brief MinHash sketches of the scaffolds of each reference sequence
+ * file, kept in a memory-mapped sidecar file, and the Mash distances
+ * between them.
+ */
+
+#ifndef SAMTOOLS_MINHASH_SKETCH_H
+#define SAMTOOLS_MINHASH_SKETCH_H
+
+#include "samtools_service_data.h"
+#include "sidecar_file.h"
+#include "parameter_set.h"
+
+
+/**
+ * The sketches of every scaffold in a reference sequence file. Each
+ * sketch holds the smallest hashes of the scaffold's canonical k-mers,
+ * in ascending order.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct ScaffoldSketches
+{
+	/** The mapped sidecar file. */
+	MappedFile ss_file;
+
+	/** The k-mer length. */
+	uint32 ss_kmer_length;
+
+	/** The maximum number of hashes in each sketch. */
+	uint32 ss_sketch_size;
+
+	/** The number of scaffolds, in the same order as the FASTA index. */
+	size_t ss_num_scaffolds;
+
+	/**
+	 * For each scaffold, the index in ss_hashes_p of its first hash. There
+	 * is an extra entry at the end so the hashes of scaffold i run from
+	 * ss_offsets_p [i] up to ss_offsets_p [i + 1].
+	 */
+	const uint64 *ss_offsets_p;
+
+	/** The hashes for all of the scaffolds. */
+	const uint64 *ss_hashes_p;
+} ScaffoldSketches;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Build the sketch sidecar file for an IndexData if it does not have an
+ * up-to-date one. This reads the whole FASTA file so it is run by the
+ * background SidecarBuilder rather than by a job.
+ *
+ * @param index_data_p The IndexData.
+ * @param sidecar_directory_s The directory for the sidecar files or
+ * <code>NULL</code> to keep them next to the FASTA file.
+ * @param stop_flag_p If this becomes <code>true</code>, the build stops
+ * and any partially-built file is discarded.
+ * @return <code>true</code> if the file is up to date, <code>false</code>
+ * otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool BuildIndexScaffoldSketches (IndexData *index_data_p, const char *sidecar_directory_s, volatile bool *stop_flag_p);
+
+
+/**
+ * Get the ScaffoldSketches for an IndexData, mapping its sidecar file
+ * the first time that it is available. This never builds the file.
+ *
+ * @param index_data_p The IndexData to get the sketches for.
+ * @param sidecar_directory_s The directory that the sidecar file is kept
+ * in. If this is <code>NULL</code>, it is next to the FASTA file.
+ * @return The ScaffoldSketches, which belong to the IndexData, or <code>NULL</code>
+ * if the sidecar file has not been built yet.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL const ScaffoldSketches *GetIndexScaffoldSketches (IndexData *index_data_p, const char *sidecar_directory_s);
+
+
+/**
+ * Free a ScaffoldSketches.
+ *
+ * @param sketches_p The ScaffoldSketches to free.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void FreeScaffoldSketches (ScaffoldSketches *sketches_p);
+
+
+/**
+ * Add the parameters used by the sketch mode.
+ *
+ * @param data_p The configuration data for the SamTools service.
+ * @param param_set_p The ParameterSet to add the parameters to.
+ * @return <code>true</code> if the parameters were added successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool AddSketchParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p);
+
+
+/**
+ * Get the ParameterType for one of the sketch parameters.
+ *
+ * @param param_name_s The name of the parameter.
+ * @param pt_p Where the ParameterType will be stored if the parameter is
+ * one of the sketch parameters.
+ * @return <code>true</code> if the parameter was found, <code>false</code>
+ * otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool GetSketchParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p);
+
+
+/**
+ * Run a job that finds the scaffolds, or assemblies, nearest to a given
+ * one by comparing their MinHash sketches rather than their sequences.
+ *
+ * @param service_p The SamTools Service.
+ * @param param_set_p The parameters for the job.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void RunSketchJob (Service *service_p, ParameterSet *param_set_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_MINHASH_SKETCH_H */
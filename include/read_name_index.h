@@ -0,0 +1,134 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * read_name_index.h
+ *
+ * @file
+ * @brief An index from read names to the virtual offsets of their
+ * records in a BAM file, used to find a read's mate without scanning
+ * the whole file.
+ */
+
+#ifndef SAMTOOLS_READ_NAME_INDEX_H
+#define SAMTOOLS_READ_NAME_INDEX_H
+
+#include "samtools_service.h"
+#include "sidecar_file.h"
+
+#include "htslib/sam.h"
+
+
+/**
+ * An entry in a ReadNameIndex. The entries are sorted by their hashes.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct ReadNameEntry
+{
+	/** The hash of the read name. */
+	uint64 rne_hash;
+
+	/** The BGZF virtual offset of the read's record. */
+	uint64 rne_offset;
+} ReadNameEntry;
+
+
+/**
+ * A read name index that has been mapped into memory.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct ReadNameIndex
+{
+	/** The mapped index file. */
+	MappedFile rni_file;
+
+	/** The entries within rni_file. */
+	const ReadNameEntry *rni_entries_p;
+
+	/** The number of entries in rni_entries_p. */
+	size_t rni_num_entries;
+} ReadNameIndex;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Build the read name index for a BAM file if it doesn't exist yet or is
+ * older than the BAM file. This reads and sorts the names of every read
+ * so it is run by the background SidecarBuilder rather than by a job.
+ *
+ * @param filename_s The alignment file. Nothing is built for files that
+ * are not BAM.
+ * @param sidecar_directory_s The directory to keep the index in. If this
+ * is <code>NULL</code>, the index is kept next to the BAM file.
+ * @param stop_flag_p If this becomes <code>true</code>, the build stops
+ * and the partial index is discarded.
+ * @return <code>true</code> if the index is up to date or is not needed,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool BuildReadNameIndexSidecar (const char *filename_s, const char *sidecar_directory_s, volatile bool *stop_flag_p);
+
+
+/**
+ * Load the read name index for a BAM file. This never builds the index.
+ *
+ * @param filename_s The BAM file.
+ * @param sidecar_directory_s The directory that the index is kept in. If
+ * this is <code>NULL</code>, it is looked for next to the BAM file.
+ * @return The ReadNameIndex which should be freed with FreeReadNameIndex
+ * or <code>NULL</code> if there isn't an up-to-date one yet or upon error.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL ReadNameIndex *LoadReadNameIndex (const char *filename_s, const char *sidecar_directory_s);
+
+
+/**
+ * Free a ReadNameIndex.
+ *
+ * @param index_p The ReadNameIndex to free.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void FreeReadNameIndex (ReadNameIndex *index_p);
+
+
+/**
+ * Find the primary record for the mate of a paired read.
+ *
+ * @param index_p The ReadNameIndex for the BAM file.
+ * @param file_p The open BAM file. This will be repositioned so any
+ * iterator using it needs to have finished.
+ * @param header_p The header of the BAM file.
+ * @param read_p The read to find the mate of.
+ * @param mate_p Where the mate will be stored.
+ * @return <code>true</code> if the mate was found, <code>false</code>
+ * otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool FindMateByName (const ReadNameIndex *index_p, htsFile *file_p, sam_hdr_t *header_p, const bam1_t *read_p, bam1_t *mate_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_READ_NAME_INDEX_H */
@@ -0,0 +1,112 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * restriction_map.h
+ *
+ * @file
+ * @brief Find where a set of restriction enzymes cut within a region
+ * of a scaffold and the sizes of the fragments that they give.
+ */
+
+#ifndef SAMTOOLS_RESTRICTION_MAP_H
+#define SAMTOOLS_RESTRICTION_MAP_H
+
+#include "samtools_service_data.h"
+#include "parameter_set.h"
+
+
+/**
+ * The configured restriction enzymes compiled into a single
+ * automaton that finds all of their sites in one pass.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct RestrictionEnzymeSet RestrictionEnzymeSet;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Compile a set of restriction enzymes. Each site is written with a ^
+ * marking where the enzyme cuts the top strand, e.g. G^AATTC, and can
+ * use the IUPAC codes for degenerate bases.
+ *
+ * @param enzymes_config_p A JSON array of objects, each with a "name" and
+ * a "site". If this is <code>NULL</code>, a built-in set of common enzymes
+ * is used.
+ * @return The RestrictionEnzymeSet or <code>NULL</code> upon error.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL RestrictionEnzymeSet *CompileRestrictionEnzymes (const json_t *enzymes_config_p);
+
+
+/**
+ * Free a RestrictionEnzymeSet.
+ *
+ * @param enzymes_p The RestrictionEnzymeSet to free.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void FreeRestrictionEnzymeSet (RestrictionEnzymeSet *enzymes_p);
+
+
+/**
+ * Add the parameters used by the restriction map mode.
+ *
+ * @param data_p The configuration data for the SamTools service.
+ * @param param_set_p The ParameterSet to add the parameters to.
+ * @return <code>true</code> if the parameters were added successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool AddRestrictionMapParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p);
+
+
+/**
+ * Get the ParameterType for one of the restriction map parameters.
+ *
+ * @param param_name_s The name of the parameter.
+ * @param pt_p Where the ParameterType will be stored if the parameter is
+ * one of the restriction map parameters.
+ * @return <code>true</code> if the parameter was found, <code>false</code>
+ * otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool GetRestrictionMapParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p);
+
+
+/**
+ * Run a job that finds the cut positions of the chosen enzymes within
+ * a region, along with histograms of the fragment sizes for each enzyme
+ * and for all of them together. The region is split into blocks which
+ * are scanned concurrently.
+ *
+ * @param service_p The SamTools Service.
+ * @param param_set_p The parameters for the job.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void RunRestrictionMapJob (Service *service_p, ParameterSet *param_set_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_RESTRICTION_MAP_H */
@@ -84,6 +84,28 @@
 SAMTOOLS_PREFIX NamedParameterType SS_INDEX SAMTOOLS_VAL ("input_file", PT_STRING);
 
 
+/**
+ * The NamedParamaterType specifying the scaffold, or region within a
+ * scaffold, that the Samtools service will use.
+ */
+SAMTOOLS_PREFIX NamedParameterType SS_SCAFFOLD SAMTOOLS_VAL ("Scaffold", PT_STRING);
+
+
+/**
+ * The NamedParamaterType specifying the number of letters on each line
+ * of any sequences that the Samtools service returns.
+ */
+SAMTOOLS_PREFIX NamedParameterType SS_SCAFFOLD_LINE_BREAK SAMTOOLS_VAL ("Scaffold line break index", PT_SIGNED_INT);
+
+
+/**
+ * The NamedParamaterType specifying whether the modes that can search
+ * across assemblies use all of the configured indexes rather than just
+ * the selected one.
+ */
+SAMTOOLS_PREFIX NamedParameterType SS_ALL_INDEXES SAMTOOLS_VAL ("All indexes", PT_BOOLEAN);
+
+
 #ifdef __cplusplus
 extern "C"
 {
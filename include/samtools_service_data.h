@@ -0,0 +1,175 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * samtools_service_data.h
+ *
+ * @file
+ * @brief The configuration data shared between the different
+ * modes of the SamTools service.
+ */
+
+#ifndef SAMTOOLS_SERVICE_DATA_H
+#define SAMTOOLS_SERVICE_DATA_H
+
+#include "samtools_service.h"
+#include "jobs_manager.h"
+#include "index_data.h"
+#include "alignment_data.h"
+#include "variant_data.h"
+
+
+struct SidecarBuilder;
+
+struct RestrictionEnzymeSet;
+
+/**
+ * The ServiceData for the SamTools service.
+ *
+ * @extends ServiceData
+ * @ingroup samtools_service
+ */
+typedef struct SamToolsServiceData
+{
+	/** The base ServiceData. */
+	ServiceData stsd_base_data;
+
+	/** The available reference sequence files. */
+	IndexData *stsd_index_data_p;
+
+	/** The number of entries in stsd_index_data_p. */
+	size_t stsd_index_data_size;
+
+	/** The available alignment files. */
+	AlignmentData *stsd_alignment_data_p;
+
+	/** The number of entries in stsd_alignment_data_p. */
+	size_t stsd_alignment_data_size;
+
+	/** The available VCF and BCF files. */
+	VariantData *stsd_variant_data_p;
+
+	/** The number of entries in stsd_variant_data_p. */
+	size_t stsd_variant_data_size;
+
+	/**
+	 * The directory to keep the files precomputed from the configured
+	 * data files in. If this is <code>NULL</code>, they are kept next
+	 * to the files that they were built from.
+	 */
+	const char *stsd_sidecar_directory_s;
+
+	/**
+	 * The directory that the modes which produce files write them to.
+	 * If this is <code>NULL</code>, those modes are not available.
+	 */
+	const char *stsd_output_directory_s;
+
+	/** The maximum number of worker threads that a single job can use. */
+	uint32 stsd_num_threads;
+
+	/**
+	 * The background thread building the sidecar files or
+	 * <code>NULL</code> if it is not running.
+	 */
+	struct SidecarBuilder *stsd_sidecar_builder_p;
+
+	/**
+	 * The restriction enzymes compiled at startup or <code>NULL</code>
+	 * if they could not be.
+	 */
+	struct RestrictionEnzymeSet *stsd_restriction_enzymes_p;
+} SamToolsServiceData;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Wrap some data up as an inline DataResource and add it as
+ * a result to a ServiceJob.
+ *
+ * @param job_p The ServiceJob to add the result to.
+ * @param title_s The title to give to the result.
+ * @param data_p The data to add. This will not be stolen by this
+ * function so the caller still needs to call json_decref on it.
+ * @return <code>true</code> if the result was added successfully,
+ * <code>false</code> otherwise in which case an error will have been
+ * added to the ServiceJob.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool AddInlineResultToServiceJob (ServiceJob *job_p, const char *title_s, json_t *data_p);
+
+
+/**
+ * Add a file that a job has written as a result to the ServiceJob.
+ *
+ * @param job_p The ServiceJob to add the result to.
+ * @param filename_s The file.
+ * @return <code>true</code> if the result was added successfully,
+ * <code>false</code> otherwise in which case an error will have been
+ * added to the ServiceJob.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool AddFileResultToServiceJob (ServiceJob *job_p, const char *filename_s);
+
+
+/**
+ * Get the name of a file in the configured output directory for
+ * a ServiceJob to write to.
+ *
+ * @param data_p The configuration data for the SamTools service.
+ * @param job_p The ServiceJob that will write the file.
+ * @param suffix_s The suffix to add to the job's id.
+ * @return The filename which should be freed with FreeCopiedString or
+ * <code>NULL</code> upon error, including when there is no output
+ * directory configured.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL char *MakeJobOutputFilename (const SamToolsServiceData *data_p, const ServiceJob *job_p, const char *suffix_s);
+
+
+/**
+ * Get the IndexData chosen by the Index parameter.
+ *
+ * @param data_p The configuration data for the SamTools service.
+ * @param params_p The parameters for the job.
+ * @return The selected IndexData or <code>NULL</code> if it could not
+ * be found.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL IndexData *GetSelectedIndexData (const SamToolsServiceData * const data_p, const ParameterSet *params_p);
+
+
+/**
+ * Get the IndexData for a FASTA file or BLAST database name.
+ *
+ * @param data_p The configuration data for the SamTools service.
+ * @param name_s The FASTA filename or BLAST database name of the index.
+ * @return The matching IndexData or <code>NULL</code> if there is none.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL IndexData *GetIndexDataByName (const SamToolsServiceData * const data_p, const char *name_s);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_SERVICE_DATA_H */
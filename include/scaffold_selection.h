@@ -0,0 +1,105 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * scaffold_selection.h
+ *
+ * @file
+ * @brief Select a set of scaffolds from a reference sequence file
+ * either by name or by a regular expression or glob pattern.
+ */
+
+#ifndef SAMTOOLS_SCAFFOLD_SELECTION_H
+#define SAMTOOLS_SCAFFOLD_SELECTION_H
+
+#include "samtools_service_data.h"
+#include "parameter_set.h"
+
+
+/**
+ * A scaffold that has been selected.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct SelectedScaffold
+{
+	/**
+	 * The name of the scaffold. This belongs to the IndexData's
+	 * FASTA index so it must not be freed.
+	 */
+	const char *ss_name_s;
+
+	/** The length of the scaffold. */
+	hts_pos_t ss_length;
+
+	/** The index of the scaffold within the FASTA index. */
+	int ss_index;
+} SelectedScaffold;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Add the parameters used to select scaffolds.
+ *
+ * @param data_p The configuration data for the SamTools service.
+ * @param param_set_p The ParameterSet to add the parameters to.
+ * @return <code>true</code> if the parameters were added successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool AddScaffoldSelectionParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p);
+
+
+/**
+ * Get the ParameterType for one of the scaffold selection parameters.
+ *
+ * @param param_name_s The name of the parameter.
+ * @param pt_p Where the ParameterType will be stored if the parameter is
+ * one of the scaffold selection parameters.
+ * @return <code>true</code> if the parameter was found, <code>false</code>
+ * otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool GetScaffoldSelectionParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p);
+
+
+/**
+ * Get the scaffolds that match the scaffold selection parameters, in the
+ * order that they are in the FASTA file.
+ *
+ * @param index_data_p The IndexData to select the scaffolds from.
+ * @param param_set_p The parameters for the job.
+ * @param num_threads The maximum number of threads to match the names with.
+ * @param scaffolds_pp Where the selected scaffolds will be stored. This should
+ * be freed with FreeMemory.
+ * @param num_scaffolds_p Where the number of selected scaffolds will be stored.
+ * @return <code>true</code> if the selection was made successfully, even if no
+ * scaffolds matched, <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool SelectScaffolds (IndexData *index_data_p, const ParameterSet *param_set_p, const uint32 num_threads, SelectedScaffold **scaffolds_pp, size_t *num_scaffolds_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_SCAFFOLD_SELECTION_H */
@@ -0,0 +1,282 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * sequence_kernels.h
+ *
+ * @file
+ * @brief Low-level scanning functions for sequence data. Where SSE2 is
+ * available these work on 16 bases at a time, otherwise they fall back
+ * to scalar loops that give the same results.
+ */
+
+#ifndef SAMTOOLS_SEQUENCE_KERNELS_H
+#define SAMTOOLS_SEQUENCE_KERNELS_H
+
+#include "samtools_service.h"
+
+
+/**
+ * The base counts for a block of sequence.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct BaseComposition
+{
+	/** The number of G and C bases, in either case. */
+	uint64 bc_gc;
+
+	/** The number of A and T bases, in either case. */
+	uint64 bc_at;
+
+	/** The number of gap, N or n, bases. */
+	uint64 bc_n;
+
+	/** The number of soft-masked, lower case, bases. */
+	uint64 bc_soft_masked;
+
+	/** The number of CpG dinucleotides that start in the block, in either case. */
+	uint64 bc_cpg;
+} BaseComposition;
+
+
+/**
+ * The code that EncodeBases gives any base other than A, C, G or T.
+ *
+ * @ingroup samtools_service
+ */
+#define INVALID_BASE (4)
+
+
+/**
+ * The code that EncodeCodons gives a codon containing a base other than
+ * A, C, G or T.
+ *
+ * @ingroup samtools_service
+ */
+#define INVALID_CODON (0xFF)
+
+
+/**
+ * The most codons that FindNextTargetCodon can look for at once.
+ *
+ * @ingroup samtools_service
+ */
+#define MAX_TARGET_CODONS (8)
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Find the next gap base, <code>N</code> or <code>n</code>, in a sequence.
+ *
+ * @param sequence_s The sequence. This does not need to be terminated.
+ * @param start The index to start looking from.
+ * @param length The length of the sequence.
+ * @return The index of the next gap base or length if there are none.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL size_t FindNextGapBase (const char *sequence_s, size_t start, const size_t length);
+
+
+/**
+ * Find the next base in a sequence that is not a gap base.
+ *
+ * @param sequence_s The sequence. This does not need to be terminated.
+ * @param start The index to start looking from.
+ * @param length The length of the sequence.
+ * @return The index of the next non-gap base or length if there are none.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL size_t FindNextNonGapBase (const char *sequence_s, size_t start, const size_t length);
+
+
+/**
+ * Find the next soft-masked, <i>i.e.</i> lower case, base in a sequence.
+ *
+ * @param sequence_s The sequence. This does not need to be terminated.
+ * @param start The index to start looking from.
+ * @param length The length of the sequence.
+ * @return The index of the next soft-masked base or length if there are none.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL size_t FindNextSoftMaskedBase (const char *sequence_s, size_t start, const size_t length);
+
+
+/**
+ * Find the next base in a sequence that is not soft-masked.
+ *
+ * @param sequence_s The sequence. This does not need to be terminated.
+ * @param start The index to start looking from.
+ * @param length The length of the sequence.
+ * @return The index of the next unmasked base or length if there are none.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL size_t FindNextUnmaskedBase (const char *sequence_s, size_t start, const size_t length);
+
+
+/**
+ * Convert the soft-masked bases in a sequence to upper case in place.
+ *
+ * @param sequence_s The sequence. This does not need to be terminated.
+ * @param length The length of the sequence.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void UnmaskBases (char *sequence_s, const size_t length);
+
+
+/**
+ * Replace the soft-masked bases in a sequence with <code>N</code> in place.
+ *
+ * @param sequence_s The sequence. This does not need to be terminated.
+ * @param length The length of the sequence.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void HardMaskBases (char *sequence_s, const size_t length);
+
+
+/**
+ * Add the base counts for a block of sequence to a BaseComposition.
+ *
+ * @param sequence_s The sequence. This does not need to be terminated.
+ * @param length The length of the sequence.
+ * @param next_base The base after the end of the block, so that a CpG
+ * which spans the end can be counted, or <code>0</code> if there is none.
+ * @param composition_p The BaseComposition to add the counts to.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void CountBaseComposition (const char *sequence_s, const size_t length, const char next_base, BaseComposition *composition_p);
+
+
+/**
+ * Find the next position in a sequence where a motif could start, by
+ * checking just its first and last bases. The bases are compared without
+ * regard to case.
+ *
+ * @param sequence_s The sequence. This does not need to be terminated.
+ * @param start The position to start looking from.
+ * @param end The position after the last one that the motif could start at,
+ * <i>i.e.</i> the length of the sequence minus last_offset.
+ * @param first_base The first base of the motif in upper case.
+ * @param last_base The last base of the motif in upper case.
+ * @param last_offset The offset of the last base within the motif.
+ * @return The next candidate position or end if there are none.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL size_t FindMotifCandidate (const char *sequence_s, size_t start, const size_t end, const char first_base, const char last_base, const size_t last_offset);
+
+
+/**
+ * Hash a batch of 2-bit encoded k-mers with Thomas Wang's invertible
+ * integer hash, so that distinct k-mers always get distinct hashes.
+ * This only needs shifts, adds and exclusive ors, so with SSE2 two
+ * k-mers are hashed at a time.
+ *
+ * @param kmers_p The k-mers.
+ * @param hashes_p Where the hashes will be stored. This can be the same as kmers_p.
+ * @param count The number of k-mers.
+ * @param mask The mask with the low 2k bits set.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void HashKmers (const uint64 *kmers_p, uint64 *hashes_p, const size_t count, const uint64 mask);
+
+
+/**
+ * Find the next position in a sequence whose base is the same as the one
+ * a number of bases further on, so a run of these positions marks a
+ * homopolymer, for a period of 1, or a microsatellite. The bases are
+ * compared without regard to case and gap bases never match.
+ *
+ * @param sequence_s The sequence. This does not need to be terminated.
+ * @param start The position to start looking from.
+ * @param end The position after the last one to check, <i>i.e.</i> the
+ * length of the sequence minus period.
+ * @param period The distance between the bases to compare.
+ * @return The next matching position or end if there are none.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL size_t FindNextPeriodicBase (const char *sequence_s, size_t start, const size_t end, const size_t period);
+
+
+/**
+ * Find the next position in a sequence whose base differs from the one
+ * a number of bases further on, or where either of them is a gap base.
+ *
+ * @param sequence_s The sequence. This does not need to be terminated.
+ * @param start The position to start looking from.
+ * @param end The position after the last one to check, <i>i.e.</i> the
+ * length of the sequence minus period.
+ * @param period The distance between the bases to compare.
+ * @return The next differing position or end if there are none.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL size_t FindNextAperiodicBase (const char *sequence_s, size_t start, const size_t end, const size_t period);
+
+
+/**
+ * Encode each base in a sequence as A, C, G and T being 0 to 3 and
+ * anything else being INVALID_BASE, so that the complement of a valid
+ * base is 3 minus its code. With SSE2 this does 16 bases at a time.
+ *
+ * @param sequence_s The sequence. This does not need to be terminated.
+ * @param codes_p Where the code for each base will be stored.
+ * @param length The number of bases to encode.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void EncodeBases (const char *sequence_s, uint8 *codes_p, const size_t length);
+
+
+/**
+ * Encode each codon in a sequence as a 6-bit code, with two bits for each
+ * base where A, C, G and T are 0 to 3 and the first base is the most
+ * significant, so <i>e.g.</i> ATG is 14. A codon with any other base gets
+ * INVALID_CODON. With SSE2 this does 16 codons at a time.
+ *
+ * @param sequence_s The sequence, which needs num_codons + 2 bases. This
+ * does not need to be terminated.
+ * @param codons_p Where the code for the codon starting at each base will
+ * be stored.
+ * @param num_codons The number of codons to encode.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void EncodeCodons (const char *sequence_s, uint8 *codons_p, const size_t num_codons);
+
+
+/**
+ * Find the next codon that is one of a set of codons, comparing 16 codons
+ * at a time with SSE2.
+ *
+ * @param codons_p The codon codes from EncodeCodons.
+ * @param start The position to start looking from.
+ * @param end The position after the last one to check.
+ * @param targets_p The codes of the codons to look for.
+ * @param num_targets The number of codons to look for, which can be at
+ * most MAX_TARGET_CODONS.
+ * @return The position of the next matching codon or end if there are none.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL size_t FindNextTargetCodon (const uint8 *codons_p, size_t start, const size_t end, const uint8 *targets_p, const size_t num_targets);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_SEQUENCE_KERNELS_H */
@@ -0,0 +1,86 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * sidecar_builder.h
+ *
+ * @file
+ * @brief A background thread that builds the sidecar files which need
+ * a whole pass over a configured data file, so that no job has to wait
+ * for one to be built.
+ */
+
+#ifndef SAMTOOLS_SIDECAR_BUILDER_H
+#define SAMTOOLS_SIDECAR_BUILDER_H
+
+#include "samtools_service_data.h"
+
+
+/**
+ * The sidecar files that a SidecarBuilder builds.
+ *
+ * @ingroup samtools_service
+ */
+typedef enum SidecarBuildFlags
+{
+	/** The composition track for each FASTA file. */
+	SB_COMPOSITION_TRACKS = 1 << 0,
+
+	/** The read name index for each BAM file. */
+	SB_READ_NAME_INDEXES = 1 << 1,
+
+	/** The scaffold sketches for each FASTA file. */
+	SB_SCAFFOLD_SKETCHES = 1 << 2,
+
+	/** The gap map for each FASTA file. */
+	SB_GAP_MAPS = 1 << 3
+} SidecarBuildFlags;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Start a background thread that builds each of the requested sidecar
+ * files that is missing or out of date.
+ *
+ * @param data_p The configuration data for the SamTools service.
+ * @param flags The SidecarBuildFlags for the files to build.
+ * @return <code>true</code> if the thread was started successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool StartSidecarBuilder (SamToolsServiceData *data_p, const uint32 flags);
+
+
+/**
+ * Stop the background sidecar builder, if it is running, and wait for
+ * it to finish. Any partially-built file is discarded.
+ *
+ * @param data_p The configuration data for the SamTools service.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void StopSidecarBuilder (SamToolsServiceData *data_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_SIDECAR_BUILDER_H */
@@ -0,0 +1,178 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * sidecar_file.h
+ *
+ * @file
+ * @brief Helpers for the precomputed files that the service keeps
+ * alongside its configured data files.
+ */
+
+#ifndef SAMTOOLS_SIDECAR_FILE_H
+#define SAMTOOLS_SIDECAR_FILE_H
+
+#include <stdio.h>
+
+#include "samtools_service.h"
+
+
+/**
+ * A read-only file that has been mapped into memory.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct MappedFile
+{
+	/** The contents of the file. */
+	const void *mf_data_p;
+
+	/** The size of the file in bytes. */
+	size_t mf_size;
+} MappedFile;
+
+
+/**
+ * A sidecar file that is being written incrementally.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct SidecarWriter
+{
+	/** The sidecar file. */
+	char *sw_filename_s;
+
+	/** The temporary file that the data is written to. */
+	char *sw_temp_filename_s;
+
+	/** The handle for the temporary file. */
+	FILE *sw_out_f;
+} SidecarWriter;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Get the filename to use for a sidecar file of a data file.
+ *
+ * @param directory_s The directory to store the sidecar file in. If this
+ * is <code>NULL</code>, the sidecar file is stored next to the data file.
+ * @param filename_s The data file.
+ * @param suffix_s The suffix to add to the data file's name.
+ * @return The sidecar filename which should be freed with FreeCopiedString
+ * or <code>NULL</code> upon error.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL char *MakeSidecarFilename (const char *directory_s, const char *filename_s, const char *suffix_s);
+
+
+/**
+ * Check whether a sidecar file exists and is newer than the
+ * data file that it was built from.
+ *
+ * @param sidecar_filename_s The sidecar file.
+ * @param filename_s The data file.
+ * @return <code>true</code> if the sidecar file can be used,
+ * <code>false</code> if it needs to be built.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool IsSidecarFileUpToDate (const char *sidecar_filename_s, const char *filename_s);
+
+
+/**
+ * Write a sidecar file. The data is written to a temporary file which is
+ * then renamed so that a partially-written sidecar file is never used.
+ *
+ * @param sidecar_filename_s The sidecar file.
+ * @param header_p The data to write at the start of the file.
+ * @param header_size The number of bytes in header_p.
+ * @param data_p The data to write after the header.
+ * @param data_size The number of bytes in data_p.
+ * @return <code>true</code> if the file was written successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool WriteSidecarFile (const char *sidecar_filename_s, const void *header_p, const size_t header_size, const void *data_p, const size_t data_size);
+
+
+/**
+ * Start writing a sidecar file that is too large to build in memory.
+ * As with WriteSidecarFile, the data goes to a temporary file until
+ * the writer is closed.
+ *
+ * @param sidecar_filename_s The sidecar file.
+ * @return The SidecarWriter or <code>NULL</code> upon error.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL SidecarWriter *OpenSidecarWriter (const char *sidecar_filename_s);
+
+
+/**
+ * Append some data to a sidecar file.
+ *
+ * @param writer_p The SidecarWriter.
+ * @param data_p The data to write.
+ * @param data_size The number of bytes in data_p.
+ * @return <code>true</code> if the data was written successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool WriteSidecarData (SidecarWriter *writer_p, const void *data_p, const size_t data_size);
+
+
+/**
+ * Finish a sidecar file and free the SidecarWriter.
+ *
+ * @param writer_p The SidecarWriter.
+ * @param keep_flag If this is <code>true</code>, the temporary file replaces
+ * the sidecar file, otherwise it is deleted.
+ * @return <code>true</code> if the sidecar file was kept successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool CloseSidecarWriter (SidecarWriter *writer_p, bool keep_flag);
+
+
+/**
+ * Map a file into memory.
+ *
+ * @param mapped_file_p The MappedFile to store the details in.
+ * @param filename_s The file to map.
+ * @return <code>true</code> if the file was mapped successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool OpenMappedFile (MappedFile *mapped_file_p, const char *filename_s);
+
+
+/**
+ * Unmap a file that was mapped by OpenMappedFile.
+ *
+ * @param mapped_file_p The MappedFile to unmap.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void CloseMappedFile (MappedFile *mapped_file_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_SIDECAR_FILE_H */
@@ -0,0 +1,127 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * soft_mask.h
+ *
+ * @file
+ * @brief Apply the different ways of handling the soft-masked, lower
+ * case, bases in a scaffold's sequence.
+ */
+
+#ifndef SAMTOOLS_SOFT_MASK_H
+#define SAMTOOLS_SOFT_MASK_H
+
+#include "samtools_service_data.h"
+#include "byte_buffer.h"
+#include "parameter_set.h"
+
+
+/**
+ * What to do with the soft-masked bases in a sequence.
+ *
+ * @ingroup samtools_service
+ */
+typedef enum MaskMode
+{
+	/** Leave the sequence as it is. */
+	MM_KEEP,
+
+	/** Convert the soft-masked bases to upper case. */
+	MM_UPPER,
+
+	/** Replace the soft-masked bases with N. */
+	MM_HARD,
+
+	/** Get the soft-masked intervals as BED rather than the sequence. */
+	MM_INTERVALS
+} MaskMode;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Add the parameters used for choosing how to handle soft-masked bases.
+ *
+ * @param data_p The configuration data for the SamTools service.
+ * @param param_set_p The ParameterSet to add the parameters to.
+ * @return <code>true</code> if the parameters were added successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool AddSoftMaskParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p);
+
+
+/**
+ * Get the ParameterType for one of the soft-masking parameters.
+ *
+ * @param param_name_s The name of the parameter.
+ * @param pt_p Where the ParameterType will be stored if the parameter is
+ * one of the soft-masking parameters.
+ * @return <code>true</code> if the parameter was found, <code>false</code>
+ * otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool GetSoftMaskParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p);
+
+
+/**
+ * Get the requested MaskMode from a ParameterSet.
+ *
+ * @param param_set_p The parameters for the job.
+ * @return The MaskMode, which is MM_KEEP if none was given.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL MaskMode GetMaskMode (const ParameterSet *param_set_p);
+
+
+/**
+ * Convert a block of sequence in place for MM_UPPER or MM_HARD. For
+ * the other modes this does nothing.
+ *
+ * @param sequence_s The sequence. This does not need to be terminated.
+ * @param length The length of the sequence.
+ * @param mode The MaskMode to apply.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void ApplyMaskMode (char *sequence_s, const size_t length, const MaskMode mode);
+
+
+/**
+ * Append the runs of soft-masked bases in a sequence to a ByteBuffer
+ * as BED lines.
+ *
+ * @param buffer_p The ByteBuffer to append to.
+ * @param scaffold_name_s The name to use for the BED chromosome column.
+ * @param sequence_s The sequence. This does not need to be terminated.
+ * @param length The length of the sequence.
+ * @param offset The 0-based position of the start of sequence_s within the scaffold.
+ * @return <code>true</code> if the intervals were appended successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool AppendSoftMaskedIntervals (ByteBuffer *buffer_p, const char *scaffold_name_s, const char *sequence_s, const size_t length, const uint64 offset);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_SOFT_MASK_H */
@@ -0,0 +1,146 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * variant_data.h
+ *
+ * @file
+ * @brief The configured VCF and BCF files along with their cached
+ * file, header and index handles.
+ */
+
+#ifndef SAMTOOLS_VARIANT_DATA_H
+#define SAMTOOLS_VARIANT_DATA_H
+
+#include <pthread.h>
+
+#include "samtools_service.h"
+#include "parameter_set.h"
+
+#include "htslib/vcf.h"
+#include "htslib/tbx.h"
+
+
+/**
+ * The details of a configured variant file.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct VariantData
+{
+	/** The name to show for the variant file. */
+	const char *vd_name_s;
+
+	/** The bgzipped VCF or BCF file. */
+	const char *vd_filename_s;
+
+	/** The open variant file. */
+	htsFile *vd_file_p;
+
+	/**
+	 * The header of the variant file. Each query works on its own
+	 * copy of this so that it can choose which samples to decode.
+	 */
+	bcf_hdr_t *vd_header_p;
+
+	/** The tabix index for a VCF file. */
+	tbx_t *vd_tbx_p;
+
+	/** The CSI index for a BCF file. */
+	hts_idx_t *vd_index_p;
+
+	/**
+	 * The mutex guarding the file handles, since they can only be
+	 * used by one thread at a time.
+	 */
+	pthread_mutex_t vd_mutex;
+} VariantData;
+
+
+/* forward declaration */
+struct SamToolsServiceData;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Initialise a VariantData. The variant file is not opened until
+ * it is first used.
+ *
+ * @param variant_data_p The VariantData to initialise.
+ * @param name_s The name to show for the variant file.
+ * @param filename_s The bgzipped VCF or BCF file.
+ * @return <code>true</code> if the VariantData was initialised successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool InitVariantData (VariantData *variant_data_p, const char *name_s, const char *filename_s);
+
+
+/**
+ * Close any handles that a VariantData has open.
+ *
+ * @param variant_data_p The VariantData to clear.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void ClearVariantData (VariantData *variant_data_p);
+
+
+/**
+ * Add the parameters used by the variants mode.
+ *
+ * @param data_p The configuration data for the SamTools service.
+ * @param param_set_p The ParameterSet to add the parameters to.
+ * @return <code>true</code> if the parameters were added successfully,
+ * <code>false</code> otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool AddVariantsParameters (struct SamToolsServiceData *data_p, ParameterSet *param_set_p);
+
+
+/**
+ * Get the ParameterType for one of the variants mode's parameters.
+ *
+ * @param param_name_s The name of the parameter.
+ * @param pt_p Where the ParameterType will be stored if the parameter is
+ * one of the variants mode's parameters.
+ * @return <code>true</code> if the parameter was found, <code>false</code>
+ * otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool GetVariantsParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p);
+
+
+/**
+ * Run a job that gets the variant records from a configured variant file
+ * that overlap the region given by the Scaffold parameter.
+ *
+ * @param service_p The SamTools Service.
+ * @param param_set_p The parameters for the job.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void RunVariantsJob (Service *service_p, ParameterSet *param_set_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_VARIANT_DATA_H */
@@ -0,0 +1,90 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * window_prefetch.h
+ *
+ * @file
+ * @brief Spot clients panning along a scaffold and ask the kernel to
+ * read the next window of the FASTA file before it is requested.
+ */
+
+#ifndef SAMTOOLS_WINDOW_PREFETCH_H
+#define SAMTOOLS_WINDOW_PREFETCH_H
+
+#include "samtools_service.h"
+
+#include "htslib/hts.h"
+
+
+/**
+ * The layout of a FASTA file and the recent runs of requests against it.
+ * The details are private to window_prefetch.c.
+ *
+ * @ingroup samtools_service
+ */
+typedef struct WindowPrefetcher WindowPrefetcher;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create a WindowPrefetcher for a FASTA file. This reads the file's .fai
+ * index and, if the file is bgzipped, its .gzi index, so both of these
+ * need to exist already.
+ *
+ * @param fasta_filename_s The FASTA file.
+ * @param budget The maximum number of bytes of the file that can have
+ * been prefetched without being requested yet.
+ * @return The WindowPrefetcher or <code>NULL</code> upon error.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL WindowPrefetcher *AllocateWindowPrefetcher (const char *fasta_filename_s, const uint64 budget);
+
+
+/**
+ * Free a WindowPrefetcher.
+ *
+ * @param prefetcher_p The WindowPrefetcher to free.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void FreeWindowPrefetcher (WindowPrefetcher *prefetcher_p);
+
+
+/**
+ * Record a request for a region and, if it continues a run of requests
+ * moving along the scaffold, advise the kernel to read the window beyond
+ * it in the same direction. This does not wait for the read.
+ *
+ * @param prefetcher_p The WindowPrefetcher for the FASTA file.
+ * @param scaffold_index The index of the scaffold within the FASTA index.
+ * @param start The 0-based start of the requested region.
+ * @param end The 0-based, exclusive end of the requested region. This is
+ * truncated to the length of the scaffold.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL void PrefetchAdjacentWindow (WindowPrefetcher *prefetcher_p, const int scaffold_index, const hts_pos_t start, hts_pos_t end);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_WINDOW_PREFETCH_H */
@@ -0,0 +1,72 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * worker_pool.h
+ *
+ * @file
+ * @brief A simple pool of threads for running a fixed number of
+ * independent tasks concurrently.
+ */
+
+#ifndef SAMTOOLS_WORKER_POOL_H
+#define SAMTOOLS_WORKER_POOL_H
+
+#include "samtools_service.h"
+
+
+/**
+ * The callback function that a worker thread uses to run a single task.
+ *
+ * @param task_index The index of the task to run, from 0 to the number of
+ * tasks - 1.
+ * @param data_p The custom data that was passed to RunWorkerPool.
+ * @return <code>true</code> if the task ran successfully, <code>false</code>
+ * otherwise.
+ * @ingroup samtools_service
+ */
+typedef bool (*RunWorkerTask) (const size_t task_index, void *data_p);
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Run a number of tasks across a pool of threads. Each thread takes the next
+ * unclaimed task until there are none left, so tasks of differing sizes
+ * are balanced across the threads. The calling thread takes part too and
+ * the function does not return until all of the tasks have finished.
+ *
+ * @param num_tasks The number of tasks to run.
+ * @param num_threads The maximum number of threads to use. If this is 0 or 1,
+ * the tasks are run in order on the calling thread.
+ * @param run_task_fn The callback function to run each task.
+ * @param data_p The custom data to pass to each call of run_task_fn.
+ * @return <code>true</code> if all of the tasks succeeded, <code>false</code>
+ * otherwise.
+ * @ingroup samtools_service
+ */
+SAMTOOLS_SERVICE_LOCAL bool RunWorkerPool (const size_t num_tasks, const uint32 num_threads, RunWorkerTask run_task_fn, void *data_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef SAMTOOLS_WORKER_POOL_H */
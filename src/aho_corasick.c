@@ -0,0 +1,327 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * aho_corasick.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <string.h>
+
+#include "aho_corasick.h"
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+static const uint32 S_INITIAL_NUM_STATES = 256;
+
+static const uint32 S_INITIAL_NUM_PATTERNS = 64;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static int GetBaseCode (const char base);
+
+static int32 AddState (AhoCorasickAutomaton *automaton_p);
+
+static bool GrowArray (void **array_pp, const size_t element_size, const size_t old_size, const size_t new_size);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+AhoCorasickAutomaton *AllocateAhoCorasickAutomaton (void)
+{
+	AhoCorasickAutomaton *automaton_p = (AhoCorasickAutomaton *) AllocMemory (sizeof (AhoCorasickAutomaton));
+
+	if (automaton_p)
+		{
+			memset (automaton_p, 0, sizeof (AhoCorasickAutomaton));
+
+			/* The root state */
+			if (AddState (automaton_p) == 0)
+				{
+					return automaton_p;
+				}
+
+			FreeAhoCorasickAutomaton (automaton_p);
+		}
+
+	return NULL;
+}
+
+
+void FreeAhoCorasickAutomaton (AhoCorasickAutomaton *automaton_p)
+{
+	void *arrays_pp [] = { automaton_p -> aca_transitions_p, automaton_p -> aca_failures_p, automaton_p -> aca_patterns_p, automaton_p -> aca_output_links_p, automaton_p -> aca_next_patterns_p, automaton_p -> aca_pattern_lengths_p };
+	size_t i;
+
+	for (i = 0; i < sizeof (arrays_pp) / sizeof (arrays_pp [0]); ++ i)
+		{
+			if (arrays_pp [i])
+				{
+					FreeMemory (arrays_pp [i]);
+				}
+		}
+
+	FreeMemory (automaton_p);
+}
+
+
+int32 AddAhoCorasickPattern (AhoCorasickAutomaton *automaton_p, const char *pattern_s, const size_t length)
+{
+	int32 state = 0;
+	int32 pattern_index;
+	size_t i;
+
+	if (automaton_p -> aca_num_patterns == automaton_p -> aca_max_patterns)
+		{
+			const uint32 new_max = (automaton_p -> aca_max_patterns > 0) ? (automaton_p -> aca_max_patterns << 1) : S_INITIAL_NUM_PATTERNS;
+
+			if (! ((GrowArray ((void **) & (automaton_p -> aca_next_patterns_p), sizeof (int32), automaton_p -> aca_max_patterns, new_max)) &&
+				(GrowArray ((void **) & (automaton_p -> aca_pattern_lengths_p), sizeof (uint32), automaton_p -> aca_max_patterns, new_max))))
+				{
+					return -1;
+				}
+
+			automaton_p -> aca_max_patterns = new_max;
+		}
+
+	for (i = 0; i < length; ++ i)
+		{
+			const int code = GetBaseCode (pattern_s [i]);
+			int32 next_state;
+
+			if (code < 0)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Pattern contains bases other than A, C, G and T");
+					return -1;
+				}
+
+			next_state = automaton_p -> aca_transitions_p [state * AC_ALPHABET_SIZE + code];
+
+			if (next_state <= 0)
+				{
+					if ((next_state = AddState (automaton_p)) < 0)
+						{
+							return -1;
+						}
+
+					automaton_p -> aca_transitions_p [state * AC_ALPHABET_SIZE + code] = next_state;
+				}
+
+			state = next_state;
+		}
+
+	pattern_index = (int32) (automaton_p -> aca_num_patterns);
+	automaton_p -> aca_pattern_lengths_p [pattern_index] = (uint32) length;
+
+	/* Patterns with the same bases share a state */
+	automaton_p -> aca_next_patterns_p [pattern_index] = automaton_p -> aca_patterns_p [state];
+	automaton_p -> aca_patterns_p [state] = pattern_index;
+
+	++ (automaton_p -> aca_num_patterns);
+
+	return pattern_index;
+}
+
+
+bool FinishAhoCorasickAutomaton (AhoCorasickAutomaton *automaton_p)
+{
+	int32 *queue_p = (int32 *) AllocMemoryArray (sizeof (int32), automaton_p -> aca_num_states);
+
+	if (queue_p)
+		{
+			uint32 head = 0;
+			uint32 tail = 0;
+			int code;
+
+			/* The root's children fail back to the root and any missing transitions loop on it */
+			for (code = 0; code < AC_ALPHABET_SIZE; ++ code)
+				{
+					const int32 child = automaton_p -> aca_transitions_p [code];
+
+					if (child > 0)
+						{
+							automaton_p -> aca_failures_p [child] = 0;
+							automaton_p -> aca_output_links_p [child] = -1;
+							queue_p [tail ++] = child;
+						}
+					else
+						{
+							automaton_p -> aca_transitions_p [code] = 0;
+						}
+				}
+
+			/* Breadth-first, so each state's failure state is done before it */
+			while (head < tail)
+				{
+					const int32 state = queue_p [head ++];
+					const int32 failure = automaton_p -> aca_failures_p [state];
+
+					for (code = 0; code < AC_ALPHABET_SIZE; ++ code)
+						{
+							const int32 child = automaton_p -> aca_transitions_p [state * AC_ALPHABET_SIZE + code];
+							const int32 failure_next = automaton_p -> aca_transitions_p [failure * AC_ALPHABET_SIZE + code];
+
+							if (child > 0)
+								{
+									automaton_p -> aca_failures_p [child] = failure_next;
+									automaton_p -> aca_output_links_p [child] = (automaton_p -> aca_patterns_p [failure_next] >= 0) ? failure_next : automaton_p -> aca_output_links_p [failure_next];
+									queue_p [tail ++] = child;
+								}
+							else
+								{
+									automaton_p -> aca_transitions_p [state * AC_ALPHABET_SIZE + code] = failure_next;
+								}
+						}
+				}
+
+			FreeMemory (queue_p);
+
+			return true;
+		}
+
+	return false;
+}
+
+
+bool ScanWithAhoCorasick (const AhoCorasickAutomaton *automaton_p, const char *sequence_s, const size_t length, AhoCorasickMatch match_fn, void *data_p)
+{
+	const int32 * const transitions_p = automaton_p -> aca_transitions_p;
+	int32 state = 0;
+	size_t i;
+
+	for (i = 0; i < length; ++ i)
+		{
+			const int code = GetBaseCode (sequence_s [i]);
+
+			if (code >= 0)
+				{
+					int32 output = state = transitions_p [state * AC_ALPHABET_SIZE + code];
+
+					if (automaton_p -> aca_patterns_p [output] < 0)
+						{
+							output = automaton_p -> aca_output_links_p [output];
+						}
+
+					while (output > 0)
+						{
+							int32 pattern_index;
+
+							for (pattern_index = automaton_p -> aca_patterns_p [output]; pattern_index >= 0; pattern_index = automaton_p -> aca_next_patterns_p [pattern_index])
+								{
+									if (!match_fn ((uint32) pattern_index, i + 1 - automaton_p -> aca_pattern_lengths_p [pattern_index], data_p))
+										{
+											return false;
+										}
+								}
+
+							output = automaton_p -> aca_output_links_p [output];
+						}
+				}
+			else
+				{
+					state = 0;
+				}
+		}
+
+	return true;
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static int GetBaseCode (const char base)
+{
+	switch (base)
+		{
+			case 'A':
+			case 'a':
+				return 0;
+
+			case 'C':
+			case 'c':
+				return 1;
+
+			case 'G':
+			case 'g':
+				return 2;
+
+			case 'T':
+			case 't':
+				return 3;
+
+			default:
+				return -1;
+		}
+}
+
+
+static int32 AddState (AhoCorasickAutomaton *automaton_p)
+{
+	int32 state;
+
+	if (automaton_p -> aca_num_states == automaton_p -> aca_max_states)
+		{
+			const uint32 old_max = automaton_p -> aca_max_states;
+			const uint32 new_max = (old_max > 0) ? (old_max << 1) : S_INITIAL_NUM_STATES;
+
+			if (! ((GrowArray ((void **) & (automaton_p -> aca_transitions_p), sizeof (int32) * AC_ALPHABET_SIZE, old_max, new_max)) &&
+				(GrowArray ((void **) & (automaton_p -> aca_failures_p), sizeof (int32), old_max, new_max)) &&
+				(GrowArray ((void **) & (automaton_p -> aca_patterns_p), sizeof (int32), old_max, new_max)) &&
+				(GrowArray ((void **) & (automaton_p -> aca_output_links_p), sizeof (int32), old_max, new_max))))
+				{
+					return -1;
+				}
+
+			automaton_p -> aca_max_states = new_max;
+		}
+
+	state = (int32) (automaton_p -> aca_num_states);
+
+	/* 0 is the root, which is never a child, so it marks a missing transition until the automaton is finished */
+	memset (automaton_p -> aca_transitions_p + state * AC_ALPHABET_SIZE, 0, sizeof (int32) * AC_ALPHABET_SIZE);
+	automaton_p -> aca_failures_p [state] = 0;
+	automaton_p -> aca_patterns_p [state] = -1;
+	automaton_p -> aca_output_links_p [state] = -1;
+
+	++ (automaton_p -> aca_num_states);
+
+	return state;
+}
+
+
+static bool GrowArray (void **array_pp, const size_t element_size, const size_t old_size, const size_t new_size)
+{
+	void *new_array_p = (*array_pp) ? ReallocMemory (*array_pp, new_size * element_size, old_size * element_size) : AllocMemoryArray (element_size, new_size);
+
+	if (new_array_p)
+		{
+			*array_pp = new_array_p;
+			return true;
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to grow automaton to " SIZET_FMT " entries", new_size);
+
+	return false;
+}
@@ -0,0 +1,347 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * alignment_data.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <ctype.h>
+#include <string.h>
+
+#include "alignment_data.h"
+#include "samtools_service_data.h"
+#include "memory_allocations.h"
+#include "streams.h"
+
+#include "string_parameter.h"
+#include "unsigned_int_parameter.h"
+
+
+#ifdef _DEBUG
+	#define ALIGNMENT_DATA_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define ALIGNMENT_DATA_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+static NamedParameterType S_SAMPLES = { "Samples", PT_STRING };
+static NamedParameterType S_MIN_MAPPING_QUALITY = { "Min mapping quality", PT_UNSIGNED_INT };
+static NamedParameterType S_MIN_BASE_QUALITY = { "Min base quality", PT_UNSIGNED_INT };
+
+
+static const uint32 S_DEFAULT_MIN_MAPPING_QUALITY = 20;
+static const uint32 S_DEFAULT_MIN_BASE_QUALITY = 13;
+
+static const uint16 S_IGNORED_READ_FLAGS = BAM_FUNMAP | BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool OpenAlignmentData (AlignmentData *alignment_data_p);
+
+static bool IsSampleInList (const char *sample_s, const char *samples_s);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool InitAlignmentData (AlignmentData *alignment_data_p, const char *name_s, const char *filename_s, IndexData *reference_p)
+{
+	alignment_data_p -> ad_name_s = name_s;
+	alignment_data_p -> ad_filename_s = filename_s;
+	alignment_data_p -> ad_reference_p = reference_p;
+	alignment_data_p -> ad_file_p = NULL;
+	alignment_data_p -> ad_header_p = NULL;
+	alignment_data_p -> ad_index_p = NULL;
+	alignment_data_p -> ad_read_names_p = NULL;
+
+	if (pthread_mutex_init (& (alignment_data_p -> ad_mutex), NULL) == 0)
+		{
+			return true;
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise mutex for \"%s\"", filename_s);
+		}
+
+	return false;
+}
+
+
+void ClearAlignmentData (AlignmentData *alignment_data_p)
+{
+	if (alignment_data_p -> ad_read_names_p)
+		{
+			FreeReadNameIndex (alignment_data_p -> ad_read_names_p);
+			alignment_data_p -> ad_read_names_p = NULL;
+		}
+
+	if (alignment_data_p -> ad_index_p)
+		{
+			hts_idx_destroy (alignment_data_p -> ad_index_p);
+			alignment_data_p -> ad_index_p = NULL;
+		}
+
+	if (alignment_data_p -> ad_header_p)
+		{
+			sam_hdr_destroy (alignment_data_p -> ad_header_p);
+			alignment_data_p -> ad_header_p = NULL;
+		}
+
+	if (alignment_data_p -> ad_file_p)
+		{
+			sam_close (alignment_data_p -> ad_file_p);
+			alignment_data_p -> ad_file_p = NULL;
+		}
+
+	pthread_mutex_destroy (& (alignment_data_p -> ad_mutex));
+}
+
+
+bool LockAlignmentData (AlignmentData *alignment_data_p)
+{
+	pthread_mutex_lock (& (alignment_data_p -> ad_mutex));
+
+	if ((alignment_data_p -> ad_index_p) || (OpenAlignmentData (alignment_data_p)))
+		{
+			return true;
+		}
+
+	pthread_mutex_unlock (& (alignment_data_p -> ad_mutex));
+
+	return false;
+}
+
+
+void UnlockAlignmentData (AlignmentData *alignment_data_p)
+{
+	pthread_mutex_unlock (& (alignment_data_p -> ad_mutex));
+}
+
+
+ReadNameIndex *GetAlignmentReadNameIndex (AlignmentData *alignment_data_p, const char *sidecar_directory_s)
+{
+	if (! (alignment_data_p -> ad_read_names_p))
+		{
+			alignment_data_p -> ad_read_names_p = LoadReadNameIndex (alignment_data_p -> ad_filename_s, sidecar_directory_s);
+		}
+
+	return alignment_data_p -> ad_read_names_p;
+}
+
+
+bool AddAlignmentParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	bool success_flag = false;
+
+	if (EasyCreateAndAddStringParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_SAMPLES.npt_type, S_SAMPLES.npt_name_s, "Samples", "A comma-separated list of the samples to use. If this is empty, then all of the available samples will be used.", NULL, PL_ADVANCED))
+		{
+			if (EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MIN_MAPPING_QUALITY.npt_name_s, "Min mapping quality", "Reads with a mapping quality below this are ignored", &S_DEFAULT_MIN_MAPPING_QUALITY, PL_ADVANCED))
+				{
+					if (EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MIN_BASE_QUALITY.npt_name_s, "Min base quality", "Bases with a quality below this are ignored", &S_DEFAULT_MIN_BASE_QUALITY, PL_ADVANCED))
+						{
+							success_flag = true;
+						}
+				}
+		}
+
+	return success_flag;
+}
+
+
+bool GetAlignmentParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_SAMPLES.npt_name_s) == 0)
+		{
+			*pt_p = S_SAMPLES.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MIN_MAPPING_QUALITY.npt_name_s) == 0)
+		{
+			*pt_p = S_MIN_MAPPING_QUALITY.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MIN_BASE_QUALITY.npt_name_s) == 0)
+		{
+			*pt_p = S_MIN_BASE_QUALITY.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+size_t GetRequestedSamples (const SamToolsServiceData *data_p, const ParameterSet *param_set_p, AlignmentData ***samples_ppp)
+{
+	size_t num_samples = 0;
+	AlignmentData **samples_pp = NULL;
+
+	if (data_p -> stsd_alignment_data_size > 0)
+		{
+			samples_pp = (AlignmentData **) AllocMemoryArray (sizeof (AlignmentData *), data_p -> stsd_alignment_data_size);
+
+			if (samples_pp)
+				{
+					const char *samples_s = NULL;
+					size_t i;
+
+					GetCurrentStringParameterValueFromParameterSet (param_set_p, S_SAMPLES.npt_name_s, &samples_s);
+
+					for (i = 0; i < data_p -> stsd_alignment_data_size; ++ i)
+						{
+							AlignmentData *alignment_data_p = (data_p -> stsd_alignment_data_p) + i;
+
+							if ((samples_s == NULL) || (*samples_s == '\0') || (IsSampleInList (alignment_data_p -> ad_name_s, samples_s)))
+								{
+									samples_pp [num_samples] = alignment_data_p;
+									++ num_samples;
+								}
+						}
+
+					if (num_samples == 0)
+						{
+							FreeMemory (samples_pp);
+							samples_pp = NULL;
+						}
+				}
+		}
+
+	*samples_ppp = samples_pp;
+
+	return num_samples;
+}
+
+
+void GetAlignmentQualityThresholds (const ParameterSet *param_set_p, uint32 *min_mapping_quality_p, uint32 *min_base_quality_p)
+{
+	const uint32 *value_p = NULL;
+
+	*min_mapping_quality_p = S_DEFAULT_MIN_MAPPING_QUALITY;
+	*min_base_quality_p = S_DEFAULT_MIN_BASE_QUALITY;
+
+	if (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MIN_MAPPING_QUALITY.npt_name_s, &value_p) && value_p)
+		{
+			*min_mapping_quality_p = *value_p;
+		}
+
+	if (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MIN_BASE_QUALITY.npt_name_s, &value_p) && value_p)
+		{
+			*min_base_quality_p = *value_p;
+		}
+}
+
+
+bool IsUsableRead (const bam1_t *read_p, const uint32 min_mapping_quality)
+{
+	return (((read_p -> core.flag & S_IGNORED_READ_FLAGS) == 0) && (read_p -> core.qual >= min_mapping_quality));
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static bool OpenAlignmentData (AlignmentData *alignment_data_p)
+{
+	#if ALIGNMENT_DATA_DEBUG >= STM_LEVEL_FINER
+	PrintLog (STM_LEVEL_FINER, __FILE__, __LINE__, "OpenAlignmentData - about to open %s", alignment_data_p -> ad_filename_s);
+	#endif
+
+	alignment_data_p -> ad_file_p = sam_open (alignment_data_p -> ad_filename_s, "r");
+
+	if (alignment_data_p -> ad_file_p)
+		{
+			/*
+			 * Point CRAM decoding at our configured reference rather than
+			 * letting htslib search REF_PATH or download it.
+			 */
+			if ((alignment_data_p -> ad_reference_p) && (hts_get_format (alignment_data_p -> ad_file_p) -> format == cram))
+				{
+					if (!SetIndexAsCramReference (alignment_data_p -> ad_reference_p, alignment_data_p -> ad_file_p))
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to set reference for \"%s\"", alignment_data_p -> ad_filename_s);
+						}
+				}
+
+			alignment_data_p -> ad_header_p = sam_hdr_read (alignment_data_p -> ad_file_p);
+
+			if (alignment_data_p -> ad_header_p)
+				{
+					alignment_data_p -> ad_index_p = sam_index_load (alignment_data_p -> ad_file_p, alignment_data_p -> ad_filename_s);
+
+					if (alignment_data_p -> ad_index_p)
+						{
+							if ((alignment_data_p -> ad_reference_p) && (hts_get_format (alignment_data_p -> ad_file_p) -> format == cram))
+								{
+									KeepIndexCramReference (alignment_data_p -> ad_reference_p, alignment_data_p -> ad_file_p, alignment_data_p -> ad_filename_s);
+								}
+
+							return true;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to load index for \"%s\"", alignment_data_p -> ad_filename_s);
+						}
+
+					sam_hdr_destroy (alignment_data_p -> ad_header_p);
+					alignment_data_p -> ad_header_p = NULL;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to read header from \"%s\"", alignment_data_p -> ad_filename_s);
+				}
+
+			sam_close (alignment_data_p -> ad_file_p);
+			alignment_data_p -> ad_file_p = NULL;
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to open \"%s\"", alignment_data_p -> ad_filename_s);
+		}
+
+	return false;
+}
+
+
+/*
+ * Check whether a sample name is a complete entry in a comma-separated list.
+ */
+static bool IsSampleInList (const char *sample_s, const char *samples_s)
+{
+	const size_t name_length = strlen (sample_s);
+	const char *match_s = samples_s;
+
+	while ((match_s = strstr (match_s, sample_s)) != NULL)
+		{
+			if (((match_s == samples_s) || (* (match_s - 1) == ',') || isspace (* (match_s - 1))) &&
+				((match_s [name_length] == '\0') || (match_s [name_length] == ',') || isspace (match_s [name_length])))
+				{
+					return true;
+				}
+
+			match_s += name_length;
+		}
+
+	return false;
+}
@@ -0,0 +1,741 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * allele_counter.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allele_counter.h"
+#include "worker_pool.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "byte_buffer.h"
+#include "audit.h"
+
+#include "string_parameter.h"
+#include "unsigned_int_parameter.h"
+
+#include "htslib/sam.h"
+
+
+#ifdef _DEBUG
+	#define ALLELE_COUNTER_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define ALLELE_COUNTER_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * The number of alleles that are counted at each position, A, C, G and T.
+ */
+#define AC_NUM_ALLELES (4)
+
+
+typedef struct SNPPosition
+{
+	/* This points into the SNPPanel's buffer */
+	const char *sp_chromosome_s;
+
+	/* 0-based */
+	hts_pos_t sp_pos;
+} SNPPosition;
+
+
+typedef struct SNPPanel
+{
+	char *spa_buffer_s;
+	SNPPosition *spa_positions_p;
+	size_t spa_num_positions;
+} SNPPanel;
+
+
+/*
+ * A run of positions on the same chromosome, along with the chromosome's
+ * id in the alignment file that is currently being counted.
+ */
+typedef struct ChromosomeBlock
+{
+	size_t cb_start;
+	size_t cb_end;
+	int cb_tid;
+} ChromosomeBlock;
+
+
+typedef struct AlleleCountsTask
+{
+	const SNPPanel *act_panel_p;
+	AlignmentData **act_samples_pp;
+	uint32 **act_counts_pp;
+	bool *act_success_flags_p;
+	uint32 act_min_mapping_quality;
+	uint32 act_min_base_quality;
+} AlleleCountsTask;
+
+
+static NamedParameterType S_SNP_POSITIONS = { "SNP positions", PT_LARGE_STRING };
+
+
+/*
+ * Positions that are closer together than this are fetched with a single
+ * index query rather than one query each.
+ */
+static const hts_pos_t S_MAX_QUERY_GAP = 16384;
+
+
+/*
+ * Map the 4-bit nucleotide codes used in BAM records onto the
+ * allele columns, A, C, G, T. Ambiguous bases are ignored.
+ */
+static const int8 S_NT16_TO_ALLELE [16] = { -1, 0, 1, -1, 2, -1, -1, -1, 3, -1, -1, -1, -1, -1, -1, -1 };
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool ParseSNPPanel (const char *positions_s, SNPPanel *panel_p);
+
+static void ClearSNPPanel (SNPPanel *panel_p);
+
+static int CompareSNPPositions (const void *v0_p, const void *v1_p);
+
+static int CompareChromosomeBlocks (const void *v0_p, const void *v1_p);
+
+static bool CountAllelesForSample (const size_t task_index, void *data_p);
+
+static bool CountAllelesInRegion (htsFile *bam_p, hts_idx_t *index_p, bam1_t *read_p, const SNPPosition *positions_p, const size_t start, const size_t end, const int tid, const AlleleCountsTask *task_p, uint32 *counts_p);
+
+static void CountAllelesForRead (const bam1_t *read_p, const SNPPosition *positions_p, size_t first, const size_t end, const uint32 min_base_quality, uint32 *counts_p);
+
+static bool WriteAlleleCounts (const SNPPanel *panel_p, AlignmentData **samples_pp, const size_t num_samples, uint32 **counts_pp, const bool *success_flags_p, ByteBuffer *buffer_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool AddAlleleCountsParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	bool success_flag = false;
+
+	if (EasyCreateAndAddStringParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_SNP_POSITIONS.npt_type, S_SNP_POSITIONS.npt_name_s, "SNP positions", "The positions to count alleles at. Each position is on its own line as a chromosome name and a 1-based position separated by a tab, space or colon.", NULL, PL_ADVANCED))
+		{
+			success_flag = true;
+		}
+
+	return success_flag;
+}
+
+
+bool GetAlleleCountsParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_SNP_POSITIONS.npt_name_s) == 0)
+		{
+			*pt_p = S_SNP_POSITIONS.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+void RunAlleleCountsJob (Service *service_p, ParameterSet *param_set_p)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, "Allele counts", "Allele counts at SNP positions", NULL, NULL, NULL);
+
+	if (job_p)
+		{
+			const char *positions_s = NULL;
+			SNPPanel panel;
+
+			LogParameterSet (param_set_p, job_p);
+
+			SetServiceJobStatus (job_p, OS_STARTED);
+			LogServiceJob (job_p);
+
+			/* Assume failure */
+			SetServiceJobStatus (job_p, OS_FAILED);
+
+			GetCurrentStringParameterValueFromParameterSet (param_set_p, S_SNP_POSITIONS.npt_name_s, &positions_s);
+
+			if (ParseSNPPanel (positions_s, &panel))
+				{
+					AlignmentData **samples_pp = NULL;
+					const size_t num_samples = GetRequestedSamples (data_p, param_set_p, &samples_pp);
+
+					if (num_samples > 0)
+						{
+							uint32 **counts_pp = (uint32 **) AllocMemoryArray (sizeof (uint32 *), num_samples);
+							bool *success_flags_p = (bool *) AllocMemoryArray (sizeof (bool), num_samples);
+
+							if (counts_pp && success_flags_p)
+								{
+									AlleleCountsTask task;
+									ByteBuffer *buffer_p;
+									size_t i;
+
+									task.act_panel_p = &panel;
+									task.act_samples_pp = samples_pp;
+									task.act_counts_pp = counts_pp;
+									task.act_success_flags_p = success_flags_p;
+
+									GetAlignmentQualityThresholds (param_set_p, & (task.act_min_mapping_quality), & (task.act_min_base_quality));
+
+									RunWorkerPool (num_samples, data_p -> stsd_num_threads, CountAllelesForSample, &task);
+
+									for (i = 0; i < num_samples; ++ i)
+										{
+											if (! (success_flags_p [i]))
+												{
+													char *error_s = ConcatenateStrings ("Failed to count alleles for ", samples_pp [i] -> ad_name_s);
+
+													if (error_s)
+														{
+															AddGeneralErrorMessageToServiceJob (job_p, error_s);
+															FreeCopiedString (error_s);
+														}
+												}
+										}
+
+									buffer_p = AllocateByteBuffer (1024 * 1024);
+
+									if (buffer_p)
+										{
+											if (WriteAlleleCounts (&panel, samples_pp, num_samples, counts_pp, success_flags_p, buffer_p))
+												{
+													json_t *counts_p = json_string (GetByteBufferData (buffer_p));
+
+													if (counts_p)
+														{
+															if (AddInlineResultToServiceJob (job_p, "Allele counts", counts_p))
+																{
+																	SetServiceJobStatus (job_p, OS_SUCCEEDED);
+
+																	for (i = 0; i < num_samples; ++ i)
+																		{
+																			if (! (success_flags_p [i]))
+																				{
+																					SetServiceJobStatus (job_p, OS_PARTIALLY_SUCCEEDED);
+																					i = num_samples;
+																				}
+																		}
+																}
+
+															json_decref (counts_p);
+														}
+												}
+											else
+												{
+													AddGeneralErrorMessageToServiceJob (job_p, "Failed to write allele counts");
+												}
+
+											FreeByteBuffer (buffer_p);
+										}
+
+									for (i = 0; i < num_samples; ++ i)
+										{
+											if (counts_pp [i])
+												{
+													FreeMemory (counts_pp [i]);
+												}
+										}
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate allele counts for " SIZET_FMT " samples", num_samples);
+								}
+
+							if (success_flags_p)
+								{
+									FreeMemory (success_flags_p);
+								}
+
+							if (counts_pp)
+								{
+									FreeMemory (counts_pp);
+								}
+
+							FreeMemory (samples_pp);
+						}
+					else
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "No matching samples were found");
+						}
+
+					ClearSNPPanel (&panel);
+				}
+			else
+				{
+					AddGeneralErrorMessageToServiceJob (job_p, "Failed to parse SNP positions");
+				}
+
+			LogServiceJob (job_p);
+		}		/* if (job_p) */
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static bool ParseSNPPanel (const char *positions_s, SNPPanel *panel_p)
+{
+	bool success_flag = false;
+
+	panel_p -> spa_buffer_s = NULL;
+	panel_p -> spa_positions_p = NULL;
+	panel_p -> spa_num_positions = 0;
+
+	if (positions_s)
+		{
+			size_t max_num_positions = 1;
+			const char *c_p;
+
+			for (c_p = positions_s; *c_p; ++ c_p)
+				{
+					if (*c_p == '\n')
+						{
+							++ max_num_positions;
+						}
+				}
+
+			panel_p -> spa_buffer_s = EasyCopyToNewString (positions_s);
+			panel_p -> spa_positions_p = (SNPPosition *) AllocMemoryArray (sizeof (SNPPosition), max_num_positions);
+
+			if ((panel_p -> spa_buffer_s) && (panel_p -> spa_positions_p))
+				{
+					char *line_s = panel_p -> spa_buffer_s;
+					size_t num_positions = 0;
+
+					success_flag = true;
+
+					while (line_s && success_flag)
+						{
+							char *next_line_s = strchr (line_s, '\n');
+							char *chromosome_s;
+
+							if (next_line_s)
+								{
+									*next_line_s = '\0';
+									++ next_line_s;
+								}
+
+							while (isspace (*line_s))
+								{
+									++ line_s;
+								}
+
+							chromosome_s = line_s;
+
+							/* Skip blank lines and comments */
+							if ((*chromosome_s != '\0') && (*chromosome_s != '#'))
+								{
+									char *end_s = chromosome_s;
+
+									while ((*end_s != '\0') && (*end_s != '\t') && (*end_s != ' ') && (*end_s != ':'))
+										{
+											++ end_s;
+										}
+
+									if (*end_s != '\0')
+										{
+											char *pos_end_s = NULL;
+											long long pos;
+
+											*end_s = '\0';
+											pos = strtoll (end_s + 1, &pos_end_s, 10);
+
+											if ((pos_end_s != end_s + 1) && (pos > 0))
+												{
+													SNPPosition *position_p = (panel_p -> spa_positions_p) + num_positions;
+
+													position_p -> sp_chromosome_s = chromosome_s;
+													position_p -> sp_pos = (hts_pos_t) (pos - 1);
+													++ num_positions;
+												}
+											else
+												{
+													PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Invalid SNP position for \"%s\"", chromosome_s);
+													success_flag = false;
+												}
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "No SNP position for \"%s\"", chromosome_s);
+											success_flag = false;
+										}
+								}
+
+							line_s = next_line_s;
+						}
+
+					if (success_flag && (num_positions > 0))
+						{
+							size_t i;
+							size_t j = 0;
+
+							qsort (panel_p -> spa_positions_p, num_positions, sizeof (SNPPosition), CompareSNPPositions);
+
+							/* Remove any duplicates */
+							for (i = 1; i < num_positions; ++ i)
+								{
+									if (CompareSNPPositions ((panel_p -> spa_positions_p) + i, (panel_p -> spa_positions_p) + j) != 0)
+										{
+											++ j;
+
+											if (j != i)
+												{
+													panel_p -> spa_positions_p [j] = panel_p -> spa_positions_p [i];
+												}
+										}
+								}
+
+							panel_p -> spa_num_positions = j + 1;
+						}
+					else
+						{
+							success_flag = false;
+						}
+				}
+
+			if (!success_flag)
+				{
+					ClearSNPPanel (panel_p);
+				}
+		}
+
+	return success_flag;
+}
+
+
+static void ClearSNPPanel (SNPPanel *panel_p)
+{
+	if (panel_p -> spa_buffer_s)
+		{
+			FreeCopiedString (panel_p -> spa_buffer_s);
+			panel_p -> spa_buffer_s = NULL;
+		}
+
+	if (panel_p -> spa_positions_p)
+		{
+			FreeMemory (panel_p -> spa_positions_p);
+			panel_p -> spa_positions_p = NULL;
+		}
+
+	panel_p -> spa_num_positions = 0;
+}
+
+
+static int CompareSNPPositions (const void *v0_p, const void *v1_p)
+{
+	const SNPPosition *pos0_p = (const SNPPosition *) v0_p;
+	const SNPPosition *pos1_p = (const SNPPosition *) v1_p;
+	int res = strcmp (pos0_p -> sp_chromosome_s, pos1_p -> sp_chromosome_s);
+
+	if (res == 0)
+		{
+			if (pos0_p -> sp_pos < pos1_p -> sp_pos)
+				{
+					res = -1;
+				}
+			else if (pos0_p -> sp_pos > pos1_p -> sp_pos)
+				{
+					res = 1;
+				}
+		}
+
+	return res;
+}
+
+
+static int CompareChromosomeBlocks (const void *v0_p, const void *v1_p)
+{
+	const ChromosomeBlock *block0_p = (const ChromosomeBlock *) v0_p;
+	const ChromosomeBlock *block1_p = (const ChromosomeBlock *) v1_p;
+
+	return (block0_p -> cb_tid < block1_p -> cb_tid) ? -1 : ((block0_p -> cb_tid > block1_p -> cb_tid) ? 1 : 0);
+}
+
+
+static bool CountAllelesForSample (const size_t task_index, void *data_p)
+{
+	AlleleCountsTask *task_p = (AlleleCountsTask *) data_p;
+	AlignmentData *sample_p = task_p -> act_samples_pp [task_index];
+	const SNPPanel *panel_p = task_p -> act_panel_p;
+	uint32 *counts_p = (uint32 *) AllocMemoryArray (sizeof (uint32), AC_NUM_ALLELES * (panel_p -> spa_num_positions));
+	bool success_flag = false;
+
+	task_p -> act_counts_pp [task_index] = counts_p;
+
+	if (counts_p)
+		{
+			ChromosomeBlock *blocks_p = (ChromosomeBlock *) AllocMemoryArray (sizeof (ChromosomeBlock), panel_p -> spa_num_positions);
+
+			memset (counts_p, 0, AC_NUM_ALLELES * (panel_p -> spa_num_positions) * sizeof (uint32));
+
+			if (blocks_p)
+				{
+					bam1_t *read_p = bam_init1 ();
+
+					if (read_p)
+						{
+							if (LockAlignmentData (sample_p))
+								{
+									const SNPPosition *positions_p = panel_p -> spa_positions_p;
+									size_t num_blocks = 0;
+									size_t i = 0;
+
+									/*
+									 * Group the positions by chromosome and then order these groups
+									 * as they are in this alignment file so that it is read
+									 * sequentially.
+									 */
+									while (i < panel_p -> spa_num_positions)
+										{
+											size_t j = i + 1;
+
+											while ((j < panel_p -> spa_num_positions) && (strcmp (positions_p [i].sp_chromosome_s, positions_p [j].sp_chromosome_s) == 0))
+												{
+													++ j;
+												}
+
+											blocks_p [num_blocks].cb_start = i;
+											blocks_p [num_blocks].cb_end = j;
+											blocks_p [num_blocks].cb_tid = sam_hdr_name2tid (sample_p -> ad_header_p, positions_p [i].sp_chromosome_s);
+
+											if (blocks_p [num_blocks].cb_tid >= 0)
+												{
+													++ num_blocks;
+												}
+
+											i = j;
+										}
+
+									qsort (blocks_p, num_blocks, sizeof (ChromosomeBlock), CompareChromosomeBlocks);
+
+									success_flag = true;
+
+									for (i = 0; (i < num_blocks) && success_flag; ++ i)
+										{
+											const ChromosomeBlock *block_p = blocks_p + i;
+											size_t start = block_p -> cb_start;
+
+											while ((start < block_p -> cb_end) && success_flag)
+												{
+													size_t end = start + 1;
+
+													while ((end < block_p -> cb_end) && (positions_p [end].sp_pos - positions_p [end - 1].sp_pos <= S_MAX_QUERY_GAP))
+														{
+															++ end;
+														}
+
+													success_flag = CountAllelesInRegion (sample_p -> ad_file_p, sample_p -> ad_index_p, read_p, positions_p, start, end, block_p -> cb_tid, task_p, counts_p);
+
+													start = end;
+												}
+										}
+
+									UnlockAlignmentData (sample_p);
+								}
+
+							bam_destroy1 (read_p);
+						}
+
+					FreeMemory (blocks_p);
+				}
+		}
+
+	task_p -> act_success_flags_p [task_index] = success_flag;
+
+	return success_flag;
+}
+
+
+/*
+ * Count the alleles for the positions from start up to, but not including,
+ * end. All of these positions are on the same chromosome.
+ */
+static bool CountAllelesInRegion (htsFile *bam_p, hts_idx_t *index_p, bam1_t *read_p, const SNPPosition *positions_p, const size_t start, const size_t end, const int tid, const AlleleCountsTask *task_p, uint32 *counts_p)
+{
+	bool success_flag = false;
+	hts_itr_t *itr_p = sam_itr_queryi (index_p, tid, positions_p [start].sp_pos, positions_p [end - 1].sp_pos + 1);
+
+	if (itr_p)
+		{
+			size_t first = start;
+			int res;
+
+			while ((res = sam_itr_next (bam_p, itr_p, read_p)) >= 0)
+				{
+					if (IsUsableRead (read_p, task_p -> act_min_mapping_quality))
+						{
+							/*
+							 * The reads come in order of their start positions so any
+							 * positions before this read can't be covered by any later
+							 * reads either.
+							 */
+							while ((first < end) && (positions_p [first].sp_pos < read_p -> core.pos))
+								{
+									++ first;
+								}
+
+							if (first == end)
+								{
+									break;
+								}
+
+							CountAllelesForRead (read_p, positions_p, first, end, task_p -> act_min_base_quality, counts_p);
+						}
+				}
+
+			if (res < -1)
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Error %d reading alignments for tid %d", res, tid);
+				}
+			else
+				{
+					success_flag = true;
+				}
+
+			hts_itr_destroy (itr_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to query tid %d at " INT64_FMT, tid, (int64) (positions_p [start].sp_pos));
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Walk the read's CIGAR in step with the sorted positions, counting the
+ * aligned base at each position that the read covers.
+ */
+static void CountAllelesForRead (const bam1_t *read_p, const SNPPosition *positions_p, size_t first, const size_t end, const uint32 min_base_quality, uint32 *counts_p)
+{
+	const uint32_t *cigar_p = bam_get_cigar (read_p);
+	const uint8_t *seq_p = bam_get_seq (read_p);
+	const uint8_t *qual_p = bam_get_qual (read_p);
+	hts_pos_t ref_pos = read_p -> core.pos;
+	int32 query_pos = 0;
+	uint32 i;
+
+	for (i = 0; (i < read_p -> core.n_cigar) && (first < end); ++ i)
+		{
+			const int op = bam_cigar_op (cigar_p [i]);
+			const hts_pos_t len = bam_cigar_oplen (cigar_p [i]);
+			const int op_type = bam_cigar_type (op);
+
+			/* bit 1 is set if the op consumes the query and bit 2 if it consumes the reference */
+			if (op_type & 2)
+				{
+					const hts_pos_t op_end = ref_pos + len;
+
+					while ((first < end) && (positions_p [first].sp_pos < op_end))
+						{
+							if ((op_type & 1) && (positions_p [first].sp_pos >= ref_pos))
+								{
+									const int32 qpos = query_pos + (int32) (positions_p [first].sp_pos - ref_pos);
+
+									if (qual_p [qpos] >= min_base_quality)
+										{
+											const int8 allele = S_NT16_TO_ALLELE [bam_seqi (seq_p, qpos)];
+
+											if (allele >= 0)
+												{
+													++ counts_p [first * AC_NUM_ALLELES + allele];
+												}
+										}
+								}
+
+							++ first;
+						}
+
+					ref_pos = op_end;
+				}
+
+			if (op_type & 1)
+				{
+					query_pos += (int32) len;
+				}
+		}
+}
+
+
+/*
+ * Write the counts out as a tab-separated matrix with a row for each
+ * position and a column for each sample. Each cell holds the A, C, G
+ * and T counts separated by commas, or . if the sample could not be read.
+ */
+static bool WriteAlleleCounts (const SNPPanel *panel_p, AlignmentData **samples_pp, const size_t num_samples, uint32 **counts_pp, const bool *success_flags_p, ByteBuffer *buffer_p)
+{
+	bool success_flag = AppendStringToByteBuffer (buffer_p, "#chromosome\tposition");
+	size_t i;
+
+	for (i = 0; (i < num_samples) && success_flag; ++ i)
+		{
+			success_flag = AppendStringsToByteBuffer (buffer_p, "\t", samples_pp [i] -> ad_name_s, NULL);
+		}
+
+	for (i = 0; (i < panel_p -> spa_num_positions) && success_flag; ++ i)
+		{
+			const SNPPosition *position_p = (panel_p -> spa_positions_p) + i;
+			char pos_s [32];
+			size_t j;
+
+			snprintf (pos_s, sizeof (pos_s), "\t" INT64_FMT, (int64) (position_p -> sp_pos + 1));
+			success_flag = AppendStringsToByteBuffer (buffer_p, "\n", position_p -> sp_chromosome_s, pos_s, NULL);
+
+			for (j = 0; (j < num_samples) && success_flag; ++ j)
+				{
+					char cell_s [64];
+					const uint32 *counts_p = counts_pp [j];
+
+					/* A sample that could not be read is left blank rather than shown with no coverage */
+					if (counts_p && (success_flags_p [j]))
+						{
+							counts_p += i * AC_NUM_ALLELES;
+							snprintf (cell_s, sizeof (cell_s), "\t" UINT32_FMT "," UINT32_FMT "," UINT32_FMT "," UINT32_FMT, counts_p [0], counts_p [1], counts_p [2], counts_p [3]);
+						}
+					else
+						{
+							strcpy (cell_s, "\t.");
+						}
+
+					success_flag = AppendStringToByteBuffer (buffer_p, cell_s);
+				}
+		}
+
+	if (success_flag)
+		{
+			success_flag = AppendToByteBuffer (buffer_p, "\n", 1);
+		}
+
+	return success_flag;
+}
@@ -0,0 +1,295 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * composition.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "composition.h"
+#include "composition_track.h"
+#include "worker_pool.h"
+#include "memory_allocations.h"
+#include "audit.h"
+
+#include "string_parameter.h"
+#include "unsigned_int_parameter.h"
+
+
+#ifdef _DEBUG
+	#define COMPOSITION_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define COMPOSITION_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+typedef struct CompositionCounter
+{
+	IndexData *cc_index_data_p;
+	const char *cc_scaffold_name_s;
+	hts_pos_t cc_start;
+	hts_pos_t cc_end;
+	hts_pos_t cc_scaffold_length;
+	uint32 cc_window_size;
+	hts_pos_t cc_block_size;
+	BaseComposition *cc_windows_p;
+} CompositionCounter;
+
+
+static NamedParameterType S_WINDOW_SIZE = { "Window size", PT_UNSIGNED_INT };
+
+
+static const uint32 S_DEFAULT_WINDOW_SIZE = 1000;
+
+/*
+ * The most windows that a job can return, so a small window size can't
+ * be used to make a huge result.
+ */
+static const size_t S_MAX_NUM_WINDOWS = 1000000;
+
+/*
+ * Each task counts roughly this many bases, rounded to a whole
+ * number of windows.
+ */
+static const hts_pos_t S_BLOCK_SIZE = 1 << 22;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool CountCompositionBlock (const size_t task_index, void *data_p);
+
+static bool AddCountsToJSON (json_t *result_p, const char *key_s, const BaseComposition *windows_p, const size_t num_windows, const size_t count_offset);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool AddCompositionParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	return (EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_WINDOW_SIZE.npt_name_s, "Window size", "The number of bases in each window of the composition", &S_DEFAULT_WINDOW_SIZE, PL_ADVANCED) != NULL);
+}
+
+
+bool GetCompositionParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_WINDOW_SIZE.npt_name_s) == 0)
+		{
+			*pt_p = S_WINDOW_SIZE.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+bool CountRegionComposition (IndexData *index_data_p, const char *scaffold_name_s, const hts_pos_t start, const hts_pos_t end, const hts_pos_t scaffold_length, const uint32 window_size, const uint32 num_threads, BaseComposition *windows_p)
+{
+	CompositionCounter counter;
+	const hts_pos_t windows_per_block = (S_BLOCK_SIZE > window_size) ? S_BLOCK_SIZE / window_size : 1;
+
+	counter.cc_index_data_p = index_data_p;
+	counter.cc_scaffold_name_s = scaffold_name_s;
+	counter.cc_start = start;
+	counter.cc_end = end;
+	counter.cc_scaffold_length = scaffold_length;
+	counter.cc_window_size = window_size;
+	counter.cc_block_size = windows_per_block * window_size;
+	counter.cc_windows_p = windows_p;
+
+	return RunWorkerPool ((size_t) ((end - start + counter.cc_block_size - 1) / counter.cc_block_size), num_threads, CountCompositionBlock, &counter);
+}
+
+
+json_t *GetCompositionAsJSON (const char *scaffold_name_s, const hts_pos_t start, const hts_pos_t end, const uint32 window_size, const BaseComposition *windows_p, const size_t num_windows)
+{
+	json_t *result_p = json_pack ("{s:s,s:I,s:I,s:I}", "scaffold", scaffold_name_s, "start", (json_int_t) start, "end", (json_int_t) end, "window_size", (json_int_t) window_size);
+
+	if (result_p)
+		{
+			if ((AddCountsToJSON (result_p, "gc", windows_p, num_windows, offsetof (BaseComposition, bc_gc))) &&
+				(AddCountsToJSON (result_p, "at", windows_p, num_windows, offsetof (BaseComposition, bc_at))) &&
+				(AddCountsToJSON (result_p, "n", windows_p, num_windows, offsetof (BaseComposition, bc_n))) &&
+				(AddCountsToJSON (result_p, "soft_masked", windows_p, num_windows, offsetof (BaseComposition, bc_soft_masked))) &&
+				(AddCountsToJSON (result_p, "cpg", windows_p, num_windows, offsetof (BaseComposition, bc_cpg))))
+				{
+					return result_p;
+				}
+
+			json_decref (result_p);
+		}
+
+	return NULL;
+}
+
+
+void RunCompositionJob (Service *service_p, ParameterSet *param_set_p)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	IndexData *index_data_p = GetSelectedIndexData (data_p, param_set_p);
+	const char *region_s = NULL;
+
+	if (index_data_p && (index_data_p -> id_fasta_filename_s) && GetCurrentStringParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD.npt_name_s, &region_s) && region_s)
+		{
+			ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, region_s, index_data_p -> id_fasta_filename_s, NULL, NULL, NULL);
+
+			if (job_p)
+				{
+					const uint32 *window_size_p = NULL;
+					const uint32 window_size = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_WINDOW_SIZE.npt_name_s, &window_size_p) && window_size_p && (*window_size_p > 0)) ? *window_size_p : S_DEFAULT_WINDOW_SIZE;
+					IndexRegion region;
+
+					LogParameterSet (param_set_p, job_p);
+
+					SetServiceJobStatus (job_p, OS_STARTED);
+					LogServiceJob (job_p);
+
+					/* Assume failure */
+					SetServiceJobStatus (job_p, OS_FAILED);
+
+					if (ParseIndexRegion (index_data_p, region_s, &region))
+						{
+							const size_t num_windows = (size_t) ((region.ir_end - region.ir_start + window_size - 1) / window_size);
+
+							/* Each window is a BaseComposition here and an entry in each of the JSON arrays */
+							if (num_windows > S_MAX_NUM_WINDOWS)
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "The region has more than 1000000 windows, use a larger Window size");
+								}
+							else
+								{
+									BaseComposition *windows_p = (BaseComposition *) AllocMemoryArray (sizeof (BaseComposition), num_windows);
+
+									if (windows_p)
+										{
+											const CompositionTrack *track_p = GetIndexCompositionTrack (index_data_p, data_p -> stsd_sidecar_directory_s);
+
+											memset (windows_p, 0, num_windows * sizeof (BaseComposition));
+
+											/* Summing the precomputed bins is far cheaper than reading the sequence */
+											if ((track_p && GetCompositionFromTrack (track_p, region.ir_scaffold_index, region.ir_start, region.ir_end, window_size, windows_p)) ||
+												(CountRegionComposition (index_data_p, region.ir_scaffold_name_s, region.ir_start, region.ir_end, region.ir_scaffold_length, window_size, data_p -> stsd_num_threads, windows_p)))
+												{
+													json_t *result_p = GetCompositionAsJSON (region.ir_scaffold_name_s, region.ir_start, region.ir_end, window_size, windows_p, num_windows);
+
+													if (result_p)
+														{
+															if (AddInlineResultToServiceJob (job_p, "composition", result_p))
+																{
+																	SetServiceJobStatus (job_p, OS_SUCCEEDED);
+																}
+
+															json_decref (result_p);
+														}
+												}
+											else
+												{
+													AddGeneralErrorMessageToServiceJob (job_p, "Failed to count the composition");
+												}
+
+											FreeMemory (windows_p);
+										}
+								}
+						}
+					else
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "Unknown region");
+						}
+
+					LogServiceJob (job_p);
+				}		/* if (job_p) */
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get a FASTA file and region for the composition");
+		}
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static bool CountCompositionBlock (const size_t task_index, void *data_p)
+{
+	CompositionCounter *counter_p = (CompositionCounter *) data_p;
+	const hts_pos_t block_start = counter_p -> cc_start + ((hts_pos_t) task_index) * (counter_p -> cc_block_size);
+	const hts_pos_t block_end = (counter_p -> cc_end - block_start < counter_p -> cc_block_size) ? counter_p -> cc_end : block_start + counter_p -> cc_block_size;
+	const hts_pos_t fetch_end = (block_end < counter_p -> cc_scaffold_length) ? block_end + 1 : block_end;
+	bool success_flag = false;
+	hts_pos_t length = 0;
+
+	/* Fetch one extra base so that a CpG spanning the end of the block is counted */
+	char *sequence_s = FetchIndexSequence (counter_p -> cc_index_data_p, counter_p -> cc_scaffold_name_s, block_start, fetch_end, &length);
+
+	if (sequence_s)
+		{
+			BaseComposition *window_p = counter_p -> cc_windows_p + ((block_start - counter_p -> cc_start) / counter_p -> cc_window_size);
+			const hts_pos_t block_length = (length < block_end - block_start) ? length : block_end - block_start;
+			hts_pos_t i;
+
+			for (i = 0; i < block_length; i += counter_p -> cc_window_size, ++ window_p)
+				{
+					const hts_pos_t window_length = (block_length - i < counter_p -> cc_window_size) ? block_length - i : counter_p -> cc_window_size;
+					const char next_base = (i + window_length < length) ? sequence_s [i + window_length] : '\0';
+
+					CountBaseComposition (sequence_s + i, (size_t) window_length, next_base, window_p);
+				}
+
+			free (sequence_s);
+			success_flag = true;
+		}
+
+	return success_flag;
+}
+
+
+static bool AddCountsToJSON (json_t *result_p, const char *key_s, const BaseComposition *windows_p, const size_t num_windows, const size_t count_offset)
+{
+	json_t *counts_p = json_array ();
+
+	if (counts_p)
+		{
+			size_t i;
+
+			for (i = 0; i < num_windows; ++ i)
+				{
+					const uint64 *count_p = (const uint64 *) (((const char *) (windows_p + i)) + count_offset);
+
+					if (json_array_append_new (counts_p, json_integer ((json_int_t) *count_p)) != 0)
+						{
+							json_decref (counts_p);
+							return false;
+						}
+				}
+
+			return (json_object_set_new (result_p, key_s, counts_p) == 0);
+		}
+
+	return false;
+}
@@ -0,0 +1,460 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * composition_track.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <string.h>
+
+#include "composition_track.h"
+#include "composition.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "streams.h"
+
+
+#ifdef _DEBUG
+	#define COMPOSITION_TRACK_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define COMPOSITION_TRACK_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * The start of each composition track file. This is followed by the
+ * scaffolds and then the bins.
+ */
+typedef struct CompositionTrackHeader
+{
+	char cth_magic [8];
+	uint64 cth_num_scaffolds;
+	uint64 cth_num_bins;
+	uint32 cth_bin_sizes [CT_NUM_LEVELS];
+	uint32 cth_padding;
+} CompositionTrackHeader;
+
+
+static const char * const S_COMPOSITION_TRACK_SUFFIX_S = ".comp";
+
+static const char S_COMPOSITION_TRACK_MAGIC [8] = { 'S', 'T', 'C', 'O', 'M', 'P', '0', '1' };
+
+/*
+ * The bin sizes, finest first. Each one must be a multiple of the one
+ * before it and no more than 65535 so that the counts fit in a CompositionBin.
+ */
+static const uint32 S_BIN_SIZES [CT_NUM_LEVELS] = { 100, 1000, 10000 };
+
+/*
+ * The number of finest bins counted at a time. This is a multiple
+ * of the coarsest bin size.
+ */
+static const size_t S_CHUNK_NUM_BINS = 100000;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool BuildCompositionTrack (IndexData *index_data_p, const char *track_filename_s, volatile bool *stop_flag_p);
+
+static bool WriteScaffoldBins (IndexData *index_data_p, const char *scaffold_name_s, const hts_pos_t length, BaseComposition *counts_p, CompositionBin *bins_p, CompositionBin **coarse_bins_pp, SidecarWriter *writer_p, volatile bool *stop_flag_p);
+
+static bool MapCompositionTrack (CompositionTrack *track_p, const char *track_filename_s);
+
+static const CompositionBin *GetLevelBins (const CompositionTrack *track_p, const CompositionTrackScaffold *scaffold_p, const int level);
+
+static uint64 GetNumBins (const uint64 length, const uint32 bin_size);
+
+static void AddBin (CompositionBin *bin_p, const BaseComposition *counts_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool BuildIndexCompositionTrack (IndexData *index_data_p, const char *sidecar_directory_s, volatile bool *stop_flag_p)
+{
+	bool success_flag = false;
+	char *track_filename_s = MakeSidecarFilename (sidecar_directory_s, index_data_p -> id_fasta_filename_s, S_COMPOSITION_TRACK_SUFFIX_S);
+
+	if (track_filename_s)
+		{
+			if (IsSidecarFileUpToDate (track_filename_s, index_data_p -> id_fasta_filename_s))
+				{
+					success_flag = true;
+				}
+			else
+				{
+					#if COMPOSITION_TRACK_DEBUG >= STM_LEVEL_FINE
+					PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "BuildIndexCompositionTrack - building %s", track_filename_s);
+					#endif
+
+					success_flag = BuildCompositionTrack (index_data_p, track_filename_s, stop_flag_p);
+				}
+
+			FreeCopiedString (track_filename_s);
+		}
+
+	return success_flag;
+}
+
+
+const CompositionTrack *GetIndexCompositionTrack (IndexData *index_data_p, const char *sidecar_directory_s)
+{
+	const CompositionTrack *track_p = NULL;
+
+	if (index_data_p -> id_fasta_filename_s)
+		{
+			pthread_mutex_lock (& (index_data_p -> id_sidecar_mutex));
+
+			if (! (index_data_p -> id_composition_track_p))
+				{
+					char *track_filename_s = MakeSidecarFilename (sidecar_directory_s, index_data_p -> id_fasta_filename_s, S_COMPOSITION_TRACK_SUFFIX_S);
+
+					/* Until the background builder has finished, the sequence is counted instead */
+					if (track_filename_s)
+						{
+							if (IsSidecarFileUpToDate (track_filename_s, index_data_p -> id_fasta_filename_s))
+								{
+									CompositionTrack *new_track_p = (CompositionTrack *) AllocMemory (sizeof (CompositionTrack));
+
+									if (new_track_p)
+										{
+											if (MapCompositionTrack (new_track_p, track_filename_s))
+												{
+													index_data_p -> id_composition_track_p = new_track_p;
+												}
+											else
+												{
+													FreeMemory (new_track_p);
+												}
+										}
+								}
+
+							FreeCopiedString (track_filename_s);
+						}
+				}
+
+			track_p = index_data_p -> id_composition_track_p;
+
+			pthread_mutex_unlock (& (index_data_p -> id_sidecar_mutex));
+		}
+
+	return track_p;
+}
+
+
+void FreeCompositionTrack (CompositionTrack *track_p)
+{
+	CloseMappedFile (& (track_p -> ct_file));
+	FreeMemory (track_p);
+}
+
+
+bool GetCompositionFromTrack (const CompositionTrack *track_p, const int scaffold_index, const hts_pos_t start, const hts_pos_t end, const uint32 window_size, BaseComposition *windows_p)
+{
+	if ((scaffold_index >= 0) && ((size_t) scaffold_index < track_p -> ct_num_scaffolds))
+		{
+			const CompositionTrackScaffold *scaffold_p = track_p -> ct_scaffolds_p + scaffold_index;
+			int level;
+
+			/* Use the coarsest resolution that the windows and region line up with */
+			for (level = CT_NUM_LEVELS - 1; level >= 0; -- level)
+				{
+					const uint32 bin_size = track_p -> ct_bin_sizes_p [level];
+
+					if (((window_size % bin_size) == 0) && ((start % bin_size) == 0) && (((end % bin_size) == 0) || ((uint64) end == scaffold_p -> cts_length)))
+						{
+							const CompositionBin *bins_p = GetLevelBins (track_p, scaffold_p, level);
+							const uint64 end_bin = GetNumBins ((uint64) end, bin_size);
+							uint64 bin;
+
+							for (bin = (uint64) start / bin_size; bin < end_bin; ++ bin)
+								{
+									const CompositionBin *bin_p = bins_p + bin;
+									BaseComposition *window_p = windows_p + ((bin * bin_size - (uint64) start) / window_size);
+
+									window_p -> bc_gc += bin_p -> cb_gc;
+									window_p -> bc_at += bin_p -> cb_at;
+									window_p -> bc_n += bin_p -> cb_n;
+									window_p -> bc_soft_masked += bin_p -> cb_soft_masked;
+									window_p -> bc_cpg += bin_p -> cb_cpg;
+								}
+
+							return true;
+						}
+				}
+		}
+
+	return false;
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static bool BuildCompositionTrack (IndexData *index_data_p, const char *track_filename_s, volatile bool *stop_flag_p)
+{
+	bool success_flag = false;
+	CompositionTrackHeader header;
+	CompositionTrackScaffold *scaffolds_p = NULL;
+	const char **names_ss = NULL;
+	uint64 max_length = 0;
+	faidx_t *fai_p = LockIndexFaidx (index_data_p);
+
+	if (!fai_p)
+		{
+			return false;
+		}
+
+	memset (&header, 0, sizeof (header));
+	memcpy (header.cth_magic, S_COMPOSITION_TRACK_MAGIC, sizeof (S_COMPOSITION_TRACK_MAGIC));
+	memcpy (header.cth_bin_sizes, S_BIN_SIZES, sizeof (S_BIN_SIZES));
+	header.cth_num_scaffolds = (faidx_nseq (fai_p) > 0) ? (uint64) faidx_nseq (fai_p) : 0;
+
+	scaffolds_p = (CompositionTrackScaffold *) AllocMemoryArray (sizeof (CompositionTrackScaffold), (size_t) (header.cth_num_scaffolds) + 1);
+	names_ss = (const char **) AllocMemoryArray (sizeof (const char *), (size_t) (header.cth_num_scaffolds) + 1);
+
+	if (scaffolds_p && names_ss)
+		{
+			uint64 i;
+
+			/* The layout is known up front so the bins can be streamed straight out */
+			for (i = 0; i < header.cth_num_scaffolds; ++ i)
+				{
+					int level;
+
+					names_ss [i] = faidx_iseq (fai_p, (int) i);
+					scaffolds_p [i].cts_length = (uint64) faidx_seq_len64 (fai_p, names_ss [i]);
+					scaffolds_p [i].cts_first_bin = header.cth_num_bins;
+
+					for (level = 0; level < CT_NUM_LEVELS; ++ level)
+						{
+							header.cth_num_bins += GetNumBins (scaffolds_p [i].cts_length, S_BIN_SIZES [level]);
+						}
+
+					if (scaffolds_p [i].cts_length > max_length)
+						{
+							max_length = scaffolds_p [i].cts_length;
+						}
+				}
+
+			UnlockIndexFaidx (index_data_p);
+			fai_p = NULL;
+
+			if (header.cth_num_scaffolds > 0)
+				{
+					BaseComposition *counts_p = (BaseComposition *) AllocMemoryArray (sizeof (BaseComposition), S_CHUNK_NUM_BINS);
+					CompositionBin *bins_p = (CompositionBin *) AllocMemoryArray (sizeof (CompositionBin), S_CHUNK_NUM_BINS);
+					CompositionBin *coarse_bins_p [CT_NUM_LEVELS];
+					bool alloced_flag = (counts_p != NULL) && (bins_p != NULL);
+					int level;
+
+					coarse_bins_p [0] = NULL;
+
+					for (level = 1; level < CT_NUM_LEVELS; ++ level)
+						{
+							coarse_bins_p [level] = (CompositionBin *) AllocMemoryArray (sizeof (CompositionBin), (size_t) GetNumBins (max_length, S_BIN_SIZES [level]) + 1);
+
+							if (! (coarse_bins_p [level]))
+								{
+									alloced_flag = false;
+								}
+						}
+
+					if (alloced_flag)
+						{
+							SidecarWriter *writer_p = OpenSidecarWriter (track_filename_s);
+
+							if (writer_p)
+								{
+									success_flag = (WriteSidecarData (writer_p, &header, sizeof (header))) &&
+										(WriteSidecarData (writer_p, scaffolds_p, (size_t) (header.cth_num_scaffolds) * sizeof (CompositionTrackScaffold)));
+
+									for (i = 0; (i < header.cth_num_scaffolds) && success_flag; ++ i)
+										{
+											success_flag = WriteScaffoldBins (index_data_p, names_ss [i], (hts_pos_t) (scaffolds_p [i].cts_length), counts_p, bins_p, coarse_bins_p, writer_p, stop_flag_p);
+										}
+
+									if (!CloseSidecarWriter (writer_p, success_flag))
+										{
+											success_flag = false;
+										}
+								}
+						}
+
+					for (level = 1; level < CT_NUM_LEVELS; ++ level)
+						{
+							if (coarse_bins_p [level])
+								{
+									FreeMemory (coarse_bins_p [level]);
+								}
+						}
+
+					if (bins_p)
+						{
+							FreeMemory (bins_p);
+						}
+
+					if (counts_p)
+						{
+							FreeMemory (counts_p);
+						}
+				}
+		}
+
+	if (fai_p)
+		{
+			UnlockIndexFaidx (index_data_p);
+		}
+
+	if (names_ss)
+		{
+			FreeMemory (names_ss);
+		}
+
+	if (scaffolds_p)
+		{
+			FreeMemory (scaffolds_p);
+		}
+
+	return success_flag;
+}
+
+
+static bool WriteScaffoldBins (IndexData *index_data_p, const char *scaffold_name_s, const hts_pos_t length, BaseComposition *counts_p, CompositionBin *bins_p, CompositionBin **coarse_bins_pp, SidecarWriter *writer_p, volatile bool *stop_flag_p)
+{
+	bool success_flag = true;
+	const hts_pos_t chunk_size = (hts_pos_t) (S_CHUNK_NUM_BINS * S_BIN_SIZES [0]);
+	hts_pos_t chunk_start = 0;
+	int level;
+
+	for (level = 1; level < CT_NUM_LEVELS; ++ level)
+		{
+			memset (coarse_bins_pp [level], 0, (size_t) GetNumBins ((uint64) length, S_BIN_SIZES [level]) * sizeof (CompositionBin));
+		}
+
+	while ((chunk_start < length) && success_flag)
+		{
+			const hts_pos_t chunk_end = (length - chunk_start < chunk_size) ? length : chunk_start + chunk_size;
+			const size_t num_bins = (size_t) GetNumBins ((uint64) (chunk_end - chunk_start), S_BIN_SIZES [0]);
+
+			if (*stop_flag_p)
+				{
+					return false;
+				}
+
+			memset (counts_p, 0, num_bins * sizeof (BaseComposition));
+
+			/* This runs alongside the service's jobs so it only uses a single thread */
+			if (CountRegionComposition (index_data_p, scaffold_name_s, chunk_start, chunk_end, length, S_BIN_SIZES [0], 1, counts_p))
+				{
+					const uint64 first_bin = (uint64) chunk_start / S_BIN_SIZES [0];
+					size_t i;
+
+					memset (bins_p, 0, num_bins * sizeof (CompositionBin));
+
+					for (i = 0; i < num_bins; ++ i)
+						{
+							AddBin (bins_p + i, counts_p + i);
+
+							for (level = 1; level < CT_NUM_LEVELS; ++ level)
+								{
+									AddBin (coarse_bins_pp [level] + (((first_bin + i) * S_BIN_SIZES [0]) / S_BIN_SIZES [level]), counts_p + i);
+								}
+						}
+
+					success_flag = WriteSidecarData (writer_p, bins_p, num_bins * sizeof (CompositionBin));
+				}
+			else
+				{
+					success_flag = false;
+				}
+
+			chunk_start = chunk_end;
+		}
+
+	for (level = 1; (level < CT_NUM_LEVELS) && success_flag; ++ level)
+		{
+			success_flag = WriteSidecarData (writer_p, coarse_bins_pp [level], (size_t) GetNumBins ((uint64) length, S_BIN_SIZES [level]) * sizeof (CompositionBin));
+		}
+
+	return success_flag;
+}
+
+
+static bool MapCompositionTrack (CompositionTrack *track_p, const char *track_filename_s)
+{
+	if (OpenMappedFile (& (track_p -> ct_file), track_filename_s))
+		{
+			const CompositionTrackHeader *header_p = (const CompositionTrackHeader *) (track_p -> ct_file.mf_data_p);
+
+			if ((track_p -> ct_file.mf_size >= sizeof (CompositionTrackHeader)) &&
+				(memcmp (header_p -> cth_magic, S_COMPOSITION_TRACK_MAGIC, sizeof (S_COMPOSITION_TRACK_MAGIC)) == 0) &&
+				(track_p -> ct_file.mf_size == sizeof (CompositionTrackHeader) + (header_p -> cth_num_scaffolds * sizeof (CompositionTrackScaffold)) + (header_p -> cth_num_bins * sizeof (CompositionBin))))
+				{
+					track_p -> ct_num_scaffolds = (size_t) (header_p -> cth_num_scaffolds);
+					track_p -> ct_bin_sizes_p = header_p -> cth_bin_sizes;
+					track_p -> ct_scaffolds_p = (const CompositionTrackScaffold *) (header_p + 1);
+					track_p -> ct_bins_p = (const CompositionBin *) (track_p -> ct_scaffolds_p + track_p -> ct_num_scaffolds);
+
+					return true;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "\"%s\" is not a valid composition track", track_filename_s);
+				}
+
+			CloseMappedFile (& (track_p -> ct_file));
+		}
+
+	return false;
+}
+
+
+static const CompositionBin *GetLevelBins (const CompositionTrack *track_p, const CompositionTrackScaffold *scaffold_p, const int level)
+{
+	const CompositionBin *bins_p = track_p -> ct_bins_p + scaffold_p -> cts_first_bin;
+	int i;
+
+	/* Each scaffold's resolutions are stored one after the other, finest first */
+	for (i = 0; i < level; ++ i)
+		{
+			bins_p += GetNumBins (scaffold_p -> cts_length, track_p -> ct_bin_sizes_p [i]);
+		}
+
+	return bins_p;
+}
+
+
+static uint64 GetNumBins (const uint64 length, const uint32 bin_size)
+{
+	return (length + bin_size - 1) / bin_size;
+}
+
+
+static void AddBin (CompositionBin *bin_p, const BaseComposition *counts_p)
+{
+	bin_p -> cb_gc += (uint16) (counts_p -> bc_gc);
+	bin_p -> cb_at += (uint16) (counts_p -> bc_at);
+	bin_p -> cb_n += (uint16) (counts_p -> bc_n);
+	bin_p -> cb_soft_masked += (uint16) (counts_p -> bc_soft_masked);
+	bin_p -> cb_cpg += (uint16) (counts_p -> bc_cpg);
+}
@@ -0,0 +1,386 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * consensus.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <string.h>
+
+#include "consensus.h"
+#include "fasta_utils.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "byte_buffer.h"
+#include "audit.h"
+
+#include "string_parameter.h"
+#include "unsigned_int_parameter.h"
+
+
+#ifdef _DEBUG
+	#define CONSENSUS_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define CONSENSUS_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * The columns counted for each position, A, C, G, T and deletions.
+ */
+#define CO_NUM_COLUMNS (5)
+
+
+typedef struct ConsensusReader
+{
+	htsFile *cr_file_p;
+	hts_itr_t *cr_itr_p;
+	uint32 cr_min_mapping_quality;
+} ConsensusReader;
+
+
+/*
+ * The region is piled up in windows of this many bases so the memory
+ * used stays the same however large the region is.
+ */
+static const hts_pos_t S_WINDOW_SIZE = 1 << 20;
+
+/*
+ * The maximum depth used at each position. This is higher than htslib's
+ * default so that high-coverage regions are still called.
+ */
+static const int S_MAX_DEPTH = 100000;
+
+static const char S_CONSENSUS_BASES [CO_NUM_COLUMNS] = { 'A', 'C', 'G', 'T', '-' };
+
+/*
+ * Map the 4-bit nucleotide codes used in BAM records onto the
+ * consensus columns. Ambiguous bases are ignored.
+ */
+static const int8 S_NT16_TO_COLUMN [16] = { -1, 0, 1, -1, 2, -1, -1, -1, 3, -1, -1, -1, -1, -1, -1, -1 };
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static int ReadConsensusAlignment (void *data_p, bam1_t *read_p);
+
+static bool CallConsensusForWindow (AlignmentData *sample_p, const int tid, const hts_pos_t window_start, const hts_pos_t window_end, const uint32 min_mapping_quality, const uint32 min_base_quality, uint32 *counts_p, char *consensus_s);
+
+static char CallConsensusBase (const uint32 *counts_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+void RunConsensusJob (Service *service_p, ParameterSet *param_set_p)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	const char *region_s = NULL;
+
+	if (GetCurrentStringParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD.npt_name_s, &region_s) && region_s)
+		{
+			AlignmentData **samples_pp = NULL;
+			const size_t num_samples = GetRequestedSamples (data_p, param_set_p, &samples_pp);
+
+			if (num_samples == 1)
+				{
+					AlignmentData *sample_p = *samples_pp;
+					ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, region_s, sample_p -> ad_name_s, NULL, NULL, NULL);
+
+					if (job_p)
+						{
+							LogParameterSet (param_set_p, job_p);
+
+							SetServiceJobStatus (job_p, OS_STARTED);
+							LogServiceJob (job_p);
+
+							/* Assume failure */
+							SetServiceJobStatus (job_p, OS_FAILED);
+
+							if (LockAlignmentData (sample_p))
+								{
+									int tid;
+									hts_pos_t beg;
+									hts_pos_t end;
+
+									/* The region must have at least one base once its end is clamped to the scaffold */
+									if (sam_parse_region (sample_p -> ad_header_p, region_s, &tid, &beg, &end, 0) && (tid >= 0) && (beg < end) && (beg < sam_hdr_tid2len (sample_p -> ad_header_p, tid)))
+										{
+											const hts_pos_t seq_length = sam_hdr_tid2len (sample_p -> ad_header_p, tid);
+											const uint32 *line_length_p = NULL;
+											uint32 line_length = 0;
+											uint32 min_mapping_quality;
+											uint32 min_base_quality;
+											ByteBuffer *buffer_p;
+
+											if (end > seq_length)
+												{
+													end = seq_length;
+												}
+
+											GetAlignmentQualityThresholds (param_set_p, &min_mapping_quality, &min_base_quality);
+
+											if (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD_LINE_BREAK.npt_name_s, &line_length_p) && line_length_p)
+												{
+													line_length = *line_length_p;
+												}
+
+											/* Size the buffer up front so that it never needs to grow */
+											buffer_p = AllocateByteBuffer (strlen (region_s) + 3 + (end - beg) + ((line_length > 0) ? ((end - beg) / line_length) + 1 : 1));
+
+											if (buffer_p)
+												{
+													const size_t max_window_size = (end - beg < S_WINDOW_SIZE) ? (size_t) (end - beg) : (size_t) S_WINDOW_SIZE;
+													uint32 *counts_p = (uint32 *) AllocMemoryArray (sizeof (uint32), CO_NUM_COLUMNS * max_window_size);
+													char *consensus_s = (char *) AllocMemory (max_window_size);
+
+													if (counts_p && consensus_s)
+														{
+															if (AppendStringsToByteBuffer (buffer_p, ">", region_s, "\n", NULL))
+																{
+																	hts_pos_t window_start = beg;
+																	uint32 column = 0;
+																	bool success_flag = true;
+
+																	while ((window_start < end) && success_flag)
+																		{
+																			const hts_pos_t window_end = (end - window_start < S_WINDOW_SIZE) ? end : window_start + S_WINDOW_SIZE;
+
+																			if (CallConsensusForWindow (sample_p, tid, window_start, window_end, min_mapping_quality, min_base_quality, counts_p, consensus_s))
+																				{
+																					success_flag = AppendWrappedSequence (buffer_p, consensus_s, (size_t) (window_end - window_start), line_length, &column);
+																				}
+																			else
+																				{
+																					success_flag = false;
+																				}
+
+																			window_start = window_end;
+																		}
+
+																	if (success_flag && FinishWrappedSequence (buffer_p, &column))
+																		{
+																			json_t *consensus_p = json_string (GetByteBufferData (buffer_p));
+
+																			if (consensus_p)
+																				{
+																					if (AddInlineResultToServiceJob (job_p, region_s, consensus_p))
+																						{
+																							SetServiceJobStatus (job_p, OS_SUCCEEDED);
+																						}
+
+																					json_decref (consensus_p);
+																				}
+																		}
+																	else
+																		{
+																			AddGeneralErrorMessageToServiceJob (job_p, "Failed to build consensus");
+																		}
+																}
+														}
+													else
+														{
+															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate consensus buffers for " SIZET_FMT " bases", max_window_size);
+														}
+
+													if (consensus_s)
+														{
+															FreeMemory (consensus_s);
+														}
+
+													if (counts_p)
+														{
+															FreeMemory (counts_p);
+														}
+
+													FreeByteBuffer (buffer_p);
+												}
+										}
+									else
+										{
+											AddGeneralErrorMessageToServiceJob (job_p, "Unknown region");
+										}
+
+									UnlockAlignmentData (sample_p);
+								}
+							else
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "Failed to open alignments");
+								}
+
+							LogServiceJob (job_p);
+						}		/* if (job_p) */
+				}
+			else
+				{
+					ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, region_s, "Consensus", NULL, NULL, NULL);
+
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Consensus needs a single sample but got " SIZET_FMT, num_samples);
+
+					if (job_p)
+						{
+							LogParameterSet (param_set_p, job_p);
+
+							SetServiceJobStatus (job_p, OS_FAILED);
+							AddGeneralErrorMessageToServiceJob (job_p, "Consensus needs a single sample");
+
+							LogServiceJob (job_p);
+						}		/* if (job_p) */
+				}
+
+			if (samples_pp)
+				{
+					FreeMemory (samples_pp);
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get %s parameter", SS_SCAFFOLD.npt_name_s);
+		}
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static int ReadConsensusAlignment (void *data_p, bam1_t *read_p)
+{
+	ConsensusReader *reader_p = (ConsensusReader *) data_p;
+	int res;
+
+	while ((res = sam_itr_next (reader_p -> cr_file_p, reader_p -> cr_itr_p, read_p)) >= 0)
+		{
+			if (IsUsableRead (read_p, reader_p -> cr_min_mapping_quality))
+				{
+					break;
+				}
+		}
+
+	return res;
+}
+
+
+static bool CallConsensusForWindow (AlignmentData *sample_p, const int tid, const hts_pos_t window_start, const hts_pos_t window_end, const uint32 min_mapping_quality, const uint32 min_base_quality, uint32 *counts_p, char *consensus_s)
+{
+	bool success_flag = false;
+	const size_t window_size = (size_t) (window_end - window_start);
+	ConsensusReader reader;
+
+	memset (counts_p, 0, window_size * CO_NUM_COLUMNS * sizeof (uint32));
+
+	reader.cr_file_p = sample_p -> ad_file_p;
+	reader.cr_min_mapping_quality = min_mapping_quality;
+	reader.cr_itr_p = sam_itr_queryi (sample_p -> ad_index_p, tid, window_start, window_end);
+
+	if (reader.cr_itr_p)
+		{
+			bam_plp_t pileup_p = bam_plp_init (ReadConsensusAlignment, &reader);
+
+			if (pileup_p)
+				{
+					const bam_pileup1_t *entries_p;
+					int pileup_tid;
+					hts_pos_t pos;
+					int depth;
+					size_t i;
+
+					bam_plp_set_maxcnt (pileup_p, S_MAX_DEPTH);
+
+					while ((entries_p = bam_plp64_auto (pileup_p, &pileup_tid, &pos, &depth)) != NULL)
+						{
+							if ((pos >= window_start) && (pos < window_end))
+								{
+									uint32 *column_counts_p = counts_p + ((pos - window_start) * CO_NUM_COLUMNS);
+									int j;
+
+									for (j = 0; j < depth; ++ j, ++ entries_p)
+										{
+											if (entries_p -> is_del)
+												{
+													++ column_counts_p [CO_NUM_COLUMNS - 1];
+												}
+											else if (! (entries_p -> is_refskip))
+												{
+													const bam1_t *read_p = entries_p -> b;
+
+													if (bam_get_qual (read_p) [entries_p -> qpos] >= min_base_quality)
+														{
+															const int8 column = S_NT16_TO_COLUMN [bam_seqi (bam_get_seq (read_p), entries_p -> qpos)];
+
+															if (column >= 0)
+																{
+																	++ column_counts_p [column];
+																}
+														}
+												}
+										}
+								}
+							else if (pos >= window_end)
+								{
+									break;
+								}
+						}
+
+					for (i = 0; i < window_size; ++ i)
+						{
+							consensus_s [i] = CallConsensusBase (counts_p + (i * CO_NUM_COLUMNS));
+						}
+
+					success_flag = true;
+
+					bam_plp_destroy (pileup_p);
+				}
+
+			hts_itr_destroy (reader.cr_itr_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to query %s for tid %d", sample_p -> ad_filename_s, tid);
+		}
+
+	return success_flag;
+}
+
+
+static char CallConsensusBase (const uint32 *counts_p)
+{
+	char base = 'N';
+	uint32 best_count = 0;
+	bool tie_flag = false;
+	int i;
+
+	for (i = 0; i < CO_NUM_COLUMNS; ++ i)
+		{
+			if (counts_p [i] > best_count)
+				{
+					best_count = counts_p [i];
+					base = S_CONSENSUS_BASES [i];
+					tie_flag = false;
+				}
+			else if ((counts_p [i] == best_count) && (best_count > 0))
+				{
+					tie_flag = true;
+				}
+		}
+
+	return tie_flag ? 'N' : base;
+}
@@ -0,0 +1,396 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * exact_match.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <string.h>
+#include <ctype.h>
+
+#include "exact_match.h"
+#include "fm_index.h"
+#include "fasta_utils.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "audit.h"
+
+#include "string_parameter.h"
+#include "unsigned_int_parameter.h"
+#include "boolean_parameter.h"
+
+
+#ifdef _DEBUG
+	#define EXACT_MATCH_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define EXACT_MATCH_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+typedef struct ExactMatchHit
+{
+	uint64 emh_start;
+	size_t emh_scaffold_index;
+	char emh_strand;
+} ExactMatchHit;
+
+
+static NamedParameterType S_QUERY = { "Query", PT_STRING };
+
+static NamedParameterType S_MAX_LOCATIONS = { "Max locations", PT_UNSIGNED_INT };
+
+
+static const uint32 S_DEFAULT_MAX_LOCATIONS = 1000;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static json_t *SearchFmIndex (IndexData *index_data_p, const char *query_s, const char *reverse_s, const size_t length, uint32 *max_locations_p, uint64 *count_p);
+
+static uint64 AddFmIndexHits (const FmIndex *fm_index_p, const uint64 start_row, const uint64 end_row, const char strand, ExactMatchHit *hits_p, const uint64 max_hits);
+
+static int CompareExactMatchHits (const void *v0_p, const void *v1_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool HasFmIndexes (const SamToolsServiceData *data_p)
+{
+	size_t i;
+
+	for (i = 0; i < data_p -> stsd_index_data_size; ++ i)
+		{
+			if (data_p -> stsd_index_data_p [i].id_fm_index_p)
+				{
+					return true;
+				}
+		}
+
+	return false;
+}
+
+
+bool AddExactMatchParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	return ((EasyCreateAndAddStringParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_QUERY.npt_type, S_QUERY.npt_name_s, "Query", "The sequence to find, which can only use A, C, G and T", NULL, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MAX_LOCATIONS.npt_name_s, "Max locations", "The maximum number of matches to get the coordinates of. All of them are still counted.", &S_DEFAULT_MAX_LOCATIONS, PL_ADVANCED) != NULL));
+}
+
+
+bool GetExactMatchParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_QUERY.npt_name_s) == 0)
+		{
+			*pt_p = S_QUERY.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MAX_LOCATIONS.npt_name_s) == 0)
+		{
+			*pt_p = S_MAX_LOCATIONS.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+void RunExactMatchJob (Service *service_p, ParameterSet *param_set_p)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	const bool *all_indexes_flag_p = NULL;
+	const bool all_indexes_flag = (GetCurrentBooleanParameterValueFromParameterSet (param_set_p, SS_ALL_INDEXES.npt_name_s, &all_indexes_flag_p) && all_indexes_flag_p) ? *all_indexes_flag_p : false;
+	IndexData *index_data_p = all_indexes_flag ? NULL : GetSelectedIndexData (data_p, param_set_p);
+	const char *query_s = NULL;
+
+	if ((all_indexes_flag || index_data_p) && GetCurrentStringParameterValueFromParameterSet (param_set_p, S_QUERY.npt_name_s, &query_s) && query_s)
+		{
+			ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, query_s, index_data_p ? (index_data_p -> id_fasta_filename_s ? index_data_p -> id_fasta_filename_s : index_data_p -> id_blast_db_name_s) : "All indexes", NULL, NULL, NULL);
+
+			if (job_p)
+				{
+					const size_t length = strlen (query_s);
+					char *forward_s = (char *) AllocMemory (length + 1);
+					char *reverse_s = (char *) AllocMemory (length + 1);
+
+					LogParameterSet (param_set_p, job_p);
+
+					SetServiceJobStatus (job_p, OS_STARTED);
+					LogServiceJob (job_p);
+
+					/* Assume failure */
+					SetServiceJobStatus (job_p, OS_FAILED);
+
+					if (forward_s && reverse_s)
+						{
+							const uint32 *value_p = NULL;
+							uint32 max_locations = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MAX_LOCATIONS.npt_name_s, &value_p) && value_p) ? *value_p : S_DEFAULT_MAX_LOCATIONS;
+							bool valid_flag = (length > 0);
+							size_t i;
+
+							for (i = 0; i < length; ++ i)
+								{
+									forward_s [i] = (char) toupper (query_s [i]);
+
+									if (!strchr ("ACGT", forward_s [i]))
+										{
+											valid_flag = false;
+										}
+								}
+
+							forward_s [length] = '\0';
+
+							ReverseComplementSequence (reverse_s, forward_s, length);
+							reverse_s [length] = '\0';
+
+							if (valid_flag)
+								{
+									json_t *result_p = json_pack ("{s:s}", "query", forward_s);
+									json_t *indexes_p = json_array ();
+
+									if (result_p && indexes_p && (json_object_set_new (result_p, "indexes", indexes_p) == 0))
+										{
+											const bool palindrome_flag = (strcmp (forward_s, reverse_s) == 0);
+											const uint32 requested_locations = max_locations;
+											uint64 count = 0;
+											bool success_flag = true;
+											bool found_flag = false;
+
+											for (i = 0; (i < data_p -> stsd_index_data_size) && success_flag; ++ i)
+												{
+													IndexData *current_index_p = data_p -> stsd_index_data_p + i;
+
+													if ((current_index_p == index_data_p) || (all_indexes_flag && (current_index_p -> id_fm_index_p)))
+														{
+															if (current_index_p -> id_fm_index_p)
+																{
+																	json_t *index_result_p = SearchFmIndex (current_index_p, forward_s, palindrome_flag ? NULL : reverse_s, length, &max_locations, &count);
+
+																	success_flag = (index_result_p && (json_array_append_new (indexes_p, index_result_p) == 0));
+																	found_flag = true;
+																}
+														}
+												}
+
+											if (!found_flag)
+												{
+													AddGeneralErrorMessageToServiceJob (job_p, "No FM-index has been built for this index");
+												}
+											else if (success_flag && (json_object_set_new (result_p, "count", json_integer ((json_int_t) count)) == 0))
+												{
+													if (AddInlineResultToServiceJob (job_p, "exact_matches", result_p))
+														{
+															if (count <= (uint64) requested_locations)
+																{
+																	SetServiceJobStatus (job_p, OS_SUCCEEDED);
+																}
+															else
+																{
+																	AddGeneralErrorMessageToServiceJob (job_p, "Only the first Max locations matches have coordinates");
+																	SetServiceJobStatus (job_p, OS_PARTIALLY_SUCCEEDED);
+																}
+														}
+												}
+											else
+												{
+													AddGeneralErrorMessageToServiceJob (job_p, "Failed to search the FM-indexes");
+												}
+
+											json_decref (result_p);
+										}
+									else
+										{
+											if (result_p)
+												{
+													json_decref (result_p);
+												}
+											else if (indexes_p)
+												{
+													json_decref (indexes_p);
+												}
+
+											AddGeneralErrorMessageToServiceJob (job_p, "Failed to create the exact match results");
+										}
+								}
+							else
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "The query can only contain A, C, G and T");
+								}
+						}
+
+					if (reverse_s)
+						{
+							FreeMemory (reverse_s);
+						}
+
+					if (forward_s)
+						{
+							FreeMemory (forward_s);
+						}
+
+					LogServiceJob (job_p);
+				}		/* if (job_p) */
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get an index and query for exact matching");
+		}
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static json_t *SearchFmIndex (IndexData *index_data_p, const char *query_s, const char *reverse_s, const size_t length, uint32 *max_locations_p, uint64 *count_p)
+{
+	const FmIndex *fm_index_p = index_data_p -> id_fm_index_p;
+	uint64 forward_rows [2] = { 0, 0 };
+	uint64 reverse_rows [2] = { 0, 0 };
+	json_t *result_p = NULL;
+
+	if (FindFmIndexRows (fm_index_p, query_s, length, forward_rows, forward_rows + 1) && ((!reverse_s) || FindFmIndexRows (fm_index_p, reverse_s, length, reverse_rows, reverse_rows + 1)))
+		{
+			const uint64 index_count = (forward_rows [1] - forward_rows [0]) + (reverse_rows [1] - reverse_rows [0]);
+			const uint64 max_hits = (index_count < (uint64) (*max_locations_p)) ? index_count : (uint64) (*max_locations_p);
+			ExactMatchHit *hits_p = (max_hits > 0) ? (ExactMatchHit *) AllocMemoryArray (sizeof (ExactMatchHit), (size_t) max_hits) : NULL;
+
+			if (hits_p || (max_hits == 0))
+				{
+					uint64 num_hits = AddFmIndexHits (fm_index_p, forward_rows [0], forward_rows [1], '+', hits_p, max_hits);
+					faidx_t *fai_p;
+
+					num_hits += AddFmIndexHits (fm_index_p, reverse_rows [0], reverse_rows [1], '-', hits_p + num_hits, max_hits - num_hits);
+
+					if (num_hits > 1)
+						{
+							qsort (hits_p, (size_t) num_hits, sizeof (ExactMatchHit), CompareExactMatchHits);
+						}
+
+					/* The scaffold names belong to the FASTA index, which stays open, so they can be used after unlocking it */
+					if ((fai_p = LockIndexFaidx (index_data_p)) != NULL)
+						{
+							const size_t num_scaffolds = (size_t) faidx_nseq (fai_p);
+
+							UnlockIndexFaidx (index_data_p);
+
+							if (num_scaffolds == (size_t) (fm_index_p -> fi_header_p -> fmh_num_scaffolds))
+								{
+									json_t *locations_p = json_array ();
+
+									result_p = json_pack ("{s:s,s:I}", "index", (index_data_p -> id_blast_db_name_s) ? index_data_p -> id_blast_db_name_s : index_data_p -> id_fasta_filename_s, "count", (json_int_t) index_count);
+
+									if (result_p && locations_p && (json_object_set_new (result_p, "locations", locations_p) == 0))
+										{
+											uint64 i;
+
+											for (i = 0; (i < num_hits) && result_p; ++ i)
+												{
+													const ExactMatchHit *hit_p = hits_p + i;
+													json_t *location_p = json_pack ("{s:s,s:I,s:I,s:s}",
+														"scaffold", faidx_iseq (fai_p, (int) (hit_p -> emh_scaffold_index)),
+														"start", (json_int_t) (hit_p -> emh_start + 1),
+														"end", (json_int_t) (hit_p -> emh_start + length),
+														"strand", (hit_p -> emh_strand == '+') ? "+" : "-");
+
+													if (!(location_p && (json_array_append_new (locations_p, location_p) == 0)))
+														{
+															json_decref (result_p);
+															result_p = NULL;
+														}
+												}
+
+											if (result_p)
+												{
+													*count_p += index_count;
+													*max_locations_p -= (uint32) num_hits;
+												}
+										}
+									else
+										{
+											if (result_p)
+												{
+													json_decref (result_p);
+													result_p = NULL;
+												}
+											else if (locations_p)
+												{
+													json_decref (locations_p);
+												}
+										}
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "The FM-index for %s has " UINT64_FMT " scaffolds rather than " SIZET_FMT ", so it needs rebuilding", index_data_p -> id_fasta_filename_s, fm_index_p -> fi_header_p -> fmh_num_scaffolds, num_scaffolds);
+								}
+						}
+
+					if (hits_p)
+						{
+							FreeMemory (hits_p);
+						}
+				}
+		}
+
+	return result_p;
+}
+
+
+static uint64 AddFmIndexHits (const FmIndex *fm_index_p, const uint64 start_row, const uint64 end_row, const char strand, ExactMatchHit *hits_p, const uint64 max_hits)
+{
+	uint64 num_hits = 0;
+	uint64 row;
+
+	for (row = start_row; (row < end_row) && (num_hits < max_hits); ++ row)
+		{
+			ExactMatchHit *hit_p = hits_p + num_hits;
+
+			hit_p -> emh_start = GetFmIndexScaffoldPosition (fm_index_p, LocateFmIndexRow (fm_index_p, row), & (hit_p -> emh_scaffold_index));
+			hit_p -> emh_strand = strand;
+
+			++ num_hits;
+		}
+
+	return num_hits;
+}
+
+
+static int CompareExactMatchHits (const void *v0_p, const void *v1_p)
+{
+	const ExactMatchHit *hit0_p = (const ExactMatchHit *) v0_p;
+	const ExactMatchHit *hit1_p = (const ExactMatchHit *) v1_p;
+
+	if (hit0_p -> emh_scaffold_index != hit1_p -> emh_scaffold_index)
+		{
+			return (hit0_p -> emh_scaffold_index < hit1_p -> emh_scaffold_index) ? -1 : 1;
+		}
+
+	if (hit0_p -> emh_start != hit1_p -> emh_start)
+		{
+			return (hit0_p -> emh_start < hit1_p -> emh_start) ? -1 : 1;
+		}
+
+	return (hit0_p -> emh_strand < hit1_p -> emh_strand) ? -1 : ((hit0_p -> emh_strand > hit1_p -> emh_strand) ? 1 : 0);
+}
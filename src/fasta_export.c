@@ -0,0 +1,298 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * fasta_export.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fasta_export.h"
+#include "fasta_writer.h"
+#include "scaffold_selection.h"
+#include "gap_map.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "audit.h"
+
+#include "unsigned_int_parameter.h"
+
+
+#ifdef _DEBUG
+	#define FASTA_EXPORT_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define FASTA_EXPORT_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+static const char * const S_COMPRESSED_SUFFIX_S = ".fa.gz";
+
+static const char * const S_UNCOMPRESSED_SUFFIX_S = ".fa";
+
+/*
+ * Each scaffold is copied in blocks of this many bases.
+ */
+static const hts_pos_t S_BLOCK_SIZE = 1 << 22;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static void RunFastaFileJob (Service *service_p, ParameterSet *param_set_p, const bool compress_flag);
+
+static bool ExportScaffold (IndexData *index_data_p, const SelectedScaffold *scaffold_p, FastaWriter *writer_p);
+
+static bool ExportScaffoldContigs (IndexData *index_data_p, const SelectedScaffold *scaffold_p, const GapMap *gap_map_p, const uint32 min_gap_length, ByteBuffer *name_buffer_p, FastaWriter *writer_p);
+
+static bool ExportContig (IndexData *index_data_p, const SelectedScaffold *scaffold_p, const hts_pos_t start, const hts_pos_t end, ByteBuffer *name_buffer_p, FastaWriter *writer_p);
+
+static bool WriteScaffoldRegion (IndexData *index_data_p, const char *scaffold_name_s, hts_pos_t start, const hts_pos_t end, FastaWriter *writer_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+void RunExportJob (Service *service_p, ParameterSet *param_set_p)
+{
+	RunFastaFileJob (service_p, param_set_p, true);
+}
+
+
+void RunMultiFastaJob (Service *service_p, ParameterSet *param_set_p)
+{
+	RunFastaFileJob (service_p, param_set_p, false);
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static void RunFastaFileJob (Service *service_p, ParameterSet *param_set_p, const bool compress_flag)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	IndexData *index_data_p = GetSelectedIndexData (data_p, param_set_p);
+
+	if (index_data_p && (index_data_p -> id_fasta_filename_s))
+		{
+			ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, compress_flag ? "Export" : "Scaffolds", index_data_p -> id_fasta_filename_s, NULL, NULL, NULL);
+
+			if (job_p)
+				{
+					SelectedScaffold *scaffolds_p = NULL;
+					size_t num_scaffolds = 0;
+
+					LogParameterSet (param_set_p, job_p);
+
+					SetServiceJobStatus (job_p, OS_STARTED);
+					LogServiceJob (job_p);
+
+					/* Assume failure */
+					SetServiceJobStatus (job_p, OS_FAILED);
+
+					if (SelectScaffolds (index_data_p, param_set_p, data_p -> stsd_num_threads, &scaffolds_p, &num_scaffolds))
+						{
+							if (num_scaffolds > 0)
+								{
+									/* The gap map gives each contig's coordinates before it is written */
+									const uint32 split_gap_length = GetSplitGapLength (param_set_p);
+									const GapMap *gap_map_p = (split_gap_length > 0) ? GetIndexGapMap (index_data_p, data_p -> stsd_sidecar_directory_s) : NULL;
+
+									if ((split_gap_length > 0) && (!gap_map_p))
+										{
+											AddGeneralErrorMessageToServiceJob (job_p, "The gap map is not ready yet");
+										}
+									else
+										{
+										char *output_filename_s = MakeJobOutputFilename (data_p, job_p, compress_flag ? S_COMPRESSED_SUFFIX_S : S_UNCOMPRESSED_SUFFIX_S);
+
+										if (output_filename_s)
+											{
+												const uint32 *line_length_p = NULL;
+												uint32 line_length = 0;
+												FastaWriter *writer_p;
+
+												if (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD_LINE_BREAK.npt_name_s, &line_length_p) && line_length_p)
+													{
+														line_length = *line_length_p;
+													}
+
+												writer_p = AllocateFastaWriter (output_filename_s, line_length, compress_flag, data_p -> stsd_num_threads);
+
+												if (writer_p)
+													{
+														bool success_flag = true;
+														size_t i;
+
+														if (split_gap_length > 0)
+															{
+																ByteBuffer *name_buffer_p = AllocateByteBuffer (1024);
+
+																if (name_buffer_p)
+																	{
+																		for (i = 0; (i < num_scaffolds) && success_flag; ++ i)
+																			{
+																				success_flag = ExportScaffoldContigs (index_data_p, scaffolds_p + i, gap_map_p, split_gap_length, name_buffer_p, writer_p);
+																			}
+																	}
+																else
+																	{
+																		success_flag = false;
+																	}
+
+																if (name_buffer_p)
+																	{
+																		FreeByteBuffer (name_buffer_p);
+																	}
+															}
+														else
+															{
+																for (i = 0; (i < num_scaffolds) && success_flag; ++ i)
+																	{
+																		success_flag = ExportScaffold (index_data_p, scaffolds_p + i, writer_p);
+																	}
+															}
+
+														if (success_flag && CloseFastaWriter (writer_p))
+															{
+																if (AddFileResultToServiceJob (job_p, output_filename_s))
+																	{
+																		SetServiceJobStatus (job_p, OS_SUCCEEDED);
+																	}
+															}
+														else
+															{
+																AddGeneralErrorMessageToServiceJob (job_p, "Failed to write FASTA file");
+															}
+
+														FreeFastaWriter (writer_p);
+													}
+												else
+													{
+														AddGeneralErrorMessageToServiceJob (job_p, "Failed to create FASTA file");
+													}
+
+												FreeCopiedString (output_filename_s);
+											}
+										}
+								}
+							else
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "No scaffolds matched");
+								}
+
+							if (scaffolds_p)
+								{
+									FreeMemory (scaffolds_p);
+								}
+						}
+					else
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "Failed to select scaffolds");
+						}
+
+					LogServiceJob (job_p);
+				}		/* if (job_p) */
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get a FASTA file for %s", SS_INDEX.npt_name_s);
+		}
+}
+
+
+static bool ExportScaffold (IndexData *index_data_p, const SelectedScaffold *scaffold_p, FastaWriter *writer_p)
+{
+	return ((StartFastaWriterSequence (writer_p, scaffold_p -> ss_name_s)) &&
+		(WriteScaffoldRegion (index_data_p, scaffold_p -> ss_name_s, 0, scaffold_p -> ss_length, writer_p)) &&
+		(FinishFastaWriterSequence (writer_p)));
+}
+
+
+static bool ExportScaffoldContigs (IndexData *index_data_p, const SelectedScaffold *scaffold_p, const GapMap *gap_map_p, const uint32 min_gap_length, ByteBuffer *name_buffer_p, FastaWriter *writer_p)
+{
+	bool success_flag = true;
+	const GapInterval *gap_p = gap_map_p -> gm_gaps_p + gap_map_p -> gm_offsets_p [scaffold_p -> ss_index];
+	const GapInterval * const end_p = gap_map_p -> gm_gaps_p + gap_map_p -> gm_offsets_p [scaffold_p -> ss_index + 1];
+	hts_pos_t contig_start = 0;
+
+	for ( ; (gap_p < end_p) && success_flag; ++ gap_p)
+		{
+			const hts_pos_t gap_start = (hts_pos_t) (gap_p -> gi_start);
+			const hts_pos_t gap_end = (hts_pos_t) (gap_p -> gi_end);
+
+			/* Gaps at either end of the scaffold are trimmed whatever their length */
+			if ((gap_end - gap_start >= (hts_pos_t) min_gap_length) || (gap_start == 0) || (gap_end == scaffold_p -> ss_length))
+				{
+					if (gap_start > contig_start)
+						{
+							success_flag = ExportContig (index_data_p, scaffold_p, contig_start, gap_start, name_buffer_p, writer_p);
+						}
+
+					contig_start = gap_end;
+				}
+		}
+
+	if (success_flag && (contig_start < scaffold_p -> ss_length))
+		{
+			success_flag = ExportContig (index_data_p, scaffold_p, contig_start, scaffold_p -> ss_length, name_buffer_p, writer_p);
+		}
+
+	return success_flag;
+}
+
+
+static bool ExportContig (IndexData *index_data_p, const SelectedScaffold *scaffold_p, const hts_pos_t start, const hts_pos_t end, ByteBuffer *name_buffer_p, FastaWriter *writer_p)
+{
+	ResetByteBuffer (name_buffer_p);
+
+	return ((AppendContigName (name_buffer_p, scaffold_p -> ss_name_s, start, end)) &&
+		(StartFastaWriterSequence (writer_p, GetByteBufferData (name_buffer_p))) &&
+		(WriteScaffoldRegion (index_data_p, scaffold_p -> ss_name_s, start, end, writer_p)) &&
+		(FinishFastaWriterSequence (writer_p)));
+}
+
+
+static bool WriteScaffoldRegion (IndexData *index_data_p, const char *scaffold_name_s, hts_pos_t start, const hts_pos_t end, FastaWriter *writer_p)
+{
+	bool success_flag = true;
+
+	while ((start < end) && success_flag)
+		{
+			const hts_pos_t block_end = (end - start < S_BLOCK_SIZE) ? end : start + S_BLOCK_SIZE;
+			hts_pos_t length = 0;
+			char *sequence_s = FetchIndexSequence (index_data_p, scaffold_name_s, start, block_end, &length);
+
+			if (sequence_s)
+				{
+					success_flag = WriteFastaWriterSequence (writer_p, sequence_s, (size_t) length);
+					free (sequence_s);
+				}
+			else
+				{
+					success_flag = false;
+				}
+
+			start = block_end;
+		}
+
+	return success_flag;
+}
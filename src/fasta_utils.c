@@ -0,0 +1,137 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * fasta_utils.c
+ *
+ * @file
+ * @brief
+ */
+
+#include "fasta_utils.h"
+
+
+/*
+ * The complements of the upper case letters, A to Z, covering
+ * the IUPAC codes. U is complemented to A.
+ */
+static const char S_COMPLEMENTS [] = "TVGHEFCDIJMLKNOPQYSAABWXRZ";
+
+
+bool AppendWrappedSequence (ByteBuffer *buffer_p, const char *sequence_s, size_t length, const uint32 line_length, uint32 *column_p)
+{
+	bool success_flag = true;
+
+	if (line_length > 0)
+		{
+			while ((length > 0) && success_flag)
+				{
+					size_t block_size = line_length - *column_p;
+
+					if (block_size > length)
+						{
+							block_size = length;
+						}
+
+					if (AppendToByteBuffer (buffer_p, sequence_s, block_size))
+						{
+							sequence_s += block_size;
+							length -= block_size;
+							*column_p += (uint32) block_size;
+
+							if (*column_p == line_length)
+								{
+									success_flag = AppendToByteBuffer (buffer_p, "\n", 1);
+									*column_p = 0;
+								}
+						}
+					else
+						{
+							success_flag = false;
+						}
+				}
+		}
+	else if (length > 0)
+		{
+			success_flag = AppendToByteBuffer (buffer_p, sequence_s, length);
+			*column_p = 1;
+		}
+
+	return success_flag;
+}
+
+
+bool FinishWrappedSequence (ByteBuffer *buffer_p, uint32 *column_p)
+{
+	bool success_flag = true;
+
+	if (*column_p > 0)
+		{
+			success_flag = AppendToByteBuffer (buffer_p, "\n", 1);
+			*column_p = 0;
+		}
+
+	return success_flag;
+}
+
+
+char ComplementBase (const char base)
+{
+	if ((base >= 'A') && (base <= 'Z'))
+		{
+			return S_COMPLEMENTS [base - 'A'];
+		}
+	else if ((base >= 'a') && (base <= 'z'))
+		{
+			return S_COMPLEMENTS [base - 'a'] | 0x20;
+		}
+
+	return base;
+}
+
+
+void ReverseComplementSequence (char *dest_s, const char *sequence_s, const size_t length)
+{
+	size_t i;
+
+	for (i = 0; i < length; ++ i)
+		{
+			dest_s [i] = ComplementBase (sequence_s [length - 1 - i]);
+		}
+}
+
+
+const char *GetIUPACBases (const char base)
+{
+	switch (base)
+		{
+			case 'A': return "A";
+			case 'C': return "C";
+			case 'G': return "G";
+			case 'T': return "T";
+			case 'R': return "AG";
+			case 'Y': return "CT";
+			case 'S': return "CG";
+			case 'W': return "AT";
+			case 'K': return "GT";
+			case 'M': return "AC";
+			case 'B': return "CGT";
+			case 'D': return "AGT";
+			case 'H': return "ACT";
+			case 'V': return "ACG";
+			case 'N': return "ACGT";
+			default: return NULL;
+		}
+}
@@ -0,0 +1,320 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * fasta_writer.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "fasta_writer.h"
+#include "fasta_utils.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "streams.h"
+
+
+/*
+ * The amount of formatted data to gather before passing it to the
+ * compressor. This is a few BGZF blocks' worth.
+ */
+static const size_t S_BUFFER_SIZE = 1 << 18;
+
+/*
+ * The number of blocks that each compression thread can have queued.
+ */
+static const int S_BLOCKS_PER_THREAD = 256;
+
+static const char * const S_FAI_SUFFIX_S = ".fai";
+
+static const char * const S_GZI_SUFFIX_S = ".gzi";
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool FlushFastaWriter (FastaWriter *writer_p);
+
+static bool WriteFaiFile (const FastaWriter *writer_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+FastaWriter *AllocateFastaWriter (const char *filename_s, const uint32 line_length, const bool compress_flag, const uint32 num_threads)
+{
+	FastaWriter *writer_p = (FastaWriter *) AllocMemory (sizeof (FastaWriter));
+
+	if (writer_p)
+		{
+			writer_p -> faw_filename_s = EasyCopyToNewString (filename_s);
+
+			if (writer_p -> faw_filename_s)
+				{
+					writer_p -> faw_buffer_p = AllocateByteBuffer (S_BUFFER_SIZE + 1024);
+
+					if (writer_p -> faw_buffer_p)
+						{
+							writer_p -> faw_fai_buffer_p = AllocateByteBuffer (1024);
+
+							if (writer_p -> faw_fai_buffer_p)
+								{
+									writer_p -> faw_bgzf_p = bgzf_open (filename_s, compress_flag ? "w" : "wu");
+
+									if (writer_p -> faw_bgzf_p)
+										{
+											writer_p -> faw_compress_flag = compress_flag;
+											writer_p -> faw_offset = 0;
+											writer_p -> faw_line_length = line_length;
+											writer_p -> faw_column = 0;
+											writer_p -> faw_sequence_name_s = NULL;
+											writer_p -> faw_sequence_offset = 0;
+											writer_p -> faw_sequence_length = 0;
+
+											if (!compress_flag)
+												{
+													return writer_p;
+												}
+
+											if ((num_threads > 1) && (bgzf_mt (writer_p -> faw_bgzf_p, (int) num_threads, S_BLOCKS_PER_THREAD) != 0))
+												{
+													PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to use " UINT32_FMT " threads to compress \"%s\"", num_threads, filename_s);
+												}
+
+											/* Record the block offsets as they're written so the .gzi is ready when we finish */
+											if (bgzf_index_build_init (writer_p -> faw_bgzf_p) == 0)
+												{
+													return writer_p;
+												}
+											else
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to start the bgzf index for \"%s\"", filename_s);
+												}
+
+											bgzf_close (writer_p -> faw_bgzf_p);
+											remove (filename_s);
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to open \"%s\" for writing", filename_s);
+										}
+
+									FreeByteBuffer (writer_p -> faw_fai_buffer_p);
+								}
+
+							FreeByteBuffer (writer_p -> faw_buffer_p);
+						}
+
+					FreeCopiedString (writer_p -> faw_filename_s);
+				}
+
+			FreeMemory (writer_p);
+		}
+
+	return NULL;
+}
+
+
+void FreeFastaWriter (FastaWriter *writer_p)
+{
+	if (writer_p -> faw_bgzf_p)
+		{
+			bgzf_close (writer_p -> faw_bgzf_p);
+			remove (writer_p -> faw_filename_s);
+		}
+
+	if (writer_p -> faw_sequence_name_s)
+		{
+			FreeCopiedString (writer_p -> faw_sequence_name_s);
+		}
+
+	FreeByteBuffer (writer_p -> faw_fai_buffer_p);
+	FreeByteBuffer (writer_p -> faw_buffer_p);
+	FreeCopiedString (writer_p -> faw_filename_s);
+	FreeMemory (writer_p);
+}
+
+
+bool StartFastaWriterSequence (FastaWriter *writer_p, const char *name_s)
+{
+	if (AppendStringsToByteBuffer (writer_p -> faw_buffer_p, ">", name_s, "\n", NULL))
+		{
+			if (writer_p -> faw_sequence_name_s)
+				{
+					FreeCopiedString (writer_p -> faw_sequence_name_s);
+				}
+
+			writer_p -> faw_sequence_name_s = EasyCopyToNewString (name_s);
+
+			if (writer_p -> faw_sequence_name_s)
+				{
+					writer_p -> faw_sequence_offset = writer_p -> faw_offset + GetByteBufferSize (writer_p -> faw_buffer_p);
+					writer_p -> faw_sequence_length = 0;
+					writer_p -> faw_column = 0;
+
+					return true;
+				}
+		}
+
+	return false;
+}
+
+
+bool WriteFastaWriterSequence (FastaWriter *writer_p, const char *sequence_s, const size_t length)
+{
+	size_t written = 0;
+
+	while (written < length)
+		{
+			const size_t space = (GetByteBufferSize (writer_p -> faw_buffer_p) < S_BUFFER_SIZE) ? S_BUFFER_SIZE - GetByteBufferSize (writer_p -> faw_buffer_p) : 0;
+			size_t block_length = length - written;
+
+			if (block_length > space)
+				{
+					block_length = space;
+				}
+
+			if (block_length > 0)
+				{
+					if (!AppendWrappedSequence (writer_p -> faw_buffer_p, sequence_s + written, block_length, writer_p -> faw_line_length, & (writer_p -> faw_column)))
+						{
+							return false;
+						}
+
+					written += block_length;
+				}
+
+			if (GetByteBufferSize (writer_p -> faw_buffer_p) >= S_BUFFER_SIZE)
+				{
+					if (!FlushFastaWriter (writer_p))
+						{
+							return false;
+						}
+				}
+		}
+
+	writer_p -> faw_sequence_length += length;
+
+	return true;
+}
+
+
+bool FinishFastaWriterSequence (FastaWriter *writer_p)
+{
+	if (FinishWrappedSequence (writer_p -> faw_buffer_p, & (writer_p -> faw_column)))
+		{
+			const uint64 line_bases = ((writer_p -> faw_line_length > 0) && (writer_p -> faw_line_length < writer_p -> faw_sequence_length)) ? writer_p -> faw_line_length : writer_p -> faw_sequence_length;
+
+			/* name, length, offset, bases per line and bytes per line */
+			return AppendVarArgsToByteBuffer (writer_p -> faw_fai_buffer_p, "%s\t" UINT64_FMT "\t" UINT64_FMT "\t" UINT64_FMT "\t" UINT64_FMT "\n",
+				writer_p -> faw_sequence_name_s, writer_p -> faw_sequence_length, writer_p -> faw_sequence_offset, line_bases, line_bases + 1);
+		}
+
+	return false;
+}
+
+
+bool CloseFastaWriter (FastaWriter *writer_p)
+{
+	bool success_flag = false;
+
+	if (FlushFastaWriter (writer_p))
+		{
+			if ((! (writer_p -> faw_compress_flag)) || (bgzf_index_dump (writer_p -> faw_bgzf_p, writer_p -> faw_filename_s, S_GZI_SUFFIX_S) == 0))
+				{
+					const int res = bgzf_close (writer_p -> faw_bgzf_p);
+
+					writer_p -> faw_bgzf_p = NULL;
+
+					if (res == 0)
+						{
+							success_flag = WriteFaiFile (writer_p);
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to close \"%s\"", writer_p -> faw_filename_s);
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to write the bgzf index for \"%s\"", writer_p -> faw_filename_s);
+				}
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static bool FlushFastaWriter (FastaWriter *writer_p)
+{
+	const size_t size = GetByteBufferSize (writer_p -> faw_buffer_p);
+
+	if (size > 0)
+		{
+			if (bgzf_write (writer_p -> faw_bgzf_p, GetByteBufferData (writer_p -> faw_buffer_p), size) != (ssize_t) size)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to write to \"%s\"", writer_p -> faw_filename_s);
+					return false;
+				}
+
+			writer_p -> faw_offset += size;
+			ResetByteBuffer (writer_p -> faw_buffer_p);
+		}
+
+	return true;
+}
+
+
+static bool WriteFaiFile (const FastaWriter *writer_p)
+{
+	bool success_flag = false;
+	char *fai_filename_s = ConcatenateStrings (writer_p -> faw_filename_s, S_FAI_SUFFIX_S);
+
+	if (fai_filename_s)
+		{
+			FILE *fai_f = fopen (fai_filename_s, "w");
+
+			if (fai_f)
+				{
+					const size_t size = GetByteBufferSize (writer_p -> faw_fai_buffer_p);
+
+					success_flag = (fwrite (GetByteBufferData (writer_p -> faw_fai_buffer_p), 1, size, fai_f) == size);
+
+					if (fclose (fai_f) != 0)
+						{
+							success_flag = false;
+						}
+				}
+
+			if (!success_flag)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to write \"%s\"", fai_filename_s);
+				}
+
+			FreeCopiedString (fai_filename_s);
+		}
+
+	return success_flag;
+}
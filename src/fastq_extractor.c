@@ -0,0 +1,588 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * fastq_extractor.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fastq_extractor.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "byte_buffer.h"
+#include "audit.h"
+
+#include "string_parameter.h"
+#include "boolean_parameter.h"
+
+
+#ifdef _DEBUG
+	#define FASTQ_EXTRACTOR_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define FASTQ_EXTRACTOR_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * The FASTQ outputs that each read is written to.
+ */
+typedef enum FastqOutputType
+{
+	FO_FIRST,
+	FO_SECOND,
+	FO_SINGLE,
+	FO_NUM_OUTPUTS
+} FastqOutputType;
+
+
+typedef struct FastqWriter
+{
+	ByteBuffer *fw_buffers_p [FO_NUM_OUTPUTS];
+	char *fw_line_s;
+	size_t fw_line_size;
+} FastqWriter;
+
+
+static NamedParameterType S_RECOVER_MATES = { "Recover mates", PT_BOOLEAN };
+
+
+static const char * const S_OUTPUT_SUFFIXES_SS [FO_NUM_OUTPUTS] = { "_1.fastq", "_2.fastq", "_single.fastq" };
+
+static const char * const S_READ_NAME_SUFFIXES_SS [FO_NUM_OUTPUTS] = { "/1\n", "/2\n", "\n" };
+
+/*
+ * The complements of the 4-bit nucleotide codes used in BAM records.
+ */
+static const char S_NT16_COMPLEMENTS [] = "=TGKCYSBAWRDMHVN";
+
+static const uint16 S_NON_PRIMARY_FLAGS = BAM_FSECONDARY | BAM_FSUPPLEMENTARY;
+
+static const size_t S_INITIAL_NUM_READS = 4096;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bam1_t **CollectRegionReads (AlignmentData *sample_p, const int tid, const hts_pos_t beg, const hts_pos_t end, size_t *num_reads_p);
+
+static void FreeReads (bam1_t **reads_pp, const size_t num_reads);
+
+static int CompareReadsByName (const void *v0_p, const void *v1_p);
+
+static bool InitFastqWriter (FastqWriter *writer_p);
+
+static void ClearFastqWriter (FastqWriter *writer_p);
+
+static bool WriteFastqReads (FastqWriter *writer_p, AlignmentData *sample_p, bam1_t **reads_pp, const size_t num_reads, const bool recover_mates_flag, const char *sidecar_directory_s);
+
+static bool WriteFastqPair (FastqWriter *writer_p, const bam1_t *read_p, const bam1_t *mate_p);
+
+static bool WriteFastqRecord (FastqWriter *writer_p, const FastqOutputType output, const bam1_t *read_p);
+
+static bool AddFastqResults (ServiceJob *job_p, const char *region_s, const FastqWriter *writer_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool AddFastqParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	const bool def_recover_mates_flag = true;
+
+	return (EasyCreateAndAddBooleanParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_RECOVER_MATES.npt_name_s, "Recover mates",
+		"When extracting FASTQ, fetch the mates of reads whose mates are aligned outside of the region", &def_recover_mates_flag, PL_ADVANCED) != NULL);
+}
+
+
+bool GetFastqParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_RECOVER_MATES.npt_name_s) == 0)
+		{
+			*pt_p = S_RECOVER_MATES.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+void RunFastqJob (Service *service_p, ParameterSet *param_set_p)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	const char *region_s = NULL;
+
+	if (GetCurrentStringParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD.npt_name_s, &region_s) && region_s)
+		{
+			AlignmentData **samples_pp = NULL;
+			const size_t num_samples = GetRequestedSamples (data_p, param_set_p, &samples_pp);
+
+			if (num_samples == 1)
+				{
+					AlignmentData *sample_p = *samples_pp;
+					ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, region_s, sample_p -> ad_name_s, NULL, NULL, NULL);
+
+					if (job_p)
+						{
+							LogParameterSet (param_set_p, job_p);
+
+							SetServiceJobStatus (job_p, OS_STARTED);
+							LogServiceJob (job_p);
+
+							/* Assume failure */
+							SetServiceJobStatus (job_p, OS_FAILED);
+
+							if (LockAlignmentData (sample_p))
+								{
+									int tid;
+									hts_pos_t beg;
+									hts_pos_t end;
+
+									if (sam_parse_region (sample_p -> ad_header_p, region_s, &tid, &beg, &end, 0))
+										{
+											size_t num_reads = 0;
+											bam1_t **reads_pp = CollectRegionReads (sample_p, tid, beg, end, &num_reads);
+
+											if (reads_pp)
+												{
+													FastqWriter writer;
+
+													if (InitFastqWriter (&writer))
+														{
+															const bool *recover_mates_flag_p = NULL;
+															bool recover_mates_flag = true;
+
+															if (GetCurrentBooleanParameterValueFromParameterSet (param_set_p, S_RECOVER_MATES.npt_name_s, &recover_mates_flag_p) && recover_mates_flag_p)
+																{
+																	recover_mates_flag = *recover_mates_flag_p;
+																}
+
+															/* Put each pair's records next to each other */
+															qsort (reads_pp, num_reads, sizeof (bam1_t *), CompareReadsByName);
+
+															if (WriteFastqReads (&writer, sample_p, reads_pp, num_reads, recover_mates_flag, data_p -> stsd_sidecar_directory_s))
+																{
+																	if (AddFastqResults (job_p, region_s, &writer))
+																		{
+																			SetServiceJobStatus (job_p, OS_SUCCEEDED);
+																		}
+																}
+															else
+																{
+																	AddGeneralErrorMessageToServiceJob (job_p, "Failed to write FASTQ");
+																}
+
+															ClearFastqWriter (&writer);
+														}
+
+													FreeReads (reads_pp, num_reads);
+												}
+											else
+												{
+													AddGeneralErrorMessageToServiceJob (job_p, "Failed to get reads");
+												}
+										}
+									else
+										{
+											AddGeneralErrorMessageToServiceJob (job_p, "Unknown region");
+										}
+
+									UnlockAlignmentData (sample_p);
+								}
+							else
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "Failed to open alignment file");
+								}
+
+							LogServiceJob (job_p);
+						}		/* if (job_p) */
+				}
+			else
+				{
+					ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, region_s, "FASTQ", NULL, NULL, NULL);
+
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "FASTQ extraction needs exactly 1 sample but got " SIZET_FMT, num_samples);
+
+					if (job_p)
+						{
+							LogParameterSet (param_set_p, job_p);
+
+							SetServiceJobStatus (job_p, OS_FAILED);
+							AddGeneralErrorMessageToServiceJob (job_p, "FASTQ extraction needs a single sample");
+
+							LogServiceJob (job_p);
+						}		/* if (job_p) */
+				}
+
+			if (samples_pp)
+				{
+					FreeMemory (samples_pp);
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get %s parameter", SS_SCAFFOLD.npt_name_s);
+		}
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+/*
+ * Get copies of the primary records overlapping a region. Unmapped mates
+ * are placed next to their mapped reads so they are included too.
+ */
+static bam1_t **CollectRegionReads (AlignmentData *sample_p, const int tid, const hts_pos_t beg, const hts_pos_t end, size_t *num_reads_p)
+{
+	size_t max_num_reads = S_INITIAL_NUM_READS;
+	bam1_t **reads_pp = (bam1_t **) AllocMemoryArray (sizeof (bam1_t *), max_num_reads);
+
+	if (reads_pp)
+		{
+			hts_itr_t *itr_p = sam_itr_queryi (sample_p -> ad_index_p, tid, beg, end);
+
+			if (itr_p)
+				{
+					bam1_t *read_p = bam_init1 ();
+
+					if (read_p)
+						{
+							size_t num_reads = 0;
+							bool success_flag = true;
+							int res;
+
+							while (success_flag && ((res = sam_itr_next (sample_p -> ad_file_p, itr_p, read_p)) >= 0))
+								{
+									if ((read_p -> core.flag & S_NON_PRIMARY_FLAGS) == 0)
+										{
+											if (num_reads == max_num_reads)
+												{
+													bam1_t **new_reads_pp = (bam1_t **) ReallocMemory (reads_pp, 2 * max_num_reads * sizeof (bam1_t *), max_num_reads * sizeof (bam1_t *));
+
+													if (new_reads_pp)
+														{
+															reads_pp = new_reads_pp;
+															max_num_reads <<= 1;
+														}
+													else
+														{
+															success_flag = false;
+														}
+												}
+
+											if (success_flag)
+												{
+													if ((reads_pp [num_reads] = bam_dup1 (read_p)) != NULL)
+														{
+															++ num_reads;
+														}
+													else
+														{
+															success_flag = false;
+														}
+												}
+										}
+								}
+
+							if (res < -1)
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to read from \"%s\"", sample_p -> ad_filename_s);
+									success_flag = false;
+								}
+
+							bam_destroy1 (read_p);
+							hts_itr_destroy (itr_p);
+
+							if (success_flag)
+								{
+									*num_reads_p = num_reads;
+									return reads_pp;
+								}
+
+							FreeReads (reads_pp, num_reads);
+							return NULL;
+						}
+
+					hts_itr_destroy (itr_p);
+				}
+
+			FreeMemory (reads_pp);
+		}
+
+	return NULL;
+}
+
+
+static void FreeReads (bam1_t **reads_pp, const size_t num_reads)
+{
+	size_t i;
+
+	for (i = 0; i < num_reads; ++ i)
+		{
+			bam_destroy1 (reads_pp [i]);
+		}
+
+	FreeMemory (reads_pp);
+}
+
+
+static int CompareReadsByName (const void *v0_p, const void *v1_p)
+{
+	const bam1_t *read0_p = * ((const bam1_t **) v0_p);
+	const bam1_t *read1_p = * ((const bam1_t **) v1_p);
+	int res = strcmp (bam_get_qname (read0_p), bam_get_qname (read1_p));
+
+	if (res == 0)
+		{
+			/* Put the first read of each pair before the second */
+			res = (int) (read0_p -> core.flag & (BAM_FREAD1 | BAM_FREAD2)) - (int) (read1_p -> core.flag & (BAM_FREAD1 | BAM_FREAD2));
+		}
+
+	return res;
+}
+
+
+static bool InitFastqWriter (FastqWriter *writer_p)
+{
+	int i;
+
+	writer_p -> fw_line_s = NULL;
+	writer_p -> fw_line_size = 0;
+
+	for (i = 0; i < FO_NUM_OUTPUTS; ++ i)
+		{
+			writer_p -> fw_buffers_p [i] = AllocateByteBuffer (1 << 16);
+
+			if (! (writer_p -> fw_buffers_p [i]))
+				{
+					while (i > 0)
+						{
+							-- i;
+							FreeByteBuffer (writer_p -> fw_buffers_p [i]);
+						}
+
+					return false;
+				}
+		}
+
+	return true;
+}
+
+
+static void ClearFastqWriter (FastqWriter *writer_p)
+{
+	int i;
+
+	for (i = 0; i < FO_NUM_OUTPUTS; ++ i)
+		{
+			FreeByteBuffer (writer_p -> fw_buffers_p [i]);
+		}
+
+	if (writer_p -> fw_line_s)
+		{
+			FreeMemory (writer_p -> fw_line_s);
+		}
+}
+
+
+static bool WriteFastqReads (FastqWriter *writer_p, AlignmentData *sample_p, bam1_t **reads_pp, const size_t num_reads, const bool recover_mates_flag, const char *sidecar_directory_s)
+{
+	const ReadNameIndex *names_index_p = NULL;
+	bool names_index_failed_flag = ! (recover_mates_flag);
+	bam1_t *mate_p = bam_init1 ();
+	bool success_flag = (mate_p != NULL);
+	size_t num_recovered = 0;
+	size_t i = 0;
+
+	while ((i < num_reads) && success_flag)
+		{
+			const bam1_t *read_p = reads_pp [i];
+
+			if ((i + 1 < num_reads) && (strcmp (bam_get_qname (read_p), bam_get_qname (reads_pp [i + 1])) == 0))
+				{
+					/* Both mates are in the region */
+					success_flag = WriteFastqPair (writer_p, read_p, reads_pp [i + 1]);
+					i += 2;
+				}
+			else
+				{
+					bool found_mate_flag = false;
+
+					if ((read_p -> core.flag & BAM_FPAIRED) && !names_index_failed_flag)
+						{
+							if (!names_index_p)
+								{
+									names_index_p = GetAlignmentReadNameIndex (sample_p, sidecar_directory_s);
+
+									if (!names_index_p)
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "No read name index for \"%s\" yet so mates will not be recovered", sample_p -> ad_filename_s);
+											names_index_failed_flag = true;
+										}
+								}
+
+							if (names_index_p)
+								{
+									found_mate_flag = FindMateByName (names_index_p, sample_p -> ad_file_p, sample_p -> ad_header_p, read_p, mate_p);
+								}
+						}
+
+					if (found_mate_flag)
+						{
+							success_flag = WriteFastqPair (writer_p, read_p, mate_p);
+							++ num_recovered;
+						}
+					else
+						{
+							success_flag = WriteFastqRecord (writer_p, FO_SINGLE, read_p);
+						}
+
+					++ i;
+				}
+		}
+
+	#if FASTQ_EXTRACTOR_DEBUG >= STM_LEVEL_FINE
+	PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "WriteFastqReads - " SIZET_FMT " reads, " SIZET_FMT " mates recovered", num_reads, num_recovered);
+	#endif
+
+	if (mate_p)
+		{
+			bam_destroy1 (mate_p);
+		}
+
+	return success_flag;
+}
+
+
+static bool WriteFastqPair (FastqWriter *writer_p, const bam1_t *read_p, const bam1_t *mate_p)
+{
+	if (mate_p -> core.flag & BAM_FREAD1)
+		{
+			const bam1_t *temp_p = read_p;
+
+			read_p = mate_p;
+			mate_p = temp_p;
+		}
+
+	return (WriteFastqRecord (writer_p, FO_FIRST, read_p) && WriteFastqRecord (writer_p, FO_SECOND, mate_p));
+}
+
+
+/*
+ * Write a read as it came off the sequencer, so reads aligned to the
+ * reverse strand are reverse complemented.
+ */
+static bool WriteFastqRecord (FastqWriter *writer_p, const FastqOutputType output, const bam1_t *read_p)
+{
+	ByteBuffer *buffer_p = writer_p -> fw_buffers_p [output];
+	const size_t length = (size_t) (read_p -> core.l_qseq);
+
+	if (length + 1 > writer_p -> fw_line_size)
+		{
+			char *line_s = (char *) AllocMemory (length + 1);
+
+			if (!line_s)
+				{
+					return false;
+				}
+
+			if (writer_p -> fw_line_s)
+				{
+					FreeMemory (writer_p -> fw_line_s);
+				}
+
+			writer_p -> fw_line_s = line_s;
+			writer_p -> fw_line_size = length + 1;
+		}
+
+	if (AppendStringsToByteBuffer (buffer_p, "@", bam_get_qname (read_p), S_READ_NAME_SUFFIXES_SS [output], NULL))
+		{
+			const uint8 *seq_p = bam_get_seq (read_p);
+			const uint8 *qual_p = bam_get_qual (read_p);
+			const bool reverse_flag = bam_is_rev (read_p);
+			char *line_s = writer_p -> fw_line_s;
+			size_t i;
+
+			for (i = 0; i < length; ++ i)
+				{
+					line_s [i] = reverse_flag ? S_NT16_COMPLEMENTS [bam_seqi (seq_p, length - 1 - i)] : seq_nt16_str [bam_seqi (seq_p, i)];
+				}
+
+			if (AppendToByteBuffer (buffer_p, line_s, length) && AppendStringToByteBuffer (buffer_p, "\n+\n"))
+				{
+					/* A missing quality string is stored as 0xFF */
+					const bool missing_qualities_flag = (length > 0) && (qual_p [0] == 0xFF);
+
+					for (i = 0; i < length; ++ i)
+						{
+							line_s [i] = missing_qualities_flag ? '!' : (char) (33 + qual_p [reverse_flag ? length - 1 - i : i]);
+						}
+
+					line_s [length] = '\n';
+
+					return AppendToByteBuffer (buffer_p, line_s, length + 1);
+				}
+		}
+
+	return false;
+}
+
+
+static bool AddFastqResults (ServiceJob *job_p, const char *region_s, const FastqWriter *writer_p)
+{
+	bool success_flag = true;
+	int i;
+
+	for (i = 0; (i < FO_NUM_OUTPUTS) && success_flag; ++ i)
+		{
+			const ByteBuffer *buffer_p = writer_p -> fw_buffers_p [i];
+
+			/* Always return both halves of the pairs even if they're empty */
+			if ((i != FO_SINGLE) || (GetByteBufferSize (buffer_p) > 0))
+				{
+					char *title_s = ConcatenateStrings (region_s, S_OUTPUT_SUFFIXES_SS [i]);
+
+					success_flag = false;
+
+					if (title_s)
+						{
+							json_t *fastq_p = json_string (GetByteBufferData (buffer_p));
+
+							if (fastq_p)
+								{
+									success_flag = AddInlineResultToServiceJob (job_p, title_s, fastq_p);
+									json_decref (fastq_p);
+								}
+
+							FreeCopiedString (title_s);
+						}
+				}
+		}
+
+	return success_flag;
+}
@@ -0,0 +1,316 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * fm_index.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <string.h>
+
+#include "fm_index.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "streams.h"
+
+
+#ifdef _DEBUG
+	#define FM_INDEX_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define FM_INDEX_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+static const char S_FM_INDEX_MAGIC [8] = { 'S', 'T', 'F', 'M', 'I', 'D', '0', '1' };
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool MapFmIndex (FmIndex *fm_index_p, const char *fm_index_filename_s);
+
+static uint64 CountFmIndexOccurrences (const FmIndex *fm_index_p, const uint32 code, const uint64 row);
+
+static uint64 GetPreviousFmIndexRow (const FmIndex *fm_index_p, const uint64 row);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+size_t GetFmIndexPreambleSize (const uint64 num_scaffolds)
+{
+	const size_t size = sizeof (FmIndexHeader) + ((size_t) (num_scaffolds + 1) * sizeof (uint64));
+
+	/* Keep the blocks on cache line boundaries */
+	return (size + sizeof (FmIndexBlock) - 1) & ~(sizeof (FmIndexBlock) - 1);
+}
+
+
+void SetFmIndexMagic (FmIndexHeader *header_p)
+{
+	memcpy (header_p -> fmh_magic, S_FM_INDEX_MAGIC, sizeof (S_FM_INDEX_MAGIC));
+}
+
+
+FmIndex *LoadFmIndex (const char *fasta_filename_s, const char *sidecar_directory_s)
+{
+	FmIndex *fm_index_p = NULL;
+	char *fm_index_filename_s = MakeSidecarFilename (sidecar_directory_s, fasta_filename_s, FM_INDEX_SUFFIX_S);
+
+	if (fm_index_filename_s)
+		{
+			/* These are only ever built offline so a missing one isn't an error */
+			if (IsSidecarFileUpToDate (fm_index_filename_s, fasta_filename_s))
+				{
+					fm_index_p = (FmIndex *) AllocMemory (sizeof (FmIndex));
+
+					if (fm_index_p)
+						{
+							if (!MapFmIndex (fm_index_p, fm_index_filename_s))
+								{
+									FreeMemory (fm_index_p);
+									fm_index_p = NULL;
+								}
+						}
+				}
+			#if FM_INDEX_DEBUG >= STM_LEVEL_FINE
+			else
+				{
+					PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "LoadFmIndex - no up to date %s", fm_index_filename_s);
+				}
+			#endif
+
+			FreeCopiedString (fm_index_filename_s);
+		}
+
+	return fm_index_p;
+}
+
+
+void FreeFmIndex (FmIndex *fm_index_p)
+{
+	CloseMappedFile (& (fm_index_p -> fi_file));
+	FreeMemory (fm_index_p);
+}
+
+
+bool FindFmIndexRows (const FmIndex *fm_index_p, const char *sequence_s, const size_t length, uint64 *start_row_p, uint64 *end_row_p)
+{
+	uint64 start_row = 0;
+	uint64 end_row = fm_index_p -> fi_header_p -> fmh_text_length;
+	size_t i = length;
+
+	/* Extend the match a base at a time from the end of the sequence */
+	while ((i > 0) && (start_row < end_row))
+		{
+			const uint32 code = GetFmIndexCode (sequence_s [-- i]);
+
+			if (code == FM_N)
+				{
+					return false;
+				}
+
+			start_row = fm_index_p -> fi_header_p -> fmh_first_rows [code - FM_A] + CountFmIndexOccurrences (fm_index_p, code, start_row);
+			end_row = fm_index_p -> fi_header_p -> fmh_first_rows [code - FM_A] + CountFmIndexOccurrences (fm_index_p, code, end_row);
+		}
+
+	/* Check the rest of the sequence even when there are no matches */
+	while (i > 0)
+		{
+			if (GetFmIndexCode (sequence_s [-- i]) == FM_N)
+				{
+					return false;
+				}
+		}
+
+	*start_row_p = start_row;
+	*end_row_p = (end_row > start_row) ? end_row : start_row;
+
+	return true;
+}
+
+
+uint64 LocateFmIndexRow (const FmIndex *fm_index_p, uint64 row)
+{
+	uint64 steps = 0;
+
+	/* The terminator's row is always sampled as it is at position 0, so this stops within a sample rate's steps */
+	for (;;)
+		{
+			const FmIndexBlock *block_p = fm_index_p -> fi_blocks_p + (row / FM_INDEX_BLOCK_SIZE);
+			const uint64 before_mask = (((uint64) 1) << (row % FM_INDEX_BLOCK_SIZE)) - 1;
+
+			if ((block_p -> fmb_sampled_bits >> (row % FM_INDEX_BLOCK_SIZE)) & 1)
+				{
+					const uint64 sample = fm_index_p -> fi_sample_ranks_p [row / FM_INDEX_BLOCK_SIZE] + (uint64) __builtin_popcountll (block_p -> fmb_sampled_bits & before_mask);
+
+					return fm_index_p -> fi_samples_p [sample] + steps;
+				}
+
+			row = GetPreviousFmIndexRow (fm_index_p, row);
+			++ steps;
+		}
+}
+
+
+uint64 GetFmIndexScaffoldPosition (const FmIndex *fm_index_p, const uint64 text_position, size_t *scaffold_index_p)
+{
+	const uint64 *starts_p = fm_index_p -> fi_scaffold_starts_p;
+	size_t lo = 0;
+	size_t hi = (size_t) (fm_index_p -> fi_header_p -> fmh_num_scaffolds);
+
+	/* Find the last scaffold that starts at or before the position */
+	while (hi - lo > 1)
+		{
+			const size_t mid = lo + ((hi - lo) >> 1);
+
+			if (starts_p [mid] <= text_position)
+				{
+					lo = mid;
+				}
+			else
+				{
+					hi = mid;
+				}
+		}
+
+	*scaffold_index_p = lo;
+
+	return text_position - starts_p [lo];
+}
+
+
+
+uint32 GetFmIndexCode (const char base)
+{
+	switch (base)
+		{
+			case 'A':
+			case 'a':
+				return FM_A;
+
+			case 'C':
+			case 'c':
+				return FM_C;
+
+			case 'G':
+			case 'g':
+				return FM_G;
+
+			case 'T':
+			case 't':
+				return FM_T;
+
+			default:
+				return FM_N;
+		}
+}
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static bool MapFmIndex (FmIndex *fm_index_p, const char *fm_index_filename_s)
+{
+	if (OpenMappedFile (& (fm_index_p -> fi_file), fm_index_filename_s))
+		{
+			const FmIndexHeader *header_p = (const FmIndexHeader *) (fm_index_p -> fi_file.mf_data_p);
+
+			if ((fm_index_p -> fi_file.mf_size >= sizeof (FmIndexHeader)) &&
+				(memcmp (header_p -> fmh_magic, S_FM_INDEX_MAGIC, sizeof (S_FM_INDEX_MAGIC)) == 0) &&
+				(header_p -> fmh_num_scaffolds > 0) && (header_p -> fmh_sample_rate > 0))
+				{
+					const size_t preamble_size = GetFmIndexPreambleSize (header_p -> fmh_num_scaffolds);
+					const uint64 num_blocks = (header_p -> fmh_text_length / FM_INDEX_BLOCK_SIZE) + 1;
+
+					if (fm_index_p -> fi_file.mf_size == preamble_size + (num_blocks * sizeof (FmIndexBlock)) + (num_blocks * sizeof (uint64)) + (header_p -> fmh_num_samples * sizeof (uint64)))
+						{
+							const char *data_p = (const char *) (fm_index_p -> fi_file.mf_data_p);
+
+							fm_index_p -> fi_header_p = header_p;
+							fm_index_p -> fi_scaffold_starts_p = (const uint64 *) (header_p + 1);
+							fm_index_p -> fi_blocks_p = (const FmIndexBlock *) (data_p + preamble_size);
+							fm_index_p -> fi_sample_ranks_p = (const uint64 *) (fm_index_p -> fi_blocks_p + num_blocks);
+							fm_index_p -> fi_samples_p = fm_index_p -> fi_sample_ranks_p + num_blocks;
+
+							#if FM_INDEX_DEBUG >= STM_LEVEL_FINE
+							PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "MapFmIndex - mapped %s with " UINT64_FMT " bases", fm_index_filename_s, header_p -> fmh_text_length);
+							#endif
+
+							return true;
+						}
+				}
+
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "\"%s\" is not a valid FM-index", fm_index_filename_s);
+
+			CloseMappedFile (& (fm_index_p -> fi_file));
+		}
+
+	return false;
+}
+
+
+static uint64 CountFmIndexOccurrences (const FmIndex *fm_index_p, const uint32 code, const uint64 row)
+{
+	const FmIndexBlock *block_p = fm_index_p -> fi_blocks_p + (row / FM_INDEX_BLOCK_SIZE);
+	const uint64 before_mask = (((uint64) 1) << (row % FM_INDEX_BLOCK_SIZE)) - 1;
+	const uint32 bits = code - FM_A;
+	uint64 matches = ~ (block_p -> fmb_other_bits);
+
+	matches &= (bits & 1) ? block_p -> fmb_low_bits : ~ (block_p -> fmb_low_bits);
+	matches &= (bits & 2) ? block_p -> fmb_high_bits : ~ (block_p -> fmb_high_bits);
+
+	return block_p -> fmb_counts [bits] + (uint64) __builtin_popcountll (matches & before_mask);
+}
+
+
+/*
+ * The LF-mapping: the row for the suffix that starts one position
+ * earlier in the text than the given row's suffix.
+ */
+static uint64 GetPreviousFmIndexRow (const FmIndex *fm_index_p, const uint64 row)
+{
+	const FmIndexBlock *block_p = fm_index_p -> fi_blocks_p + (row / FM_INDEX_BLOCK_SIZE);
+	const uint32 offset = (uint32) (row % FM_INDEX_BLOCK_SIZE);
+
+	if ((block_p -> fmb_other_bits >> offset) & 1)
+		{
+			/* This is an N since the terminator's row is sampled, so count the Ns before it */
+			uint64 num_ns = row;
+			uint32 code;
+
+			for (code = FM_A; code <= FM_T; ++ code)
+				{
+					num_ns -= CountFmIndexOccurrences (fm_index_p, code, row);
+				}
+
+			if (fm_index_p -> fi_header_p -> fmh_terminator_row < row)
+				{
+					-- num_ns;
+				}
+
+			return fm_index_p -> fi_header_p -> fmh_first_rows [FM_N - FM_A] + num_ns;
+		}
+	else
+		{
+			const uint32 code = FM_A + (uint32) (((block_p -> fmb_low_bits >> offset) & 1) | (((block_p -> fmb_high_bits >> offset) & 1) << 1));
+
+			return fm_index_p -> fi_header_p -> fmh_first_rows [code - FM_A] + CountFmIndexOccurrences (fm_index_p, code, row);
+		}
+}
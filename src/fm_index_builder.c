@@ -0,0 +1,648 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * fm_index_builder.c
+ *
+ * @file
+ * @brief A command line tool that builds the FM-index for a FASTA file.
+ *
+ * The suffix array of the whole assembly is built in memory with the
+ * SA-IS algorithm, so this needs about 9 bytes per base. It is meant to
+ * be run offline, once per assembly, and the service maps the result
+ * when it starts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "htslib/faidx.h"
+
+#include "fm_index.h"
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+/*
+ * Scaffolds are read from the FASTA file in blocks of this many bases.
+ */
+static const hts_pos_t S_BLOCK_SIZE = 1 << 22;
+
+static const uint64 S_DEFAULT_SAMPLE_RATE = 32;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool BuildFmIndex (const char *fasta_filename_s, const char *fm_index_filename_s, const uint64 sample_rate);
+
+static uint8 *ReadFmIndexText (faidx_t *fai_p, uint64 *text_length_p, uint64 **scaffold_starts_pp);
+
+static bool WriteFmIndex (const char *fm_index_filename_s, const uint8 *text_p, int64 *suffix_array_p, const uint64 text_length, const uint64 *scaffold_starts_p, const uint64 num_scaffolds, const uint64 sample_rate);
+
+static bool BuildSuffixArray (const void *text_p, int64 *suffix_array_p, const int64 length, const int64 alphabet_size, const bool wide_flag);
+
+static void GetBuckets (const void *text_p, int64 *buckets_p, const int64 length, const int64 alphabet_size, const bool wide_flag, const bool end_flag);
+
+static void InduceLTypes (const uint8 *types_p, int64 *suffix_array_p, const void *text_p, int64 *buckets_p, const int64 length, const int64 alphabet_size, const bool wide_flag);
+
+static void InduceSTypes (const uint8 *types_p, int64 *suffix_array_p, const void *text_p, int64 *buckets_p, const int64 length, const int64 alphabet_size, const bool wide_flag);
+
+
+/*
+ * The characters are bytes at the top level of SA-IS and the 64-bit
+ * names of the reduced strings below it.
+ */
+#define GET_CHAR(t,i,w) ((w) ? ((const int64 *) (t)) [(i)] : (int64) (((const uint8 *) (t)) [(i)]))
+
+/* Whether a suffix is S-type, i.e. smaller than the one after it */
+#define IS_S_TYPE(t,i) (((t) [(i) >> 3] >> ((i) & 7)) & 1)
+
+#define SET_S_TYPE(t,i,b) ((t) [(i) >> 3] = (uint8) ((b) ? ((t) [(i) >> 3] | (1 << ((i) & 7))) : ((t) [(i) >> 3] & ~(1 << ((i) & 7)))))
+
+#define IS_LMS(t,i) (((i) > 0) && IS_S_TYPE (t, i) && !IS_S_TYPE (t, (i) - 1))
+
+
+/*
+ * API FUNCTIONS
+ */
+
+int main (int argc, char *argv [])
+{
+	int res = 1;
+
+	if ((argc >= 2) && (argc <= 4))
+		{
+			const char *fasta_filename_s = argv [1];
+			const char *sidecar_directory_s = ((argc >= 3) && (* (argv [2]))) ? argv [2] : NULL;
+			const uint64 sample_rate = (argc == 4) ? (uint64) strtoull (argv [3], NULL, 10) : S_DEFAULT_SAMPLE_RATE;
+
+			if (sample_rate > 0)
+				{
+					char *fm_index_filename_s = MakeSidecarFilename (sidecar_directory_s, fasta_filename_s, FM_INDEX_SUFFIX_S);
+
+					if (fm_index_filename_s)
+						{
+							if (BuildFmIndex (fasta_filename_s, fm_index_filename_s, sample_rate))
+								{
+									printf ("Built %s\n", fm_index_filename_s);
+									res = 0;
+								}
+							else
+								{
+									fprintf (stderr, "Failed to build %s\n", fm_index_filename_s);
+								}
+
+							FreeCopiedString (fm_index_filename_s);
+						}
+				}
+			else
+				{
+					fprintf (stderr, "The sample rate must be at least 1\n");
+				}
+		}
+	else
+		{
+			fprintf (stderr, "Usage: %s <fasta file> [<sidecar directory> [<sample rate>]]\n\n"
+				"Build the FM-index for an indexed FASTA file. The sidecar directory must match\n"
+				"the service's \"sidecar_directory\" setting; if it is empty or missing the index\n"
+				"is written next to the FASTA file. The suffix array is sampled every\n"
+				"<sample rate> bases, " UINT64_FMT " by default.\n", argv [0], S_DEFAULT_SAMPLE_RATE);
+		}
+
+	return res;
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static bool BuildFmIndex (const char *fasta_filename_s, const char *fm_index_filename_s, const uint64 sample_rate)
+{
+	bool success_flag = false;
+	faidx_t *fai_p = fai_load (fasta_filename_s);
+
+	if (fai_p)
+		{
+			uint64 text_length = 0;
+			uint64 *scaffold_starts_p = NULL;
+			uint8 *text_p = ReadFmIndexText (fai_p, &text_length, &scaffold_starts_p);
+
+			if (text_p)
+				{
+					int64 *suffix_array_p = (int64 *) AllocMemoryArray (sizeof (int64), (size_t) text_length);
+
+					if (suffix_array_p)
+						{
+							success_flag = BuildSuffixArray (text_p, suffix_array_p, (int64) text_length, FM_ALPHABET_SIZE - 1, false) &&
+								WriteFmIndex (fm_index_filename_s, text_p, suffix_array_p, text_length, scaffold_starts_p, (uint64) faidx_nseq (fai_p), sample_rate);
+
+							FreeMemory (suffix_array_p);
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate the suffix array for " UINT64_FMT " bases", text_length);
+						}
+
+					FreeMemory (scaffold_starts_p);
+					FreeMemory (text_p);
+				}
+
+			fai_destroy (fai_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to load fasta index %s", fasta_filename_s);
+		}
+
+	return success_flag;
+}
+
+
+static uint8 *ReadFmIndexText (faidx_t *fai_p, uint64 *text_length_p, uint64 **scaffold_starts_pp)
+{
+	const int num_scaffolds = faidx_nseq (fai_p);
+	uint64 *scaffold_starts_p;
+	uint64 text_length = 0;
+	int i;
+
+	if (num_scaffolds <= 0)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "There are no scaffolds to index");
+			return NULL;
+		}
+
+	if ((scaffold_starts_p = (uint64 *) AllocMemoryArray (sizeof (uint64), (size_t) num_scaffolds + 1)) == NULL)
+		{
+			return NULL;
+		}
+
+	/* Each scaffold is followed by a separator, and the last one by the terminator */
+	for (i = 0; i < num_scaffolds; ++ i)
+		{
+			scaffold_starts_p [i] = text_length;
+			text_length += (uint64) faidx_seq_len64 (fai_p, faidx_iseq (fai_p, i)) + 1;
+		}
+
+	scaffold_starts_p [i] = text_length;
+
+	if (text_length > 1)
+		{
+			uint8 *text_p = (uint8 *) AllocMemory ((size_t) text_length);
+
+			if (text_p)
+				{
+					bool success_flag = true;
+
+					for (i = 0; (i < num_scaffolds) && success_flag; ++ i)
+						{
+							const char *name_s = faidx_iseq (fai_p, i);
+							const hts_pos_t length = (hts_pos_t) (scaffold_starts_p [i + 1] - scaffold_starts_p [i] - 1);
+							uint8 *dest_p = text_p + scaffold_starts_p [i];
+							hts_pos_t block_start;
+
+							for (block_start = 0; (block_start < length) && success_flag; block_start += S_BLOCK_SIZE)
+								{
+									const hts_pos_t block_end = (length - block_start < S_BLOCK_SIZE) ? length : block_start + S_BLOCK_SIZE;
+									hts_pos_t block_length = 0;
+									char *sequence_s = faidx_fetch_seq64 (fai_p, name_s, block_start, block_end - 1, &block_length);
+
+									if (sequence_s && (block_length == block_end - block_start))
+										{
+											hts_pos_t j;
+
+											for (j = 0; j < block_length; ++ j)
+												{
+													*dest_p = (uint8) GetFmIndexCode (sequence_s [j]);
+													++ dest_p;
+												}
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to read %s:" INT64_FMT "-" INT64_FMT, name_s, (int64) block_start, (int64) block_end);
+											success_flag = false;
+										}
+
+									if (sequence_s)
+										{
+											free (sequence_s);
+										}
+								}
+
+							*dest_p = FM_N;
+						}
+
+					if (success_flag)
+						{
+							text_p [text_length - 1] = FM_TERMINATOR;
+
+							*text_length_p = text_length;
+							*scaffold_starts_pp = scaffold_starts_p;
+
+							return text_p;
+						}
+
+					FreeMemory (text_p);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " UINT64_FMT " bases", text_length);
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "There are no bases to index");
+		}
+
+	FreeMemory (scaffold_starts_p);
+
+	return NULL;
+}
+
+
+static bool WriteFmIndex (const char *fm_index_filename_s, const uint8 *text_p, int64 *suffix_array_p, const uint64 text_length, const uint64 *scaffold_starts_p, const uint64 num_scaffolds, const uint64 sample_rate)
+{
+	bool success_flag = false;
+	const uint64 num_blocks = (text_length / FM_INDEX_BLOCK_SIZE) + 1;
+	const size_t preamble_size = GetFmIndexPreambleSize (num_scaffolds);
+	char *preamble_p = (char *) AllocMemory (preamble_size);
+	uint64 *sample_ranks_p = (uint64 *) AllocMemoryArray (sizeof (uint64), (size_t) num_blocks);
+
+	if (preamble_p && sample_ranks_p)
+		{
+			FmIndexHeader *header_p = (FmIndexHeader *) preamble_p;
+			uint64 symbol_counts [FM_ALPHABET_SIZE];
+			uint64 row;
+			uint32 code;
+
+			memset (preamble_p, 0, preamble_size);
+			memset (symbol_counts, 0, sizeof (symbol_counts));
+
+			for (row = 0; row < text_length; ++ row)
+				{
+					++ symbol_counts [text_p [row]];
+
+					if (suffix_array_p [row] == 0)
+						{
+							header_p -> fmh_terminator_row = row;
+						}
+				}
+
+			SetFmIndexMagic (header_p);
+			header_p -> fmh_text_length = text_length;
+			header_p -> fmh_num_scaffolds = num_scaffolds;
+			header_p -> fmh_sample_rate = sample_rate;
+			header_p -> fmh_num_samples = (text_length + sample_rate - 1) / sample_rate;
+			header_p -> fmh_first_rows [0] = symbol_counts [FM_TERMINATOR];
+
+			for (code = FM_A + 1; code < FM_ALPHABET_SIZE; ++ code)
+				{
+					header_p -> fmh_first_rows [code - FM_A] = header_p -> fmh_first_rows [code - FM_A - 1] + symbol_counts [code - 1];
+				}
+
+			memcpy (header_p + 1, scaffold_starts_p, (size_t) (num_scaffolds + 1) * sizeof (uint64));
+
+			{
+				SidecarWriter *writer_p = OpenSidecarWriter (fm_index_filename_s);
+
+				if (writer_p)
+					{
+						uint64 counts [4] = { 0, 0, 0, 0 };
+						uint64 num_samples = 0;
+						uint64 block_index;
+
+						success_flag = WriteSidecarData (writer_p, preamble_p, preamble_size);
+
+						for (block_index = 0; (block_index < num_blocks) && success_flag; ++ block_index)
+							{
+								const uint64 block_start = block_index * FM_INDEX_BLOCK_SIZE;
+								const uint64 block_end = (text_length - block_start < FM_INDEX_BLOCK_SIZE) ? text_length : block_start + FM_INDEX_BLOCK_SIZE;
+								FmIndexBlock block;
+
+								memset (&block, 0, sizeof (block));
+								memcpy (block.fmb_counts, counts, sizeof (counts));
+								sample_ranks_p [block_index] = num_samples;
+
+								for (row = block_start; row < block_end; ++ row)
+									{
+										const int64 position = suffix_array_p [row];
+										const uint8 symbol = (position > 0) ? text_p [position - 1] : FM_TERMINATOR;
+										const uint64 bit = ((uint64) 1) << (row - block_start);
+
+										if ((symbol >= FM_A) && (symbol <= FM_T))
+											{
+												const uint32 bits = symbol - FM_A;
+
+												if (bits & 1)
+													{
+														block.fmb_low_bits |= bit;
+													}
+
+												if (bits & 2)
+													{
+														block.fmb_high_bits |= bit;
+													}
+
+												++ counts [bits];
+											}
+										else
+											{
+												block.fmb_other_bits |= bit;
+											}
+
+										if ((uint64) position % sample_rate == 0)
+											{
+												block.fmb_sampled_bits |= bit;
+
+												/* The rows up to here have been written so the samples can be packed into the start of the array */
+												suffix_array_p [num_samples] = position;
+												++ num_samples;
+											}
+									}
+
+								success_flag = WriteSidecarData (writer_p, &block, sizeof (block));
+							}
+
+						success_flag = success_flag && (num_samples == header_p -> fmh_num_samples) &&
+							WriteSidecarData (writer_p, sample_ranks_p, (size_t) num_blocks * sizeof (uint64)) &&
+							WriteSidecarData (writer_p, suffix_array_p, (size_t) num_samples * sizeof (uint64));
+
+						if (!CloseSidecarWriter (writer_p, success_flag))
+							{
+								success_flag = false;
+							}
+					}
+			}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate the FM-index header for " UINT64_FMT " scaffolds", num_scaffolds);
+		}
+
+	if (sample_ranks_p)
+		{
+			FreeMemory (sample_ranks_p);
+		}
+
+	if (preamble_p)
+		{
+			FreeMemory (preamble_p);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * SA-IS (Nong, Zhang and Chan, 2009). The text must end with a unique
+ * character that is smaller than all of the others. The reduced string
+ * of each level is stored within the suffix array.
+ */
+static bool BuildSuffixArray (const void *text_p, int64 *suffix_array_p, const int64 length, const int64 alphabet_size, const bool wide_flag)
+{
+	uint8 *types_p = (uint8 *) AllocMemory ((size_t) (length >> 3) + 1);
+	int64 *buckets_p = (int64 *) AllocMemoryArray (sizeof (int64), (size_t) alphabet_size + 1);
+	int64 num_lms = 0;
+	int64 name = 0;
+	int64 previous = -1;
+	int64 *reduced_suffix_array_p;
+	int64 *reduced_text_p;
+	int64 i;
+	int64 j;
+
+	if (! (types_p && buckets_p))
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate the suffix array workspace for " INT64_FMT " characters", length);
+
+			if (types_p)
+				{
+					FreeMemory (types_p);
+				}
+
+			if (buckets_p)
+				{
+					FreeMemory (buckets_p);
+				}
+
+			return false;
+		}
+
+	/* Classify each suffix as S-type or L-type */
+	SET_S_TYPE (types_p, length - 1, 1);
+
+	if (length > 1)
+		{
+			SET_S_TYPE (types_p, length - 2, 0);
+		}
+
+	for (i = length - 3; i >= 0; -- i)
+		{
+			const int64 c = GET_CHAR (text_p, i, wide_flag);
+			const int64 next_c = GET_CHAR (text_p, i + 1, wide_flag);
+
+			SET_S_TYPE (types_p, i, (c < next_c) || ((c == next_c) && IS_S_TYPE (types_p, i + 1)));
+		}
+
+	/* Sort the LMS substrings by putting them at the ends of their buckets and inducing */
+	GetBuckets (text_p, buckets_p, length, alphabet_size, wide_flag, true);
+
+	for (i = 0; i < length; ++ i)
+		{
+			suffix_array_p [i] = -1;
+		}
+
+	for (i = 1; i < length; ++ i)
+		{
+			if (IS_LMS (types_p, i))
+				{
+					suffix_array_p [-- buckets_p [GET_CHAR (text_p, i, wide_flag)]] = i;
+				}
+		}
+
+	InduceLTypes (types_p, suffix_array_p, text_p, buckets_p, length, alphabet_size, wide_flag);
+	InduceSTypes (types_p, suffix_array_p, text_p, buckets_p, length, alphabet_size, wide_flag);
+
+	/* Move the sorted LMS substrings to the start */
+	for (i = 0; i < length; ++ i)
+		{
+			if (IS_LMS (types_p, suffix_array_p [i]))
+				{
+					suffix_array_p [num_lms ++] = suffix_array_p [i];
+				}
+		}
+
+	for (i = num_lms; i < length; ++ i)
+		{
+			suffix_array_p [i] = -1;
+		}
+
+	/* Name them, giving equal substrings the same name */
+	for (i = 0; i < num_lms; ++ i)
+		{
+			const int64 position = suffix_array_p [i];
+			bool differ_flag = false;
+			int64 d;
+
+			for (d = 0; d < length; ++ d)
+				{
+					if ((previous == -1) || (GET_CHAR (text_p, position + d, wide_flag) != GET_CHAR (text_p, previous + d, wide_flag)) || (IS_S_TYPE (types_p, position + d) != IS_S_TYPE (types_p, previous + d)))
+						{
+							differ_flag = true;
+							break;
+						}
+					else if ((d > 0) && (IS_LMS (types_p, position + d) || IS_LMS (types_p, previous + d)))
+						{
+							break;
+						}
+				}
+
+			if (differ_flag)
+				{
+					++ name;
+					previous = position;
+				}
+
+			/* No two LMS positions are adjacent so halving them can't collide */
+			suffix_array_p [num_lms + (position >> 1)] = name - 1;
+		}
+
+	for (i = length - 1, j = length - 1; i >= num_lms; -- i)
+		{
+			if (suffix_array_p [i] >= 0)
+				{
+					suffix_array_p [j --] = suffix_array_p [i];
+				}
+		}
+
+	/* Sort the reduced string, recursing if any names are repeated */
+	reduced_suffix_array_p = suffix_array_p;
+	reduced_text_p = suffix_array_p + length - num_lms;
+
+	if (name < num_lms)
+		{
+			if (!BuildSuffixArray (reduced_text_p, reduced_suffix_array_p, num_lms, name - 1, true))
+				{
+					FreeMemory (buckets_p);
+					FreeMemory (types_p);
+
+					return false;
+				}
+		}
+	else
+		{
+			for (i = 0; i < num_lms; ++ i)
+				{
+					reduced_suffix_array_p [reduced_text_p [i]] = i;
+				}
+		}
+
+	/* Then induce the full suffix array from the sorted LMS suffixes */
+	GetBuckets (text_p, buckets_p, length, alphabet_size, wide_flag, true);
+
+	for (i = 1, j = 0; i < length; ++ i)
+		{
+			if (IS_LMS (types_p, i))
+				{
+					reduced_text_p [j ++] = i;
+				}
+		}
+
+	for (i = 0; i < num_lms; ++ i)
+		{
+			reduced_suffix_array_p [i] = reduced_text_p [reduced_suffix_array_p [i]];
+		}
+
+	for (i = num_lms; i < length; ++ i)
+		{
+			suffix_array_p [i] = -1;
+		}
+
+	for (i = num_lms - 1; i >= 0; -- i)
+		{
+			j = suffix_array_p [i];
+			suffix_array_p [i] = -1;
+			suffix_array_p [-- buckets_p [GET_CHAR (text_p, j, wide_flag)]] = j;
+		}
+
+	InduceLTypes (types_p, suffix_array_p, text_p, buckets_p, length, alphabet_size, wide_flag);
+	InduceSTypes (types_p, suffix_array_p, text_p, buckets_p, length, alphabet_size, wide_flag);
+
+	FreeMemory (buckets_p);
+	FreeMemory (types_p);
+
+	return true;
+}
+
+
+static void GetBuckets (const void *text_p, int64 *buckets_p, const int64 length, const int64 alphabet_size, const bool wide_flag, const bool end_flag)
+{
+	int64 sum = 0;
+	int64 i;
+
+	for (i = 0; i <= alphabet_size; ++ i)
+		{
+			buckets_p [i] = 0;
+		}
+
+	for (i = 0; i < length; ++ i)
+		{
+			++ buckets_p [GET_CHAR (text_p, i, wide_flag)];
+		}
+
+	for (i = 0; i <= alphabet_size; ++ i)
+		{
+			sum += buckets_p [i];
+			buckets_p [i] = end_flag ? sum : sum - buckets_p [i];
+		}
+}
+
+
+static void InduceLTypes (const uint8 *types_p, int64 *suffix_array_p, const void *text_p, int64 *buckets_p, const int64 length, const int64 alphabet_size, const bool wide_flag)
+{
+	int64 i;
+
+	GetBuckets (text_p, buckets_p, length, alphabet_size, wide_flag, false);
+
+	for (i = 0; i < length; ++ i)
+		{
+			const int64 j = suffix_array_p [i] - 1;
+
+			if ((j >= 0) && !IS_S_TYPE (types_p, j))
+				{
+					suffix_array_p [buckets_p [GET_CHAR (text_p, j, wide_flag)] ++] = j;
+				}
+		}
+}
+
+
+static void InduceSTypes (const uint8 *types_p, int64 *suffix_array_p, const void *text_p, int64 *buckets_p, const int64 length, const int64 alphabet_size, const bool wide_flag)
+{
+	int64 i;
+
+	GetBuckets (text_p, buckets_p, length, alphabet_size, wide_flag, true);
+
+	for (i = length - 1; i >= 0; -- i)
+		{
+			const int64 j = suffix_array_p [i] - 1;
+
+			if ((j >= 0) && IS_S_TYPE (types_p, j))
+				{
+					suffix_array_p [-- buckets_p [GET_CHAR (text_p, j, wide_flag)]] = j;
+				}
+		}
+}
@@ -0,0 +1,779 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * gap_map.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gap_map.h"
+#include "sequence_kernels.h"
+#include "fasta_utils.h"
+#include "worker_pool.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "byte_buffer.h"
+#include "audit.h"
+
+#include "string_parameter.h"
+#include "unsigned_int_parameter.h"
+#include "boolean_parameter.h"
+
+
+#ifdef _DEBUG
+	#define GAP_MAP_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define GAP_MAP_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * The start of each gap map file. This is followed by the scaffold
+ * offsets and then the gaps.
+ */
+typedef struct GapMapHeader
+{
+	char gmh_magic [8];
+	uint64 gmh_num_scaffolds;
+	uint64 gmh_num_gaps;
+} GapMapHeader;
+
+
+typedef struct GapMapBuilder
+{
+	IndexData *gmb_index_data_p;
+	size_t gmb_num_scaffolds;
+	const char **gmb_names_ss;
+	hts_pos_t *gmb_lengths_p;
+	GapList *gmb_gap_lists_p;
+	volatile bool *gmb_stop_flag_p;
+} GapMapBuilder;
+
+
+static NamedParameterType S_MIN_GAP_LENGTH = { "Min gap length", PT_UNSIGNED_INT };
+
+static NamedParameterType S_SPLIT_AT_GAPS = { "Split at gaps", PT_BOOLEAN };
+
+
+static const uint32 S_DEFAULT_MIN_GAP_LENGTH = 1;
+
+static const bool S_DEFAULT_SPLIT_AT_GAPS = false;
+
+static const char * const S_ALL_SCAFFOLDS_S = "*";
+
+static const char * const S_GAP_MAP_SUFFIX_S = ".gaps";
+
+static const char S_GAP_MAP_MAGIC [8] = { 'S', 'T', 'G', 'A', 'P', 'S', '0', '1' };
+
+/*
+ * Scaffolds are scanned in blocks of this many bases.
+ */
+static const hts_pos_t S_BLOCK_SIZE = 1 << 22;
+
+static const size_t S_INITIAL_NUM_GAPS = 64;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool AddGapToList (GapList *gaps_p, const hts_pos_t start, const hts_pos_t end);
+
+static bool BuildGapMap (IndexData *index_data_p, const char *gap_map_filename_s, const uint32 num_threads, volatile bool *stop_flag_p);
+
+static bool ScanScaffoldGaps (const size_t task_index, void *data_p);
+
+static bool WriteGapMap (const GapMapBuilder *builder_p, const char *gap_map_filename_s);
+
+static bool MapGapMap (GapMap *gap_map_p, const char *gap_map_filename_s);
+
+static bool AppendScaffoldGaps (ByteBuffer *buffer_p, const GapMap *gap_map_p, const int scaffold_index, const char *name_s, const hts_pos_t beg, const hts_pos_t end, const uint32 min_gap_length, uint64 *num_gaps_p, uint64 *gap_length_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+void InitGapScanner (GapScanner *scanner_p)
+{
+	scanner_p -> gs_gap_start = -1;
+	scanner_p -> gs_gaps.gl_gaps_p = NULL;
+	scanner_p -> gs_gaps.gl_num_gaps = 0;
+	scanner_p -> gs_gaps.gl_max_gaps = 0;
+}
+
+
+void ClearGapScanner (GapScanner *scanner_p)
+{
+	if (scanner_p -> gs_gaps.gl_gaps_p)
+		{
+			FreeMemory (scanner_p -> gs_gaps.gl_gaps_p);
+		}
+
+	InitGapScanner (scanner_p);
+}
+
+
+bool ScanGapsInBlock (GapScanner *scanner_p, const char *sequence_s, const size_t length, const hts_pos_t block_start)
+{
+	size_t i = 0;
+
+	/* Carry on with a gap from the previous block */
+	if (scanner_p -> gs_gap_start >= 0)
+		{
+			i = FindNextNonGapBase (sequence_s, 0, length);
+
+			if (i == length)
+				{
+					return true;
+				}
+
+			if (!AddGapToList (& (scanner_p -> gs_gaps), scanner_p -> gs_gap_start, block_start + (hts_pos_t) i))
+				{
+					return false;
+				}
+
+			scanner_p -> gs_gap_start = -1;
+		}
+
+	while ((i = FindNextGapBase (sequence_s, i, length)) < length)
+		{
+			const size_t gap_end = FindNextNonGapBase (sequence_s, i, length);
+
+			if (gap_end == length)
+				{
+					/* This gap might continue into the next block */
+					scanner_p -> gs_gap_start = block_start + (hts_pos_t) i;
+					return true;
+				}
+
+			if (!AddGapToList (& (scanner_p -> gs_gaps), block_start + (hts_pos_t) i, block_start + (hts_pos_t) gap_end))
+				{
+					return false;
+				}
+
+			i = gap_end;
+		}
+
+	return true;
+}
+
+
+bool FinishGapScan (GapScanner *scanner_p, const hts_pos_t end)
+{
+	if (scanner_p -> gs_gap_start >= 0)
+		{
+			const hts_pos_t start = scanner_p -> gs_gap_start;
+
+			scanner_p -> gs_gap_start = -1;
+
+			return AddGapToList (& (scanner_p -> gs_gaps), start, end);
+		}
+
+	return true;
+}
+
+
+bool BuildIndexGapMap (IndexData *index_data_p, const char *sidecar_directory_s, volatile bool *stop_flag_p)
+{
+	bool success_flag = false;
+	char *gap_map_filename_s = MakeSidecarFilename (sidecar_directory_s, index_data_p -> id_fasta_filename_s, S_GAP_MAP_SUFFIX_S);
+
+	if (gap_map_filename_s)
+		{
+			if (IsSidecarFileUpToDate (gap_map_filename_s, index_data_p -> id_fasta_filename_s))
+				{
+					success_flag = true;
+				}
+			else
+				{
+					/* This runs alongside the service's jobs so it only uses a single thread */
+					success_flag = BuildGapMap (index_data_p, gap_map_filename_s, 1, stop_flag_p);
+				}
+
+			FreeCopiedString (gap_map_filename_s);
+		}
+
+	return success_flag;
+}
+
+
+const GapMap *GetIndexGapMap (IndexData *index_data_p, const char *sidecar_directory_s)
+{
+	const GapMap *gap_map_p = NULL;
+
+	if (index_data_p -> id_fasta_filename_s)
+		{
+			pthread_mutex_lock (& (index_data_p -> id_sidecar_mutex));
+
+			if (! (index_data_p -> id_gap_map_p))
+				{
+					char *gap_map_filename_s = MakeSidecarFilename (sidecar_directory_s, index_data_p -> id_fasta_filename_s, S_GAP_MAP_SUFFIX_S);
+
+					/* Until the background builder has written the file, there is no gap map */
+					if (gap_map_filename_s)
+						{
+							if (IsSidecarFileUpToDate (gap_map_filename_s, index_data_p -> id_fasta_filename_s))
+								{
+									GapMap *new_gap_map_p = (GapMap *) AllocMemory (sizeof (GapMap));
+
+									if (new_gap_map_p)
+										{
+											if (MapGapMap (new_gap_map_p, gap_map_filename_s))
+												{
+													index_data_p -> id_gap_map_p = new_gap_map_p;
+												}
+											else
+												{
+													FreeMemory (new_gap_map_p);
+												}
+										}
+								}
+
+							FreeCopiedString (gap_map_filename_s);
+						}
+				}
+
+			gap_map_p = index_data_p -> id_gap_map_p;
+
+			pthread_mutex_unlock (& (index_data_p -> id_sidecar_mutex));
+		}
+
+	return gap_map_p;
+}
+
+
+void FreeGapMap (GapMap *gap_map_p)
+{
+	CloseMappedFile (& (gap_map_p -> gm_file));
+	FreeMemory (gap_map_p);
+}
+
+
+bool AddGapParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	return ((EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MIN_GAP_LENGTH.npt_name_s, "Min gap length", "Runs of N shorter than this are ignored", &S_DEFAULT_MIN_GAP_LENGTH, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddBooleanParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_SPLIT_AT_GAPS.npt_name_s, "Split at gaps", "Split the scaffolds into contigs at each run of at least Min gap length Ns", &S_DEFAULT_SPLIT_AT_GAPS, PL_ADVANCED) != NULL));
+}
+
+
+bool GetGapParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_MIN_GAP_LENGTH.npt_name_s) == 0)
+		{
+			*pt_p = S_MIN_GAP_LENGTH.npt_type;
+		}
+	else if (strcmp (param_name_s, S_SPLIT_AT_GAPS.npt_name_s) == 0)
+		{
+			*pt_p = S_SPLIT_AT_GAPS.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+uint32 GetMinGapLength (const ParameterSet *param_set_p)
+{
+	const uint32 *value_p = NULL;
+
+	if (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MIN_GAP_LENGTH.npt_name_s, &value_p) && value_p && (*value_p > 0))
+		{
+			return *value_p;
+		}
+
+	return S_DEFAULT_MIN_GAP_LENGTH;
+}
+
+
+uint32 GetSplitGapLength (const ParameterSet *param_set_p)
+{
+	const bool *split_flag_p = NULL;
+
+	if (GetCurrentBooleanParameterValueFromParameterSet (param_set_p, S_SPLIT_AT_GAPS.npt_name_s, &split_flag_p) && split_flag_p && (*split_flag_p))
+		{
+			return GetMinGapLength (param_set_p);
+		}
+
+	return 0;
+}
+
+
+bool AppendContigs (ByteBuffer *buffer_p, const char *scaffold_name_s, char *sequence_s, const size_t length, const hts_pos_t offset, const uint32 min_gap_length, const uint32 line_length, const MaskMode mask_mode)
+{
+	bool success_flag = true;
+	size_t contig_start = FindNextNonGapBase (sequence_s, 0, length);
+
+	while ((contig_start < length) && success_flag)
+		{
+			size_t contig_end = length;
+			size_t next_start = length;
+			size_t i = contig_start;
+
+			/* Find the next gap that is long enough to split at, skipping over any shorter ones */
+			while ((i = FindNextGapBase (sequence_s, i, length)) < length)
+				{
+					const size_t gap_end = FindNextNonGapBase (sequence_s, i, length);
+
+					if ((gap_end - i >= min_gap_length) || (gap_end == length))
+						{
+							contig_end = i;
+							next_start = gap_end;
+							break;
+						}
+
+					i = gap_end;
+				}
+
+			if (AppendToByteBuffer (buffer_p, ">", 1) && AppendContigName (buffer_p, scaffold_name_s, offset + (hts_pos_t) contig_start, offset + (hts_pos_t) contig_end) && AppendToByteBuffer (buffer_p, "\n", 1))
+				{
+					uint32 column = 0;
+
+					ApplyMaskMode (sequence_s + contig_start, contig_end - contig_start, mask_mode);
+
+					success_flag = (AppendWrappedSequence (buffer_p, sequence_s + contig_start, contig_end - contig_start, line_length, &column)) && (FinishWrappedSequence (buffer_p, &column));
+				}
+			else
+				{
+					success_flag = false;
+				}
+
+			contig_start = next_start;
+		}
+
+	if (!success_flag)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add contigs for %s", scaffold_name_s);
+		}
+
+	return success_flag;
+}
+
+
+bool AppendContigName (ByteBuffer *buffer_p, const char *scaffold_name_s, const hts_pos_t start, const hts_pos_t end)
+{
+	return AppendVarArgsToByteBuffer (buffer_p, "%s:%" PRIhts_pos "-%" PRIhts_pos, scaffold_name_s, start + 1, end);
+}
+
+
+void RunGapsJob (Service *service_p, ParameterSet *param_set_p)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	IndexData *index_data_p = GetSelectedIndexData (data_p, param_set_p);
+	const char *scaffold_s = NULL;
+
+	if (index_data_p && (index_data_p -> id_fasta_filename_s) && GetCurrentStringParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD.npt_name_s, &scaffold_s) && scaffold_s)
+		{
+			ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, scaffold_s, index_data_p -> id_fasta_filename_s, NULL, NULL, NULL);
+
+			if (job_p)
+				{
+					const GapMap *gap_map_p;
+
+					LogParameterSet (param_set_p, job_p);
+
+					SetServiceJobStatus (job_p, OS_STARTED);
+					LogServiceJob (job_p);
+
+					/* Assume failure */
+					SetServiceJobStatus (job_p, OS_FAILED);
+
+					gap_map_p = GetIndexGapMap (index_data_p, data_p -> stsd_sidecar_directory_s);
+
+					if (gap_map_p)
+						{
+							ByteBuffer *buffer_p = AllocateByteBuffer (1024);
+
+							if (buffer_p)
+								{
+									const uint32 min_gap_length = GetMinGapLength (param_set_p);
+									uint64 num_gaps = 0;
+									uint64 gap_length = 0;
+									bool success_flag = false;
+									faidx_t *fai_p = LockIndexFaidx (index_data_p);
+
+									if (fai_p)
+										{
+											if (strcmp (scaffold_s, S_ALL_SCAFFOLDS_S) == 0)
+												{
+													int i;
+
+													success_flag = true;
+
+													for (i = 0; (i < (int) (gap_map_p -> gm_num_scaffolds)) && success_flag; ++ i)
+														{
+															success_flag = AppendScaffoldGaps (buffer_p, gap_map_p, i, faidx_iseq (fai_p, i), 0, HTS_POS_MAX, min_gap_length, &num_gaps, &gap_length);
+														}
+												}
+											else
+												{
+													int tid;
+													hts_pos_t beg;
+													hts_pos_t end;
+
+													if (fai_parse_region (fai_p, scaffold_s, &tid, &beg, &end, 0) && (tid >= 0) && ((size_t) tid < gap_map_p -> gm_num_scaffolds))
+														{
+															success_flag = AppendScaffoldGaps (buffer_p, gap_map_p, tid, faidx_iseq (fai_p, tid), beg, end, min_gap_length, &num_gaps, &gap_length);
+														}
+													else
+														{
+															AddGeneralErrorMessageToServiceJob (job_p, "Unknown scaffold");
+														}
+												}
+
+											UnlockIndexFaidx (index_data_p);
+										}
+
+									if (success_flag)
+										{
+											json_t *bed_p = json_string (GetByteBufferData (buffer_p));
+
+											if (bed_p)
+												{
+													json_t *summary_p = json_pack ("{s:I,s:I}", "gaps", (json_int_t) num_gaps, "gap_length", (json_int_t) gap_length);
+
+													if (summary_p)
+														{
+															if (AddInlineResultToServiceJob (job_p, "gaps.bed", bed_p) && AddInlineResultToServiceJob (job_p, "summary", summary_p))
+																{
+																	SetServiceJobStatus (job_p, OS_SUCCEEDED);
+																}
+
+															json_decref (summary_p);
+														}
+
+													json_decref (bed_p);
+												}
+										}
+
+									FreeByteBuffer (buffer_p);
+								}
+						}
+					else
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "The gap map is not ready yet");
+						}
+
+					LogServiceJob (job_p);
+				}		/* if (job_p) */
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get a FASTA file and scaffold for the gap map");
+		}
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static bool AddGapToList (GapList *gaps_p, const hts_pos_t start, const hts_pos_t end)
+{
+	if (gaps_p -> gl_num_gaps == gaps_p -> gl_max_gaps)
+		{
+			const size_t new_max_gaps = (gaps_p -> gl_max_gaps > 0) ? (gaps_p -> gl_max_gaps << 1) : S_INITIAL_NUM_GAPS;
+			GapInterval *new_gaps_p = NULL;
+
+			if (gaps_p -> gl_gaps_p)
+				{
+					new_gaps_p = (GapInterval *) ReallocMemory (gaps_p -> gl_gaps_p, new_max_gaps * sizeof (GapInterval), gaps_p -> gl_max_gaps * sizeof (GapInterval));
+				}
+			else
+				{
+					new_gaps_p = (GapInterval *) AllocMemoryArray (sizeof (GapInterval), new_max_gaps);
+				}
+
+			if (!new_gaps_p)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to grow gap list to " SIZET_FMT " entries", new_max_gaps);
+					return false;
+				}
+
+			gaps_p -> gl_gaps_p = new_gaps_p;
+			gaps_p -> gl_max_gaps = new_max_gaps;
+		}
+
+	gaps_p -> gl_gaps_p [gaps_p -> gl_num_gaps].gi_start = (uint64) start;
+	gaps_p -> gl_gaps_p [gaps_p -> gl_num_gaps].gi_end = (uint64) end;
+	++ (gaps_p -> gl_num_gaps);
+
+	return true;
+}
+
+
+static bool BuildGapMap (IndexData *index_data_p, const char *gap_map_filename_s, const uint32 num_threads, volatile bool *stop_flag_p)
+{
+	bool success_flag = false;
+	faidx_t *fai_p = LockIndexFaidx (index_data_p);
+
+	#if GAP_MAP_DEBUG >= STM_LEVEL_FINE
+	PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "BuildGapMap - building %s", gap_map_filename_s);
+	#endif
+
+	if (fai_p)
+		{
+			GapMapBuilder builder;
+			const int num_seqs = faidx_nseq (fai_p);
+
+			builder.gmb_index_data_p = index_data_p;
+			builder.gmb_stop_flag_p = stop_flag_p;
+			builder.gmb_num_scaffolds = (num_seqs > 0) ? (size_t) num_seqs : 0;
+			builder.gmb_names_ss = (const char **) AllocMemoryArray (sizeof (const char *), builder.gmb_num_scaffolds + 1);
+			builder.gmb_lengths_p = (hts_pos_t *) AllocMemoryArray (sizeof (hts_pos_t), builder.gmb_num_scaffolds + 1);
+			builder.gmb_gap_lists_p = (GapList *) AllocMemoryArray (sizeof (GapList), builder.gmb_num_scaffolds + 1);
+
+			if ((builder.gmb_names_ss) && (builder.gmb_lengths_p) && (builder.gmb_gap_lists_p))
+				{
+					size_t i;
+
+					for (i = 0; i < builder.gmb_num_scaffolds; ++ i)
+						{
+							builder.gmb_names_ss [i] = faidx_iseq (fai_p, (int) i);
+							builder.gmb_lengths_p [i] = faidx_seq_len64 (fai_p, builder.gmb_names_ss [i]);
+							builder.gmb_gap_lists_p [i].gl_gaps_p = NULL;
+							builder.gmb_gap_lists_p [i].gl_num_gaps = 0;
+							builder.gmb_gap_lists_p [i].gl_max_gaps = 0;
+						}
+
+					/* The workers fetch through the index themselves */
+					UnlockIndexFaidx (index_data_p);
+					fai_p = NULL;
+
+					if (RunWorkerPool (builder.gmb_num_scaffolds, num_threads, ScanScaffoldGaps, &builder))
+						{
+							success_flag = WriteGapMap (&builder, gap_map_filename_s);
+						}
+
+					for (i = 0; i < builder.gmb_num_scaffolds; ++ i)
+						{
+							if (builder.gmb_gap_lists_p [i].gl_gaps_p)
+								{
+									FreeMemory (builder.gmb_gap_lists_p [i].gl_gaps_p);
+								}
+						}
+				}
+
+			if (fai_p)
+				{
+					UnlockIndexFaidx (index_data_p);
+				}
+
+			if (builder.gmb_gap_lists_p)
+				{
+					FreeMemory (builder.gmb_gap_lists_p);
+				}
+
+			if (builder.gmb_lengths_p)
+				{
+					FreeMemory (builder.gmb_lengths_p);
+				}
+
+			if (builder.gmb_names_ss)
+				{
+					FreeMemory (builder.gmb_names_ss);
+				}
+		}
+
+	return success_flag;
+}
+
+
+static bool ScanScaffoldGaps (const size_t task_index, void *data_p)
+{
+	GapMapBuilder *builder_p = (GapMapBuilder *) data_p;
+	const char *name_s = builder_p -> gmb_names_ss [task_index];
+	const hts_pos_t length = builder_p -> gmb_lengths_p [task_index];
+	bool success_flag = true;
+	GapScanner scanner;
+	hts_pos_t block_start = 0;
+
+	InitGapScanner (&scanner);
+
+	while ((block_start < length) && success_flag)
+		{
+			const hts_pos_t block_end = (length - block_start < S_BLOCK_SIZE) ? length : block_start + S_BLOCK_SIZE;
+			hts_pos_t block_length = 0;
+			char *sequence_s = FetchIndexSequence (builder_p -> gmb_index_data_p, name_s, block_start, block_end, &block_length);
+
+			if (sequence_s)
+				{
+					success_flag = ScanGapsInBlock (&scanner, sequence_s, (size_t) block_length, block_start);
+					free (sequence_s);
+				}
+			else
+				{
+					success_flag = false;
+				}
+
+			block_start = block_end;
+
+			if (* (builder_p -> gmb_stop_flag_p))
+				{
+					success_flag = false;
+				}
+		}
+
+	if (success_flag && FinishGapScan (&scanner, length))
+		{
+			/* Hand the gaps over to the builder */
+			builder_p -> gmb_gap_lists_p [task_index] = scanner.gs_gaps;
+		}
+	else
+		{
+			ClearGapScanner (&scanner);
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+static bool WriteGapMap (const GapMapBuilder *builder_p, const char *gap_map_filename_s)
+{
+	bool success_flag = false;
+	const size_t header_size = sizeof (GapMapHeader) + ((builder_p -> gmb_num_scaffolds + 1) * sizeof (uint64));
+	char *header_data_p = (char *) AllocMemory (header_size);
+
+	if (header_data_p)
+		{
+			GapMapHeader *header_p = (GapMapHeader *) header_data_p;
+			uint64 *offsets_p = (uint64 *) (header_p + 1);
+			uint64 num_gaps = 0;
+			GapInterval *gaps_p;
+			size_t i;
+
+			for (i = 0; i < builder_p -> gmb_num_scaffolds; ++ i)
+				{
+					offsets_p [i] = num_gaps;
+					num_gaps += builder_p -> gmb_gap_lists_p [i].gl_num_gaps;
+				}
+
+			offsets_p [i] = num_gaps;
+
+			memcpy (header_p -> gmh_magic, S_GAP_MAP_MAGIC, sizeof (S_GAP_MAP_MAGIC));
+			header_p -> gmh_num_scaffolds = builder_p -> gmb_num_scaffolds;
+			header_p -> gmh_num_gaps = num_gaps;
+
+			gaps_p = (GapInterval *) AllocMemoryArray (sizeof (GapInterval), (size_t) num_gaps + 1);
+
+			if (gaps_p)
+				{
+					for (i = 0; i < builder_p -> gmb_num_scaffolds; ++ i)
+						{
+							const GapList *list_p = builder_p -> gmb_gap_lists_p + i;
+
+							if (list_p -> gl_num_gaps > 0)
+								{
+									memcpy (gaps_p + offsets_p [i], list_p -> gl_gaps_p, list_p -> gl_num_gaps * sizeof (GapInterval));
+								}
+						}
+
+					success_flag = WriteSidecarFile (gap_map_filename_s, header_data_p, header_size, gaps_p, (size_t) num_gaps * sizeof (GapInterval));
+
+					FreeMemory (gaps_p);
+				}
+
+			FreeMemory (header_data_p);
+		}
+
+	return success_flag;
+}
+
+
+static bool MapGapMap (GapMap *gap_map_p, const char *gap_map_filename_s)
+{
+	if (OpenMappedFile (& (gap_map_p -> gm_file), gap_map_filename_s))
+		{
+			const GapMapHeader *header_p = (const GapMapHeader *) (gap_map_p -> gm_file.mf_data_p);
+
+			if ((gap_map_p -> gm_file.mf_size >= sizeof (GapMapHeader)) &&
+				(memcmp (header_p -> gmh_magic, S_GAP_MAP_MAGIC, sizeof (S_GAP_MAP_MAGIC)) == 0) &&
+				(gap_map_p -> gm_file.mf_size == sizeof (GapMapHeader) + ((header_p -> gmh_num_scaffolds + 1) * sizeof (uint64)) + (header_p -> gmh_num_gaps * sizeof (GapInterval))))
+				{
+					gap_map_p -> gm_num_scaffolds = (size_t) (header_p -> gmh_num_scaffolds);
+					gap_map_p -> gm_offsets_p = (const uint64 *) (header_p + 1);
+					gap_map_p -> gm_gaps_p = (const GapInterval *) (gap_map_p -> gm_offsets_p + gap_map_p -> gm_num_scaffolds + 1);
+
+					return true;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "\"%s\" is not a valid gap map", gap_map_filename_s);
+				}
+
+			CloseMappedFile (& (gap_map_p -> gm_file));
+		}
+
+	return false;
+}
+
+
+static bool AppendScaffoldGaps (ByteBuffer *buffer_p, const GapMap *gap_map_p, const int scaffold_index, const char *name_s, const hts_pos_t beg, const hts_pos_t end, const uint32 min_gap_length, uint64 *num_gaps_p, uint64 *gap_length_p)
+{
+	const GapInterval *gaps_p = gap_map_p -> gm_gaps_p + gap_map_p -> gm_offsets_p [scaffold_index];
+	const size_t num_gaps = (size_t) (gap_map_p -> gm_offsets_p [scaffold_index + 1] - gap_map_p -> gm_offsets_p [scaffold_index]);
+	size_t lo = 0;
+	size_t hi = num_gaps;
+
+	/* Find the first gap that ends after the start of the region */
+	while (lo < hi)
+		{
+			const size_t mid = lo + ((hi - lo) >> 1);
+
+			if (gaps_p [mid].gi_end <= (uint64) beg)
+				{
+					lo = mid + 1;
+				}
+			else
+				{
+					hi = mid;
+				}
+		}
+
+	while ((lo < num_gaps) && (gaps_p [lo].gi_start < (uint64) end))
+		{
+			const GapInterval *gap_p = gaps_p + lo;
+
+			/* Gaps are filtered on their full length, not just the part in the region */
+			if (gap_p -> gi_end - gap_p -> gi_start >= min_gap_length)
+				{
+					const uint64 start = (gap_p -> gi_start > (uint64) beg) ? gap_p -> gi_start : (uint64) beg;
+					const uint64 stop = (gap_p -> gi_end < (uint64) end) ? gap_p -> gi_end : (uint64) end;
+
+					if (!AppendVarArgsToByteBuffer (buffer_p, "%s\t" UINT64_FMT "\t" UINT64_FMT "\n", name_s, start, stop))
+						{
+							return false;
+						}
+
+					++ (*num_gaps_p);
+					*gap_length_p += stop - start;
+				}
+
+			++ lo;
+		}
+
+	return true;
+}
@@ -0,0 +1,1317 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * in_silico_pcr.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "in_silico_pcr.h"
+#include "worker_pool.h"
+#include "fasta_utils.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "audit.h"
+
+#include "string_parameter.h"
+#include "unsigned_int_parameter.h"
+#include "boolean_parameter.h"
+
+
+#ifdef _DEBUG
+	#define IN_SILICO_PCR_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define IN_SILICO_PCR_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * The number of bases at the 3' end of each primer that have to match
+ * exactly. These are the seeds used to find the candidate sites.
+ */
+#define PCR_SEED_LENGTH (12)
+
+#define PCR_NUM_SEEDS (((uint32) 1) << (2 * PCR_SEED_LENGTH))
+
+
+typedef struct PrimerPair
+{
+	char *pp_name_s;
+
+	/* The forward and reverse primers, 5' to 3', in upper case */
+	char *pp_primers_ss [2];
+} PrimerPair;
+
+
+/*
+ * A primer as it would appear on the top strand, either as written when
+ * it primes towards the end of the scaffold or reverse complemented when
+ * it primes towards the start. Each pair has four of these.
+ */
+typedef struct PcrSite
+{
+	uint32 ps_pair_index;
+
+	/* 0 for the forward primer, 1 for the reverse one */
+	uint32 ps_primer;
+
+	bool ps_reversed_flag;
+
+	char *ps_bases_s;
+	uint32 ps_length;
+
+	/* Where the 3' seed starts within ps_bases_s */
+	uint32 ps_seed_offset;
+} PcrSite;
+
+
+typedef struct SeedEntry
+{
+	uint32 se_seed;
+	uint32 se_site_index;
+} SeedEntry;
+
+
+typedef struct PcrHit
+{
+	/* The 0-based start of the site on the top strand */
+	uint64 ph_start;
+
+	uint32 ph_site_index;
+	uint32 ph_mismatches;
+} PcrHit;
+
+
+typedef struct PcrTask
+{
+	IndexData *pt_index_data_p;
+	const char *pt_scaffold_name_s;
+
+	/* The part of the region that this task reports sites starting in */
+	hts_pos_t pt_block_start;
+	hts_pos_t pt_block_end;
+
+	hts_pos_t pt_region_start;
+	hts_pos_t pt_region_end;
+
+	PcrHit *pt_hits_p;
+	size_t pt_num_hits;
+	size_t pt_max_hits;
+} PcrTask;
+
+
+typedef struct PcrProduct
+{
+	uint32 pp_pair_index;
+	IndexData *pp_index_data_p;
+	const char *pp_scaffold_name_s;
+	hts_pos_t pp_start;
+	hts_pos_t pp_end;
+	char pp_strand;
+	uint32 pp_forward_mismatches;
+	uint32 pp_reverse_mismatches;
+
+	/* The product read from the forward primer, which is freed with free () */
+	char *pp_sequence_s;
+} PcrProduct;
+
+
+typedef struct InSilicoPcr
+{
+	PrimerPair *isp_pairs_p;
+	uint32 isp_num_pairs;
+
+	PcrSite *isp_sites_p;
+	uint32 isp_max_site_length;
+
+	/* A bit for each possible seed, set if any site has it, so most positions are rejected with one lookup */
+	uint8 *isp_seed_bits_p;
+
+	/* The seeds of all of the sites, sorted by seed */
+	SeedEntry *isp_seeds_p;
+	size_t isp_num_seeds;
+	size_t isp_max_seeds;
+
+	uint32 isp_max_mismatches;
+	uint32 isp_max_product_size;
+	uint32 isp_max_products;
+
+	PcrTask *isp_tasks_p;
+	size_t isp_num_tasks;
+	size_t isp_max_tasks;
+
+	PcrProduct *isp_products_p;
+	size_t isp_num_products;
+	size_t isp_max_products_allocated;
+} InSilicoPcr;
+
+
+static NamedParameterType S_PRIMER_PAIRS = { "Primer pairs", PT_LARGE_STRING };
+
+static NamedParameterType S_MAX_PRODUCT_SIZE = { "Max product size", PT_UNSIGNED_INT };
+
+static NamedParameterType S_MAX_MISMATCHES = { "Max mismatches", PT_UNSIGNED_INT };
+
+static NamedParameterType S_MAX_PRODUCTS = { "Max products", PT_UNSIGNED_INT };
+
+
+static const uint32 S_DEFAULT_MAX_PRODUCT_SIZE = 4000;
+
+static const uint32 S_DEFAULT_MAX_MISMATCHES = 2;
+
+static const uint32 S_DEFAULT_MAX_PRODUCTS = 1000;
+
+/*
+ * The limit on the number of exact seeds that the degenerate bases
+ * at the 3' end of a primer can expand to.
+ */
+static const size_t S_MAX_SEED_EXPANSIONS = 256;
+
+static const hts_pos_t S_BLOCK_SIZE = 1 << 22;
+
+static const char * const S_PAIR_SEPARATORS_S = ";\r\n";
+
+static const char * const S_PRIMER_SEPARATORS_S = " \t,";
+
+/*
+ * The 2-bit code for each base plus one, so that 0 marks the bytes
+ * which are not bases.
+ */
+static const uint8 S_BASE_CODES [256] =
+{
+	['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4,
+	['a'] = 1, ['c'] = 2, ['g'] = 3, ['t'] = 4
+};
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool ParsePrimerPairs (const char *pairs_s, InSilicoPcr *pcr_p, ServiceJob *job_p);
+
+static bool ParsePrimerPair (const char *entry_s, const size_t entry_length, PrimerPair *pair_p, ServiceJob *job_p);
+
+static bool BuildSeedIndex (InSilicoPcr *pcr_p, ServiceJob *job_p);
+
+static bool AddSiteSeeds (InSilicoPcr *pcr_p, const uint32 site_index);
+
+static int CompareSeedEntries (const void *v0_p, const void *v1_p);
+
+static bool AddIndexTasks (InSilicoPcr *pcr_p, IndexData *index_data_p, const char *region_s, bool *found_flag_p);
+
+static bool AddPcrTask (InSilicoPcr *pcr_p, IndexData *index_data_p, const char *scaffold_name_s, const hts_pos_t start, const hts_pos_t end);
+
+static bool ScanPcrBlock (const size_t task_index, void *data_p);
+
+static bool AddPcrHit (PcrTask *task_p, const uint64 start, const uint32 site_index, const uint32 mismatches);
+
+static uint32 CountSiteMismatches (const PcrSite *site_p, const char *sequence_s, const uint32 max_mismatches);
+
+static bool PairScaffoldHits (InSilicoPcr *pcr_p, const size_t first_task, const size_t end_task, bool *complete_flag_p);
+
+static int ComparePcrHits (const void *v0_p, const void *v1_p);
+
+static bool FetchPcrProduct (const size_t product_index, void *data_p);
+
+static json_t *GetPcrProductsAsJSON (const InSilicoPcr *pcr_p);
+
+static void ClearInSilicoPcr (InSilicoPcr *pcr_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool AddInSilicoPcrParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	return ((EasyCreateAndAddStringParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_PRIMER_PAIRS.npt_type, S_PRIMER_PAIRS.npt_name_s, "Primer pairs", "The primer pairs, one per line, each as an optional name followed by the forward and reverse primers, 5' to 3', e.g. gapdh ACCTTGGCCAAGGTCATCCA TCCACCACCCTGTTGCTGTA", NULL, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MAX_PRODUCT_SIZE.npt_name_s, "Max product size", "The maximum length of a product, including the primers", &S_DEFAULT_MAX_PRODUCT_SIZE, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MAX_MISMATCHES.npt_name_s, "Max mismatches", "The maximum number of mismatches for each primer. The 12 bases at the 3' end of a primer must match exactly.", &S_DEFAULT_MAX_MISMATCHES, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MAX_PRODUCTS.npt_name_s, "Max products", "The search stops after this many products", &S_DEFAULT_MAX_PRODUCTS, PL_ADVANCED) != NULL));
+}
+
+
+bool GetInSilicoPcrParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_PRIMER_PAIRS.npt_name_s) == 0)
+		{
+			*pt_p = S_PRIMER_PAIRS.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MAX_PRODUCT_SIZE.npt_name_s) == 0)
+		{
+			*pt_p = S_MAX_PRODUCT_SIZE.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MAX_MISMATCHES.npt_name_s) == 0)
+		{
+			*pt_p = S_MAX_MISMATCHES.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MAX_PRODUCTS.npt_name_s) == 0)
+		{
+			*pt_p = S_MAX_PRODUCTS.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+void RunInSilicoPcrJob (Service *service_p, ParameterSet *param_set_p)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	const bool *all_indexes_flag_p = NULL;
+	const bool all_indexes_flag = (GetCurrentBooleanParameterValueFromParameterSet (param_set_p, SS_ALL_INDEXES.npt_name_s, &all_indexes_flag_p) && all_indexes_flag_p) ? *all_indexes_flag_p : false;
+	IndexData *index_data_p = all_indexes_flag ? NULL : GetSelectedIndexData (data_p, param_set_p);
+	const char *region_s = NULL;
+	const char *pairs_s = NULL;
+
+	if ((all_indexes_flag || (index_data_p && (index_data_p -> id_fasta_filename_s))) &&
+		GetCurrentStringParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD.npt_name_s, &region_s) && region_s &&
+		GetCurrentStringParameterValueFromParameterSet (param_set_p, S_PRIMER_PAIRS.npt_name_s, &pairs_s) && pairs_s)
+		{
+			ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, region_s, index_data_p ? index_data_p -> id_fasta_filename_s : "All indexes", NULL, NULL, NULL);
+
+			if (job_p)
+				{
+					const uint32 *value_p = NULL;
+					InSilicoPcr pcr;
+
+					memset (&pcr, 0, sizeof (InSilicoPcr));
+					pcr.isp_max_product_size = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MAX_PRODUCT_SIZE.npt_name_s, &value_p) && value_p && (*value_p > 0)) ? *value_p : S_DEFAULT_MAX_PRODUCT_SIZE;
+					pcr.isp_max_mismatches = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MAX_MISMATCHES.npt_name_s, &value_p) && value_p) ? *value_p : S_DEFAULT_MAX_MISMATCHES;
+					pcr.isp_max_products = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MAX_PRODUCTS.npt_name_s, &value_p) && value_p && (*value_p > 0)) ? *value_p : S_DEFAULT_MAX_PRODUCTS;
+
+					LogParameterSet (param_set_p, job_p);
+
+					SetServiceJobStatus (job_p, OS_STARTED);
+					LogServiceJob (job_p);
+
+					/* Assume failure */
+					SetServiceJobStatus (job_p, OS_FAILED);
+
+					if (ParsePrimerPairs (pairs_s, &pcr, job_p) && BuildSeedIndex (&pcr, job_p))
+						{
+							bool success_flag = true;
+							bool found_flag = false;
+
+							if (index_data_p)
+								{
+									success_flag = AddIndexTasks (&pcr, index_data_p, region_s, &found_flag);
+								}
+							else
+								{
+									size_t i;
+
+									/* Each index is searched for the region and those without it are skipped */
+									for (i = 0; (i < data_p -> stsd_index_data_size) && success_flag; ++ i)
+										{
+											IndexData *current_index_p = data_p -> stsd_index_data_p + i;
+
+											if (current_index_p -> id_fasta_filename_s)
+												{
+													success_flag = AddIndexTasks (&pcr, current_index_p, region_s, &found_flag);
+												}
+										}
+								}
+
+							if (success_flag && found_flag)
+								{
+									if (RunWorkerPool (pcr.isp_num_tasks, data_p -> stsd_num_threads, ScanPcrBlock, &pcr))
+										{
+											bool complete_flag = true;
+											size_t first_task = 0;
+
+											/* The blocks of each scaffold are consecutive so pair up the sites a scaffold at a time */
+											while ((first_task < pcr.isp_num_tasks) && success_flag && complete_flag)
+												{
+													const PcrTask *first_p = pcr.isp_tasks_p + first_task;
+													size_t end_task = first_task + 1;
+
+													while ((end_task < pcr.isp_num_tasks) && (pcr.isp_tasks_p [end_task].pt_index_data_p == first_p -> pt_index_data_p) && (pcr.isp_tasks_p [end_task].pt_scaffold_name_s == first_p -> pt_scaffold_name_s))
+														{
+															++ end_task;
+														}
+
+													success_flag = PairScaffoldHits (&pcr, first_task, end_task, &complete_flag);
+													first_task = end_task;
+												}
+
+											/* Then fetch all of the products in one go */
+											if (success_flag && RunWorkerPool (pcr.isp_num_products, data_p -> stsd_num_threads, FetchPcrProduct, &pcr))
+												{
+													json_t *result_p = GetPcrProductsAsJSON (&pcr);
+
+													if (result_p)
+														{
+															if (AddInlineResultToServiceJob (job_p, "pcr_products", result_p))
+																{
+																	if (complete_flag)
+																		{
+																			SetServiceJobStatus (job_p, OS_SUCCEEDED);
+																		}
+																	else
+																		{
+																			AddGeneralErrorMessageToServiceJob (job_p, "Stopped after reaching Max products");
+																			SetServiceJobStatus (job_p, OS_PARTIALLY_SUCCEEDED);
+																		}
+																}
+
+															json_decref (result_p);
+														}
+												}
+											else
+												{
+													AddGeneralErrorMessageToServiceJob (job_p, "Failed to get the products");
+												}
+										}
+									else
+										{
+											AddGeneralErrorMessageToServiceJob (job_p, "Failed to search for the primers");
+										}
+								}
+							else if (success_flag)
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "Unknown region");
+								}
+							else
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "Failed to split the search into blocks");
+								}
+						}
+
+					ClearInSilicoPcr (&pcr);
+
+					LogServiceJob (job_p);
+				}		/* if (job_p) */
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get a FASTA file, region and primer pairs for in silico PCR");
+		}
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static bool ParsePrimerPairs (const char *pairs_s, InSilicoPcr *pcr_p, ServiceJob *job_p)
+{
+	const char *start_p = pairs_s;
+	size_t max_pairs = 1;
+
+	while ((start_p = strpbrk (start_p, S_PAIR_SEPARATORS_S)) != NULL)
+		{
+			++ max_pairs;
+			++ start_p;
+		}
+
+	if ((pcr_p -> isp_pairs_p = (PrimerPair *) AllocMemoryArray (sizeof (PrimerPair), max_pairs)) != NULL)
+		{
+			start_p = pairs_s;
+
+			while (*start_p)
+				{
+					const size_t length = strcspn (start_p, S_PAIR_SEPARATORS_S);
+
+					/* Skip blank lines */
+					if (strspn (start_p, S_PRIMER_SEPARATORS_S) < length)
+						{
+							if (!ParsePrimerPair (start_p, length, pcr_p -> isp_pairs_p + pcr_p -> isp_num_pairs, job_p))
+								{
+									return false;
+								}
+
+							++ (pcr_p -> isp_num_pairs);
+						}
+
+					start_p += length;
+
+					if (*start_p)
+						{
+							++ start_p;
+						}
+				}
+
+			if (pcr_p -> isp_num_pairs > 0)
+				{
+					return true;
+				}
+
+			AddGeneralErrorMessageToServiceJob (job_p, "No primer pairs were given");
+		}
+
+	return false;
+}
+
+
+static bool ParsePrimerPair (const char *entry_s, const size_t entry_length, PrimerPair *pair_p, ServiceJob *job_p)
+{
+	const char *tokens_p [3];
+	size_t token_lengths [3];
+	size_t num_tokens = 0;
+	size_t offset = 0;
+	const char *error_s = NULL;
+
+	memset (pair_p, 0, sizeof (PrimerPair));
+
+	while (offset < entry_length)
+		{
+			size_t token_length;
+
+			offset += strspn (entry_s + offset, S_PRIMER_SEPARATORS_S);
+
+			if (offset >= entry_length)
+				{
+					break;
+				}
+
+			token_length = strcspn (entry_s + offset, S_PRIMER_SEPARATORS_S);
+
+			if (offset + token_length > entry_length)
+				{
+					token_length = entry_length - offset;
+				}
+
+			if (num_tokens == 3)
+				{
+					++ num_tokens;
+					break;
+				}
+
+			tokens_p [num_tokens] = entry_s + offset;
+			token_lengths [num_tokens] = token_length;
+			++ num_tokens;
+
+			offset += token_length;
+		}
+
+	if ((num_tokens == 2) || (num_tokens == 3))
+		{
+			const size_t first_primer = num_tokens - 2;
+			size_t i;
+
+			if (num_tokens == 3)
+				{
+					pair_p -> pp_name_s = CopyToNewString (tokens_p [0], token_lengths [0], false);
+				}
+			else
+				{
+					/* Without a name, a pair is known by its primers */
+					char *forward_s = CopyToNewString (tokens_p [0], token_lengths [0], false);
+					char *reverse_s = CopyToNewString (tokens_p [1], token_lengths [1], false);
+
+					if (forward_s && reverse_s)
+						{
+							pair_p -> pp_name_s = ConcatenateVarargsStrings (forward_s, "/", reverse_s, NULL);
+						}
+
+					if (forward_s)
+						{
+							FreeCopiedString (forward_s);
+						}
+
+					if (reverse_s)
+						{
+							FreeCopiedString (reverse_s);
+						}
+				}
+
+			for (i = 0; (i < 2) && pair_p -> pp_name_s && !error_s; ++ i)
+				{
+					const size_t length = token_lengths [first_primer + i];
+					char *primer_s = (char *) AllocMemory (length + 1);
+
+					if (primer_s)
+						{
+							size_t j;
+
+							for (j = 0; j < length; ++ j)
+								{
+									primer_s [j] = (char) toupper (tokens_p [first_primer + i][j]);
+
+									if (!GetIUPACBases (primer_s [j]))
+										{
+											error_s = " has a primer with bases that are not IUPAC codes";
+										}
+								}
+
+							primer_s [length] = '\0';
+							pair_p -> pp_primers_ss [i] = primer_s;
+
+							if (!error_s && (length < PCR_SEED_LENGTH))
+								{
+									error_s = " has a primer shorter than 12 bases";
+								}
+						}
+					else
+						{
+							error_s = " could not be allocated";
+						}
+				}
+
+			if (pair_p -> pp_name_s && !error_s)
+				{
+					return true;
+				}
+		}
+	else
+		{
+			error_s = " needs a forward and a reverse primer";
+		}
+
+	{
+		char *line_s = CopyToNewString (entry_s, entry_length, true);
+		char *message_s = line_s ? ConcatenateVarargsStrings ("Primer pair \"", line_s, "\"", error_s ? error_s : " could not be read", NULL) : NULL;
+
+		AddGeneralErrorMessageToServiceJob (job_p, message_s ? message_s : "Invalid primer pair");
+
+		if (message_s)
+			{
+				FreeCopiedString (message_s);
+			}
+
+		if (line_s)
+			{
+				FreeCopiedString (line_s);
+			}
+	}
+
+	/* The pair hasn't been counted so it has to be freed here */
+	if (pair_p -> pp_primers_ss [0])
+		{
+			FreeMemory (pair_p -> pp_primers_ss [0]);
+		}
+
+	if (pair_p -> pp_primers_ss [1])
+		{
+			FreeMemory (pair_p -> pp_primers_ss [1]);
+		}
+
+	if (pair_p -> pp_name_s)
+		{
+			FreeCopiedString (pair_p -> pp_name_s);
+		}
+
+	return false;
+}
+
+
+static bool BuildSeedIndex (InSilicoPcr *pcr_p, ServiceJob *job_p)
+{
+	const uint32 num_sites = 4 * (pcr_p -> isp_num_pairs);
+
+	pcr_p -> isp_sites_p = (PcrSite *) AllocMemoryArray (sizeof (PcrSite), num_sites);
+	pcr_p -> isp_seed_bits_p = (uint8 *) AllocMemory (PCR_NUM_SEEDS >> 3);
+
+	if ((pcr_p -> isp_sites_p) && (pcr_p -> isp_seed_bits_p))
+		{
+			uint32 i;
+
+			memset (pcr_p -> isp_sites_p, 0, num_sites * sizeof (PcrSite));
+			memset (pcr_p -> isp_seed_bits_p, 0, PCR_NUM_SEEDS >> 3);
+
+			for (i = 0; i < num_sites; ++ i)
+				{
+					PcrSite *site_p = pcr_p -> isp_sites_p + i;
+					const char *primer_s = pcr_p -> isp_pairs_p [i >> 2].pp_primers_ss [(i >> 1) & 1];
+					const size_t length = strlen (primer_s);
+
+					site_p -> ps_pair_index = i >> 2;
+					site_p -> ps_primer = (i >> 1) & 1;
+					site_p -> ps_reversed_flag = ((i & 1) != 0);
+					site_p -> ps_length = (uint32) length;
+
+					if ((site_p -> ps_bases_s = (char *) AllocMemory (length + 1)) == NULL)
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate primer site");
+							return false;
+						}
+
+					/* The 3' end is at the right of a primer as written and at the left once it's reverse complemented */
+					if (site_p -> ps_reversed_flag)
+						{
+							ReverseComplementSequence (site_p -> ps_bases_s, primer_s, length);
+							site_p -> ps_seed_offset = 0;
+						}
+					else
+						{
+							memcpy (site_p -> ps_bases_s, primer_s, length);
+							site_p -> ps_seed_offset = (uint32) length - PCR_SEED_LENGTH;
+						}
+
+					site_p -> ps_bases_s [length] = '\0';
+
+					if (length > pcr_p -> isp_max_site_length)
+						{
+							pcr_p -> isp_max_site_length = (uint32) length;
+						}
+
+					if (!AddSiteSeeds (pcr_p, i))
+						{
+							char *message_s = ConcatenateVarargsStrings ("Primer pair ", pcr_p -> isp_pairs_p [i >> 2].pp_name_s, " has too many degenerate bases at a 3' end", NULL);
+
+							AddGeneralErrorMessageToServiceJob (job_p, message_s ? message_s : "A primer has too many degenerate bases at its 3' end");
+
+							if (message_s)
+								{
+									FreeCopiedString (message_s);
+								}
+
+							return false;
+						}
+				}
+
+			qsort (pcr_p -> isp_seeds_p, pcr_p -> isp_num_seeds, sizeof (SeedEntry), CompareSeedEntries);
+
+			return true;
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate seed index");
+
+	return false;
+}
+
+
+static bool AddSiteSeeds (InSilicoPcr *pcr_p, const uint32 site_index)
+{
+	const PcrSite *site_p = pcr_p -> isp_sites_p + site_index;
+	const char *seed_s = site_p -> ps_bases_s + site_p -> ps_seed_offset;
+	size_t choices [PCR_SEED_LENGTH];
+	size_t num_expansions = 1;
+	bool more_flag = true;
+	size_t i;
+
+	for (i = 0; i < PCR_SEED_LENGTH; ++ i)
+		{
+			num_expansions *= strlen (GetIUPACBases (seed_s [i]));
+			choices [i] = 0;
+		}
+
+	if (num_expansions > S_MAX_SEED_EXPANSIONS)
+		{
+			return false;
+		}
+
+	if (pcr_p -> isp_num_seeds + num_expansions > pcr_p -> isp_max_seeds)
+		{
+			const size_t new_max = ((pcr_p -> isp_max_seeds > 0) ? (pcr_p -> isp_max_seeds << 1) : 64) + num_expansions;
+			SeedEntry *seeds_p = (pcr_p -> isp_seeds_p) ?
+				(SeedEntry *) ReallocMemory (pcr_p -> isp_seeds_p, new_max * sizeof (SeedEntry), (pcr_p -> isp_max_seeds) * sizeof (SeedEntry)) :
+				(SeedEntry *) AllocMemoryArray (sizeof (SeedEntry), new_max);
+
+			if (!seeds_p)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " seeds", new_max);
+					return false;
+				}
+
+			pcr_p -> isp_seeds_p = seeds_p;
+			pcr_p -> isp_max_seeds = new_max;
+		}
+
+	/* Step through every combination of the degenerate bases like an odometer */
+	while (more_flag)
+		{
+			SeedEntry *entry_p = pcr_p -> isp_seeds_p + pcr_p -> isp_num_seeds;
+			uint32 seed = 0;
+
+			for (i = 0; i < PCR_SEED_LENGTH; ++ i)
+				{
+					seed = (seed << 2) | (uint32) (S_BASE_CODES [(unsigned char) GetIUPACBases (seed_s [i]) [choices [i]]] - 1);
+				}
+
+			entry_p -> se_seed = seed;
+			entry_p -> se_site_index = site_index;
+			++ (pcr_p -> isp_num_seeds);
+
+			pcr_p -> isp_seed_bits_p [seed >> 3] |= (uint8) (1 << (seed & 7));
+
+			more_flag = false;
+
+			for (i = PCR_SEED_LENGTH; i > 0; )
+				{
+					-- i;
+
+					if (GetIUPACBases (seed_s [i]) [++ (choices [i])] != '\0')
+						{
+							more_flag = true;
+							break;
+						}
+
+					choices [i] = 0;
+				}
+		}
+
+	return true;
+}
+
+
+static int CompareSeedEntries (const void *v0_p, const void *v1_p)
+{
+	const SeedEntry *entry0_p = (const SeedEntry *) v0_p;
+	const SeedEntry *entry1_p = (const SeedEntry *) v1_p;
+
+	if (entry0_p -> se_seed != entry1_p -> se_seed)
+		{
+			return (entry0_p -> se_seed < entry1_p -> se_seed) ? -1 : 1;
+		}
+
+	return (entry0_p -> se_site_index < entry1_p -> se_site_index) ? -1 : ((entry0_p -> se_site_index > entry1_p -> se_site_index) ? 1 : 0);
+}
+
+
+static bool AddIndexTasks (InSilicoPcr *pcr_p, IndexData *index_data_p, const char *region_s, bool *found_flag_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (region_s, "*") == 0)
+		{
+			faidx_t *fai_p = LockIndexFaidx (index_data_p);
+
+			if (fai_p)
+				{
+					const int num_seqs = faidx_nseq (fai_p);
+					int i;
+
+					for (i = 0; (i < num_seqs) && success_flag; ++ i)
+						{
+							/* The names belong to the index, which stays open, so the tasks can keep them */
+							const char *name_s = faidx_iseq (fai_p, i);
+
+							success_flag = AddPcrTask (pcr_p, index_data_p, name_s, 0, faidx_seq_len64 (fai_p, name_s));
+						}
+
+					UnlockIndexFaidx (index_data_p);
+
+					*found_flag_p = true;
+				}
+			else
+				{
+					success_flag = false;
+				}
+		}
+	else
+		{
+			IndexRegion region;
+
+			if (ParseIndexRegion (index_data_p, region_s, &region))
+				{
+					success_flag = AddPcrTask (pcr_p, index_data_p, region.ir_scaffold_name_s, region.ir_start, region.ir_end);
+					*found_flag_p = true;
+				}
+		}
+
+	return success_flag;
+}
+
+
+static bool AddPcrTask (InSilicoPcr *pcr_p, IndexData *index_data_p, const char *scaffold_name_s, const hts_pos_t start, const hts_pos_t end)
+{
+	hts_pos_t block_start;
+
+	for (block_start = start; block_start < end; block_start += S_BLOCK_SIZE)
+		{
+			PcrTask *task_p;
+
+			if (pcr_p -> isp_num_tasks == pcr_p -> isp_max_tasks)
+				{
+					const size_t new_max = (pcr_p -> isp_max_tasks > 0) ? (pcr_p -> isp_max_tasks << 1) : 256;
+					PcrTask *tasks_p = (pcr_p -> isp_tasks_p) ?
+						(PcrTask *) ReallocMemory (pcr_p -> isp_tasks_p, new_max * sizeof (PcrTask), (pcr_p -> isp_max_tasks) * sizeof (PcrTask)) :
+						(PcrTask *) AllocMemoryArray (sizeof (PcrTask), new_max);
+
+					if (!tasks_p)
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " in silico PCR tasks", new_max);
+							return false;
+						}
+
+					pcr_p -> isp_tasks_p = tasks_p;
+					pcr_p -> isp_max_tasks = new_max;
+				}
+
+			task_p = pcr_p -> isp_tasks_p + pcr_p -> isp_num_tasks;
+			memset (task_p, 0, sizeof (PcrTask));
+
+			task_p -> pt_index_data_p = index_data_p;
+			task_p -> pt_scaffold_name_s = scaffold_name_s;
+			task_p -> pt_block_start = block_start;
+			task_p -> pt_block_end = (end - block_start < S_BLOCK_SIZE) ? end : block_start + S_BLOCK_SIZE;
+			task_p -> pt_region_start = start;
+			task_p -> pt_region_end = end;
+
+			++ (pcr_p -> isp_num_tasks);
+		}
+
+	return true;
+}
+
+
+static bool ScanPcrBlock (const size_t task_index, void *data_p)
+{
+	const InSilicoPcr *pcr_p = (const InSilicoPcr *) data_p;
+	PcrTask *task_p = pcr_p -> isp_tasks_p + task_index;
+
+	/* Read far enough either side of the block to see the whole of any site starting within it */
+	const hts_pos_t margin = (hts_pos_t) (pcr_p -> isp_max_site_length) - 1;
+	const hts_pos_t fetch_start = (task_p -> pt_block_start - task_p -> pt_region_start > margin) ? task_p -> pt_block_start - margin : task_p -> pt_region_start;
+	const hts_pos_t fetch_end = (task_p -> pt_region_end - task_p -> pt_block_end > margin) ? task_p -> pt_block_end + margin : task_p -> pt_region_end;
+	bool success_flag = false;
+	hts_pos_t length = 0;
+	char *sequence_s = FetchIndexSequence (task_p -> pt_index_data_p, task_p -> pt_scaffold_name_s, fetch_start, fetch_end, &length);
+
+	if (sequence_s)
+		{
+			const uint32 seed_mask = PCR_NUM_SEEDS - 1;
+			uint32 seed = 0;
+			uint32 num_valid = 0;
+			hts_pos_t i;
+
+			success_flag = true;
+
+			for (i = 0; (i < length) && success_flag; ++ i)
+				{
+					const uint8 code = S_BASE_CODES [(unsigned char) sequence_s [i]];
+
+					if (code > 0)
+						{
+							seed = ((seed << 2) | (uint32) (code - 1)) & seed_mask;
+
+							if ((++ num_valid >= PCR_SEED_LENGTH) && (pcr_p -> isp_seed_bits_p [seed >> 3] & (1 << (seed & 7))))
+								{
+									const hts_pos_t seed_start = i + 1 - PCR_SEED_LENGTH;
+									size_t lo = 0;
+									size_t hi = pcr_p -> isp_num_seeds;
+
+									/* Find the first entry for the seed */
+									while (lo < hi)
+										{
+											const size_t mid = (lo + hi) >> 1;
+
+											if (pcr_p -> isp_seeds_p [mid].se_seed < seed)
+												{
+													lo = mid + 1;
+												}
+											else
+												{
+													hi = mid;
+												}
+										}
+
+									for ( ; (lo < pcr_p -> isp_num_seeds) && (pcr_p -> isp_seeds_p [lo].se_seed == seed) && success_flag; ++ lo)
+										{
+											const uint32 site_index = pcr_p -> isp_seeds_p [lo].se_site_index;
+											const PcrSite *site_p = pcr_p -> isp_sites_p + site_index;
+											const hts_pos_t site_start = seed_start - (hts_pos_t) (site_p -> ps_seed_offset);
+											const hts_pos_t start = fetch_start + site_start;
+
+											if ((site_start >= 0) && (site_start + (hts_pos_t) (site_p -> ps_length) <= length) &&
+												(start >= task_p -> pt_block_start) && (start < task_p -> pt_block_end))
+												{
+													const uint32 mismatches = CountSiteMismatches (site_p, sequence_s + site_start, pcr_p -> isp_max_mismatches);
+
+													if (mismatches <= pcr_p -> isp_max_mismatches)
+														{
+															success_flag = AddPcrHit (task_p, (uint64) start, site_index, mismatches);
+														}
+												}
+										}
+								}
+						}
+					else
+						{
+							num_valid = 0;
+						}
+				}
+
+			free (sequence_s);
+		}
+
+	return success_flag;
+}
+
+
+static bool AddPcrHit (PcrTask *task_p, const uint64 start, const uint32 site_index, const uint32 mismatches)
+{
+	PcrHit *hit_p;
+
+	if (task_p -> pt_num_hits == task_p -> pt_max_hits)
+		{
+			const size_t new_max = (task_p -> pt_max_hits > 0) ? (task_p -> pt_max_hits << 1) : 64;
+			PcrHit *hits_p = (task_p -> pt_hits_p) ?
+				(PcrHit *) ReallocMemory (task_p -> pt_hits_p, new_max * sizeof (PcrHit), (task_p -> pt_max_hits) * sizeof (PcrHit)) :
+				(PcrHit *) AllocMemoryArray (sizeof (PcrHit), new_max);
+
+			if (!hits_p)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " primer sites", new_max);
+					return false;
+				}
+
+			task_p -> pt_hits_p = hits_p;
+			task_p -> pt_max_hits = new_max;
+		}
+
+	hit_p = task_p -> pt_hits_p + task_p -> pt_num_hits;
+	hit_p -> ph_start = start;
+	hit_p -> ph_site_index = site_index;
+	hit_p -> ph_mismatches = mismatches;
+
+	++ (task_p -> pt_num_hits);
+
+	return true;
+}
+
+
+static uint32 CountSiteMismatches (const PcrSite *site_p, const char *sequence_s, const uint32 max_mismatches)
+{
+	const uint32 seed_end = site_p -> ps_seed_offset + PCR_SEED_LENGTH;
+	uint32 mismatches = 0;
+	uint32 i;
+
+	for (i = 0; i < site_p -> ps_length; ++ i)
+		{
+			/* The seed is already known to match */
+			if (i == site_p -> ps_seed_offset)
+				{
+					i = seed_end - 1;
+				}
+			else
+				{
+					const char base = (char) toupper (sequence_s [i]);
+
+					if ((base == '\0') || !strchr (GetIUPACBases (site_p -> ps_bases_s [i]), base))
+						{
+							if (++ mismatches > max_mismatches)
+								{
+									break;
+								}
+						}
+				}
+		}
+
+	return mismatches;
+}
+
+
+static bool PairScaffoldHits (InSilicoPcr *pcr_p, const size_t first_task, const size_t end_task, bool *complete_flag_p)
+{
+	PcrHit *hits_p = NULL;
+	size_t num_hits = 0;
+	size_t i;
+
+	for (i = first_task; i < end_task; ++ i)
+		{
+			num_hits += pcr_p -> isp_tasks_p [i].pt_num_hits;
+		}
+
+	if (num_hits == 0)
+		{
+			return true;
+		}
+
+	if ((hits_p = (PcrHit *) AllocMemoryArray (sizeof (PcrHit), num_hits)) != NULL)
+		{
+			const PcrTask *task_p = pcr_p -> isp_tasks_p + first_task;
+			size_t offset = 0;
+			bool success_flag = true;
+
+			for (i = first_task; i < end_task; ++ i)
+				{
+					const PcrTask *current_task_p = pcr_p -> isp_tasks_p + i;
+
+					if (current_task_p -> pt_num_hits > 0)
+						{
+							memcpy (hits_p + offset, current_task_p -> pt_hits_p, (current_task_p -> pt_num_hits) * sizeof (PcrHit));
+							offset += current_task_p -> pt_num_hits;
+						}
+				}
+
+			qsort (hits_p, num_hits, sizeof (PcrHit), ComparePcrHits);
+
+			/*
+			 * A product runs from a primer facing towards the end of the scaffold
+			 * to the reverse complement of its partner within the size limit.
+			 */
+			for (i = 0; (i < num_hits) && success_flag; ++ i)
+				{
+					const PcrHit *hit_p = hits_p + i;
+					const PcrSite *site_p = pcr_p -> isp_sites_p + hit_p -> ph_site_index;
+
+					if (! (site_p -> ps_reversed_flag))
+						{
+							const uint32 partner_index = (site_p -> ps_pair_index << 2) | ((1 - site_p -> ps_primer) << 1) | 1;
+							const uint64 max_end = hit_p -> ph_start + pcr_p -> isp_max_product_size;
+							size_t j;
+
+							for (j = i + 1; (j < num_hits) && (hits_p [j].ph_start < max_end) && success_flag; ++ j)
+								{
+									if (hits_p [j].ph_site_index == partner_index)
+										{
+											const uint64 end = hits_p [j].ph_start + pcr_p -> isp_sites_p [partner_index].ps_length;
+
+											if ((end <= max_end) && (end >= hit_p -> ph_start + site_p -> ps_length))
+												{
+													PcrProduct *product_p;
+
+													if (pcr_p -> isp_num_products == pcr_p -> isp_max_products)
+														{
+															*complete_flag_p = false;
+															FreeMemory (hits_p);
+															return true;
+														}
+
+													if (pcr_p -> isp_num_products == pcr_p -> isp_max_products_allocated)
+														{
+															const size_t new_max = (pcr_p -> isp_max_products_allocated > 0) ? (pcr_p -> isp_max_products_allocated << 1) : 64;
+															PcrProduct *products_p = (pcr_p -> isp_products_p) ?
+																(PcrProduct *) ReallocMemory (pcr_p -> isp_products_p, new_max * sizeof (PcrProduct), (pcr_p -> isp_max_products_allocated) * sizeof (PcrProduct)) :
+																(PcrProduct *) AllocMemoryArray (sizeof (PcrProduct), new_max);
+
+															if (!products_p)
+																{
+																	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " products", new_max);
+																	success_flag = false;
+																	break;
+																}
+
+															pcr_p -> isp_products_p = products_p;
+															pcr_p -> isp_max_products_allocated = new_max;
+														}
+
+													product_p = pcr_p -> isp_products_p + pcr_p -> isp_num_products;
+
+													product_p -> pp_pair_index = site_p -> ps_pair_index;
+													product_p -> pp_index_data_p = task_p -> pt_index_data_p;
+													product_p -> pp_scaffold_name_s = task_p -> pt_scaffold_name_s;
+													product_p -> pp_start = (hts_pos_t) (hit_p -> ph_start);
+													product_p -> pp_end = (hts_pos_t) end;
+													product_p -> pp_sequence_s = NULL;
+
+													/* If the reverse primer is the one facing the end of the scaffold, the product is on the bottom strand */
+													if (site_p -> ps_primer == 0)
+														{
+															product_p -> pp_strand = '+';
+															product_p -> pp_forward_mismatches = hit_p -> ph_mismatches;
+															product_p -> pp_reverse_mismatches = hits_p [j].ph_mismatches;
+														}
+													else
+														{
+															product_p -> pp_strand = '-';
+															product_p -> pp_forward_mismatches = hits_p [j].ph_mismatches;
+															product_p -> pp_reverse_mismatches = hit_p -> ph_mismatches;
+														}
+
+													++ (pcr_p -> isp_num_products);
+												}
+										}
+								}
+						}
+				}
+
+			FreeMemory (hits_p);
+
+			return success_flag;
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " primer sites", num_hits);
+
+	return false;
+}
+
+
+static int ComparePcrHits (const void *v0_p, const void *v1_p)
+{
+	const PcrHit *hit0_p = (const PcrHit *) v0_p;
+	const PcrHit *hit1_p = (const PcrHit *) v1_p;
+
+	if (hit0_p -> ph_start != hit1_p -> ph_start)
+		{
+			return (hit0_p -> ph_start < hit1_p -> ph_start) ? -1 : 1;
+		}
+
+	return (hit0_p -> ph_site_index < hit1_p -> ph_site_index) ? -1 : ((hit0_p -> ph_site_index > hit1_p -> ph_site_index) ? 1 : 0);
+}
+
+
+static bool FetchPcrProduct (const size_t product_index, void *data_p)
+{
+	InSilicoPcr *pcr_p = (InSilicoPcr *) data_p;
+	PcrProduct *product_p = pcr_p -> isp_products_p + product_index;
+	hts_pos_t length = 0;
+
+	product_p -> pp_sequence_s = FetchIndexSequence (product_p -> pp_index_data_p, product_p -> pp_scaffold_name_s, product_p -> pp_start, product_p -> pp_end, &length);
+
+	if (product_p -> pp_sequence_s)
+		{
+			/* A bottom strand product is turned round so that it reads from the forward primer */
+			if (product_p -> pp_strand == '-')
+				{
+					char *start_p = product_p -> pp_sequence_s;
+					char *end_p = start_p + length - 1;
+
+					while (start_p < end_p)
+						{
+							const char c = ComplementBase (*start_p);
+
+							*start_p = ComplementBase (*end_p);
+							*end_p = c;
+
+							++ start_p;
+							-- end_p;
+						}
+
+					if (start_p == end_p)
+						{
+							*start_p = ComplementBase (*start_p);
+						}
+				}
+
+			return true;
+		}
+
+	return false;
+}
+
+
+static json_t *GetPcrProductsAsJSON (const InSilicoPcr *pcr_p)
+{
+	json_t *result_p = json_pack ("{s:I,s:I}", "max_product_size", (json_int_t) (pcr_p -> isp_max_product_size), "max_mismatches", (json_int_t) (pcr_p -> isp_max_mismatches));
+	json_t *products_p = json_array ();
+
+	if (result_p && products_p && (json_object_set_new (result_p, "products", products_p) == 0))
+		{
+			bool success_flag = true;
+			size_t i;
+
+			for (i = 0; (i < pcr_p -> isp_num_products) && success_flag; ++ i)
+				{
+					const PcrProduct *product_p = pcr_p -> isp_products_p + i;
+					const IndexData *index_data_p = product_p -> pp_index_data_p;
+					json_t *product_json_p = json_pack ("{s:s,s:s,s:s,s:I,s:I,s:s,s:I,s:I,s:I,s:s}",
+						"pair", pcr_p -> isp_pairs_p [product_p -> pp_pair_index].pp_name_s,
+						"index", (index_data_p -> id_blast_db_name_s) ? index_data_p -> id_blast_db_name_s : index_data_p -> id_fasta_filename_s,
+						"scaffold", product_p -> pp_scaffold_name_s,
+						"start", (json_int_t) (product_p -> pp_start + 1),
+						"end", (json_int_t) (product_p -> pp_end),
+						"strand", (product_p -> pp_strand == '+') ? "+" : "-",
+						"length", (json_int_t) (product_p -> pp_end - product_p -> pp_start),
+						"forward_mismatches", (json_int_t) (product_p -> pp_forward_mismatches),
+						"reverse_mismatches", (json_int_t) (product_p -> pp_reverse_mismatches),
+						"sequence", product_p -> pp_sequence_s);
+
+					success_flag = (product_json_p && (json_array_append_new (products_p, product_json_p) == 0));
+				}
+
+			if (success_flag)
+				{
+					return result_p;
+				}
+		}
+	else if (products_p)
+		{
+			json_decref (products_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create the in silico PCR results");
+
+	if (result_p)
+		{
+			json_decref (result_p);
+		}
+
+	return NULL;
+}
+
+
+static void ClearInSilicoPcr (InSilicoPcr *pcr_p)
+{
+	size_t i;
+
+	if (pcr_p -> isp_pairs_p)
+		{
+			for (i = 0; i < pcr_p -> isp_num_pairs; ++ i)
+				{
+					FreeCopiedString (pcr_p -> isp_pairs_p [i].pp_name_s);
+					FreeMemory (pcr_p -> isp_pairs_p [i].pp_primers_ss [0]);
+					FreeMemory (pcr_p -> isp_pairs_p [i].pp_primers_ss [1]);
+				}
+
+			FreeMemory (pcr_p -> isp_pairs_p);
+		}
+
+	if (pcr_p -> isp_sites_p)
+		{
+			for (i = 0; i < 4 * (size_t) (pcr_p -> isp_num_pairs); ++ i)
+				{
+					if (pcr_p -> isp_sites_p [i].ps_bases_s)
+						{
+							FreeMemory (pcr_p -> isp_sites_p [i].ps_bases_s);
+						}
+				}
+
+			FreeMemory (pcr_p -> isp_sites_p);
+		}
+
+	if (pcr_p -> isp_seed_bits_p)
+		{
+			FreeMemory (pcr_p -> isp_seed_bits_p);
+		}
+
+	if (pcr_p -> isp_seeds_p)
+		{
+			FreeMemory (pcr_p -> isp_seeds_p);
+		}
+
+	if (pcr_p -> isp_tasks_p)
+		{
+			for (i = 0; i < pcr_p -> isp_num_tasks; ++ i)
+				{
+					if (pcr_p -> isp_tasks_p [i].pt_hits_p)
+						{
+							FreeMemory (pcr_p -> isp_tasks_p [i].pt_hits_p);
+						}
+				}
+
+			FreeMemory (pcr_p -> isp_tasks_p);
+		}
+
+	if (pcr_p -> isp_products_p)
+		{
+			for (i = 0; i < pcr_p -> isp_num_products; ++ i)
+				{
+					if (pcr_p -> isp_products_p [i].pp_sequence_s)
+						{
+							free (pcr_p -> isp_products_p [i].pp_sequence_s);
+						}
+				}
+
+			FreeMemory (pcr_p -> isp_products_p);
+		}
+
+	memset (pcr_p, 0, sizeof (InSilicoPcr));
+}
@@ -0,0 +1,297 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * index_data.c
+ *
+ * @file
+ * @brief
+ */
+
+#include "index_data.h"
+#include "gap_map.h"
+#include "composition_track.h"
+#include "fm_index.h"
+#include "minhash_sketch.h"
+#include "window_prefetch.h"
+#include "streams.h"
+
+
+#ifdef _DEBUG
+	#define INDEX_DATA_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define INDEX_DATA_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * The number of bytes of decompressed blocks that each faidx handle keeps
+ * so that repeated requests for nearby regions of a bgzipped FASTA file
+ * don't need to inflate the same blocks again.
+ */
+static const int S_FAI_CACHE_SIZE = 16 * 1024 * 1024;
+
+
+bool InitIndexData (IndexData *index_data_p, const char *blast_db_s, const char *fasta_filename_s)
+{
+	index_data_p -> id_blast_db_name_s = blast_db_s;
+	index_data_p -> id_fasta_filename_s = fasta_filename_s;
+	index_data_p -> id_fai_p = NULL;
+	index_data_p -> id_cram_refs_p = NULL;
+	index_data_p -> id_cram_refs_holder_p = NULL;
+	index_data_p -> id_gap_map_p = NULL;
+	index_data_p -> id_composition_track_p = NULL;
+	index_data_p -> id_fm_index_p = NULL;
+	index_data_p -> id_sketches_p = NULL;
+	index_data_p -> id_prefetcher_p = NULL;
+
+	if (pthread_mutex_init (& (index_data_p -> id_mutex), NULL) == 0)
+		{
+			if (pthread_mutex_init (& (index_data_p -> id_sidecar_mutex), NULL) == 0)
+				{
+					return true;
+				}
+
+			pthread_mutex_destroy (& (index_data_p -> id_mutex));
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise mutex for \"%s\"", fasta_filename_s ? fasta_filename_s : blast_db_s);
+		}
+
+	return false;
+}
+
+
+void ClearIndexData (IndexData *index_data_p)
+{
+	if (index_data_p -> id_fai_p)
+		{
+			fai_destroy (index_data_p -> id_fai_p);
+			index_data_p -> id_fai_p = NULL;
+		}
+
+	/* Any CRAM files still sharing the references keep them until they are closed */
+	if (index_data_p -> id_cram_refs_holder_p)
+		{
+			sam_close (index_data_p -> id_cram_refs_holder_p);
+			index_data_p -> id_cram_refs_holder_p = NULL;
+		}
+
+	index_data_p -> id_cram_refs_p = NULL;
+
+	if (index_data_p -> id_gap_map_p)
+		{
+			FreeGapMap (index_data_p -> id_gap_map_p);
+			index_data_p -> id_gap_map_p = NULL;
+		}
+
+	if (index_data_p -> id_composition_track_p)
+		{
+			FreeCompositionTrack (index_data_p -> id_composition_track_p);
+			index_data_p -> id_composition_track_p = NULL;
+		}
+
+	if (index_data_p -> id_fm_index_p)
+		{
+			FreeFmIndex (index_data_p -> id_fm_index_p);
+			index_data_p -> id_fm_index_p = NULL;
+		}
+
+	if (index_data_p -> id_sketches_p)
+		{
+			FreeScaffoldSketches (index_data_p -> id_sketches_p);
+			index_data_p -> id_sketches_p = NULL;
+		}
+
+	if (index_data_p -> id_prefetcher_p)
+		{
+			FreeWindowPrefetcher (index_data_p -> id_prefetcher_p);
+			index_data_p -> id_prefetcher_p = NULL;
+		}
+
+	pthread_mutex_destroy (& (index_data_p -> id_sidecar_mutex));
+	pthread_mutex_destroy (& (index_data_p -> id_mutex));
+}
+
+
+faidx_t *LockIndexFaidx (IndexData *index_data_p)
+{
+	if (index_data_p -> id_fasta_filename_s)
+		{
+			pthread_mutex_lock (& (index_data_p -> id_mutex));
+
+			if (! (index_data_p -> id_fai_p))
+				{
+					#if INDEX_DATA_DEBUG >= STM_LEVEL_FINER
+					PrintLog (STM_LEVEL_FINER, __FILE__, __LINE__, "LockIndexFaidx - about to load %s", index_data_p -> id_fasta_filename_s);
+					#endif
+
+					index_data_p -> id_fai_p = fai_load (index_data_p -> id_fasta_filename_s);
+
+					if (index_data_p -> id_fai_p)
+						{
+							fai_set_cache_size (index_data_p -> id_fai_p, S_FAI_CACHE_SIZE);
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to load fasta index %s", index_data_p -> id_fasta_filename_s);
+						}
+				}
+
+			if (index_data_p -> id_fai_p)
+				{
+					return index_data_p -> id_fai_p;
+				}
+
+			pthread_mutex_unlock (& (index_data_p -> id_mutex));
+		}
+
+	return NULL;
+}
+
+
+void UnlockIndexFaidx (IndexData *index_data_p)
+{
+	pthread_mutex_unlock (& (index_data_p -> id_mutex));
+}
+
+
+char *FetchIndexSequence (IndexData *index_data_p, const char *name_s, hts_pos_t beg, hts_pos_t end, hts_pos_t *length_p)
+{
+	char *sequence_s = NULL;
+	faidx_t *fai_p = LockIndexFaidx (index_data_p);
+
+	if (fai_p)
+		{
+			if (end > beg)
+				{
+					/* faidx_fetch_seq64 uses an inclusive end coordinate */
+					sequence_s = faidx_fetch_seq64 (fai_p, name_s, beg, end - 1, length_p);
+				}
+
+			UnlockIndexFaidx (index_data_p);
+
+			if (!sequence_s)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to fetch %s:" INT64_FMT "-" INT64_FMT " from %s", name_s, (int64) beg, (int64) end, index_data_p -> id_fasta_filename_s);
+				}
+		}
+
+	return sequence_s;
+}
+
+
+bool ParseIndexRegion (IndexData *index_data_p, const char *region_s, IndexRegion *region_p)
+{
+	bool success_flag = false;
+	faidx_t *fai_p = LockIndexFaidx (index_data_p);
+
+	if (fai_p)
+		{
+			if (fai_parse_region (fai_p, region_s, & (region_p -> ir_scaffold_index), & (region_p -> ir_start), & (region_p -> ir_end), 0) && (region_p -> ir_scaffold_index >= 0))
+				{
+					region_p -> ir_scaffold_name_s = faidx_iseq (fai_p, region_p -> ir_scaffold_index);
+					region_p -> ir_scaffold_length = faidx_seq_len64 (fai_p, region_p -> ir_scaffold_name_s);
+
+					if (region_p -> ir_end > region_p -> ir_scaffold_length)
+						{
+							region_p -> ir_end = region_p -> ir_scaffold_length;
+						}
+
+					success_flag = (region_p -> ir_start < region_p -> ir_end);
+				}
+
+			UnlockIndexFaidx (index_data_p);
+		}
+
+	return success_flag;
+}
+
+
+bool SetIndexAsCramReference (IndexData *index_data_p, htsFile *cram_file_p)
+{
+	bool success_flag = false;
+
+	if (index_data_p -> id_fasta_filename_s)
+		{
+			pthread_mutex_lock (& (index_data_p -> id_mutex));
+
+			if (index_data_p -> id_cram_refs_p)
+				{
+					if (hts_set_opt (cram_file_p, CRAM_OPT_SHARED_REF, index_data_p -> id_cram_refs_p) == 0)
+						{
+							success_flag = true;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to share the CRAM references for \"%s\"", index_data_p -> id_fasta_filename_s);
+						}
+				}
+			else if (hts_set_fai_filename (cram_file_p, index_data_p -> id_fasta_filename_s) == 0)
+				{
+					/* The references are only kept by KeepIndexCramReference once this file has opened successfully */
+					success_flag = true;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to set \"%s\" as a CRAM reference", index_data_p -> id_fasta_filename_s);
+				}
+
+			pthread_mutex_unlock (& (index_data_p -> id_mutex));
+		}
+
+	return success_flag;
+}
+
+
+void KeepIndexCramReference (IndexData *index_data_p, htsFile *cram_file_p, const char *cram_filename_s)
+{
+	pthread_mutex_lock (& (index_data_p -> id_mutex));
+
+	if (! (index_data_p -> id_cram_refs_p))
+		{
+			refs_t *refs_p = cram_get_refs (cram_file_p);
+
+			if (refs_p)
+				{
+					/*
+					 * Sharing the references with a handle of our own adds to htslib's
+					 * count of their users, so they outlive cram_file_p.
+					 */
+					htsFile *holder_p = sam_open (cram_filename_s, "r");
+
+					if (holder_p)
+						{
+							if (hts_set_opt (holder_p, CRAM_OPT_SHARED_REF, refs_p) == 0)
+								{
+									index_data_p -> id_cram_refs_p = refs_p;
+									index_data_p -> id_cram_refs_holder_p = holder_p;
+								}
+							else
+								{
+									sam_close (holder_p);
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to keep the CRAM references for \"%s\"", index_data_p -> id_fasta_filename_s);
+								}
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to reopen \"%s\" to keep its CRAM references", cram_filename_s);
+						}
+				}
+		}
+
+	pthread_mutex_unlock (& (index_data_p -> id_mutex));
+}
@@ -0,0 +1,772 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * kmer_counter.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "kmer_counter.h"
+#include "worker_pool.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "audit.h"
+
+#include "string_parameter.h"
+#include "unsigned_int_parameter.h"
+
+
+#ifdef _DEBUG
+	#define KMER_COUNTER_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define KMER_COUNTER_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * The k-mers are split into this many partitions by the top bits of
+ * their hashes so that each one can be counted separately in a table
+ * small enough to stay mostly in cache.
+ */
+#define KC_PARTITION_BITS (8)
+
+#define KC_NUM_PARTITIONS (1 << KC_PARTITION_BITS)
+
+
+typedef struct KmerCount
+{
+	uint64 kc_kmer;
+	uint32 kc_count;
+} KmerCount;
+
+
+/*
+ * The canonical k-mers starting within a block, grouped by partition.
+ */
+typedef struct KmerBlock
+{
+	uint64 *kb_kmers_p;
+	size_t kb_offsets [KC_NUM_PARTITIONS + 1];
+} KmerBlock;
+
+
+typedef struct KmerPartition
+{
+	/* The number of k-mers seen each number of times, with the last entry for everything above */
+	uint64 *kp_spectrum_p;
+
+	/* A heap of the most frequent k-mers with the least frequent at the top */
+	KmerCount *kp_top_p;
+	size_t kp_num_top;
+
+	uint64 kp_num_distinct;
+} KmerPartition;
+
+
+typedef struct KmerSpectrum
+{
+	IndexData *ks_index_data_p;
+	const IndexRegion *ks_region_p;
+	uint32 ks_kmer_length;
+	uint32 ks_max_multiplicity;
+	uint32 ks_max_top;
+
+	KmerBlock *ks_blocks_p;
+	size_t ks_num_blocks;
+
+	KmerPartition *ks_partitions_p;
+} KmerSpectrum;
+
+
+static NamedParameterType S_KMER_LENGTH = { "K-mer length", PT_UNSIGNED_INT };
+
+static NamedParameterType S_TOP_KMERS = { "Top k-mers", PT_UNSIGNED_INT };
+
+static NamedParameterType S_MAX_MULTIPLICITY = { "Max multiplicity", PT_UNSIGNED_INT };
+
+
+static const uint32 S_DEFAULT_KMER_LENGTH = 21;
+
+static const uint32 S_DEFAULT_TOP_KMERS = 20;
+
+static const uint32 S_DEFAULT_MAX_MULTIPLICITY = 1000;
+
+/*
+ * Each partition holds a count for every multiplicity up to the
+ * requested maximum, so this keeps those arrays to a few megabytes.
+ */
+static const uint32 S_MAX_MULTIPLICITY_LIMIT = 1000000;
+
+/*
+ * Each of the partitions keeps its own top k-mers and they are all
+ * gathered up to pick the overall ones, so this bounds both.
+ */
+static const uint32 S_MAX_TOP_KMERS_LIMIT = 10000;
+
+/*
+ * The k-mers are packed two bits per base into a uint64.
+ */
+static const uint32 S_MAX_KMER_LENGTH = 32;
+
+/*
+ * Every k-mer in the region is held in memory at once, so this keeps
+ * a single job to around a gigabyte.
+ */
+static const hts_pos_t S_MAX_REGION_LENGTH = 1 << 27;
+
+/*
+ * Each task gathers the k-mers starting in this many bases.
+ */
+static const hts_pos_t S_BLOCK_SIZE = 1 << 22;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool GatherKmerBlock (const size_t task_index, void *data_p);
+
+static size_t GetCanonicalKmers (const char *sequence_s, const size_t length, const uint32 kmer_length, uint64 *kmers_p);
+
+static bool CountKmerPartition (const size_t task_index, void *data_p);
+
+static void AddTopKmer (KmerCount *top_p, size_t *num_top_p, const size_t max_top, const KmerCount *kmer_count_p);
+
+static bool IsMoreFrequentKmer (const KmerCount *kmer_count0_p, const KmerCount *kmer_count1_p);
+
+static json_t *GetKmerSpectrumAsJSON (const KmerSpectrum *spectrum_p);
+
+static void ClearKmerSpectrum (KmerSpectrum *spectrum_p);
+
+static uint64 MixKmer (uint64 kmer);
+
+static int CompareKmerCounts (const void *v0_p, const void *v1_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool AddKmerCountParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	return ((EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_KMER_LENGTH.npt_name_s, "K-mer length", "The length of the k-mers to count, up to 32", &S_DEFAULT_KMER_LENGTH, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_TOP_KMERS.npt_name_s, "Top k-mers", "The number of the most frequent k-mers to return", &S_DEFAULT_TOP_KMERS, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MAX_MULTIPLICITY.npt_name_s, "Max multiplicity", "The last bin of the spectrum, which also counts the k-mers that occur more often than this", &S_DEFAULT_MAX_MULTIPLICITY, PL_ADVANCED) != NULL));
+}
+
+
+bool GetKmerCountParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_KMER_LENGTH.npt_name_s) == 0)
+		{
+			*pt_p = S_KMER_LENGTH.npt_type;
+		}
+	else if (strcmp (param_name_s, S_TOP_KMERS.npt_name_s) == 0)
+		{
+			*pt_p = S_TOP_KMERS.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MAX_MULTIPLICITY.npt_name_s) == 0)
+		{
+			*pt_p = S_MAX_MULTIPLICITY.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+void RunKmerCountJob (Service *service_p, ParameterSet *param_set_p)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	IndexData *index_data_p = GetSelectedIndexData (data_p, param_set_p);
+	const char *region_s = NULL;
+
+	if (index_data_p && (index_data_p -> id_fasta_filename_s) && GetCurrentStringParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD.npt_name_s, &region_s) && region_s)
+		{
+			ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, region_s, index_data_p -> id_fasta_filename_s, NULL, NULL, NULL);
+
+			if (job_p)
+				{
+					const uint32 *value_p = NULL;
+					const uint32 kmer_length = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_KMER_LENGTH.npt_name_s, &value_p) && value_p) ? *value_p : S_DEFAULT_KMER_LENGTH;
+					const uint32 max_top = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_TOP_KMERS.npt_name_s, &value_p) && value_p) ? *value_p : S_DEFAULT_TOP_KMERS;
+					const uint32 max_multiplicity = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MAX_MULTIPLICITY.npt_name_s, &value_p) && value_p && (*value_p > 0)) ? *value_p : S_DEFAULT_MAX_MULTIPLICITY;
+					IndexRegion region;
+
+					LogParameterSet (param_set_p, job_p);
+
+					SetServiceJobStatus (job_p, OS_STARTED);
+					LogServiceJob (job_p);
+
+					/* Assume failure */
+					SetServiceJobStatus (job_p, OS_FAILED);
+
+					if ((kmer_length == 0) || (kmer_length > S_MAX_KMER_LENGTH))
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "K-mer length must be between 1 and 32");
+						}
+					else if (max_multiplicity > S_MAX_MULTIPLICITY_LIMIT)
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "Max multiplicity must be at most 1000000");
+						}
+					else if (max_top > S_MAX_TOP_KMERS_LIMIT)
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "Top k-mers must be at most 10000");
+						}
+					else if (ParseIndexRegion (index_data_p, region_s, &region))
+						{
+							if (region.ir_end - region.ir_start <= S_MAX_REGION_LENGTH)
+								{
+									KmerSpectrum spectrum;
+
+									memset (&spectrum, 0, sizeof (KmerSpectrum));
+
+									spectrum.ks_index_data_p = index_data_p;
+									spectrum.ks_region_p = &region;
+									spectrum.ks_kmer_length = kmer_length;
+									spectrum.ks_max_multiplicity = max_multiplicity;
+									spectrum.ks_max_top = max_top;
+									spectrum.ks_num_blocks = (size_t) ((region.ir_end - region.ir_start + S_BLOCK_SIZE - 1) / S_BLOCK_SIZE);
+									spectrum.ks_blocks_p = (KmerBlock *) AllocMemoryArray (sizeof (KmerBlock), spectrum.ks_num_blocks + 1);
+									spectrum.ks_partitions_p = (KmerPartition *) AllocMemoryArray (sizeof (KmerPartition), KC_NUM_PARTITIONS);
+
+									if ((spectrum.ks_blocks_p) && (spectrum.ks_partitions_p))
+										{
+											memset (spectrum.ks_blocks_p, 0, (spectrum.ks_num_blocks + 1) * sizeof (KmerBlock));
+											memset (spectrum.ks_partitions_p, 0, KC_NUM_PARTITIONS * sizeof (KmerPartition));
+
+											if (RunWorkerPool (spectrum.ks_num_blocks, data_p -> stsd_num_threads, GatherKmerBlock, &spectrum) &&
+												RunWorkerPool (KC_NUM_PARTITIONS, data_p -> stsd_num_threads, CountKmerPartition, &spectrum))
+												{
+													json_t *result_p = GetKmerSpectrumAsJSON (&spectrum);
+
+													if (result_p)
+														{
+															if (AddInlineResultToServiceJob (job_p, "kmers", result_p))
+																{
+																	SetServiceJobStatus (job_p, OS_SUCCEEDED);
+																}
+
+															json_decref (result_p);
+														}
+												}
+											else
+												{
+													AddGeneralErrorMessageToServiceJob (job_p, "Failed to count the k-mers");
+												}
+										}
+									else
+										{
+											AddGeneralErrorMessageToServiceJob (job_p, "Failed to allocate the k-mer counts");
+										}
+
+									ClearKmerSpectrum (&spectrum);
+								}
+							else
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "The region is too long to count its k-mers");
+								}
+						}
+					else
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "Unknown region");
+						}
+
+					LogServiceJob (job_p);
+				}		/* if (job_p) */
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get a FASTA file and region to count the k-mers of");
+		}
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static bool GatherKmerBlock (const size_t task_index, void *data_p)
+{
+	KmerSpectrum *spectrum_p = (KmerSpectrum *) data_p;
+	KmerBlock *block_p = spectrum_p -> ks_blocks_p + task_index;
+	const IndexRegion *region_p = spectrum_p -> ks_region_p;
+	const hts_pos_t block_start = region_p -> ir_start + ((hts_pos_t) task_index) * S_BLOCK_SIZE;
+	const hts_pos_t block_end = (region_p -> ir_end - block_start < S_BLOCK_SIZE) ? region_p -> ir_end : block_start + S_BLOCK_SIZE;
+	const hts_pos_t overlap_end = block_end + (hts_pos_t) (spectrum_p -> ks_kmer_length) - 1;
+	bool success_flag = false;
+	hts_pos_t length = 0;
+
+	/* Overlap the next block so that this one gets every k-mer that starts within it */
+	char *sequence_s = FetchIndexSequence (spectrum_p -> ks_index_data_p, region_p -> ir_scaffold_name_s, block_start, (overlap_end < region_p -> ir_end) ? overlap_end : region_p -> ir_end, &length);
+
+	if (sequence_s)
+		{
+			const size_t max_kmers = (size_t) (block_end - block_start);
+			uint64 *kmers_p = (uint64 *) AllocMemoryArray (sizeof (uint64), max_kmers);
+
+			if (kmers_p)
+				{
+					const size_t num_kmers = GetCanonicalKmers (sequence_s, (size_t) length, spectrum_p -> ks_kmer_length, kmers_p);
+
+					if ((block_p -> kb_kmers_p = (uint64 *) AllocMemoryArray (sizeof (uint64), (num_kmers > 0) ? num_kmers : 1)) != NULL)
+						{
+							size_t next [KC_NUM_PARTITIONS];
+							size_t i;
+
+							/* Split the k-mers by partition with a single counting sort pass */
+							memset (block_p -> kb_offsets, 0, sizeof (block_p -> kb_offsets));
+
+							for (i = 0; i < num_kmers; ++ i)
+								{
+									++ (block_p -> kb_offsets [(MixKmer (kmers_p [i]) >> (64 - KC_PARTITION_BITS)) + 1]);
+								}
+
+							for (i = 0; i < KC_NUM_PARTITIONS; ++ i)
+								{
+									block_p -> kb_offsets [i + 1] += block_p -> kb_offsets [i];
+									next [i] = block_p -> kb_offsets [i];
+								}
+
+							for (i = 0; i < num_kmers; ++ i)
+								{
+									block_p -> kb_kmers_p [next [MixKmer (kmers_p [i]) >> (64 - KC_PARTITION_BITS)] ++] = kmers_p [i];
+								}
+
+							success_flag = true;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " k-mers", num_kmers);
+						}
+
+					FreeMemory (kmers_p);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " k-mers", max_kmers);
+				}
+
+			free (sequence_s);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Roll the 2-bit forward and reverse complement k-mers along the sequence,
+ * starting again after any base other than A, C, G or T, and keep the
+ * smaller of each pair so that both strands count as the same k-mer.
+ */
+static size_t GetCanonicalKmers (const char *sequence_s, const size_t length, const uint32 kmer_length, uint64 *kmers_p)
+{
+	const uint32 shift = 2 * (kmer_length - 1);
+	const uint64 mask = (kmer_length < 32) ? ((((uint64) 1) << (2 * kmer_length)) - 1) : UINT64_MAX;
+	uint64 forward = 0;
+	uint64 reverse = 0;
+	uint32 num_valid = 0;
+	size_t num_kmers = 0;
+	size_t i;
+
+	for (i = 0; i < length; ++ i)
+		{
+			uint64 code;
+
+			switch (sequence_s [i])
+				{
+					case 'A':
+					case 'a':
+						code = 0;
+						break;
+
+					case 'C':
+					case 'c':
+						code = 1;
+						break;
+
+					case 'G':
+					case 'g':
+						code = 2;
+						break;
+
+					case 'T':
+					case 't':
+						code = 3;
+						break;
+
+					default:
+						num_valid = 0;
+						continue;
+				}
+
+			forward = ((forward << 2) | code) & mask;
+			reverse = (reverse >> 2) | ((3 - code) << shift);
+
+			if (++ num_valid >= kmer_length)
+				{
+					kmers_p [num_kmers ++] = (forward < reverse) ? forward : reverse;
+				}
+		}
+
+	return num_kmers;
+}
+
+
+static bool CountKmerPartition (const size_t task_index, void *data_p)
+{
+	KmerSpectrum *spectrum_p = (KmerSpectrum *) data_p;
+	KmerPartition *partition_p = spectrum_p -> ks_partitions_p + task_index;
+	size_t num_kmers = 0;
+	size_t i;
+
+	for (i = 0; i < spectrum_p -> ks_num_blocks; ++ i)
+		{
+			const KmerBlock *block_p = spectrum_p -> ks_blocks_p + i;
+
+			num_kmers += block_p -> kb_offsets [task_index + 1] - block_p -> kb_offsets [task_index];
+		}
+
+	partition_p -> kp_spectrum_p = (uint64 *) AllocMemoryArray (sizeof (uint64), (size_t) (spectrum_p -> ks_max_multiplicity) + 1);
+	partition_p -> kp_top_p = (KmerCount *) AllocMemoryArray (sizeof (KmerCount), (spectrum_p -> ks_max_top > 0) ? spectrum_p -> ks_max_top : 1);
+
+	if ((partition_p -> kp_spectrum_p) && (partition_p -> kp_top_p))
+		{
+			memset (partition_p -> kp_spectrum_p, 0, ((size_t) (spectrum_p -> ks_max_multiplicity) + 1) * sizeof (uint64));
+
+			if (num_kmers > 0)
+				{
+					/* Keep the table at most half full so the probe sequences stay short */
+					size_t capacity = 16;
+					KmerCount *table_p;
+
+					while (capacity < (num_kmers << 1))
+						{
+							capacity <<= 1;
+						}
+
+					if ((table_p = (KmerCount *) AllocMemoryArray (sizeof (KmerCount), capacity)) != NULL)
+						{
+							const size_t mask = capacity - 1;
+
+							memset (table_p, 0, capacity * sizeof (KmerCount));
+
+							for (i = 0; i < spectrum_p -> ks_num_blocks; ++ i)
+								{
+									const KmerBlock *block_p = spectrum_p -> ks_blocks_p + i;
+									const uint64 *kmer_p = block_p -> kb_kmers_p + block_p -> kb_offsets [task_index];
+									const uint64 *end_p = block_p -> kb_kmers_p + block_p -> kb_offsets [task_index + 1];
+
+									for ( ; kmer_p < end_p; ++ kmer_p)
+										{
+											size_t slot = (size_t) MixKmer (*kmer_p) & mask;
+
+											/* An empty slot has a count of zero since every k-mer in the table has been seen */
+											while ((table_p [slot].kc_count > 0) && (table_p [slot].kc_kmer != *kmer_p))
+												{
+													slot = (slot + 1) & mask;
+												}
+
+											table_p [slot].kc_kmer = *kmer_p;
+											++ (table_p [slot].kc_count);
+										}
+								}
+
+							for (i = 0; i < capacity; ++ i)
+								{
+									if (table_p [i].kc_count > 0)
+										{
+											const uint32 count = table_p [i].kc_count;
+
+											++ (partition_p -> kp_num_distinct);
+											++ (partition_p -> kp_spectrum_p [(count < spectrum_p -> ks_max_multiplicity) ? count : spectrum_p -> ks_max_multiplicity]);
+
+											AddTopKmer (partition_p -> kp_top_p, & (partition_p -> kp_num_top), spectrum_p -> ks_max_top, table_p + i);
+										}
+								}
+
+							FreeMemory (table_p);
+
+							return true;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate k-mer table of " SIZET_FMT " entries", capacity);
+						}
+				}
+			else
+				{
+					return true;
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate k-mer spectrum");
+		}
+
+	return false;
+}
+
+
+static void AddTopKmer (KmerCount *top_p, size_t *num_top_p, const size_t max_top, const KmerCount *kmer_count_p)
+{
+	size_t i;
+
+	if (*num_top_p < max_top)
+		{
+			/* Sift the new entry up from the bottom of the heap */
+			i = (*num_top_p) ++;
+
+			while ((i > 0) && IsMoreFrequentKmer (top_p + ((i - 1) >> 1), kmer_count_p))
+				{
+					top_p [i] = top_p [(i - 1) >> 1];
+					i = (i - 1) >> 1;
+				}
+
+			top_p [i] = *kmer_count_p;
+		}
+	else if ((max_top > 0) && IsMoreFrequentKmer (kmer_count_p, top_p))
+		{
+			/* Replace the least frequent entry and sift it down */
+			i = 0;
+
+			for (;;)
+				{
+					size_t child = (i << 1) + 1;
+
+					if (child >= max_top)
+						{
+							break;
+						}
+
+					if ((child + 1 < max_top) && IsMoreFrequentKmer (top_p + child, top_p + child + 1))
+						{
+							++ child;
+						}
+
+					if (!IsMoreFrequentKmer (kmer_count_p, top_p + child))
+						{
+							break;
+						}
+
+					top_p [i] = top_p [child];
+					i = child;
+				}
+
+			top_p [i] = *kmer_count_p;
+		}
+}
+
+
+/*
+ * Ties are broken by the k-mer so that the results don't depend on the
+ * order that the partitions were counted in.
+ */
+static bool IsMoreFrequentKmer (const KmerCount *kmer_count0_p, const KmerCount *kmer_count1_p)
+{
+	return (kmer_count0_p -> kc_count > kmer_count1_p -> kc_count) || ((kmer_count0_p -> kc_count == kmer_count1_p -> kc_count) && (kmer_count0_p -> kc_kmer < kmer_count1_p -> kc_kmer));
+}
+
+
+static json_t *GetKmerSpectrumAsJSON (const KmerSpectrum *spectrum_p)
+{
+	const IndexRegion *region_p = spectrum_p -> ks_region_p;
+	uint64 num_kmers = 0;
+	uint64 num_distinct = 0;
+	size_t num_top = 0;
+	KmerCount *top_p = (KmerCount *) AllocMemoryArray (sizeof (KmerCount), (KC_NUM_PARTITIONS * (size_t) (spectrum_p -> ks_max_top)) + 1);
+	json_t *spectrum_json_p = json_array ();
+	json_t *top_json_p = json_array ();
+	json_t *result_p = NULL;
+	bool success_flag = (top_p != NULL) && (spectrum_json_p != NULL) && (top_json_p != NULL);
+	uint32 multiplicity;
+	size_t i;
+
+	for (i = 0; i < spectrum_p -> ks_num_blocks; ++ i)
+		{
+			num_kmers += spectrum_p -> ks_blocks_p [i].kb_offsets [KC_NUM_PARTITIONS];
+		}
+
+	for (i = 0; (i < KC_NUM_PARTITIONS) && success_flag; ++ i)
+		{
+			const KmerPartition *partition_p = spectrum_p -> ks_partitions_p + i;
+
+			num_distinct += partition_p -> kp_num_distinct;
+			memcpy (top_p + num_top, partition_p -> kp_top_p, (partition_p -> kp_num_top) * sizeof (KmerCount));
+			num_top += partition_p -> kp_num_top;
+		}
+
+	for (multiplicity = 1; (multiplicity <= spectrum_p -> ks_max_multiplicity) && success_flag; ++ multiplicity)
+		{
+			uint64 count = 0;
+
+			for (i = 0; i < KC_NUM_PARTITIONS; ++ i)
+				{
+					count += spectrum_p -> ks_partitions_p [i].kp_spectrum_p [multiplicity];
+				}
+
+			/* Only the multiplicities that occur are listed */
+			if (count > 0)
+				{
+					json_t *bin_p = json_pack ("{s:I,s:I}", "multiplicity", (json_int_t) multiplicity, "kmers", (json_int_t) count);
+
+					success_flag = (bin_p != NULL) && (json_array_append_new (spectrum_json_p, bin_p) == 0);
+				}
+		}
+
+	if (success_flag)
+		{
+			if (num_top > 1)
+				{
+					qsort (top_p, num_top, sizeof (KmerCount), CompareKmerCounts);
+				}
+
+			if (num_top > spectrum_p -> ks_max_top)
+				{
+					num_top = spectrum_p -> ks_max_top;
+				}
+
+			for (i = 0; (i < num_top) && success_flag; ++ i)
+				{
+					char kmer_s [33];
+					uint32 j;
+					json_t *kmer_p;
+
+					for (j = 0; j < spectrum_p -> ks_kmer_length; ++ j)
+						{
+							kmer_s [j] = "ACGT" [(top_p [i].kc_kmer >> (2 * (spectrum_p -> ks_kmer_length - 1 - j))) & 3];
+						}
+
+					kmer_s [j] = '\0';
+
+					kmer_p = json_pack ("{s:s,s:I}", "kmer", kmer_s, "count", (json_int_t) (top_p [i].kc_count));
+					success_flag = (kmer_p != NULL) && (json_array_append_new (top_json_p, kmer_p) == 0);
+				}
+		}
+
+	if (success_flag)
+		{
+			result_p = json_pack ("{s:s,s:I,s:I,s:I,s:I,s:I,s:I,s:o,s:o}",
+				"scaffold", region_p -> ir_scaffold_name_s,
+				"start", (json_int_t) (region_p -> ir_start + 1),
+				"end", (json_int_t) (region_p -> ir_end),
+				"kmer_length", (json_int_t) (spectrum_p -> ks_kmer_length),
+				"max_multiplicity", (json_int_t) (spectrum_p -> ks_max_multiplicity),
+				"total_kmers", (json_int_t) num_kmers,
+				"distinct_kmers", (json_int_t) num_distinct,
+				"spectrum", spectrum_json_p,
+				"top_kmers", top_json_p);
+
+			/* json_pack takes the arrays with "o" even if it fails */
+			spectrum_json_p = NULL;
+			top_json_p = NULL;
+		}
+
+	if (!result_p)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create the k-mer results");
+		}
+
+	if (top_json_p)
+		{
+			json_decref (top_json_p);
+		}
+
+	if (spectrum_json_p)
+		{
+			json_decref (spectrum_json_p);
+		}
+
+	if (top_p)
+		{
+			FreeMemory (top_p);
+		}
+
+	return result_p;
+}
+
+
+static void ClearKmerSpectrum (KmerSpectrum *spectrum_p)
+{
+	size_t i;
+
+	if (spectrum_p -> ks_blocks_p)
+		{
+			for (i = 0; i < spectrum_p -> ks_num_blocks; ++ i)
+				{
+					if (spectrum_p -> ks_blocks_p [i].kb_kmers_p)
+						{
+							FreeMemory (spectrum_p -> ks_blocks_p [i].kb_kmers_p);
+						}
+				}
+
+			FreeMemory (spectrum_p -> ks_blocks_p);
+			spectrum_p -> ks_blocks_p = NULL;
+		}
+
+	if (spectrum_p -> ks_partitions_p)
+		{
+			for (i = 0; i < KC_NUM_PARTITIONS; ++ i)
+				{
+					if (spectrum_p -> ks_partitions_p [i].kp_spectrum_p)
+						{
+							FreeMemory (spectrum_p -> ks_partitions_p [i].kp_spectrum_p);
+						}
+
+					if (spectrum_p -> ks_partitions_p [i].kp_top_p)
+						{
+							FreeMemory (spectrum_p -> ks_partitions_p [i].kp_top_p);
+						}
+				}
+
+			FreeMemory (spectrum_p -> ks_partitions_p);
+			spectrum_p -> ks_partitions_p = NULL;
+		}
+}
+
+
+/*
+ * The finaliser from MurmurHash3, which spreads the k-mers over both the
+ * partitions, using the top bits, and the table slots, using the bottom ones.
+ */
+static uint64 MixKmer (uint64 kmer)
+{
+	kmer ^= kmer >> 33;
+	kmer *= 0xFF51AFD7ED558CCDULL;
+	kmer ^= kmer >> 33;
+	kmer *= 0xC4CEB9FE1A85EC53ULL;
+	kmer ^= kmer >> 33;
+
+	return kmer;
+}
+
+
+static int CompareKmerCounts (const void *v0_p, const void *v1_p)
+{
+	const KmerCount *kmer_count0_p = (const KmerCount *) v0_p;
+	const KmerCount *kmer_count1_p = (const KmerCount *) v1_p;
+
+	return IsMoreFrequentKmer (kmer_count0_p, kmer_count1_p) ? -1 : (IsMoreFrequentKmer (kmer_count1_p, kmer_count0_p) ? 1 : 0);
+}
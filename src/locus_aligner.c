@@ -0,0 +1,1047 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * locus_aligner.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "locus_aligner.h"
+#include "sequence_kernels.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "audit.h"
+
+#include "string_parameter.h"
+#include "unsigned_int_parameter.h"
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+
+#ifdef _DEBUG
+	#define LOCUS_ALIGNER_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define LOCUS_ALIGNER_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * Far enough below any real score that subtracting gap penalties from it
+ * can never overflow.
+ */
+#define LA_NEG_INF (-(1 << 29))
+
+/*
+ * The traceback bits for each cell. The low two bits say which matrix
+ * the best score came from and the others say whether the gap in each
+ * gap matrix was extended from the previous cell rather than opened.
+ */
+#define LA_FROM_DIAGONAL (0)
+#define LA_FROM_E (1)
+#define LA_FROM_F (2)
+#define LA_SOURCE_MASK (3)
+#define LA_EXTEND_E (4)
+#define LA_EXTEND_F (8)
+
+/*
+ * The codes that bases other than A, C, G and T get in each sequence, and
+ * that the columns outside the other sequence get, so none of them ever
+ * match anything.
+ */
+#define LA_REFERENCE_INVALID (INVALID_BASE)
+#define LA_OTHER_INVALID (INVALID_BASE + 1)
+#define LA_OTHER_PADDING (INVALID_BASE + 2)
+
+
+/*
+ * The scoring and the band for an alignment of a reference sequence down
+ * the rows against another sequence across the columns. Each row only
+ * stores the cells in the band, so the cell at column c of row i is at
+ * j = i + ab_low + c in the full matrix.
+ */
+typedef struct AlignmentBand
+{
+	const uint8 *ab_reference_p;
+	size_t ab_reference_length;
+
+	/* The other sequence's codes, laid out so row i starts at i - 1 */
+	int32 *ab_other_p;
+	size_t ab_other_length;
+
+	hts_pos_t ab_low;
+	hts_pos_t ab_high;
+
+	/* The number of cells in each row, rounded up to a whole vector */
+	size_t ab_width;
+
+	uint8 *ab_trace_p;
+
+	/* The current and previous rows of each matrix, with a spare cell at the end */
+	int32 *ab_h_p [2];
+	int32 *ab_f_p [2];
+	int32 *ab_flags_p;
+} AlignmentBand;
+
+
+typedef struct LocusAlignment
+{
+	/* The alignment from the start as runs of =, X, I and D */
+	char *la_ops_s;
+	size_t la_num_ops;
+	int32 la_score;
+} LocusAlignment;
+
+
+static NamedParameterType S_OTHER_INDEX = { "Other index", PT_STRING };
+
+static NamedParameterType S_OTHER_REGION = { "Other region", PT_STRING };
+
+static NamedParameterType S_BAND_WIDTH = { "Band width", PT_UNSIGNED_INT };
+
+static NamedParameterType S_MAX_VARIANTS = { "Max variants", PT_UNSIGNED_INT };
+
+
+static const uint32 S_DEFAULT_BAND_WIDTH = 100;
+
+static const uint32 S_DEFAULT_MAX_VARIANTS = 10000;
+
+/*
+ * The traceback needs a byte per cell in the band and the other
+ * sequence's codes need four bytes each, so this keeps a single job
+ * to 64Mb of them.
+ */
+static const size_t S_MAX_BAND_SIZE = 1 << 26;
+
+static const int32 S_MATCH_SCORE = 2;
+
+static const int32 S_MISMATCH_SCORE = -4;
+
+static const int32 S_GAP_OPEN = 4;
+
+static const int32 S_GAP_EXTEND = 2;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool AlignBanded (const uint8 *reference_p, const size_t reference_length, const uint8 *other_p, const size_t other_length, const uint32 band_width, LocusAlignment *alignment_p);
+
+static size_t GetAlignmentBandWidth (const size_t reference_length, const size_t other_length, const uint32 band_width);
+
+static size_t GetAlignmentBandSize (const size_t reference_length, const size_t other_length, const uint32 band_width);
+
+static bool InitAlignmentBand (AlignmentBand *band_p, const uint8 *reference_p, const size_t reference_length, const uint8 *other_p, const size_t other_length, const uint32 band_width);
+
+static void ClearAlignmentBand (AlignmentBand *band_p);
+
+static void FillFirstRow (AlignmentBand *band_p);
+
+static void FillRow (AlignmentBand *band_p, const size_t row);
+
+static void ScoreRowFromAbove (const AlignmentBand *band_p, const size_t row, const int32 *prev_h_p, const int32 *prev_f_p, int32 *h_p, int32 *f_p);
+
+static void ScoreRowFromLeft (const AlignmentBand *band_p, int32 *h_p, uint8 *trace_p);
+
+static bool TraceBack (const AlignmentBand *band_p, LocusAlignment *alignment_p);
+
+static json_t *GetLocusAlignmentAsJSON (const LocusAlignment *alignment_p, const IndexRegion *region_p, const char *reference_s, const char *other_index_s, const IndexRegion *other_region_p, const char *other_s, const uint32 band_width, const uint32 max_variants, bool *complete_flag_p);
+
+static json_t *GetVariantAsJSON (const char op, const hts_pos_t position, const hts_pos_t other_position, const char *reference_s, const char *other_s, const size_t length);
+
+static char *GetUpperCaseBases (const char *sequence_s, const size_t length);
+
+#ifdef __SSE2__
+static inline __m128i SelectInt32 (const __m128i mask, const __m128i if_true, const __m128i if_false);
+#endif
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool AddLocusAlignmentParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	return ((EasyCreateAndAddStringParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_OTHER_INDEX.npt_type, S_OTHER_INDEX.npt_name_s, "Other index", "The index to compare the region against. If this is empty, the selected index is used.", NULL, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddStringParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_OTHER_REGION.npt_type, S_OTHER_REGION.npt_name_s, "Other region", "The region in the other index to compare against, e.g. chr2:1000-2000. If this is empty, the same region as in the Scaffold parameter is used.", NULL, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_BAND_WIDTH.npt_name_s, "Band width", "How far the alignment can stray from the diagonal, beyond the difference in the lengths of the two regions", &S_DEFAULT_BAND_WIDTH, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MAX_VARIANTS.npt_name_s, "Max variants", "The most differences between the two regions to list", &S_DEFAULT_MAX_VARIANTS, PL_ADVANCED) != NULL));
+}
+
+
+bool GetLocusAlignmentParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_OTHER_INDEX.npt_name_s) == 0)
+		{
+			*pt_p = S_OTHER_INDEX.npt_type;
+		}
+	else if (strcmp (param_name_s, S_OTHER_REGION.npt_name_s) == 0)
+		{
+			*pt_p = S_OTHER_REGION.npt_type;
+		}
+	else if (strcmp (param_name_s, S_BAND_WIDTH.npt_name_s) == 0)
+		{
+			*pt_p = S_BAND_WIDTH.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MAX_VARIANTS.npt_name_s) == 0)
+		{
+			*pt_p = S_MAX_VARIANTS.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+void RunLocusAlignmentJob (Service *service_p, ParameterSet *param_set_p)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	IndexData *index_data_p = GetSelectedIndexData (data_p, param_set_p);
+	const char *region_s = NULL;
+
+	if (index_data_p && (index_data_p -> id_fasta_filename_s) && GetCurrentStringParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD.npt_name_s, &region_s) && region_s)
+		{
+			ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, region_s, index_data_p -> id_fasta_filename_s, NULL, NULL, NULL);
+
+			if (job_p)
+				{
+					const char *other_index_s = NULL;
+					const char *other_region_s = NULL;
+					const uint32 *value_p = NULL;
+					const uint32 band_width = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_BAND_WIDTH.npt_name_s, &value_p) && value_p) ? *value_p : S_DEFAULT_BAND_WIDTH;
+					const uint32 max_variants = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MAX_VARIANTS.npt_name_s, &value_p) && value_p && (*value_p > 0)) ? *value_p : S_DEFAULT_MAX_VARIANTS;
+					IndexData *other_index_data_p = index_data_p;
+					IndexRegion region;
+					IndexRegion other_region;
+
+					if (!(GetCurrentStringParameterValueFromParameterSet (param_set_p, S_OTHER_INDEX.npt_name_s, &other_index_s) && other_index_s && (*other_index_s != '\0')))
+						{
+							other_index_s = index_data_p -> id_fasta_filename_s;
+						}
+					else
+						{
+							other_index_data_p = GetIndexDataByName (data_p, other_index_s);
+						}
+
+					if (!(GetCurrentStringParameterValueFromParameterSet (param_set_p, S_OTHER_REGION.npt_name_s, &other_region_s) && other_region_s && (*other_region_s != '\0')))
+						{
+							other_region_s = region_s;
+						}
+
+					LogParameterSet (param_set_p, job_p);
+
+					SetServiceJobStatus (job_p, OS_STARTED);
+					LogServiceJob (job_p);
+
+					/* Assume failure */
+					SetServiceJobStatus (job_p, OS_FAILED);
+
+					if (! (other_index_data_p && (other_index_data_p -> id_fasta_filename_s)))
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "Unknown other index");
+						}
+					else if (!ParseIndexRegion (index_data_p, region_s, &region))
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "Unknown region");
+						}
+					else if (!ParseIndexRegion (other_index_data_p, other_region_s, &other_region))
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "Unknown other region");
+						}
+					else
+						{
+							const size_t length = (size_t) (region.ir_end - region.ir_start);
+							const size_t other_length = (size_t) (other_region.ir_end - other_region.ir_start);
+
+							if (GetAlignmentBandSize (length, other_length, band_width) <= S_MAX_BAND_SIZE)
+								{
+									hts_pos_t fetched_length = 0;
+									hts_pos_t other_fetched_length = 0;
+									char *sequence_s = FetchIndexSequence (index_data_p, region.ir_scaffold_name_s, region.ir_start, region.ir_end, &fetched_length);
+									char *other_sequence_s = FetchIndexSequence (other_index_data_p, other_region.ir_scaffold_name_s, other_region.ir_start, other_region.ir_end, &other_fetched_length);
+
+									if (sequence_s && other_sequence_s && (fetched_length == (hts_pos_t) length) && (other_fetched_length == (hts_pos_t) other_length))
+										{
+											uint8 *codes_p = (uint8 *) AllocMemoryArray (sizeof (uint8), length + other_length + 1);
+
+											if (codes_p)
+												{
+													LocusAlignment alignment;
+
+													memset (&alignment, 0, sizeof (LocusAlignment));
+
+													EncodeBases (sequence_s, codes_p, length);
+													EncodeBases (other_sequence_s, codes_p + length, other_length);
+
+													if (AlignBanded (codes_p, length, codes_p + length, other_length, band_width, &alignment))
+														{
+															bool complete_flag = true;
+															json_t *result_p = GetLocusAlignmentAsJSON (&alignment, &region, sequence_s, other_index_s, &other_region, other_sequence_s, band_width, max_variants, &complete_flag);
+
+															if (result_p)
+																{
+																	if (AddInlineResultToServiceJob (job_p, "compare", result_p))
+																		{
+																			if (complete_flag)
+																				{
+																					SetServiceJobStatus (job_p, OS_SUCCEEDED);
+																				}
+																			else
+																				{
+																					AddGeneralErrorMessageToServiceJob (job_p, "Stopped after reaching Max variants");
+																					SetServiceJobStatus (job_p, OS_PARTIALLY_SUCCEEDED);
+																				}
+																		}
+
+																	json_decref (result_p);
+																}
+
+															FreeMemory (alignment.la_ops_s);
+														}
+													else
+														{
+															AddGeneralErrorMessageToServiceJob (job_p, "Failed to align the regions");
+														}
+
+													FreeMemory (codes_p);
+												}
+											else
+												{
+													AddGeneralErrorMessageToServiceJob (job_p, "Failed to allocate the base codes");
+												}
+										}
+									else
+										{
+											AddGeneralErrorMessageToServiceJob (job_p, "Failed to get the sequences to compare");
+										}
+
+									if (other_sequence_s)
+										{
+											free (other_sequence_s);
+										}
+
+									if (sequence_s)
+										{
+											free (sequence_s);
+										}
+								}
+							else
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "The regions are too long, or too different in length, to align within the band");
+								}
+						}
+
+					LogServiceJob (job_p);
+				}		/* if (job_p) */
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get a FASTA file and region to compare");
+		}
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+/*
+ * A global alignment with affine gaps, as in Gotoh's algorithm, where H
+ * is the best score at each cell, E the best ending in a gap in the
+ * reference and F the best ending in a gap in the other sequence. The
+ * band runs from ab_low to ab_high diagonals, which covers the difference
+ * in length and band_width either side of it.
+ */
+static bool AlignBanded (const uint8 *reference_p, const size_t reference_length, const uint8 *other_p, const size_t other_length, const uint32 band_width, LocusAlignment *alignment_p)
+{
+	AlignmentBand band;
+	bool success_flag = false;
+
+	if (InitAlignmentBand (&band, reference_p, reference_length, other_p, other_length, band_width))
+		{
+			size_t i;
+
+			FillFirstRow (&band);
+
+			for (i = 1; i <= reference_length; ++ i)
+				{
+					FillRow (&band, i);
+				}
+
+			alignment_p -> la_score = band.ab_h_p [reference_length & 1] [(size_t) ((hts_pos_t) other_length - (hts_pos_t) reference_length - band.ab_low)];
+
+			success_flag = TraceBack (&band, alignment_p);
+
+			ClearAlignmentBand (&band);
+		}
+
+	return success_flag;
+}
+
+
+static size_t GetAlignmentBandWidth (const size_t reference_length, const size_t other_length, const uint32 band_width)
+{
+	const size_t length_difference = (reference_length > other_length) ? reference_length - other_length : other_length - reference_length;
+
+	/* Rounded up to a whole vector */
+	return (length_difference + 2 * ((size_t) band_width) + 1 + 3) & ~((size_t) 3);
+}
+
+
+/*
+ * The bytes taken by the traceback and the other sequence's codes,
+ * which are what grow with the band.
+ */
+static size_t GetAlignmentBandSize (const size_t reference_length, const size_t other_length, const uint32 band_width)
+{
+	const size_t width = GetAlignmentBandWidth (reference_length, other_length, band_width);
+
+	return ((reference_length + 1) * width) + ((reference_length + width) * sizeof (int32));
+}
+
+
+static bool InitAlignmentBand (AlignmentBand *band_p, const uint8 *reference_p, const size_t reference_length, const uint8 *other_p, const size_t other_length, const uint32 band_width)
+{
+	const hts_pos_t length_difference = (hts_pos_t) other_length - (hts_pos_t) reference_length;
+	size_t num_other_codes;
+	size_t i;
+
+	memset (band_p, 0, sizeof (AlignmentBand));
+
+	band_p -> ab_reference_p = reference_p;
+	band_p -> ab_reference_length = reference_length;
+	band_p -> ab_other_length = other_length;
+	band_p -> ab_low = ((length_difference < 0) ? length_difference : 0) - (hts_pos_t) band_width;
+	band_p -> ab_high = ((length_difference > 0) ? length_difference : 0) + (hts_pos_t) band_width;
+	band_p -> ab_width = GetAlignmentBandWidth (reference_length, other_length, band_width);
+
+	num_other_codes = reference_length + band_p -> ab_width;
+
+	band_p -> ab_other_p = (int32 *) AllocMemoryArray (sizeof (int32), num_other_codes);
+	band_p -> ab_trace_p = (uint8 *) AllocMemoryArray (sizeof (uint8), (reference_length + 1) * (band_p -> ab_width));
+	band_p -> ab_flags_p = (int32 *) AllocMemoryArray (sizeof (int32), band_p -> ab_width);
+
+	for (i = 0; i < 2; ++ i)
+		{
+			band_p -> ab_h_p [i] = (int32 *) AllocMemoryArray (sizeof (int32), band_p -> ab_width + 4);
+			band_p -> ab_f_p [i] = (int32 *) AllocMemoryArray (sizeof (int32), band_p -> ab_width + 4);
+		}
+
+	if ((band_p -> ab_other_p) && (band_p -> ab_trace_p) && (band_p -> ab_flags_p) && (band_p -> ab_h_p [0]) && (band_p -> ab_h_p [1]) && (band_p -> ab_f_p [0]) && (band_p -> ab_f_p [1]))
+		{
+			/* Entry k is the other sequence's base at column k + ab_low + 1 */
+			for (i = 0; i < num_other_codes; ++ i)
+				{
+					const hts_pos_t j = (hts_pos_t) i + band_p -> ab_low;
+
+					if ((j >= 0) && (j < (hts_pos_t) other_length))
+						{
+							band_p -> ab_other_p [i] = (other_p [j] == INVALID_BASE) ? LA_OTHER_INVALID : other_p [j];
+						}
+					else
+						{
+							band_p -> ab_other_p [i] = LA_OTHER_PADDING;
+						}
+				}
+
+			for (i = 0; i < band_p -> ab_width + 4; ++ i)
+				{
+					band_p -> ab_h_p [0] [i] = LA_NEG_INF;
+					band_p -> ab_h_p [1] [i] = LA_NEG_INF;
+					band_p -> ab_f_p [0] [i] = LA_NEG_INF;
+					band_p -> ab_f_p [1] [i] = LA_NEG_INF;
+				}
+
+			return true;
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate alignment band of " SIZET_FMT " by " SIZET_FMT, reference_length + 1, band_p -> ab_width);
+		}
+
+	ClearAlignmentBand (band_p);
+
+	return false;
+}
+
+
+static void ClearAlignmentBand (AlignmentBand *band_p)
+{
+	size_t i;
+
+	for (i = 0; i < 2; ++ i)
+		{
+			if (band_p -> ab_f_p [i])
+				{
+					FreeMemory (band_p -> ab_f_p [i]);
+					band_p -> ab_f_p [i] = NULL;
+				}
+
+			if (band_p -> ab_h_p [i])
+				{
+					FreeMemory (band_p -> ab_h_p [i]);
+					band_p -> ab_h_p [i] = NULL;
+				}
+		}
+
+	if (band_p -> ab_flags_p)
+		{
+			FreeMemory (band_p -> ab_flags_p);
+			band_p -> ab_flags_p = NULL;
+		}
+
+	if (band_p -> ab_trace_p)
+		{
+			FreeMemory (band_p -> ab_trace_p);
+			band_p -> ab_trace_p = NULL;
+		}
+
+	if (band_p -> ab_other_p)
+		{
+			FreeMemory (band_p -> ab_other_p);
+			band_p -> ab_other_p = NULL;
+		}
+}
+
+
+/*
+ * The first row is all gap in the reference.
+ */
+static void FillFirstRow (AlignmentBand *band_p)
+{
+	int32 *h_p = band_p -> ab_h_p [0];
+	size_t c;
+
+	for (c = 0; c < band_p -> ab_width; ++ c)
+		{
+			const hts_pos_t j = (hts_pos_t) c + band_p -> ab_low;
+
+			band_p -> ab_trace_p [c] = LA_FROM_DIAGONAL;
+
+			if (j == 0)
+				{
+					h_p [c] = 0;
+				}
+			else if ((j > 0) && (j <= (hts_pos_t) (band_p -> ab_other_length)))
+				{
+					h_p [c] = - S_GAP_OPEN - S_GAP_EXTEND * (int32) j;
+					band_p -> ab_trace_p [c] = LA_FROM_E | ((j > 1) ? LA_EXTEND_E : 0);
+				}
+		}
+}
+
+
+/*
+ * Each row is done in two passes. The first takes the diagonal and the
+ * vertical moves, which only need the previous row. The horizontal gaps
+ * chain along the row, but the best gap ending at column c is the best
+ * of H' [c'] - open - extend * (c - c') over c' < c, where H' is the
+ * score from the first pass. So the second pass is a running maximum of
+ * H' [c'] + extend * c', which can be done a vector at a time.
+ */
+static void FillRow (AlignmentBand *band_p, const size_t row)
+{
+	const size_t current = row & 1;
+	const int32 *prev_h_p = band_p -> ab_h_p [1 - current];
+	const int32 *prev_f_p = band_p -> ab_f_p [1 - current];
+	int32 *h_p = band_p -> ab_h_p [current];
+	int32 *f_p = band_p -> ab_f_p [current];
+	const hts_pos_t first_column = (hts_pos_t) row + band_p -> ab_low;
+	const hts_pos_t last_column = (hts_pos_t) row + band_p -> ab_high;
+	const hts_pos_t other_length = (hts_pos_t) (band_p -> ab_other_length);
+	size_t c;
+
+	ScoreRowFromAbove (band_p, row, prev_h_p, prev_f_p, h_p, f_p);
+
+	/* Nothing can come from before the first column and that column is all gap in the other sequence */
+	for (c = 0; (c < band_p -> ab_width) && (first_column + (hts_pos_t) c <= 0); ++ c)
+		{
+			if (first_column + (hts_pos_t) c == 0)
+				{
+					h_p [c] = - S_GAP_OPEN - S_GAP_EXTEND * (int32) row;
+					f_p [c] = h_p [c];
+					band_p -> ab_flags_p [c] = LA_FROM_F | ((row > 1) ? LA_EXTEND_F : 0);
+				}
+			else
+				{
+					h_p [c] = LA_NEG_INF;
+					f_p [c] = LA_NEG_INF;
+				}
+		}
+
+	ScoreRowFromLeft (band_p, h_p, band_p -> ab_trace_p + row * (band_p -> ab_width));
+
+	/* The cells past the end of the other sequence or the band */
+	c = (last_column <= other_length) ? (size_t) (last_column - first_column + 1) : ((other_length >= first_column) ? (size_t) (other_length - first_column + 1) : 0);
+
+	for ( ; c < band_p -> ab_width; ++ c)
+		{
+			h_p [c] = LA_NEG_INF;
+			f_p [c] = LA_NEG_INF;
+		}
+}
+
+
+static void ScoreRowFromAbove (const AlignmentBand *band_p, const size_t row, const int32 *prev_h_p, const int32 *prev_f_p, int32 *h_p, int32 *f_p)
+{
+	const int32 *other_p = band_p -> ab_other_p + (row - 1);
+	const int32 base = band_p -> ab_reference_p [row - 1];
+	int32 *flags_p = band_p -> ab_flags_p;
+	size_t c = 0;
+
+	#ifdef __SSE2__
+	const __m128i base_v = _mm_set1_epi32 (base);
+	const __m128i match_v = _mm_set1_epi32 (S_MATCH_SCORE);
+	const __m128i mismatch_v = _mm_set1_epi32 (S_MISMATCH_SCORE);
+	const __m128i open_v = _mm_set1_epi32 (S_GAP_OPEN + S_GAP_EXTEND);
+	const __m128i extend_v = _mm_set1_epi32 (S_GAP_EXTEND);
+	const __m128i from_f_v = _mm_set1_epi32 (LA_FROM_F);
+	const __m128i extend_f_v = _mm_set1_epi32 (LA_EXTEND_F);
+
+	while (c < band_p -> ab_width)
+		{
+			const __m128i matches = _mm_cmpeq_epi32 (_mm_loadu_si128 ((const __m128i *) (other_p + c)), base_v);
+			const __m128i diagonal = _mm_add_epi32 (_mm_loadu_si128 ((const __m128i *) (prev_h_p + c)), SelectInt32 (matches, match_v, mismatch_v));
+			const __m128i f_open = _mm_sub_epi32 (_mm_loadu_si128 ((const __m128i *) (prev_h_p + c + 1)), open_v);
+			const __m128i f_extend = _mm_sub_epi32 (_mm_loadu_si128 ((const __m128i *) (prev_f_p + c + 1)), extend_v);
+			const __m128i extend_f = _mm_cmpgt_epi32 (f_extend, f_open);
+			const __m128i f = SelectInt32 (extend_f, f_extend, f_open);
+			const __m128i from_f = _mm_cmpgt_epi32 (f, diagonal);
+
+			_mm_storeu_si128 ((__m128i *) (h_p + c), SelectInt32 (from_f, f, diagonal));
+			_mm_storeu_si128 ((__m128i *) (f_p + c), f);
+			_mm_storeu_si128 ((__m128i *) (flags_p + c), _mm_or_si128 (_mm_and_si128 (from_f, from_f_v), _mm_and_si128 (extend_f, extend_f_v)));
+
+			c += 4;
+		}
+	#endif
+
+	while (c < band_p -> ab_width)
+		{
+			const int32 diagonal = prev_h_p [c] + ((other_p [c] == base) ? S_MATCH_SCORE : S_MISMATCH_SCORE);
+			const int32 f_open = prev_h_p [c + 1] - S_GAP_OPEN - S_GAP_EXTEND;
+			const int32 f_extend = prev_f_p [c + 1] - S_GAP_EXTEND;
+			const int32 f = (f_extend > f_open) ? f_extend : f_open;
+
+			h_p [c] = (f > diagonal) ? f : diagonal;
+			f_p [c] = f;
+			flags_p [c] = ((f > diagonal) ? LA_FROM_F : 0) | ((f_extend > f_open) ? LA_EXTEND_F : 0);
+
+			++ c;
+		}
+}
+
+
+static void ScoreRowFromLeft (const AlignmentBand *band_p, int32 *h_p, uint8 *trace_p)
+{
+	const int32 *flags_p = band_p -> ab_flags_p;
+	int32 best = LA_NEG_INF;
+	int32 prev_e = LA_NEG_INF;
+	int32 prev_h = LA_NEG_INF;
+	size_t c = 0;
+
+	#ifdef __SSE2__
+	const __m128i open_v = _mm_set1_epi32 (S_GAP_OPEN);
+	const __m128i open_extend_v = _mm_set1_epi32 (S_GAP_OPEN + S_GAP_EXTEND);
+	const __m128i extend_v = _mm_set1_epi32 (S_GAP_EXTEND);
+	const __m128i step_v = _mm_set1_epi32 (4 * S_GAP_EXTEND);
+	const __m128i first_lane_v = _mm_cvtsi32_si128 (LA_NEG_INF);
+	const __m128i first_lanes_v = _mm_set_epi32 (0, 0, LA_NEG_INF, LA_NEG_INF);
+	const __m128i from_e_v = _mm_set1_epi32 (LA_FROM_E);
+	const __m128i from_f_v = _mm_set1_epi32 (LA_FROM_F);
+	const __m128i extend_e_v = _mm_set1_epi32 (LA_EXTEND_E);
+	const __m128i extend_f_v = _mm_set1_epi32 (LA_EXTEND_F);
+	__m128i column_gaps = _mm_set_epi32 (3 * S_GAP_EXTEND, 2 * S_GAP_EXTEND, S_GAP_EXTEND, 0);
+
+	while (c < band_p -> ab_width)
+		{
+			const __m128i h = _mm_loadu_si128 ((const __m128i *) (h_p + c));
+			const __m128i flags = _mm_loadu_si128 ((const __m128i *) (flags_p + c));
+			const __m128i gains = _mm_add_epi32 (h, column_gaps);
+			__m128i running = gains;
+			__m128i previous;
+			__m128i e;
+			__m128i from_e;
+			__m128i new_h;
+			__m128i extend_e;
+			__m128i trace;
+			int packed;
+
+			/* The running maximum within the vector and then with the ones before it */
+			running = SelectInt32 (_mm_cmpgt_epi32 (running, _mm_or_si128 (_mm_slli_si128 (running, 4), first_lane_v)), running, _mm_or_si128 (_mm_slli_si128 (running, 4), first_lane_v));
+			running = SelectInt32 (_mm_cmpgt_epi32 (running, _mm_or_si128 (_mm_slli_si128 (running, 8), first_lanes_v)), running, _mm_or_si128 (_mm_slli_si128 (running, 8), first_lanes_v));
+			running = SelectInt32 (_mm_cmpgt_epi32 (running, _mm_set1_epi32 (best)), running, _mm_set1_epi32 (best));
+
+			/* Each cell's gap comes from the cells strictly before it */
+			previous = _mm_or_si128 (_mm_slli_si128 (running, 4), _mm_cvtsi32_si128 (best));
+			e = _mm_sub_epi32 (_mm_sub_epi32 (previous, open_v), column_gaps);
+			best = _mm_cvtsi128_si32 (_mm_shuffle_epi32 (running, 0xFF));
+
+			from_e = _mm_cmpgt_epi32 (e, h);
+			new_h = SelectInt32 (from_e, e, h);
+
+			extend_e = _mm_cmpgt_epi32 (_mm_sub_epi32 (_mm_or_si128 (_mm_slli_si128 (e, 4), _mm_cvtsi32_si128 (prev_e)), extend_v),
+				_mm_sub_epi32 (_mm_or_si128 (_mm_slli_si128 (new_h, 4), _mm_cvtsi32_si128 (prev_h)), open_extend_v));
+
+			prev_e = _mm_cvtsi128_si32 (_mm_shuffle_epi32 (e, 0xFF));
+			prev_h = _mm_cvtsi128_si32 (_mm_shuffle_epi32 (new_h, 0xFF));
+
+			trace = SelectInt32 (from_e, from_e_v, _mm_and_si128 (flags, from_f_v));
+			trace = _mm_or_si128 (_mm_or_si128 (trace, _mm_and_si128 (flags, extend_f_v)), _mm_and_si128 (extend_e, extend_e_v));
+
+			_mm_storeu_si128 ((__m128i *) (h_p + c), new_h);
+
+			/* Every lane is below 16 so the saturating packs keep them as they are */
+			trace = _mm_packs_epi32 (trace, trace);
+			trace = _mm_packus_epi16 (trace, trace);
+			packed = _mm_cvtsi128_si32 (trace);
+			memcpy (trace_p + c, &packed, 4);
+
+			column_gaps = _mm_add_epi32 (column_gaps, step_v);
+			c += 4;
+		}
+	#endif
+
+	while (c < band_p -> ab_width)
+		{
+			const int32 e = best - S_GAP_OPEN - S_GAP_EXTEND * (int32) c;
+			const int32 gain = h_p [c] + S_GAP_EXTEND * (int32) c;
+			const bool from_e = (e > h_p [c]);
+			const bool extend_e = (prev_e - S_GAP_EXTEND > prev_h - S_GAP_OPEN - S_GAP_EXTEND);
+
+			if (gain > best)
+				{
+					best = gain;
+				}
+
+			if (from_e)
+				{
+					h_p [c] = e;
+				}
+
+			trace_p [c] = (uint8) ((from_e ? LA_FROM_E : (flags_p [c] & LA_FROM_F)) | (flags_p [c] & LA_EXTEND_F) | (extend_e ? LA_EXTEND_E : 0));
+
+			prev_e = e;
+			prev_h = h_p [c];
+
+			++ c;
+		}
+}
+
+
+/*
+ * Walk back from the last cell, switching between the three matrices
+ * as the trace bits say, and then reverse the operations.
+ */
+static bool TraceBack (const AlignmentBand *band_p, LocusAlignment *alignment_p)
+{
+	const size_t max_ops = band_p -> ab_reference_length + band_p -> ab_other_length;
+	char *ops_s = (char *) AllocMemory (max_ops + 1);
+
+	if (ops_s)
+		{
+			size_t i = band_p -> ab_reference_length;
+			size_t j = band_p -> ab_other_length;
+			size_t num_ops = 0;
+			/* Which matrix the walk is in, where LA_FROM_DIAGONAL means H */
+			uint8 state = LA_FROM_DIAGONAL;
+
+			while ((i > 0) || (j > 0))
+				{
+					const uint8 trace = band_p -> ab_trace_p [i * (band_p -> ab_width) + (size_t) ((hts_pos_t) j - (hts_pos_t) i - band_p -> ab_low)];
+
+					if (state == LA_FROM_DIAGONAL)
+						{
+							state = trace & LA_SOURCE_MASK;
+
+							if (state == LA_FROM_DIAGONAL)
+								{
+									-- i;
+									-- j;
+
+									ops_s [num_ops ++] = (band_p -> ab_reference_p [i] == band_p -> ab_other_p [(size_t) ((hts_pos_t) j - band_p -> ab_low)]) ? '=' : 'X';
+								}
+						}
+					else if (state == LA_FROM_E)
+						{
+							ops_s [num_ops ++] = 'I';
+							-- j;
+
+							if (! (trace & LA_EXTEND_E))
+								{
+									state = LA_FROM_DIAGONAL;
+								}
+						}
+					else
+						{
+							ops_s [num_ops ++] = 'D';
+							-- i;
+
+							if (! (trace & LA_EXTEND_F))
+								{
+									state = LA_FROM_DIAGONAL;
+								}
+						}
+				}
+
+			alignment_p -> la_num_ops = num_ops;
+			alignment_p -> la_ops_s = ops_s;
+
+			/* Put the operations back into order */
+			for (i = 0, j = num_ops; i + 1 < j; ++ i)
+				{
+					const char c = ops_s [i];
+
+					-- j;
+					ops_s [i] = ops_s [j];
+					ops_s [j] = c;
+				}
+
+			ops_s [num_ops] = '\0';
+
+			return true;
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " alignment operations", max_ops);
+		}
+
+	return false;
+}
+
+
+static json_t *GetLocusAlignmentAsJSON (const LocusAlignment *alignment_p, const IndexRegion *region_p, const char *reference_s, const char *other_index_s, const IndexRegion *other_region_p, const char *other_s, const uint32 band_width, const uint32 max_variants, bool *complete_flag_p)
+{
+	json_t *result_p = NULL;
+	json_t *variants_p = json_array ();
+	char *cigar_s = (char *) AllocMemory (12 * (alignment_p -> la_num_ops) + 1);
+	bool success_flag = (variants_p != NULL) && (cigar_s != NULL);
+	size_t num_columns [256];
+	size_t num_variants = 0;
+	size_t i = 0;
+	size_t j = 0;
+	size_t k = 0;
+	char *cigar_end_s = cigar_s;
+
+	memset (num_columns, 0, sizeof (num_columns));
+	*complete_flag_p = true;
+
+	while ((k < alignment_p -> la_num_ops) && success_flag)
+		{
+			const char op = alignment_p -> la_ops_s [k];
+			size_t run = 1;
+
+			while ((k + run < alignment_p -> la_num_ops) && (alignment_p -> la_ops_s [k + run] == op))
+				{
+					++ run;
+				}
+
+			cigar_end_s += sprintf (cigar_end_s, SIZET_FMT "%c", run, op);
+			num_columns [(unsigned char) op] += run;
+
+			if (op == '=')
+				{
+					i += run;
+					j += run;
+				}
+			else if (op == 'X')
+				{
+					/* Each mismatch is a SNP of its own */
+					size_t l;
+
+					for (l = 0; (l < run) && success_flag; ++ l)
+						{
+							if (num_variants < max_variants)
+								{
+									json_t *variant_p = GetVariantAsJSON (op, region_p -> ir_start + (hts_pos_t) i + 1, other_region_p -> ir_start + (hts_pos_t) j + 1, reference_s + i, other_s + j, 1);
+
+									success_flag = (variant_p != NULL) && (json_array_append_new (variants_p, variant_p) == 0);
+									++ num_variants;
+								}
+							else
+								{
+									*complete_flag_p = false;
+								}
+
+							++ i;
+							++ j;
+						}
+				}
+			else
+				{
+					if (num_variants < max_variants)
+						{
+							/* Indels are placed after the last base that both sequences share */
+							json_t *variant_p = (op == 'I') ?
+								GetVariantAsJSON (op, region_p -> ir_start + (hts_pos_t) i, other_region_p -> ir_start + (hts_pos_t) j + 1, NULL, other_s + j, run) :
+								GetVariantAsJSON (op, region_p -> ir_start + (hts_pos_t) i + 1, other_region_p -> ir_start + (hts_pos_t) j, reference_s + i, NULL, run);
+
+							success_flag = (variant_p != NULL) && (json_array_append_new (variants_p, variant_p) == 0);
+							++ num_variants;
+						}
+					else
+						{
+							*complete_flag_p = false;
+						}
+
+					if (op == 'I')
+						{
+							j += run;
+						}
+					else
+						{
+							i += run;
+						}
+				}
+
+			k += run;
+		}
+
+	if (success_flag)
+		{
+			const double identity = (alignment_p -> la_num_ops > 0) ? floor ((10000.0 * num_columns ['=']) / (alignment_p -> la_num_ops) + 0.5) / 100.0 : 0.0;
+
+			*cigar_end_s = '\0';
+
+			result_p = json_pack ("{s:s,s:I,s:I,s:s,s:s,s:I,s:I,s:I,s:I,s:s,s:f,s:I,s:I,s:I,s:I,s:o}",
+				"scaffold", region_p -> ir_scaffold_name_s,
+				"start", (json_int_t) (region_p -> ir_start + 1),
+				"end", (json_int_t) (region_p -> ir_end),
+				"other_index", other_index_s,
+				"other_scaffold", other_region_p -> ir_scaffold_name_s,
+				"other_start", (json_int_t) (other_region_p -> ir_start + 1),
+				"other_end", (json_int_t) (other_region_p -> ir_end),
+				"band_width", (json_int_t) band_width,
+				"score", (json_int_t) (alignment_p -> la_score),
+				"cigar", cigar_s,
+				"identity", identity,
+				"matches", (json_int_t) (num_columns ['=']),
+				"mismatches", (json_int_t) (num_columns ['X']),
+				"inserted", (json_int_t) (num_columns ['I']),
+				"deleted", (json_int_t) (num_columns ['D']),
+				"variants", variants_p);
+
+			/* json_pack takes the array with "o" even if it fails */
+			variants_p = NULL;
+		}
+
+	if (!result_p)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create the comparison results");
+		}
+
+	if (variants_p)
+		{
+			json_decref (variants_p);
+		}
+
+	if (cigar_s)
+		{
+			FreeMemory (cigar_s);
+		}
+
+	return result_p;
+}
+
+
+/*
+ * An insertion has the bases that are only in the other sequence and
+ * a deletion has the ones that are only in the reference.
+ */
+static json_t *GetVariantAsJSON (const char op, const hts_pos_t position, const hts_pos_t other_position, const char *reference_s, const char *other_s, const size_t length)
+{
+	const char *type_s = (op == 'X') ? "snp" : ((op == 'I') ? "insertion" : "deletion");
+	json_t *variant_p = json_pack ("{s:s,s:I,s:I}", "type", type_s, "position", (json_int_t) position, "other_position", (json_int_t) other_position);
+
+	if (variant_p)
+		{
+			bool success_flag = true;
+
+			if (reference_s)
+				{
+					char *bases_s = GetUpperCaseBases (reference_s, length);
+
+					success_flag = (bases_s != NULL) && (json_object_set_new (variant_p, "reference", json_string (bases_s)) == 0);
+
+					if (bases_s)
+						{
+							FreeMemory (bases_s);
+						}
+				}
+
+			if (success_flag && other_s)
+				{
+					char *bases_s = GetUpperCaseBases (other_s, length);
+
+					success_flag = (bases_s != NULL) && (json_object_set_new (variant_p, "other", json_string (bases_s)) == 0);
+
+					if (bases_s)
+						{
+							FreeMemory (bases_s);
+						}
+				}
+
+			if (success_flag)
+				{
+					return variant_p;
+				}
+
+			json_decref (variant_p);
+		}
+
+	return NULL;
+}
+
+
+static char *GetUpperCaseBases (const char *sequence_s, const size_t length)
+{
+	char *bases_s = (char *) AllocMemory (length + 1);
+
+	if (bases_s)
+		{
+			size_t i;
+
+			for (i = 0; i < length; ++ i)
+				{
+					bases_s [i] = (char) toupper (sequence_s [i]);
+				}
+
+			bases_s [length] = '\0';
+		}
+
+	return bases_s;
+}
+
+
+#ifdef __SSE2__
+static inline __m128i SelectInt32 (const __m128i mask, const __m128i if_true, const __m128i if_false)
+{
+	return _mm_or_si128 (_mm_and_si128 (mask, if_true), _mm_andnot_si128 (mask, if_false));
+}
+#endif
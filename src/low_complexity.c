@@ -0,0 +1,749 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * low_complexity.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "low_complexity.h"
+#include "sequence_kernels.h"
+#include "memory_allocations.h"
+#include "streams.h"
+
+#include "string_parameter.h"
+#include "unsigned_int_parameter.h"
+
+
+/*
+ * The number of distinct triplets and the size of the circular queue
+ * holding the triplets in the current window.
+ */
+#define LC_NUM_TRIPLETS (64)
+#define LC_QUEUE_SIZE (64)
+
+
+typedef struct LowComplexityInterval
+{
+	uint64 lci_start;
+	uint64 lci_end;
+
+	/* The length of the repeated unit, which starts at lci_start, or 0 for an SDUST region */
+	uint32 lci_period;
+} LowComplexityInterval;
+
+
+typedef struct LowComplexityList
+{
+	LowComplexityInterval *lcl_intervals_p;
+	size_t lcl_num_intervals;
+	size_t lcl_max_intervals;
+} LowComplexityList;
+
+
+/*
+ * A candidate interval within the window whose score is above the
+ * threshold and at least that of every interval within it.
+ */
+typedef struct PerfectInterval
+{
+	int64 pi_start;
+	int64 pi_end;
+	int pi_score;
+	int pi_length;
+} PerfectInterval;
+
+
+/*
+ * The state for SDUST, from Morgulis et al. (2006), which scores the
+ * triplets in a sliding window. The window is w and v is its longest
+ * suffix in which no triplet occurs too often, as in the paper.
+ */
+typedef struct DustScanner
+{
+	int ds_triplets [LC_QUEUE_SIZE];
+	size_t ds_front;
+	size_t ds_num_triplets;
+
+	int ds_window_counts [LC_NUM_TRIPLETS];
+	int ds_window_score;
+
+	int ds_suffix_counts [LC_NUM_TRIPLETS];
+	int ds_suffix_score;
+	int ds_suffix_length;
+
+	/* The perfect intervals within the window, in decreasing order of start */
+	PerfectInterval *ds_perfect_p;
+	size_t ds_num_perfect;
+	size_t ds_max_perfect;
+
+	int ds_threshold;
+	LowComplexityList *ds_list_p;
+} DustScanner;
+
+
+static NamedParameterType S_LOW_COMPLEXITY = { "Low complexity", PT_STRING };
+
+static NamedParameterType S_DUST_THRESHOLD = { "DUST threshold", PT_UNSIGNED_INT };
+
+static NamedParameterType S_MIN_HOMOPOLYMER_LENGTH = { "Min homopolymer length", PT_UNSIGNED_INT };
+
+static NamedParameterType S_MIN_MICROSATELLITE_LENGTH = { "Min microsatellite length", PT_UNSIGNED_INT };
+
+
+static const char * const S_LOW_COMPLEXITY_NONE_S = "none";
+static const char * const S_LOW_COMPLEXITY_SOFT_S = "soft";
+static const char * const S_LOW_COMPLEXITY_HARD_S = "hard";
+static const char * const S_LOW_COMPLEXITY_INTERVALS_S = "intervals";
+
+/*
+ * The defaults used by dustmasker and minimap2.
+ */
+static const uint32 S_DEFAULT_DUST_THRESHOLD = 20;
+
+static const int S_DUST_WINDOW = 64;
+
+static const uint32 S_DEFAULT_MIN_HOMOPOLYMER_LENGTH = 8;
+
+static const uint32 S_DEFAULT_MIN_MICROSATELLITE_LENGTH = 12;
+
+/*
+ * The longest repeated unit that counts as a microsatellite.
+ */
+static const size_t S_MAX_MICROSATELLITE_PERIOD = 6;
+
+static const size_t S_INITIAL_NUM_INTERVALS = 256;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool GetLowComplexityIntervals (const char *sequence_s, const size_t length, const LowComplexitySettings *settings_p, LowComplexityList *list_p);
+
+static bool FindDustIntervals (const char *sequence_s, const size_t length, const int threshold, LowComplexityList *list_p);
+
+static void ShiftDustWindow (DustScanner *scanner_p, const int triplet);
+
+static bool FindPerfectIntervals (DustScanner *scanner_p, const int64 window_start);
+
+static bool SaveDustInterval (DustScanner *scanner_p, const int64 window_start);
+
+static void ResetDustWindow (DustScanner *scanner_p);
+
+static bool FindTandemRuns (const char *sequence_s, const size_t length, const LowComplexitySettings *settings_p, LowComplexityList *list_p);
+
+static bool HasShorterPeriod (const char *unit_s, const size_t period);
+
+static bool AppendLowComplexityInterval (LowComplexityList *list_p, const uint64 start, const uint64 end, const uint32 period);
+
+static void ClearLowComplexityList (LowComplexityList *list_p);
+
+static int CompareLowComplexityIntervals (const void *v0_p, const void *v1_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool AddLowComplexityParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	bool success_flag = false;
+	Parameter *param_p = EasyCreateAndAddStringParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_LOW_COMPLEXITY.npt_type, S_LOW_COMPLEXITY.npt_name_s, "Low complexity", "What to do with the low-complexity regions, homopolymers and microsatellites of a scaffold", S_LOW_COMPLEXITY_NONE_S, PL_ADVANCED);
+
+	if (param_p)
+		{
+			success_flag = (CreateAndAddStringParameterOption (param_p, S_LOW_COMPLEXITY_NONE_S, "Don't look for them")) &&
+				(CreateAndAddStringParameterOption (param_p, S_LOW_COMPLEXITY_SOFT_S, "Convert them to lower case")) &&
+				(CreateAndAddStringParameterOption (param_p, S_LOW_COMPLEXITY_HARD_S, "Replace them with N")) &&
+				(CreateAndAddStringParameterOption (param_p, S_LOW_COMPLEXITY_INTERVALS_S, "Get their intervals as BED instead of the sequence")) &&
+				(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_DUST_THRESHOLD.npt_name_s, "DUST threshold", "The SDUST score above which a region is low-complexity, or 0 to not run SDUST", &S_DEFAULT_DUST_THRESHOLD, PL_ADVANCED) != NULL) &&
+				(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MIN_HOMOPOLYMER_LENGTH.npt_name_s, "Min homopolymer length", "The shortest run of a single base to report, or 0 to not report them", &S_DEFAULT_MIN_HOMOPOLYMER_LENGTH, PL_ADVANCED) != NULL) &&
+				(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MIN_MICROSATELLITE_LENGTH.npt_name_s, "Min microsatellite length", "The shortest tandem repeat of a 2 to 6 base unit to report, or 0 to not report them", &S_DEFAULT_MIN_MICROSATELLITE_LENGTH, PL_ADVANCED) != NULL);
+		}
+
+	return success_flag;
+}
+
+
+bool GetLowComplexityParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_LOW_COMPLEXITY.npt_name_s) == 0)
+		{
+			*pt_p = S_LOW_COMPLEXITY.npt_type;
+		}
+	else if (strcmp (param_name_s, S_DUST_THRESHOLD.npt_name_s) == 0)
+		{
+			*pt_p = S_DUST_THRESHOLD.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MIN_HOMOPOLYMER_LENGTH.npt_name_s) == 0)
+		{
+			*pt_p = S_MIN_HOMOPOLYMER_LENGTH.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MIN_MICROSATELLITE_LENGTH.npt_name_s) == 0)
+		{
+			*pt_p = S_MIN_MICROSATELLITE_LENGTH.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+void GetLowComplexitySettings (const ParameterSet *param_set_p, LowComplexitySettings *settings_p)
+{
+	const char *mode_s = NULL;
+	const uint32 *value_p = NULL;
+
+	settings_p -> lcs_mode = LC_NONE;
+
+	if (GetCurrentStringParameterValueFromParameterSet (param_set_p, S_LOW_COMPLEXITY.npt_name_s, &mode_s) && mode_s)
+		{
+			if (strcmp (mode_s, S_LOW_COMPLEXITY_SOFT_S) == 0)
+				{
+					settings_p -> lcs_mode = LC_SOFT;
+				}
+			else if (strcmp (mode_s, S_LOW_COMPLEXITY_HARD_S) == 0)
+				{
+					settings_p -> lcs_mode = LC_HARD;
+				}
+			else if (strcmp (mode_s, S_LOW_COMPLEXITY_INTERVALS_S) == 0)
+				{
+					settings_p -> lcs_mode = LC_INTERVALS;
+				}
+			else if (strcmp (mode_s, S_LOW_COMPLEXITY_NONE_S) != 0)
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Unknown low complexity mode \"%s\", ignoring it", mode_s);
+				}
+		}
+
+	settings_p -> lcs_dust_threshold = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_DUST_THRESHOLD.npt_name_s, &value_p) && value_p) ? *value_p : S_DEFAULT_DUST_THRESHOLD;
+	settings_p -> lcs_min_homopolymer_length = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MIN_HOMOPOLYMER_LENGTH.npt_name_s, &value_p) && value_p) ? *value_p : S_DEFAULT_MIN_HOMOPOLYMER_LENGTH;
+	settings_p -> lcs_min_microsatellite_length = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MIN_MICROSATELLITE_LENGTH.npt_name_s, &value_p) && value_p) ? *value_p : S_DEFAULT_MIN_MICROSATELLITE_LENGTH;
+}
+
+
+bool ApplyLowComplexityMask (char *sequence_s, const size_t length, const LowComplexitySettings *settings_p)
+{
+	bool success_flag = true;
+
+	if ((settings_p -> lcs_mode == LC_SOFT) || (settings_p -> lcs_mode == LC_HARD))
+		{
+			LowComplexityList list;
+
+			if ((success_flag = GetLowComplexityIntervals (sequence_s, length, settings_p, &list)) == true)
+				{
+					size_t i;
+
+					for (i = 0; i < list.lcl_num_intervals; ++ i)
+						{
+							const LowComplexityInterval *interval_p = list.lcl_intervals_p + i;
+
+							if (settings_p -> lcs_mode == LC_HARD)
+								{
+									memset (sequence_s + interval_p -> lci_start, 'N', (size_t) (interval_p -> lci_end - interval_p -> lci_start));
+								}
+							else
+								{
+									uint64 j;
+
+									for (j = interval_p -> lci_start; j < interval_p -> lci_end; ++ j)
+										{
+											if ((sequence_s [j] >= 'A') && (sequence_s [j] <= 'Z'))
+												{
+													sequence_s [j] |= 0x20;
+												}
+										}
+								}
+						}
+
+					ClearLowComplexityList (&list);
+				}
+		}
+
+	return success_flag;
+}
+
+
+bool AppendLowComplexityIntervals (ByteBuffer *buffer_p, const char *scaffold_name_s, const char *sequence_s, const size_t length, const uint64 offset, const LowComplexitySettings *settings_p)
+{
+	LowComplexityList list;
+	bool success_flag = GetLowComplexityIntervals (sequence_s, length, settings_p, &list);
+
+	if (success_flag)
+		{
+			size_t i;
+
+			for (i = 0; (i < list.lcl_num_intervals) && success_flag; ++ i)
+				{
+					const LowComplexityInterval *interval_p = list.lcl_intervals_p + i;
+					char name_s [16] = "dust";
+
+					if (interval_p -> lci_period > 0)
+						{
+							uint32 j;
+
+							name_s [0] = '(';
+
+							for (j = 0; j < interval_p -> lci_period; ++ j)
+								{
+									const char c = sequence_s [interval_p -> lci_start + j];
+
+									name_s [j + 1] = ((c >= 'a') && (c <= 'z')) ? c - 0x20 : c;
+								}
+
+							strcpy (name_s + j + 1, ")n");
+						}
+
+					if (!AppendVarArgsToByteBuffer (buffer_p, "%s\t" UINT64_FMT "\t" UINT64_FMT "\t%s\n", scaffold_name_s, offset + interval_p -> lci_start, offset + interval_p -> lci_end, name_s))
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add low-complexity interval for %s", scaffold_name_s);
+							success_flag = false;
+						}
+				}
+
+			ClearLowComplexityList (&list);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static bool GetLowComplexityIntervals (const char *sequence_s, const size_t length, const LowComplexitySettings *settings_p, LowComplexityList *list_p)
+{
+	list_p -> lcl_num_intervals = 0;
+	list_p -> lcl_max_intervals = 0;
+	list_p -> lcl_intervals_p = NULL;
+
+	/* SDUST goes first since it merges each region with the one before */
+	if (((settings_p -> lcs_dust_threshold == 0) || FindDustIntervals (sequence_s, length, (int) (settings_p -> lcs_dust_threshold), list_p)) &&
+		FindTandemRuns (sequence_s, length, settings_p, list_p))
+		{
+			if (list_p -> lcl_num_intervals > 1)
+				{
+					qsort (list_p -> lcl_intervals_p, list_p -> lcl_num_intervals, sizeof (LowComplexityInterval), CompareLowComplexityIntervals);
+				}
+
+			return true;
+		}
+
+	ClearLowComplexityList (list_p);
+
+	return false;
+}
+
+
+/*
+ * A single linear pass over the sequence. Any base other than A, C, G or
+ * T breaks the sequence into independent pieces.
+ */
+static bool FindDustIntervals (const char *sequence_s, const size_t length, const int threshold, LowComplexityList *list_p)
+{
+	DustScanner scanner;
+	bool success_flag = true;
+	int64 run_length = 0;
+	int triplet = 0;
+	size_t i;
+
+	memset (&scanner, 0, sizeof (DustScanner));
+	scanner.ds_threshold = threshold;
+	scanner.ds_list_p = list_p;
+
+	for (i = 0; (i <= length) && success_flag; ++ i)
+		{
+			int code = 4;
+
+			if (i < length)
+				{
+					switch (sequence_s [i])
+						{
+							case 'A':
+							case 'a':
+								code = 0;
+								break;
+
+							case 'C':
+							case 'c':
+								code = 1;
+								break;
+
+							case 'G':
+							case 'g':
+								code = 2;
+								break;
+
+							case 'T':
+							case 't':
+								code = 3;
+								break;
+
+							default:
+								break;
+						}
+				}
+
+			if (code < 4)
+				{
+					++ run_length;
+					triplet = ((triplet << 2) | code) & (LC_NUM_TRIPLETS - 1);
+
+					if (run_length >= 3)
+						{
+							const int64 window_start = ((run_length > S_DUST_WINDOW) ? run_length - S_DUST_WINDOW : 0) + ((int64) i + 1 - run_length);
+
+							/* Save the intervals that have fallen out of the window */
+							success_flag = SaveDustInterval (&scanner, window_start);
+
+							ShiftDustWindow (&scanner, triplet);
+
+							if (success_flag && (scanner.ds_window_score * 10 > scanner.ds_suffix_length * threshold))
+								{
+									success_flag = FindPerfectIntervals (&scanner, window_start);
+								}
+						}
+				}
+			else
+				{
+					int64 window_start = ((run_length - S_DUST_WINDOW + 1 > 0) ? run_length - S_DUST_WINDOW + 1 : 0) + ((int64) i + 1 - run_length);
+
+					while ((scanner.ds_num_perfect > 0) && success_flag)
+						{
+							success_flag = SaveDustInterval (&scanner, window_start ++);
+						}
+
+					ResetDustWindow (&scanner);
+					run_length = 0;
+					triplet = 0;
+				}
+		}
+
+	if (scanner.ds_perfect_p)
+		{
+			FreeMemory (scanner.ds_perfect_p);
+		}
+
+	return success_flag;
+}
+
+
+static void ShiftDustWindow (DustScanner *scanner_p, const int triplet)
+{
+	int *window_counts_p = scanner_p -> ds_window_counts;
+	int *suffix_counts_p = scanner_p -> ds_suffix_counts;
+
+	/* The window holds the triplets of S_DUST_WINDOW bases */
+	if (scanner_p -> ds_num_triplets >= (size_t) (S_DUST_WINDOW - 2))
+		{
+			const int old = scanner_p -> ds_triplets [scanner_p -> ds_front];
+
+			scanner_p -> ds_front = (scanner_p -> ds_front + 1) & (LC_QUEUE_SIZE - 1);
+			-- (scanner_p -> ds_num_triplets);
+
+			scanner_p -> ds_window_score -= -- (window_counts_p [old]);
+
+			if (scanner_p -> ds_suffix_length > (int) (scanner_p -> ds_num_triplets))
+				{
+					-- (scanner_p -> ds_suffix_length);
+					scanner_p -> ds_suffix_score -= -- (suffix_counts_p [old]);
+				}
+		}
+
+	scanner_p -> ds_triplets [(scanner_p -> ds_front + scanner_p -> ds_num_triplets) & (LC_QUEUE_SIZE - 1)] = triplet;
+	++ (scanner_p -> ds_num_triplets);
+	++ (scanner_p -> ds_suffix_length);
+
+	scanner_p -> ds_window_score += (window_counts_p [triplet]) ++;
+	scanner_p -> ds_suffix_score += (suffix_counts_p [triplet]) ++;
+
+	/* Shrink v from the left until the new triplet no longer occurs too often within it */
+	if (suffix_counts_p [triplet] * 10 > (scanner_p -> ds_threshold << 1))
+		{
+			int old;
+
+			do
+				{
+					old = scanner_p -> ds_triplets [(scanner_p -> ds_front + scanner_p -> ds_num_triplets - scanner_p -> ds_suffix_length) & (LC_QUEUE_SIZE - 1)];
+					scanner_p -> ds_suffix_score -= -- (suffix_counts_p [old]);
+					-- (scanner_p -> ds_suffix_length);
+				}
+			while (old != triplet);
+		}
+}
+
+
+static bool FindPerfectIntervals (DustScanner *scanner_p, const int64 window_start)
+{
+	int counts [LC_NUM_TRIPLETS];
+	int score = scanner_p -> ds_suffix_score;
+	int max_score = 0;
+	int max_length = 0;
+	int i;
+
+	memcpy (counts, scanner_p -> ds_suffix_counts, sizeof (counts));
+
+	/* Extend v to the left one triplet at a time */
+	for (i = (int) (scanner_p -> ds_num_triplets) - scanner_p -> ds_suffix_length - 1; i >= 0; -- i)
+		{
+			const int triplet = scanner_p -> ds_triplets [(scanner_p -> ds_front + (size_t) i) & (LC_QUEUE_SIZE - 1)];
+			const int length = (int) (scanner_p -> ds_num_triplets) - i - 1;
+
+			score += (counts [triplet]) ++;
+
+			if (score * 10 > scanner_p -> ds_threshold * length)
+				{
+					size_t j;
+
+					for (j = 0; (j < scanner_p -> ds_num_perfect) && (scanner_p -> ds_perfect_p [j].pi_start >= i + window_start); ++ j)
+						{
+							const PerfectInterval *perfect_p = scanner_p -> ds_perfect_p + j;
+
+							if ((max_score == 0) || (perfect_p -> pi_score * max_length > max_score * perfect_p -> pi_length))
+								{
+									max_score = perfect_p -> pi_score;
+									max_length = perfect_p -> pi_length;
+								}
+						}
+
+					/* It is perfect if no interval within it scores higher */
+					if ((max_score == 0) || (score * max_length >= max_score * length))
+						{
+							PerfectInterval *perfect_p;
+
+							if (scanner_p -> ds_num_perfect == scanner_p -> ds_max_perfect)
+								{
+									const size_t new_max = (scanner_p -> ds_max_perfect > 0) ? (scanner_p -> ds_max_perfect << 1) : LC_QUEUE_SIZE;
+									PerfectInterval *intervals_p = (scanner_p -> ds_perfect_p) ?
+										(PerfectInterval *) ReallocMemory (scanner_p -> ds_perfect_p, new_max * sizeof (PerfectInterval), (scanner_p -> ds_max_perfect) * sizeof (PerfectInterval)) :
+										(PerfectInterval *) AllocMemoryArray (sizeof (PerfectInterval), new_max);
+
+									if (!intervals_p)
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " perfect intervals", new_max);
+											return false;
+										}
+
+									scanner_p -> ds_perfect_p = intervals_p;
+									scanner_p -> ds_max_perfect = new_max;
+								}
+
+							max_score = score;
+							max_length = length;
+
+							perfect_p = scanner_p -> ds_perfect_p + j;
+							memmove (perfect_p + 1, perfect_p, (scanner_p -> ds_num_perfect - j) * sizeof (PerfectInterval));
+							++ (scanner_p -> ds_num_perfect);
+
+							perfect_p -> pi_start = i + window_start;
+							perfect_p -> pi_end = (int64) (scanner_p -> ds_num_triplets) + 2 + window_start;
+							perfect_p -> pi_score = score;
+							perfect_p -> pi_length = length;
+						}
+				}
+		}
+
+	return true;
+}
+
+
+/*
+ * Save the leftmost perfect interval once the window has moved past its
+ * start, merging it with the previous region if they overlap or touch,
+ * and drop the perfect intervals that have left the window.
+ */
+static bool SaveDustInterval (DustScanner *scanner_p, const int64 window_start)
+{
+	if ((scanner_p -> ds_num_perfect > 0) && (scanner_p -> ds_perfect_p [scanner_p -> ds_num_perfect - 1].pi_start < window_start))
+		{
+			const PerfectInterval *perfect_p = scanner_p -> ds_perfect_p + (scanner_p -> ds_num_perfect - 1);
+			LowComplexityList *list_p = scanner_p -> ds_list_p;
+			LowComplexityInterval *last_p = (list_p -> lcl_num_intervals > 0) ? list_p -> lcl_intervals_p + (list_p -> lcl_num_intervals - 1) : NULL;
+
+			if (last_p && ((uint64) (perfect_p -> pi_start) <= last_p -> lci_end))
+				{
+					if ((uint64) (perfect_p -> pi_end) > last_p -> lci_end)
+						{
+							last_p -> lci_end = (uint64) (perfect_p -> pi_end);
+						}
+				}
+			else if (!AppendLowComplexityInterval (list_p, (uint64) (perfect_p -> pi_start), (uint64) (perfect_p -> pi_end), 0))
+				{
+					return false;
+				}
+
+			while ((scanner_p -> ds_num_perfect > 0) && (scanner_p -> ds_perfect_p [scanner_p -> ds_num_perfect - 1].pi_start < window_start))
+				{
+					-- (scanner_p -> ds_num_perfect);
+				}
+		}
+
+	return true;
+}
+
+
+static void ResetDustWindow (DustScanner *scanner_p)
+{
+	scanner_p -> ds_front = 0;
+	scanner_p -> ds_num_triplets = 0;
+	scanner_p -> ds_window_score = 0;
+	scanner_p -> ds_suffix_score = 0;
+	scanner_p -> ds_suffix_length = 0;
+
+	memset (scanner_p -> ds_window_counts, 0, sizeof (scanner_p -> ds_window_counts));
+	memset (scanner_p -> ds_suffix_counts, 0, sizeof (scanner_p -> ds_suffix_counts));
+}
+
+
+/*
+ * A base that matches the one a period further on extends a run with
+ * that period, so each period needs just one pass to find the starts
+ * and ends of the runs of matching positions.
+ */
+static bool FindTandemRuns (const char *sequence_s, const size_t length, const LowComplexitySettings *settings_p, LowComplexityList *list_p)
+{
+	size_t period;
+
+	for (period = 1; (period <= S_MAX_MICROSATELLITE_PERIOD) && (period < length); ++ period)
+		{
+			const uint32 min_length = (period == 1) ? settings_p -> lcs_min_homopolymer_length : settings_p -> lcs_min_microsatellite_length;
+
+			if (min_length > 0)
+				{
+					const size_t end = length - period;
+					size_t i = 0;
+
+					while ((i = FindNextPeriodicBase (sequence_s, i, end, period)) < end)
+						{
+							const size_t run_end = FindNextAperiodicBase (sequence_s, i, end, period);
+							const size_t run_length = run_end - i + period;
+
+							/* Need at least two copies and leave repeats of a shorter unit to that period */
+							if ((run_length >= min_length) && (run_length >= (period << 1)) && !HasShorterPeriod (sequence_s + i, period))
+								{
+									if (!AppendLowComplexityInterval (list_p, i, i + run_length, (uint32) period))
+										{
+											return false;
+										}
+								}
+
+							i = run_end;
+						}
+				}
+		}
+
+	return true;
+}
+
+
+static bool HasShorterPeriod (const char *unit_s, const size_t period)
+{
+	size_t divisor;
+
+	for (divisor = 1; divisor < period; ++ divisor)
+		{
+			if ((period % divisor) == 0)
+				{
+					size_t i = 0;
+
+					while ((i + divisor < period) && (((unit_s [i] ^ unit_s [i + divisor]) & ~0x20) == 0))
+						{
+							++ i;
+						}
+
+					if (i + divisor == period)
+						{
+							return true;
+						}
+				}
+		}
+
+	return false;
+}
+
+
+static bool AppendLowComplexityInterval (LowComplexityList *list_p, const uint64 start, const uint64 end, const uint32 period)
+{
+	LowComplexityInterval *interval_p;
+
+	if (list_p -> lcl_num_intervals == list_p -> lcl_max_intervals)
+		{
+			const size_t new_max = (list_p -> lcl_max_intervals > 0) ? (list_p -> lcl_max_intervals << 1) : S_INITIAL_NUM_INTERVALS;
+			LowComplexityInterval *intervals_p = (list_p -> lcl_intervals_p) ?
+				(LowComplexityInterval *) ReallocMemory (list_p -> lcl_intervals_p, new_max * sizeof (LowComplexityInterval), (list_p -> lcl_max_intervals) * sizeof (LowComplexityInterval)) :
+				(LowComplexityInterval *) AllocMemoryArray (sizeof (LowComplexityInterval), new_max);
+
+			if (!intervals_p)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " low-complexity intervals", new_max);
+					return false;
+				}
+
+			list_p -> lcl_intervals_p = intervals_p;
+			list_p -> lcl_max_intervals = new_max;
+		}
+
+	interval_p = list_p -> lcl_intervals_p + list_p -> lcl_num_intervals;
+	interval_p -> lci_start = start;
+	interval_p -> lci_end = end;
+	interval_p -> lci_period = period;
+	++ (list_p -> lcl_num_intervals);
+
+	return true;
+}
+
+
+static void ClearLowComplexityList (LowComplexityList *list_p)
+{
+	if (list_p -> lcl_intervals_p)
+		{
+			FreeMemory (list_p -> lcl_intervals_p);
+			list_p -> lcl_intervals_p = NULL;
+		}
+
+	list_p -> lcl_num_intervals = 0;
+	list_p -> lcl_max_intervals = 0;
+}
+
+
+static int CompareLowComplexityIntervals (const void *v0_p, const void *v1_p)
+{
+	const LowComplexityInterval *interval0_p = (const LowComplexityInterval *) v0_p;
+	const LowComplexityInterval *interval1_p = (const LowComplexityInterval *) v1_p;
+
+	if (interval0_p -> lci_start != interval1_p -> lci_start)
+		{
+			return (interval0_p -> lci_start < interval1_p -> lci_start) ? -1 : 1;
+		}
+
+	if (interval0_p -> lci_end != interval1_p -> lci_end)
+		{
+			return (interval0_p -> lci_end < interval1_p -> lci_end) ? -1 : 1;
+		}
+
+	return (interval0_p -> lci_period < interval1_p -> lci_period) ? -1 : ((interval0_p -> lci_period > interval1_p -> lci_period) ? 1 : 0);
+}
@@ -0,0 +1,1115 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * minhash_sketch.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "minhash_sketch.h"
+#include "sequence_kernels.h"
+#include "worker_pool.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "audit.h"
+
+#include "string_parameter.h"
+#include "unsigned_int_parameter.h"
+#include "boolean_parameter.h"
+
+
+#ifdef _DEBUG
+	#define MINHASH_SKETCH_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define MINHASH_SKETCH_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * The start of each sketch file. This is followed by the scaffold
+ * offsets and then the hashes.
+ */
+typedef struct SketchHeader
+{
+	char sh_magic [8];
+	uint32 sh_kmer_length;
+	uint32 sh_sketch_size;
+	uint64 sh_num_scaffolds;
+	uint64 sh_num_hashes;
+} SketchHeader;
+
+
+/*
+ * The smallest distinct hashes seen so far. Hashes below the threshold
+ * are appended and every so often the list is sorted and cut back down
+ * to the sketch size, which lowers the threshold.
+ */
+typedef struct BottomSketch
+{
+	uint64 *bs_hashes_p;
+	size_t bs_num_hashes;
+	size_t bs_max_hashes;
+	size_t bs_sketch_size;
+	uint64 bs_threshold;
+} BottomSketch;
+
+
+typedef struct SketchBuilder
+{
+	IndexData *sb_index_data_p;
+	size_t sb_num_scaffolds;
+	const char **sb_names_ss;
+	hts_pos_t *sb_lengths_p;
+	uint64 **sb_hashes_pp;
+	size_t *sb_num_hashes_p;
+	volatile bool *sb_stop_flag_p;
+} SketchBuilder;
+
+
+typedef struct SketchNeighbour
+{
+	IndexData *sn_index_data_p;
+	const ScaffoldSketches *sn_sketches_p;
+
+	/* This is ss_num_scaffolds when comparing against the whole assembly */
+	size_t sn_scaffold_index;
+
+	double sn_distance;
+	uint32 sn_shared_hashes;
+	uint32 sn_total_hashes;
+} SketchNeighbour;
+
+
+typedef struct SketchComparison
+{
+	const uint64 *sc_query_p;
+	size_t sc_query_length;
+	SketchNeighbour *sc_neighbours_p;
+	size_t sc_num_neighbours;
+} SketchComparison;
+
+
+static NamedParameterType S_MAX_NEIGHBOURS = { "Max neighbours", PT_UNSIGNED_INT };
+
+
+static const uint32 S_DEFAULT_MAX_NEIGHBOURS = 10;
+
+static const char * const S_ALL_SCAFFOLDS_S = "*";
+
+static const char * const S_SKETCH_SUFFIX_S = ".sketch";
+
+static const char S_SKETCH_MAGIC [8] = { 'S', 'T', 'S', 'K', 'C', 'H', '0', '1' };
+
+/*
+ * The k-mer length and sketch size that Mash uses by default, which
+ * give useful distances down to about 70% identity.
+ */
+static const uint32 S_KMER_LENGTH = 21;
+
+static const uint32 S_SKETCH_SIZE = 1000;
+
+static const hts_pos_t S_BLOCK_SIZE = 1 << 22;
+
+/*
+ * The number of k-mers that are collected before hashing them together.
+ */
+#define MS_KMER_BATCH_SIZE (4096)
+
+/*
+ * The number of neighbours that each comparison task does.
+ */
+static const size_t S_COMPARISON_TASK_SIZE = 1024;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool IsScaffoldSketchFileUpToDate (const IndexData *index_data_p, const char *sketch_filename_s);
+
+static bool BuildScaffoldSketches (IndexData *index_data_p, const char *sketch_filename_s, const uint32 num_threads, volatile bool *stop_flag_p);
+
+static bool SketchScaffold (const size_t task_index, void *data_p);
+
+static bool WriteScaffoldSketches (const SketchBuilder *builder_p, const char *sketch_filename_s);
+
+static bool MapScaffoldSketches (ScaffoldSketches *sketches_p, const char *sketch_filename_s);
+
+static bool InitBottomSketch (BottomSketch *sketch_p, const size_t sketch_size);
+
+static void ClearBottomSketch (BottomSketch *sketch_p);
+
+static void AddToBottomSketch (BottomSketch *sketch_p, const uint64 *hashes_p, const size_t num_hashes);
+
+static void CompactBottomSketch (BottomSketch *sketch_p);
+
+static bool GetAssemblySketch (const ScaffoldSketches *sketches_p, BottomSketch *sketch_p);
+
+static bool CompareSketchTask (const size_t task_index, void *data_p);
+
+static double GetMashDistance (const uint64 *hashes0_p, const size_t num_hashes0, const uint64 *hashes1_p, const size_t num_hashes1, const size_t sketch_size, const uint32 kmer_length, uint32 *shared_p, uint32 *total_p);
+
+static bool AddIndexNeighbours (SketchNeighbour **neighbours_pp, size_t *num_neighbours_p, size_t *max_neighbours_p, IndexData *index_data_p, const ScaffoldSketches *sketches_p, const bool assembly_flag);
+
+static json_t *GetSketchNeighboursAsJSON (IndexData *query_index_p, const char *query_scaffold_s, const SketchNeighbour *neighbours_p, const size_t num_neighbours, const size_t max_neighbours, const IndexData *skip_index_p, const size_t skip_scaffold);
+
+static const char *GetSketchIndexName (const IndexData *index_data_p);
+
+static int CompareUInt64s (const void *v0_p, const void *v1_p);
+
+static int CompareSketchNeighbours (const void *v0_p, const void *v1_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool BuildIndexScaffoldSketches (IndexData *index_data_p, const char *sidecar_directory_s, volatile bool *stop_flag_p)
+{
+	bool success_flag = false;
+	char *sketch_filename_s = MakeSidecarFilename (sidecar_directory_s, index_data_p -> id_fasta_filename_s, S_SKETCH_SUFFIX_S);
+
+	if (sketch_filename_s)
+		{
+			if (IsScaffoldSketchFileUpToDate (index_data_p, sketch_filename_s))
+				{
+					success_flag = true;
+				}
+			else
+				{
+					/* This runs alongside the service's jobs so it only uses a single thread */
+					success_flag = BuildScaffoldSketches (index_data_p, sketch_filename_s, 1, stop_flag_p);
+				}
+
+			FreeCopiedString (sketch_filename_s);
+		}
+
+	return success_flag;
+}
+
+
+const ScaffoldSketches *GetIndexScaffoldSketches (IndexData *index_data_p, const char *sidecar_directory_s)
+{
+	const ScaffoldSketches *sketches_p = NULL;
+
+	if (index_data_p -> id_fasta_filename_s)
+		{
+			pthread_mutex_lock (& (index_data_p -> id_sidecar_mutex));
+
+			if (! (index_data_p -> id_sketches_p))
+				{
+					char *sketch_filename_s = MakeSidecarFilename (sidecar_directory_s, index_data_p -> id_fasta_filename_s, S_SKETCH_SUFFIX_S);
+
+					/* Until the background builder has written the file, there are no sketches */
+					if (sketch_filename_s)
+						{
+							if (IsScaffoldSketchFileUpToDate (index_data_p, sketch_filename_s))
+								{
+									ScaffoldSketches *new_sketches_p = (ScaffoldSketches *) AllocMemory (sizeof (ScaffoldSketches));
+
+									if (new_sketches_p)
+										{
+											if (MapScaffoldSketches (new_sketches_p, sketch_filename_s))
+												{
+													index_data_p -> id_sketches_p = new_sketches_p;
+												}
+											else
+												{
+													FreeMemory (new_sketches_p);
+												}
+										}
+								}
+
+							FreeCopiedString (sketch_filename_s);
+						}
+				}
+
+			sketches_p = index_data_p -> id_sketches_p;
+
+			pthread_mutex_unlock (& (index_data_p -> id_sidecar_mutex));
+		}
+
+	return sketches_p;
+}
+
+
+void FreeScaffoldSketches (ScaffoldSketches *sketches_p)
+{
+	CloseMappedFile (& (sketches_p -> ss_file));
+	FreeMemory (sketches_p);
+}
+
+
+bool AddSketchParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	return (EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MAX_NEIGHBOURS.npt_name_s, "Max neighbours", "The number of nearest scaffolds, or assemblies, to return", &S_DEFAULT_MAX_NEIGHBOURS, PL_ADVANCED) != NULL);
+}
+
+
+bool GetSketchParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_MAX_NEIGHBOURS.npt_name_s) == 0)
+		{
+			*pt_p = S_MAX_NEIGHBOURS.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+void RunSketchJob (Service *service_p, ParameterSet *param_set_p)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	IndexData *index_data_p = GetSelectedIndexData (data_p, param_set_p);
+	const char *scaffold_s = NULL;
+
+	if (index_data_p && (index_data_p -> id_fasta_filename_s) && GetCurrentStringParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD.npt_name_s, &scaffold_s) && scaffold_s)
+		{
+			ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, scaffold_s, index_data_p -> id_fasta_filename_s, NULL, NULL, NULL);
+
+			if (job_p)
+				{
+					const bool *all_indexes_flag_p = NULL;
+					const bool all_indexes_flag = (GetCurrentBooleanParameterValueFromParameterSet (param_set_p, SS_ALL_INDEXES.npt_name_s, &all_indexes_flag_p) && all_indexes_flag_p) ? *all_indexes_flag_p : false;
+					const uint32 *value_p = NULL;
+					const uint32 max_neighbours = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MAX_NEIGHBOURS.npt_name_s, &value_p) && value_p && (*value_p > 0)) ? *value_p : S_DEFAULT_MAX_NEIGHBOURS;
+					const bool assembly_flag = (strcmp (scaffold_s, S_ALL_SCAFFOLDS_S) == 0);
+					const ScaffoldSketches *query_sketches_p;
+
+					LogParameterSet (param_set_p, job_p);
+
+					SetServiceJobStatus (job_p, OS_STARTED);
+					LogServiceJob (job_p);
+
+					/* Assume failure */
+					SetServiceJobStatus (job_p, OS_FAILED);
+
+					query_sketches_p = GetIndexScaffoldSketches (index_data_p, data_p -> stsd_sidecar_directory_s);
+
+					if (query_sketches_p)
+						{
+							BottomSketch assembly_sketch;
+							SketchComparison comparison;
+							const char *query_scaffold_s = NULL;
+							size_t query_scaffold = query_sketches_p -> ss_num_scaffolds;
+							bool success_flag = false;
+
+							memset (&assembly_sketch, 0, sizeof (BottomSketch));
+							memset (&comparison, 0, sizeof (SketchComparison));
+
+							if (assembly_flag)
+								{
+									if (GetAssemblySketch (query_sketches_p, &assembly_sketch))
+										{
+											comparison.sc_query_p = assembly_sketch.bs_hashes_p;
+											comparison.sc_query_length = assembly_sketch.bs_num_hashes;
+											success_flag = true;
+										}
+								}
+							else
+								{
+									IndexRegion region;
+
+									/* The whole of the scaffold is used even if the parameter is a region */
+									if (ParseIndexRegion (index_data_p, scaffold_s, &region) && ((size_t) (region.ir_scaffold_index) < query_sketches_p -> ss_num_scaffolds))
+										{
+											query_scaffold = (size_t) (region.ir_scaffold_index);
+											query_scaffold_s = region.ir_scaffold_name_s;
+
+											comparison.sc_query_p = query_sketches_p -> ss_hashes_p + query_sketches_p -> ss_offsets_p [query_scaffold];
+											comparison.sc_query_length = (size_t) (query_sketches_p -> ss_offsets_p [query_scaffold + 1] - query_sketches_p -> ss_offsets_p [query_scaffold]);
+											success_flag = true;
+										}
+									else
+										{
+											AddGeneralErrorMessageToServiceJob (job_p, "Unknown scaffold");
+										}
+								}
+
+							if (success_flag)
+								{
+									size_t max_entries = 0;
+									size_t num_skipped = 0;
+									size_t i;
+
+									/* Get the sketches for everything to compare against */
+									for (i = 0; (i < data_p -> stsd_index_data_size) && success_flag; ++ i)
+										{
+											IndexData *current_index_p = data_p -> stsd_index_data_p + i;
+
+											if (((current_index_p == index_data_p) || all_indexes_flag) && (current_index_p -> id_fasta_filename_s))
+												{
+													const ScaffoldSketches *sketches_p = (current_index_p == index_data_p) ? query_sketches_p : GetIndexScaffoldSketches (current_index_p, data_p -> stsd_sidecar_directory_s);
+
+													if (sketches_p)
+														{
+															success_flag = AddIndexNeighbours (& (comparison.sc_neighbours_p), & (comparison.sc_num_neighbours), &max_entries, current_index_p, sketches_p, assembly_flag);
+														}
+													else
+														{
+															/* Compare against the indexes that are ready rather than failing the whole search */
+															char *message_s = ConcatenateVarargsStrings ("The sketches for ", GetSketchIndexName (current_index_p), " are not ready yet so it was skipped", NULL);
+
+															AddGeneralErrorMessageToServiceJob (job_p, message_s ? message_s : "The sketches for an index are not ready yet so it was skipped");
+
+															if (message_s)
+																{
+																	FreeCopiedString (message_s);
+																}
+
+															++ num_skipped;
+														}
+												}
+										}
+
+									if (success_flag)
+										{
+											const size_t num_tasks = (comparison.sc_num_neighbours + S_COMPARISON_TASK_SIZE - 1) / S_COMPARISON_TASK_SIZE;
+
+											if (RunWorkerPool (num_tasks, data_p -> stsd_num_threads, CompareSketchTask, &comparison))
+												{
+													json_t *result_p;
+
+													if (comparison.sc_num_neighbours > 1)
+														{
+															qsort (comparison.sc_neighbours_p, comparison.sc_num_neighbours, sizeof (SketchNeighbour), CompareSketchNeighbours);
+														}
+
+													result_p = GetSketchNeighboursAsJSON (index_data_p, query_scaffold_s, comparison.sc_neighbours_p, comparison.sc_num_neighbours, max_neighbours, index_data_p, query_scaffold);
+
+													if (result_p)
+														{
+															if (AddInlineResultToServiceJob (job_p, "sketch_neighbours", result_p))
+																{
+																	SetServiceJobStatus (job_p, (num_skipped == 0) ? OS_SUCCEEDED : OS_PARTIALLY_SUCCEEDED);
+																}
+
+															json_decref (result_p);
+														}
+												}
+											else
+												{
+													AddGeneralErrorMessageToServiceJob (job_p, "Failed to compare the sketches");
+												}
+										}
+
+									if (comparison.sc_neighbours_p)
+										{
+											FreeMemory (comparison.sc_neighbours_p);
+										}
+								}
+							else if (assembly_flag)
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "Failed to get the sketch for the assembly");
+								}
+
+							ClearBottomSketch (&assembly_sketch);
+						}
+					else
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "The sketches are not ready yet");
+						}
+
+					LogServiceJob (job_p);
+				}		/* if (job_p) */
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get a FASTA file and scaffold to sketch");
+		}
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+/*
+ * The file also needs building again if the k-mer length or sketch size
+ * has changed since it was written.
+ */
+static bool IsScaffoldSketchFileUpToDate (const IndexData *index_data_p, const char *sketch_filename_s)
+{
+	bool success_flag = false;
+
+	if (IsSidecarFileUpToDate (sketch_filename_s, index_data_p -> id_fasta_filename_s))
+		{
+			ScaffoldSketches sketches;
+
+			if (MapScaffoldSketches (&sketches, sketch_filename_s))
+				{
+					success_flag = ((sketches.ss_kmer_length == S_KMER_LENGTH) && (sketches.ss_sketch_size == S_SKETCH_SIZE));
+					CloseMappedFile (& (sketches.ss_file));
+				}
+		}
+
+	return success_flag;
+}
+
+
+static bool BuildScaffoldSketches (IndexData *index_data_p, const char *sketch_filename_s, const uint32 num_threads, volatile bool *stop_flag_p)
+{
+	bool success_flag = false;
+	faidx_t *fai_p = LockIndexFaidx (index_data_p);
+
+	#if MINHASH_SKETCH_DEBUG >= STM_LEVEL_FINE
+	PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "BuildScaffoldSketches - building %s", sketch_filename_s);
+	#endif
+
+	if (fai_p)
+		{
+			SketchBuilder builder;
+			const int num_seqs = faidx_nseq (fai_p);
+
+			builder.sb_index_data_p = index_data_p;
+			builder.sb_stop_flag_p = stop_flag_p;
+			builder.sb_num_scaffolds = (num_seqs > 0) ? (size_t) num_seqs : 0;
+			builder.sb_names_ss = (const char **) AllocMemoryArray (sizeof (const char *), builder.sb_num_scaffolds + 1);
+			builder.sb_lengths_p = (hts_pos_t *) AllocMemoryArray (sizeof (hts_pos_t), builder.sb_num_scaffolds + 1);
+			builder.sb_hashes_pp = (uint64 **) AllocMemoryArray (sizeof (uint64 *), builder.sb_num_scaffolds + 1);
+			builder.sb_num_hashes_p = (size_t *) AllocMemoryArray (sizeof (size_t), builder.sb_num_scaffolds + 1);
+
+			if ((builder.sb_names_ss) && (builder.sb_lengths_p) && (builder.sb_hashes_pp) && (builder.sb_num_hashes_p))
+				{
+					size_t i;
+
+					for (i = 0; i < builder.sb_num_scaffolds; ++ i)
+						{
+							builder.sb_names_ss [i] = faidx_iseq (fai_p, (int) i);
+							builder.sb_lengths_p [i] = faidx_seq_len64 (fai_p, builder.sb_names_ss [i]);
+							builder.sb_hashes_pp [i] = NULL;
+							builder.sb_num_hashes_p [i] = 0;
+						}
+
+					/* The workers fetch through the index themselves */
+					UnlockIndexFaidx (index_data_p);
+					fai_p = NULL;
+
+					if (RunWorkerPool (builder.sb_num_scaffolds, num_threads, SketchScaffold, &builder))
+						{
+							success_flag = WriteScaffoldSketches (&builder, sketch_filename_s);
+						}
+
+					for (i = 0; i < builder.sb_num_scaffolds; ++ i)
+						{
+							if (builder.sb_hashes_pp [i])
+								{
+									FreeMemory (builder.sb_hashes_pp [i]);
+								}
+						}
+				}
+
+			if (fai_p)
+				{
+					UnlockIndexFaidx (index_data_p);
+				}
+
+			if (builder.sb_num_hashes_p)
+				{
+					FreeMemory (builder.sb_num_hashes_p);
+				}
+
+			if (builder.sb_hashes_pp)
+				{
+					FreeMemory (builder.sb_hashes_pp);
+				}
+
+			if (builder.sb_lengths_p)
+				{
+					FreeMemory (builder.sb_lengths_p);
+				}
+
+			if (builder.sb_names_ss)
+				{
+					FreeMemory (builder.sb_names_ss);
+				}
+		}
+
+	return success_flag;
+}
+
+
+static bool SketchScaffold (const size_t task_index, void *data_p)
+{
+	SketchBuilder *builder_p = (SketchBuilder *) data_p;
+	const char *name_s = builder_p -> sb_names_ss [task_index];
+	const hts_pos_t length = builder_p -> sb_lengths_p [task_index];
+	const uint32 shift = 2 * (S_KMER_LENGTH - 1);
+	const uint64 mask = (((uint64) 1) << (2 * S_KMER_LENGTH)) - 1;
+	uint64 kmers [MS_KMER_BATCH_SIZE];
+	size_t num_kmers = 0;
+	uint64 forward = 0;
+	uint64 reverse = 0;
+	uint32 num_valid = 0;
+	hts_pos_t block_start = 0;
+	bool success_flag;
+	BottomSketch sketch;
+
+	if (!InitBottomSketch (&sketch, S_SKETCH_SIZE))
+		{
+			return false;
+		}
+
+	success_flag = true;
+
+	/* The rolling k-mers carry on from one block to the next so there's no need for the blocks to overlap */
+	while ((block_start < length) && success_flag)
+		{
+
+			const hts_pos_t block_end = (length - block_start < S_BLOCK_SIZE) ? length : block_start + S_BLOCK_SIZE;
+			hts_pos_t block_length = 0;
+			char *sequence_s = FetchIndexSequence (builder_p -> sb_index_data_p, name_s, block_start, block_end, &block_length);
+
+			if (sequence_s)
+				{
+					hts_pos_t i;
+
+					for (i = 0; i < block_length; ++ i)
+						{
+							uint64 code;
+
+							switch (sequence_s [i])
+								{
+									case 'A':
+									case 'a':
+										code = 0;
+										break;
+
+									case 'C':
+									case 'c':
+										code = 1;
+										break;
+
+									case 'G':
+									case 'g':
+										code = 2;
+										break;
+
+									case 'T':
+									case 't':
+										code = 3;
+										break;
+
+									default:
+										num_valid = 0;
+										continue;
+								}
+
+							forward = ((forward << 2) | code) & mask;
+							reverse = (reverse >> 2) | ((3 - code) << shift);
+
+							if (++ num_valid >= S_KMER_LENGTH)
+								{
+									/* Use the canonical k-mer so that both strands give the same sketch */
+									kmers [num_kmers] = (forward < reverse) ? forward : reverse;
+
+									if (++ num_kmers == MS_KMER_BATCH_SIZE)
+										{
+											HashKmers (kmers, kmers, num_kmers, mask);
+											AddToBottomSketch (&sketch, kmers, num_kmers);
+											num_kmers = 0;
+										}
+								}
+						}
+
+					free (sequence_s);
+				}
+			else
+				{
+					success_flag = false;
+				}
+
+			block_start = block_end;
+
+			if (* (builder_p -> sb_stop_flag_p))
+				{
+					success_flag = false;
+				}
+		}
+
+	if (success_flag)
+		{
+			if (num_kmers > 0)
+				{
+					HashKmers (kmers, kmers, num_kmers, mask);
+					AddToBottomSketch (&sketch, kmers, num_kmers);
+				}
+
+			CompactBottomSketch (&sketch);
+
+			/* Hand the hashes over to the builder */
+			builder_p -> sb_hashes_pp [task_index] = sketch.bs_hashes_p;
+			builder_p -> sb_num_hashes_p [task_index] = sketch.bs_num_hashes;
+		}
+	else
+		{
+			ClearBottomSketch (&sketch);
+		}
+
+	return success_flag;
+}
+
+
+static bool WriteScaffoldSketches (const SketchBuilder *builder_p, const char *sketch_filename_s)
+{
+	bool success_flag = false;
+	const size_t header_size = sizeof (SketchHeader) + ((builder_p -> sb_num_scaffolds + 1) * sizeof (uint64));
+	char *header_data_p = (char *) AllocMemory (header_size);
+
+	if (header_data_p)
+		{
+			SketchHeader *header_p = (SketchHeader *) header_data_p;
+			uint64 *offsets_p = (uint64 *) (header_p + 1);
+			uint64 num_hashes = 0;
+			SidecarWriter *writer_p;
+			size_t i;
+
+			for (i = 0; i < builder_p -> sb_num_scaffolds; ++ i)
+				{
+					offsets_p [i] = num_hashes;
+					num_hashes += builder_p -> sb_num_hashes_p [i];
+				}
+
+			offsets_p [i] = num_hashes;
+
+			memcpy (header_p -> sh_magic, S_SKETCH_MAGIC, sizeof (S_SKETCH_MAGIC));
+			header_p -> sh_kmer_length = S_KMER_LENGTH;
+			header_p -> sh_sketch_size = S_SKETCH_SIZE;
+			header_p -> sh_num_scaffolds = builder_p -> sb_num_scaffolds;
+			header_p -> sh_num_hashes = num_hashes;
+
+			/* Each scaffold's hashes are written straight from the builder rather than gathered up first */
+			if ((writer_p = OpenSidecarWriter (sketch_filename_s)) != NULL)
+				{
+					success_flag = WriteSidecarData (writer_p, header_data_p, header_size);
+
+					for (i = 0; (i < builder_p -> sb_num_scaffolds) && success_flag; ++ i)
+						{
+							if (builder_p -> sb_num_hashes_p [i] > 0)
+								{
+									success_flag = WriteSidecarData (writer_p, builder_p -> sb_hashes_pp [i], builder_p -> sb_num_hashes_p [i] * sizeof (uint64));
+								}
+						}
+
+					if (!CloseSidecarWriter (writer_p, success_flag))
+						{
+							success_flag = false;
+						}
+				}
+
+			FreeMemory (header_data_p);
+		}
+
+	return success_flag;
+}
+
+
+static bool MapScaffoldSketches (ScaffoldSketches *sketches_p, const char *sketch_filename_s)
+{
+	if (OpenMappedFile (& (sketches_p -> ss_file), sketch_filename_s))
+		{
+			const SketchHeader *header_p = (const SketchHeader *) (sketches_p -> ss_file.mf_data_p);
+
+			if ((sketches_p -> ss_file.mf_size >= sizeof (SketchHeader)) &&
+				(memcmp (header_p -> sh_magic, S_SKETCH_MAGIC, sizeof (S_SKETCH_MAGIC)) == 0) &&
+				(sketches_p -> ss_file.mf_size == sizeof (SketchHeader) + ((header_p -> sh_num_scaffolds + 1) * sizeof (uint64)) + (header_p -> sh_num_hashes * sizeof (uint64))))
+				{
+					sketches_p -> ss_kmer_length = header_p -> sh_kmer_length;
+					sketches_p -> ss_sketch_size = header_p -> sh_sketch_size;
+					sketches_p -> ss_num_scaffolds = (size_t) (header_p -> sh_num_scaffolds);
+					sketches_p -> ss_offsets_p = (const uint64 *) (header_p + 1);
+					sketches_p -> ss_hashes_p = sketches_p -> ss_offsets_p + sketches_p -> ss_num_scaffolds + 1;
+
+					return true;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "\"%s\" is not a valid sketch file", sketch_filename_s);
+				}
+
+			CloseMappedFile (& (sketches_p -> ss_file));
+		}
+
+	return false;
+}
+
+
+static bool InitBottomSketch (BottomSketch *sketch_p, const size_t sketch_size)
+{
+	/* Leave room for plenty of candidates between each compaction */
+	sketch_p -> bs_max_hashes = sketch_size << 2;
+	sketch_p -> bs_num_hashes = 0;
+	sketch_p -> bs_sketch_size = sketch_size;
+	sketch_p -> bs_threshold = UINT64_MAX;
+
+	if ((sketch_p -> bs_hashes_p = (uint64 *) AllocMemoryArray (sizeof (uint64), sketch_p -> bs_max_hashes)) != NULL)
+		{
+			return true;
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate sketch of " SIZET_FMT " hashes", sketch_p -> bs_max_hashes);
+
+	return false;
+}
+
+
+static void ClearBottomSketch (BottomSketch *sketch_p)
+{
+	if (sketch_p -> bs_hashes_p)
+		{
+			FreeMemory (sketch_p -> bs_hashes_p);
+			sketch_p -> bs_hashes_p = NULL;
+		}
+
+	sketch_p -> bs_num_hashes = 0;
+}
+
+
+static void AddToBottomSketch (BottomSketch *sketch_p, const uint64 *hashes_p, const size_t num_hashes)
+{
+	size_t i;
+
+	for (i = 0; i < num_hashes; ++ i)
+		{
+			if (hashes_p [i] < sketch_p -> bs_threshold)
+				{
+					sketch_p -> bs_hashes_p [sketch_p -> bs_num_hashes] = hashes_p [i];
+
+					if (++ (sketch_p -> bs_num_hashes) == sketch_p -> bs_max_hashes)
+						{
+							CompactBottomSketch (sketch_p);
+						}
+				}
+		}
+}
+
+
+static void CompactBottomSketch (BottomSketch *sketch_p)
+{
+	if (sketch_p -> bs_num_hashes > 0)
+		{
+			size_t num_unique = 1;
+			size_t i;
+
+			qsort (sketch_p -> bs_hashes_p, sketch_p -> bs_num_hashes, sizeof (uint64), CompareUInt64s);
+
+			for (i = 1; (i < sketch_p -> bs_num_hashes) && (num_unique < sketch_p -> bs_sketch_size); ++ i)
+				{
+					if (sketch_p -> bs_hashes_p [i] != sketch_p -> bs_hashes_p [num_unique - 1])
+						{
+							sketch_p -> bs_hashes_p [num_unique ++] = sketch_p -> bs_hashes_p [i];
+						}
+				}
+
+			sketch_p -> bs_num_hashes = num_unique;
+
+			/* Once the sketch is full, only smaller hashes can get into it */
+			if (num_unique == sketch_p -> bs_sketch_size)
+				{
+					sketch_p -> bs_threshold = sketch_p -> bs_hashes_p [num_unique - 1];
+				}
+		}
+}
+
+
+/*
+ * The sketch of a whole assembly is the smallest hashes across all of its
+ * scaffolds, and those are all within the scaffolds' own sketches.
+ */
+static bool GetAssemblySketch (const ScaffoldSketches *sketches_p, BottomSketch *sketch_p)
+{
+	if (InitBottomSketch (sketch_p, sketches_p -> ss_sketch_size))
+		{
+			size_t i;
+
+			for (i = 0; i < sketches_p -> ss_num_scaffolds; ++ i)
+				{
+					AddToBottomSketch (sketch_p, sketches_p -> ss_hashes_p + sketches_p -> ss_offsets_p [i], (size_t) (sketches_p -> ss_offsets_p [i + 1] - sketches_p -> ss_offsets_p [i]));
+				}
+
+			CompactBottomSketch (sketch_p);
+
+			return true;
+		}
+
+	return false;
+}
+
+
+static bool CompareSketchTask (const size_t task_index, void *data_p)
+{
+	SketchComparison *comparison_p = (SketchComparison *) data_p;
+	const size_t start = task_index * S_COMPARISON_TASK_SIZE;
+	const size_t end = (comparison_p -> sc_num_neighbours - start < S_COMPARISON_TASK_SIZE) ? comparison_p -> sc_num_neighbours : start + S_COMPARISON_TASK_SIZE;
+	size_t i;
+
+	for (i = start; i < end; ++ i)
+		{
+			SketchNeighbour *neighbour_p = comparison_p -> sc_neighbours_p + i;
+			const ScaffoldSketches *sketches_p = neighbour_p -> sn_sketches_p;
+
+			if (neighbour_p -> sn_scaffold_index < sketches_p -> ss_num_scaffolds)
+				{
+					const size_t offset = (size_t) (sketches_p -> ss_offsets_p [neighbour_p -> sn_scaffold_index]);
+					const size_t num_hashes = (size_t) (sketches_p -> ss_offsets_p [neighbour_p -> sn_scaffold_index + 1]) - offset;
+
+					neighbour_p -> sn_distance = GetMashDistance (comparison_p -> sc_query_p, comparison_p -> sc_query_length, sketches_p -> ss_hashes_p + offset, num_hashes, sketches_p -> ss_sketch_size, sketches_p -> ss_kmer_length, & (neighbour_p -> sn_shared_hashes), & (neighbour_p -> sn_total_hashes));
+				}
+			else
+				{
+					BottomSketch assembly_sketch;
+
+					if (!GetAssemblySketch (sketches_p, &assembly_sketch))
+						{
+							return false;
+						}
+
+					neighbour_p -> sn_distance = GetMashDistance (comparison_p -> sc_query_p, comparison_p -> sc_query_length, assembly_sketch.bs_hashes_p, assembly_sketch.bs_num_hashes, sketches_p -> ss_sketch_size, sketches_p -> ss_kmer_length, & (neighbour_p -> sn_shared_hashes), & (neighbour_p -> sn_total_hashes));
+
+					ClearBottomSketch (&assembly_sketch);
+				}
+		}
+
+	return true;
+}
+
+
+/*
+ * The Jaccard index is estimated from the smallest hashes of the union of
+ * the two sketches, as the fraction of them that are in both, and turned
+ * into the Mash distance, which approximates the per-base divergence.
+ */
+static double GetMashDistance (const uint64 *hashes0_p, const size_t num_hashes0, const uint64 *hashes1_p, const size_t num_hashes1, const size_t sketch_size, const uint32 kmer_length, uint32 *shared_p, uint32 *total_p)
+{
+	size_t i = 0;
+	size_t j = 0;
+	size_t total = 0;
+	size_t shared = 0;
+
+	while ((total < sketch_size) && (i < num_hashes0) && (j < num_hashes1))
+		{
+			if (hashes0_p [i] < hashes1_p [j])
+				{
+					++ i;
+				}
+			else if (hashes0_p [i] > hashes1_p [j])
+				{
+					++ j;
+				}
+			else
+				{
+					++ shared;
+					++ i;
+					++ j;
+				}
+
+			++ total;
+		}
+
+	/* Whatever is left of the longer sketch fills up the rest of the union */
+	if (total < sketch_size)
+		{
+			const size_t remaining = (num_hashes0 - i) + (num_hashes1 - j);
+
+			total += (remaining < sketch_size - total) ? remaining : sketch_size - total;
+		}
+
+	*shared_p = (uint32) shared;
+	*total_p = (uint32) total;
+
+	if (shared > 0)
+		{
+			const double jaccard = (double) shared / (double) total;
+
+			return (shared == total) ? 0.0 : -log ((2.0 * jaccard) / (1.0 + jaccard)) / (double) kmer_length;
+		}
+
+	return 1.0;
+}
+
+
+static bool AddIndexNeighbours (SketchNeighbour **neighbours_pp, size_t *num_neighbours_p, size_t *max_neighbours_p, IndexData *index_data_p, const ScaffoldSketches *sketches_p, const bool assembly_flag)
+{
+	const size_t num_entries = assembly_flag ? 1 : sketches_p -> ss_num_scaffolds;
+	size_t i;
+
+	if (*num_neighbours_p + num_entries > *max_neighbours_p)
+		{
+			const size_t new_max = *num_neighbours_p + num_entries;
+			SketchNeighbour *neighbours_p = (*neighbours_pp) ?
+				(SketchNeighbour *) ReallocMemory (*neighbours_pp, new_max * sizeof (SketchNeighbour), (*max_neighbours_p) * sizeof (SketchNeighbour)) :
+				(SketchNeighbour *) AllocMemoryArray (sizeof (SketchNeighbour), new_max);
+
+			if (!neighbours_p)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " sketch comparisons", new_max);
+					return false;
+				}
+
+			*neighbours_pp = neighbours_p;
+			*max_neighbours_p = new_max;
+		}
+
+	for (i = 0; i < num_entries; ++ i)
+		{
+			SketchNeighbour *neighbour_p = (*neighbours_pp) + *num_neighbours_p;
+
+			neighbour_p -> sn_index_data_p = index_data_p;
+			neighbour_p -> sn_sketches_p = sketches_p;
+
+			neighbour_p -> sn_scaffold_index = assembly_flag ? sketches_p -> ss_num_scaffolds : i;
+			neighbour_p -> sn_distance = 1.0;
+			neighbour_p -> sn_shared_hashes = 0;
+			neighbour_p -> sn_total_hashes = 0;
+
+			++ (*num_neighbours_p);
+		}
+
+	return true;
+}
+
+
+static json_t *GetSketchNeighboursAsJSON (IndexData *query_index_p, const char *query_scaffold_s, const SketchNeighbour *neighbours_p, const size_t num_neighbours, const size_t max_neighbours, const IndexData *skip_index_p, const size_t skip_scaffold)
+{
+	json_t *result_p = json_pack ("{s:I,s:I,s:{s:s}}", "kmer_length", (json_int_t) S_KMER_LENGTH, "sketch_size", (json_int_t) S_SKETCH_SIZE, "query", "index", GetSketchIndexName (query_index_p));
+	json_t *results_p = json_array ();
+
+	if (result_p && results_p && (json_object_set_new (result_p, "neighbours", results_p) == 0))
+		{
+			bool success_flag = true;
+			size_t num_added = 0;
+			size_t i;
+
+			if (query_scaffold_s)
+				{
+					success_flag = (json_object_set_new (json_object_get (result_p, "query"), "scaffold", json_string (query_scaffold_s)) == 0);
+				}
+
+			for (i = 0; (i < num_neighbours) && (num_added < max_neighbours) && success_flag; ++ i)
+				{
+					const SketchNeighbour *neighbour_p = neighbours_p + i;
+
+					if ((neighbour_p -> sn_index_data_p != skip_index_p) || (neighbour_p -> sn_scaffold_index != skip_scaffold))
+						{
+							json_t *neighbour_json_p = json_pack ("{s:s,s:f,s:I,s:I}",
+								"index", GetSketchIndexName (neighbour_p -> sn_index_data_p),
+								"distance", neighbour_p -> sn_distance,
+								"shared_hashes", (json_int_t) (neighbour_p -> sn_shared_hashes),
+								"total_hashes", (json_int_t) (neighbour_p -> sn_total_hashes));
+
+							success_flag = (neighbour_json_p != NULL);
+
+							if (success_flag && (neighbour_p -> sn_scaffold_index < neighbour_p -> sn_sketches_p -> ss_num_scaffolds))
+								{
+									faidx_t *fai_p = LockIndexFaidx (neighbour_p -> sn_index_data_p);
+
+									if (fai_p)
+										{
+											success_flag = (json_object_set_new (neighbour_json_p, "scaffold", json_string (faidx_iseq (fai_p, (int) (neighbour_p -> sn_scaffold_index)))) == 0);
+											UnlockIndexFaidx (neighbour_p -> sn_index_data_p);
+										}
+									else
+										{
+											success_flag = false;
+										}
+								}
+
+							if (neighbour_json_p)
+								{
+									if (success_flag)
+										{
+											success_flag = (json_array_append_new (results_p, neighbour_json_p) == 0);
+										}
+									else
+										{
+											json_decref (neighbour_json_p);
+										}
+								}
+
+							++ num_added;
+						}
+				}
+
+			if (success_flag)
+				{
+					return result_p;
+				}
+		}
+	else if (results_p)
+		{
+			json_decref (results_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create the sketch results");
+
+	if (result_p)
+		{
+			json_decref (result_p);
+		}
+
+	return NULL;
+}
+
+
+static const char *GetSketchIndexName (const IndexData *index_data_p)
+{
+	return (index_data_p -> id_blast_db_name_s) ? index_data_p -> id_blast_db_name_s : index_data_p -> id_fasta_filename_s;
+}
+
+
+static int CompareUInt64s (const void *v0_p, const void *v1_p)
+{
+	const uint64 u0 = * ((const uint64 *) v0_p);
+	const uint64 u1 = * ((const uint64 *) v1_p);
+
+	return (u0 < u1) ? -1 : ((u0 > u1) ? 1 : 0);
+}
+
+
+static int CompareSketchNeighbours (const void *v0_p, const void *v1_p)
+{
+	const SketchNeighbour *neighbour0_p = (const SketchNeighbour *) v0_p;
+	const SketchNeighbour *neighbour1_p = (const SketchNeighbour *) v1_p;
+
+	if (neighbour0_p -> sn_distance != neighbour1_p -> sn_distance)
+		{
+			return (neighbour0_p -> sn_distance < neighbour1_p -> sn_distance) ? -1 : 1;
+		}
+
+	if (neighbour0_p -> sn_shared_hashes != neighbour1_p -> sn_shared_hashes)
+		{
+			return (neighbour0_p -> sn_shared_hashes > neighbour1_p -> sn_shared_hashes) ? -1 : 1;
+		}
+
+	/* Keep the configured order of the indexes and scaffolds for ties */
+	if (neighbour0_p -> sn_index_data_p != neighbour1_p -> sn_index_data_p)
+		{
+			return (neighbour0_p -> sn_index_data_p < neighbour1_p -> sn_index_data_p) ? -1 : 1;
+		}
+
+	return (neighbour0_p -> sn_scaffold_index < neighbour1_p -> sn_scaffold_index) ? -1 : ((neighbour0_p -> sn_scaffold_index > neighbour1_p -> sn_scaffold_index) ? 1 : 0);
+}
@@ -0,0 +1,485 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * motif_search.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "motif_search.h"
+#include "sequence_kernels.h"
+#include "fasta_utils.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "audit.h"
+
+#include "string_parameter.h"
+#include "unsigned_int_parameter.h"
+
+
+#ifdef _DEBUG
+	#define MOTIF_SEARCH_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define MOTIF_SEARCH_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * A motif, or the reverse complement of one, to search for.
+ */
+typedef struct MotifPattern
+{
+	/* The bases in upper case */
+	char *mp_bases_s;
+
+	size_t mp_length;
+
+	/* The array that the 1-based hit positions are added to */
+	json_t *mp_hits_p;
+} MotifPattern;
+
+
+typedef struct MotifSet
+{
+	MotifPattern *ms_patterns_p;
+	size_t ms_num_patterns;
+	size_t ms_max_length;
+
+	/* The JSON array with an object for each motif */
+	json_t *ms_motifs_p;
+} MotifSet;
+
+
+static NamedParameterType S_MOTIFS = { "Motifs", PT_LARGE_STRING };
+
+static NamedParameterType S_MAX_MOTIF_HITS = { "Max motif hits", PT_UNSIGNED_INT };
+
+
+static const uint32 S_DEFAULT_MAX_MOTIF_HITS = 100000;
+
+/*
+ * The region is searched in windows of this many bases.
+ */
+static const hts_pos_t S_BLOCK_SIZE = 1 << 22;
+
+static const char * const S_MOTIF_SEPARATORS_S = " \t\r\n,;";
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool ParseMotifs (const char *motifs_s, MotifSet *motifs_p, ServiceJob *job_p);
+
+static bool AddMotifPattern (MotifSet *motifs_p, char *bases_s, const size_t length, json_t *hits_p);
+
+static void ClearMotifSet (MotifSet *motifs_p);
+
+static bool SearchBlock (const MotifSet *motifs_p, const char *sequence_s, const size_t length, const size_t num_starts, const hts_pos_t offset, const uint32 max_hits, uint32 *num_hits_p, bool *complete_flag_p);
+
+static bool MatchesMotif (const char *sequence_s, const MotifPattern *pattern_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool AddMotifSearchParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	return ((EasyCreateAndAddStringParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MOTIFS.npt_type, S_MOTIFS.npt_name_s, "Motifs", "The motifs to search for, separated by commas or whitespace, e.g. GAATTC, GGATCC. These are matched on both strands without regard to case.", NULL, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MAX_MOTIF_HITS.npt_name_s, "Max motif hits", "The search stops after this many hits", &S_DEFAULT_MAX_MOTIF_HITS, PL_ADVANCED) != NULL));
+}
+
+
+bool GetMotifSearchParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_MOTIFS.npt_name_s) == 0)
+		{
+			*pt_p = S_MOTIFS.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MAX_MOTIF_HITS.npt_name_s) == 0)
+		{
+			*pt_p = S_MAX_MOTIF_HITS.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+void RunMotifSearchJob (Service *service_p, ParameterSet *param_set_p)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	IndexData *index_data_p = GetSelectedIndexData (data_p, param_set_p);
+	const char *region_s = NULL;
+	const char *motifs_s = NULL;
+
+	if (index_data_p && (index_data_p -> id_fasta_filename_s) &&
+		GetCurrentStringParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD.npt_name_s, &region_s) && region_s &&
+		GetCurrentStringParameterValueFromParameterSet (param_set_p, S_MOTIFS.npt_name_s, &motifs_s) && motifs_s)
+		{
+			ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, region_s, index_data_p -> id_fasta_filename_s, NULL, NULL, NULL);
+
+			if (job_p)
+				{
+					const uint32 *max_hits_p = NULL;
+					const uint32 max_hits = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MAX_MOTIF_HITS.npt_name_s, &max_hits_p) && max_hits_p && (*max_hits_p > 0)) ? *max_hits_p : S_DEFAULT_MAX_MOTIF_HITS;
+					IndexRegion region;
+					MotifSet motifs;
+
+					LogParameterSet (param_set_p, job_p);
+
+					SetServiceJobStatus (job_p, OS_STARTED);
+					LogServiceJob (job_p);
+
+					/* Assume failure */
+					SetServiceJobStatus (job_p, OS_FAILED);
+
+					if (ParseIndexRegion (index_data_p, region_s, &region))
+						{
+							if (ParseMotifs (motifs_s, &motifs, job_p))
+								{
+									bool success_flag = true;
+									bool complete_flag = true;
+									uint32 num_hits = 0;
+									hts_pos_t block_start = region.ir_start;
+
+									while ((block_start < region.ir_end) && success_flag && complete_flag)
+										{
+											const hts_pos_t block_end = (region.ir_end - block_start < S_BLOCK_SIZE) ? region.ir_end : block_start + S_BLOCK_SIZE;
+											const hts_pos_t overlap_end = block_end + (hts_pos_t) (motifs.ms_max_length) - 1;
+											hts_pos_t length = 0;
+
+											/* Overlap the next window so that hits spanning the join are found once */
+											char *sequence_s = FetchIndexSequence (index_data_p, region.ir_scaffold_name_s, block_start, (overlap_end < region.ir_end) ? overlap_end : region.ir_end, &length);
+
+											if (sequence_s)
+												{
+													success_flag = SearchBlock (&motifs, sequence_s, (size_t) length, (size_t) (block_end - block_start), block_start, max_hits, &num_hits, &complete_flag);
+													free (sequence_s);
+												}
+											else
+												{
+													success_flag = false;
+												}
+
+											block_start = block_end;
+										}
+
+									if (success_flag)
+										{
+											json_t *result_p = json_pack ("{s:s,s:I,s:I,s:O}", "scaffold", region.ir_scaffold_name_s, "start", (json_int_t) (region.ir_start + 1), "end", (json_int_t) region.ir_end, "motifs", motifs.ms_motifs_p);
+
+											if (result_p)
+												{
+													if (AddInlineResultToServiceJob (job_p, "motifs", result_p))
+														{
+															if (complete_flag)
+																{
+																	SetServiceJobStatus (job_p, OS_SUCCEEDED);
+																}
+															else
+																{
+																	AddGeneralErrorMessageToServiceJob (job_p, "Stopped after reaching Max motif hits");
+																	SetServiceJobStatus (job_p, OS_PARTIALLY_SUCCEEDED);
+																}
+														}
+
+													json_decref (result_p);
+												}
+										}
+									else
+										{
+											AddGeneralErrorMessageToServiceJob (job_p, "Failed to search the region");
+										}
+
+									ClearMotifSet (&motifs);
+								}
+						}
+					else
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "Unknown region");
+						}
+
+					LogServiceJob (job_p);
+				}		/* if (job_p) */
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get a FASTA file, region and motifs for the motif search");
+		}
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static bool ParseMotifs (const char *motifs_s, MotifSet *motifs_p, ServiceJob *job_p)
+{
+	const size_t max_patterns = 2 * (strlen (motifs_s) + 1);
+
+	motifs_p -> ms_num_patterns = 0;
+	motifs_p -> ms_max_length = 0;
+	motifs_p -> ms_patterns_p = (MotifPattern *) AllocMemoryArray (sizeof (MotifPattern), max_patterns);
+	motifs_p -> ms_motifs_p = json_array ();
+
+	if ((motifs_p -> ms_patterns_p) && (motifs_p -> ms_motifs_p))
+		{
+			const char *start_p = motifs_s;
+
+			while (*start_p)
+				{
+					const size_t length = strcspn (start_p, S_MOTIF_SEPARATORS_S);
+
+					if (length > 0)
+						{
+							char *forward_s = (char *) AllocMemory (length + 1);
+							char *reverse_s = (char *) AllocMemory (length + 1);
+							json_t *forward_hits_p = json_array ();
+							json_t *reverse_hits_p = NULL;
+							json_t *motif_p = NULL;
+							size_t i;
+
+							if (! (forward_s && reverse_s && forward_hits_p))
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate motif");
+
+									if (forward_hits_p)
+										{
+											json_decref (forward_hits_p);
+										}
+
+									if (reverse_s)
+										{
+											FreeMemory (reverse_s);
+										}
+
+									if (forward_s)
+										{
+											FreeMemory (forward_s);
+										}
+
+									ClearMotifSet (motifs_p);
+									return false;
+								}
+
+							for (i = 0; i < length; ++ i)
+								{
+									forward_s [i] = (char) toupper (start_p [i]);
+									forward_s [i + 1] = '\0';
+
+									if (!strchr ("ACGT", forward_s [i]))
+										{
+											char *error_s = ConcatenateVarargsStrings ("Motif ", forward_s, " contains bases other than A, C, G and T", NULL);
+
+											AddGeneralErrorMessageToServiceJob (job_p, error_s ? error_s : "Invalid motif");
+
+											if (error_s)
+												{
+													FreeCopiedString (error_s);
+												}
+
+											json_decref (forward_hits_p);
+											FreeMemory (reverse_s);
+											FreeMemory (forward_s);
+											ClearMotifSet (motifs_p);
+											return false;
+										}
+								}
+
+							ReverseComplementSequence (reverse_s, forward_s, length);
+							* (reverse_s + length) = '\0';
+
+							/* A palindromic site is only searched for once and its hits are on both strands */
+							if (strcmp (forward_s, reverse_s) == 0)
+								{
+									reverse_hits_p = json_incref (forward_hits_p);
+									FreeMemory (reverse_s);
+									reverse_s = NULL;
+								}
+							else
+								{
+									reverse_hits_p = json_array ();
+								}
+
+							if (reverse_hits_p)
+								{
+									/* json_pack takes both arrays with "o" even if it fails */
+									motif_p = json_pack ("{s:s,s:o,s:o}", "motif", forward_s, "forward", forward_hits_p, "reverse", reverse_hits_p);
+								}
+							else
+								{
+									json_decref (forward_hits_p);
+								}
+
+							if (motif_p && (json_array_append_new (motifs_p -> ms_motifs_p, motif_p) == 0))
+								{
+									/* The patterns borrow the arrays, which now belong to the motif object */
+									if (!AddMotifPattern (motifs_p, forward_s, length, forward_hits_p) || (reverse_s && !AddMotifPattern (motifs_p, reverse_s, length, reverse_hits_p)))
+										{
+											ClearMotifSet (motifs_p);
+											return false;
+										}
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add motif %s", forward_s);
+
+									if (reverse_s)
+										{
+											FreeMemory (reverse_s);
+										}
+
+									FreeMemory (forward_s);
+									ClearMotifSet (motifs_p);
+									return false;
+								}
+						}
+
+					start_p += length;
+
+					if (*start_p)
+						{
+							++ start_p;
+						}
+				}
+
+			if (motifs_p -> ms_num_patterns > 0)
+				{
+					return true;
+				}
+
+			AddGeneralErrorMessageToServiceJob (job_p, "No motifs were given");
+		}
+
+	ClearMotifSet (motifs_p);
+
+	return false;
+}
+
+
+static bool AddMotifPattern (MotifSet *motifs_p, char *bases_s, const size_t length, json_t *hits_p)
+{
+	MotifPattern *pattern_p = motifs_p -> ms_patterns_p + motifs_p -> ms_num_patterns;
+
+	pattern_p -> mp_bases_s = bases_s;
+	pattern_p -> mp_length = length;
+	pattern_p -> mp_hits_p = hits_p;
+	++ (motifs_p -> ms_num_patterns);
+
+	if (length > motifs_p -> ms_max_length)
+		{
+			motifs_p -> ms_max_length = length;
+		}
+
+	return true;
+}
+
+
+static void ClearMotifSet (MotifSet *motifs_p)
+{
+	if (motifs_p -> ms_patterns_p)
+		{
+			size_t i;
+
+			for (i = 0; i < motifs_p -> ms_num_patterns; ++ i)
+				{
+					FreeMemory (motifs_p -> ms_patterns_p [i].mp_bases_s);
+				}
+
+			FreeMemory (motifs_p -> ms_patterns_p);
+			motifs_p -> ms_patterns_p = NULL;
+		}
+
+	motifs_p -> ms_num_patterns = 0;
+
+	if (motifs_p -> ms_motifs_p)
+		{
+			json_decref (motifs_p -> ms_motifs_p);
+			motifs_p -> ms_motifs_p = NULL;
+		}
+}
+
+
+static bool SearchBlock (const MotifSet *motifs_p, const char *sequence_s, const size_t length, const size_t num_starts, const hts_pos_t offset, const uint32 max_hits, uint32 *num_hits_p, bool *complete_flag_p)
+{
+	size_t i;
+
+	for (i = 0; i < motifs_p -> ms_num_patterns; ++ i)
+		{
+			const MotifPattern *pattern_p = motifs_p -> ms_patterns_p + i;
+
+			if (pattern_p -> mp_length <= length)
+				{
+					const size_t last_offset = pattern_p -> mp_length - 1;
+					const size_t end = (length - last_offset < num_starts) ? length - last_offset : num_starts;
+					size_t pos = 0;
+
+					while ((pos = FindMotifCandidate (sequence_s, pos, end, pattern_p -> mp_bases_s [0], pattern_p -> mp_bases_s [last_offset], last_offset)) < end)
+						{
+							if (MatchesMotif (sequence_s + pos, pattern_p))
+								{
+									if (*num_hits_p == max_hits)
+										{
+											*complete_flag_p = false;
+											return true;
+										}
+
+									if (json_array_append_new (pattern_p -> mp_hits_p, json_integer ((json_int_t) (offset + (hts_pos_t) pos + 1))) != 0)
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add hit for %s", pattern_p -> mp_bases_s);
+											return false;
+										}
+
+									++ (*num_hits_p);
+								}
+
+							++ pos;
+						}
+				}
+		}
+
+	return true;
+}
+
+
+static bool MatchesMotif (const char *sequence_s, const MotifPattern *pattern_p)
+{
+	size_t i;
+
+	/* The first and last bases have already been checked */
+	for (i = 1; i + 1 < pattern_p -> mp_length; ++ i)
+		{
+			/* Clearing the case bit only makes a letter match its upper case form */
+			if ((sequence_s [i] & ~0x20) != pattern_p -> mp_bases_s [i])
+				{
+					return false;
+				}
+		}
+
+	return true;
+}
@@ -0,0 +1,783 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * oligo_tiler.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+
+#include "oligo_tiler.h"
+#include "sequence_kernels.h"
+#include "worker_pool.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "audit.h"
+
+#include "string_parameter.h"
+#include "unsigned_int_parameter.h"
+
+
+#ifdef _DEBUG
+	#define OLIGO_TILER_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define OLIGO_TILER_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+#define OT_MIN_OLIGO_LENGTH (8)
+
+#define OT_MAX_OLIGO_LENGTH (64)
+
+
+typedef struct Oligo
+{
+	hts_pos_t ol_start;
+	double ol_tm;
+	uint32 ol_gc_count;
+	uint32 ol_hairpin;
+	uint32 ol_dimer;
+	char ol_sequence_s [OT_MAX_OLIGO_LENGTH + 1];
+} Oligo;
+
+
+/*
+ * The oligos that pass within a block, in order.
+ */
+typedef struct OligoBlock
+{
+	Oligo *ob_oligos_p;
+	size_t ob_num_oligos;
+	size_t ob_oligos_size;
+
+	/*
+	 * Set if the block stopped early because it and the blocks before
+	 * it already had Max oligos between them.
+	 */
+	bool ob_truncated_flag;
+} OligoBlock;
+
+
+typedef struct OligoTiling
+{
+	IndexData *ot_index_data_p;
+	const IndexRegion *ot_region_p;
+	uint32 ot_length;
+	uint32 ot_step;
+	uint32 ot_min_tm;
+	uint32 ot_max_tm;
+	uint32 ot_min_gc;
+	uint32 ot_max_gc;
+	uint32 ot_max_self_complementarity;
+	uint32 ot_max_oligos;
+
+	OligoBlock *ot_blocks_p;
+	size_t ot_num_blocks;
+} OligoTiling;
+
+
+static NamedParameterType S_OLIGO_LENGTH = { "Oligo length", PT_UNSIGNED_INT };
+
+static NamedParameterType S_OLIGO_STEP = { "Oligo step", PT_UNSIGNED_INT };
+
+static NamedParameterType S_MIN_TM = { "Min Tm", PT_UNSIGNED_INT };
+
+static NamedParameterType S_MAX_TM = { "Max Tm", PT_UNSIGNED_INT };
+
+static NamedParameterType S_MIN_GC = { "Min GC", PT_UNSIGNED_INT };
+
+static NamedParameterType S_MAX_GC = { "Max GC", PT_UNSIGNED_INT };
+
+static NamedParameterType S_MAX_SELF_COMPLEMENTARITY = { "Max self-complementarity", PT_UNSIGNED_INT };
+
+static NamedParameterType S_MAX_OLIGOS = { "Max oligos", PT_UNSIGNED_INT };
+
+
+static const uint32 S_DEFAULT_OLIGO_LENGTH = 25;
+
+static const uint32 S_DEFAULT_OLIGO_STEP = 1;
+
+static const uint32 S_DEFAULT_MIN_TM = 55;
+
+static const uint32 S_DEFAULT_MAX_TM = 70;
+
+static const uint32 S_DEFAULT_MIN_GC = 30;
+
+static const uint32 S_DEFAULT_MAX_GC = 70;
+
+static const uint32 S_DEFAULT_MAX_SELF_COMPLEMENTARITY = 8;
+
+static const uint32 S_DEFAULT_MAX_OLIGOS = 10000;
+
+static const size_t S_INITIAL_OLIGOS_SIZE = 256;
+
+/*
+ * Each task tiles the oligos starting in this many bases.
+ */
+static const hts_pos_t S_BLOCK_SIZE = 1 << 22;
+
+/*
+ * A hairpin needs a loop of at least this many bases between its stems.
+ */
+static const uint32 S_MIN_HAIRPIN_LOOP = 3;
+
+/*
+ * The SantaLucia (1998) unified nearest-neighbour parameters indexed by
+ * the codes of the two bases of each 5' to 3' dinucleotide, in tenths of
+ * a kcal/mol for the enthalpy and tenths of a cal/K/mol for the entropy
+ * so that they can be summed exactly as the window slides.
+ */
+static const int32 S_STACK_ENTHALPY [16] =
+{
+	-79, -84, -78, -72,
+	-85, -80, -106, -78,
+	-82, -98, -80, -84,
+	-72, -82, -85, -79
+};
+
+static const int32 S_STACK_ENTROPY [16] =
+{
+	-222, -224, -210, -204,
+	-227, -199, -272, -210,
+	-222, -244, -199, -224,
+	-213, -222, -227, -222
+};
+
+/*
+ * The initiation terms for each terminal base.
+ */
+static const int32 S_TERMINAL_ENTHALPY [4] = { 23, 1, 1, 23 };
+
+static const int32 S_TERMINAL_ENTROPY [4] = { 41, -28, -28, 41 };
+
+static const int32 S_SYMMETRY_ENTROPY = -14;
+
+static const double S_GAS_CONSTANT = 1.9872;
+
+/*
+ * The Tm is for 50mM Na+ and 50nM of each strand, as used by Primer3.
+ */
+static const double S_SODIUM_CONCENTRATION = 0.05;
+
+static const double S_OLIGO_CONCENTRATION = 5e-8;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool TileBlock (const size_t task_index, void *data_p);
+
+static size_t CountEarlierOligos (const OligoTiling *tiling_p, const size_t task_index);
+
+static bool AddOligo (OligoBlock *block_p, const char *sequence_s, const uint32 length, const hts_pos_t start, const double tm, const uint32 gc_count, const uint32 hairpin, const uint32 dimer);
+
+static double GetMeltingTemperature (const int32 enthalpy, int32 entropy, const uint8 *codes_p, const uint32 length);
+
+static bool IsSelfComplementary (const uint8 *codes_p, const uint32 length);
+
+static void GetSelfComplementarity (const uint8 *codes_p, const uint32 length, uint32 *hairpin_p, uint32 *dimer_p);
+
+static inline int32 GetStackIndex (const uint8 *codes_p);
+
+static json_t *GetOligoTilingAsJSON (const OligoTiling *tiling_p, bool *complete_flag_p);
+
+static void ClearOligoTiling (OligoTiling *tiling_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool AddOligoTilingParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	return ((EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_OLIGO_LENGTH.npt_name_s, "Oligo length", "The length of the oligos to tile, from 8 to 64", &S_DEFAULT_OLIGO_LENGTH, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_OLIGO_STEP.npt_name_s, "Oligo step", "The distance between the starts of consecutive oligos", &S_DEFAULT_OLIGO_STEP, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MIN_TM.npt_name_s, "Min Tm", "The minimum nearest-neighbour melting temperature in degrees C", &S_DEFAULT_MIN_TM, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MAX_TM.npt_name_s, "Max Tm", "The maximum nearest-neighbour melting temperature in degrees C", &S_DEFAULT_MAX_TM, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MIN_GC.npt_name_s, "Min GC", "The minimum GC content as a percentage", &S_DEFAULT_MIN_GC, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MAX_GC.npt_name_s, "Max GC", "The maximum GC content as a percentage", &S_DEFAULT_MAX_GC, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MAX_SELF_COMPLEMENTARITY.npt_name_s, "Max self-complementarity", "The longest run of base pairs allowed in a hairpin or a dimer of an oligo with itself", &S_DEFAULT_MAX_SELF_COMPLEMENTARITY, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MAX_OLIGOS.npt_name_s, "Max oligos", "The tiling stops after this many oligos", &S_DEFAULT_MAX_OLIGOS, PL_ADVANCED) != NULL));
+}
+
+
+bool GetOligoTilingParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_OLIGO_LENGTH.npt_name_s) == 0)
+		{
+			*pt_p = S_OLIGO_LENGTH.npt_type;
+		}
+	else if (strcmp (param_name_s, S_OLIGO_STEP.npt_name_s) == 0)
+		{
+			*pt_p = S_OLIGO_STEP.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MIN_TM.npt_name_s) == 0)
+		{
+			*pt_p = S_MIN_TM.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MAX_TM.npt_name_s) == 0)
+		{
+			*pt_p = S_MAX_TM.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MIN_GC.npt_name_s) == 0)
+		{
+			*pt_p = S_MIN_GC.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MAX_GC.npt_name_s) == 0)
+		{
+			*pt_p = S_MAX_GC.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MAX_SELF_COMPLEMENTARITY.npt_name_s) == 0)
+		{
+			*pt_p = S_MAX_SELF_COMPLEMENTARITY.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MAX_OLIGOS.npt_name_s) == 0)
+		{
+			*pt_p = S_MAX_OLIGOS.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+void RunOligoTilingJob (Service *service_p, ParameterSet *param_set_p)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	IndexData *index_data_p = GetSelectedIndexData (data_p, param_set_p);
+	const char *region_s = NULL;
+
+	if (index_data_p && (index_data_p -> id_fasta_filename_s) && GetCurrentStringParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD.npt_name_s, &region_s) && region_s)
+		{
+			ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, region_s, index_data_p -> id_fasta_filename_s, NULL, NULL, NULL);
+
+			if (job_p)
+				{
+					const uint32 *value_p = NULL;
+					OligoTiling tiling;
+					IndexRegion region;
+
+					memset (&tiling, 0, sizeof (OligoTiling));
+
+					tiling.ot_index_data_p = index_data_p;
+					tiling.ot_region_p = &region;
+					tiling.ot_length = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_OLIGO_LENGTH.npt_name_s, &value_p) && value_p) ? *value_p : S_DEFAULT_OLIGO_LENGTH;
+					tiling.ot_step = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_OLIGO_STEP.npt_name_s, &value_p) && value_p && (*value_p > 0)) ? *value_p : S_DEFAULT_OLIGO_STEP;
+					tiling.ot_min_tm = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MIN_TM.npt_name_s, &value_p) && value_p) ? *value_p : S_DEFAULT_MIN_TM;
+					tiling.ot_max_tm = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MAX_TM.npt_name_s, &value_p) && value_p) ? *value_p : S_DEFAULT_MAX_TM;
+					tiling.ot_min_gc = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MIN_GC.npt_name_s, &value_p) && value_p) ? *value_p : S_DEFAULT_MIN_GC;
+					tiling.ot_max_gc = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MAX_GC.npt_name_s, &value_p) && value_p) ? *value_p : S_DEFAULT_MAX_GC;
+					tiling.ot_max_self_complementarity = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MAX_SELF_COMPLEMENTARITY.npt_name_s, &value_p) && value_p) ? *value_p : S_DEFAULT_MAX_SELF_COMPLEMENTARITY;
+					tiling.ot_max_oligos = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MAX_OLIGOS.npt_name_s, &value_p) && value_p && (*value_p > 0)) ? *value_p : S_DEFAULT_MAX_OLIGOS;
+
+					LogParameterSet (param_set_p, job_p);
+
+					SetServiceJobStatus (job_p, OS_STARTED);
+					LogServiceJob (job_p);
+
+					/* Assume failure */
+					SetServiceJobStatus (job_p, OS_FAILED);
+
+					if ((tiling.ot_length < OT_MIN_OLIGO_LENGTH) || (tiling.ot_length > OT_MAX_OLIGO_LENGTH))
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "Oligo length must be between 8 and 64");
+						}
+					else if ((tiling.ot_min_tm > tiling.ot_max_tm) || (tiling.ot_min_gc > tiling.ot_max_gc))
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "The minimum Tm and GC must not be above their maximums");
+						}
+					else if (ParseIndexRegion (index_data_p, region_s, &region))
+						{
+							tiling.ot_num_blocks = (size_t) ((region.ir_end - region.ir_start + S_BLOCK_SIZE - 1) / S_BLOCK_SIZE);
+							tiling.ot_blocks_p = (OligoBlock *) AllocMemoryArray (sizeof (OligoBlock), tiling.ot_num_blocks + 1);
+
+							if (tiling.ot_blocks_p)
+								{
+									memset (tiling.ot_blocks_p, 0, (tiling.ot_num_blocks + 1) * sizeof (OligoBlock));
+
+									if (RunWorkerPool (tiling.ot_num_blocks, data_p -> stsd_num_threads, TileBlock, &tiling))
+										{
+											bool complete_flag = true;
+											json_t *result_p = GetOligoTilingAsJSON (&tiling, &complete_flag);
+
+											if (result_p)
+												{
+													if (AddInlineResultToServiceJob (job_p, "oligos", result_p))
+														{
+															if (complete_flag)
+																{
+																	SetServiceJobStatus (job_p, OS_SUCCEEDED);
+																}
+															else
+																{
+																	AddGeneralErrorMessageToServiceJob (job_p, "Stopped after reaching Max oligos");
+																	SetServiceJobStatus (job_p, OS_PARTIALLY_SUCCEEDED);
+																}
+														}
+
+													json_decref (result_p);
+												}
+										}
+									else
+										{
+											AddGeneralErrorMessageToServiceJob (job_p, "Failed to tile the region");
+										}
+
+									ClearOligoTiling (&tiling);
+								}
+							else
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "Failed to allocate the oligo blocks");
+								}
+						}
+					else
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "Unknown region");
+						}
+
+					LogServiceJob (job_p);
+				}		/* if (job_p) */
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get a FASTA file and region to tile oligos across");
+		}
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+/*
+ * Slide the window along the block, keeping running sums of the stacking
+ * terms and the GC and ambiguous bases, so that each oligo's GC and Tm
+ * come at a fixed cost. Only the oligos that pass both of those have
+ * their self-complementarity checked.
+ */
+static bool TileBlock (const size_t task_index, void *data_p)
+{
+	OligoTiling *tiling_p = (OligoTiling *) data_p;
+	OligoBlock *block_p = tiling_p -> ot_blocks_p + task_index;
+	const IndexRegion *region_p = tiling_p -> ot_region_p;
+	const uint32 length = tiling_p -> ot_length;
+	const hts_pos_t block_start = region_p -> ir_start + ((hts_pos_t) task_index) * S_BLOCK_SIZE;
+	const hts_pos_t block_end = (region_p -> ir_end - block_start < S_BLOCK_SIZE) ? region_p -> ir_end : block_start + S_BLOCK_SIZE;
+	const hts_pos_t overlap_end = block_end + (hts_pos_t) length - 1;
+	bool success_flag = false;
+	hts_pos_t sequence_length = 0;
+
+	/* Overlap the next block so that this one gets every oligo that starts within it */
+	char *sequence_s = FetchIndexSequence (tiling_p -> ot_index_data_p, region_p -> ir_scaffold_name_s, block_start, (overlap_end < region_p -> ir_end) ? overlap_end : region_p -> ir_end, &sequence_length);
+
+	if (sequence_s)
+		{
+			if (sequence_length < (hts_pos_t) length)
+				{
+					success_flag = true;
+				}
+			else
+				{
+					uint8 *codes_p = (uint8 *) AllocMemoryArray (sizeof (uint8), (size_t) sequence_length);
+
+					if (codes_p)
+						{
+							const size_t num_windows = (sequence_length - length + 1 < block_end - block_start) ? (size_t) (sequence_length - length + 1) : (size_t) (block_end - block_start);
+							const size_t first_offset = (size_t) (block_start - region_p -> ir_start);
+							int32 enthalpy = 0;
+							int32 entropy = 0;
+							uint32 num_gc = 0;
+							uint32 num_invalid = 0;
+							size_t i;
+
+							EncodeBases (sequence_s, codes_p, (size_t) sequence_length);
+
+							/* Everything in the first window except its last base */
+							for (i = 0; i + 1 < length; ++ i)
+								{
+									if (codes_p [i] == INVALID_BASE)
+										{
+											++ num_invalid;
+										}
+									else if ((codes_p [i] == 1) || (codes_p [i] == 2))
+										{
+											++ num_gc;
+										}
+
+									if (i > 0)
+										{
+											const int32 stack = GetStackIndex (codes_p + i - 1);
+
+											if (stack >= 0)
+												{
+													enthalpy += S_STACK_ENTHALPY [stack];
+													entropy += S_STACK_ENTROPY [stack];
+												}
+										}
+								}
+
+							success_flag = true;
+
+							for (i = 0; i < num_windows; ++ i)
+								{
+									const size_t last = i + length - 1;
+									int32 stack = GetStackIndex (codes_p + last - 1);
+
+									if (codes_p [last] == INVALID_BASE)
+										{
+											++ num_invalid;
+										}
+									else if ((codes_p [last] == 1) || (codes_p [last] == 2))
+										{
+											++ num_gc;
+										}
+
+									if (stack >= 0)
+										{
+											enthalpy += S_STACK_ENTHALPY [stack];
+											entropy += S_STACK_ENTROPY [stack];
+										}
+
+									if ((num_invalid == 0) && (((first_offset + i) % (tiling_p -> ot_step)) == 0) &&
+										(num_gc * 100 >= tiling_p -> ot_min_gc * length) && (num_gc * 100 <= tiling_p -> ot_max_gc * length))
+										{
+											const double tm = GetMeltingTemperature (enthalpy, entropy, codes_p + i, length);
+
+											if ((tm >= (double) (tiling_p -> ot_min_tm)) && (tm <= (double) (tiling_p -> ot_max_tm)))
+												{
+													uint32 hairpin;
+													uint32 dimer;
+
+													GetSelfComplementarity (codes_p + i, length, &hairpin, &dimer);
+
+													if ((hairpin <= tiling_p -> ot_max_self_complementarity) && (dimer <= tiling_p -> ot_max_self_complementarity))
+														{
+															/* Only the first Max oligos of the region are returned, so there's no need to keep any more */
+															if (CountEarlierOligos (tiling_p, task_index) + block_p -> ob_num_oligos >= tiling_p -> ot_max_oligos)
+																{
+																	block_p -> ob_truncated_flag = true;
+																	break;
+																}
+
+															if (!AddOligo (block_p, sequence_s + i, length, block_start + (hts_pos_t) i, tm, num_gc, hairpin, dimer))
+																{
+																	success_flag = false;
+																	break;
+																}
+														}
+												}
+										}
+
+									/* Drop the first base of the window */
+									if (codes_p [i] == INVALID_BASE)
+										{
+											-- num_invalid;
+										}
+									else if ((codes_p [i] == 1) || (codes_p [i] == 2))
+										{
+											-- num_gc;
+										}
+
+									if ((stack = GetStackIndex (codes_p + i)) >= 0)
+										{
+											enthalpy -= S_STACK_ENTHALPY [stack];
+											entropy -= S_STACK_ENTROPY [stack];
+										}
+								}
+
+							FreeMemory (codes_p);
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " INT64_FMT " base codes", (int64) sequence_length);
+						}
+				}
+
+			free (sequence_s);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * The earlier blocks might still be being tiled but their counts only
+ * ever grow, so this is a lower bound on how many oligos come before
+ * the given block.
+ */
+static size_t CountEarlierOligos (const OligoTiling *tiling_p, const size_t task_index)
+{
+	size_t num_oligos = 0;
+	size_t i;
+
+	for (i = 0; i < task_index; ++ i)
+		{
+			num_oligos += * ((volatile const size_t *) & (tiling_p -> ot_blocks_p [i].ob_num_oligos));
+		}
+
+	return num_oligos;
+}
+
+
+static bool AddOligo (OligoBlock *block_p, const char *sequence_s, const uint32 length, const hts_pos_t start, const double tm, const uint32 gc_count, const uint32 hairpin, const uint32 dimer)
+{
+	Oligo *oligo_p;
+	uint32 i;
+
+	if (block_p -> ob_num_oligos == block_p -> ob_oligos_size)
+		{
+			const size_t new_size = (block_p -> ob_oligos_size > 0) ? (block_p -> ob_oligos_size << 1) : S_INITIAL_OLIGOS_SIZE;
+			Oligo *new_oligos_p = (Oligo *) ReallocMemory (block_p -> ob_oligos_p, new_size * sizeof (Oligo), block_p -> ob_oligos_size * sizeof (Oligo));
+
+			if (!new_oligos_p)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to grow oligos to " SIZET_FMT, new_size);
+					return false;
+				}
+
+			block_p -> ob_oligos_p = new_oligos_p;
+			block_p -> ob_oligos_size = new_size;
+		}
+
+	oligo_p = block_p -> ob_oligos_p + block_p -> ob_num_oligos;
+	oligo_p -> ol_start = start;
+	oligo_p -> ol_tm = tm;
+	oligo_p -> ol_gc_count = gc_count;
+	oligo_p -> ol_hairpin = hairpin;
+	oligo_p -> ol_dimer = dimer;
+
+	/* Soft-masking is not kept since it says nothing about the oligo itself */
+	for (i = 0; i < length; ++ i)
+		{
+			oligo_p -> ol_sequence_s [i] = (char) toupper (sequence_s [i]);
+		}
+
+	oligo_p -> ol_sequence_s [length] = '\0';
+
+	++ (block_p -> ob_num_oligos);
+
+	return true;
+}
+
+
+/*
+ * Tm = 1000 dH / (dS + R ln (Ct / x)) - 273.15 where x is 4 for two
+ * different strands and 1 for a self-complementary one, with the
+ * SantaLucia salt correction of 0.368 (N - 1) ln [Na+] to the entropy.
+ */
+static double GetMeltingTemperature (const int32 enthalpy, int32 entropy, const uint8 *codes_p, const uint32 length)
+{
+	const uint8 first = codes_p [0];
+	const uint8 last = codes_p [length - 1];
+	double concentration = S_OLIGO_CONCENTRATION / 4.0;
+	double total_entropy;
+
+	entropy += S_TERMINAL_ENTROPY [first] + S_TERMINAL_ENTROPY [last];
+
+	if (IsSelfComplementary (codes_p, length))
+		{
+			entropy += S_SYMMETRY_ENTROPY;
+			concentration = S_OLIGO_CONCENTRATION;
+		}
+
+	total_entropy = (entropy / 10.0) + 0.368 * (length - 1) * log (S_SODIUM_CONCENTRATION) + S_GAS_CONSTANT * log (concentration);
+
+	return (100.0 * (enthalpy + S_TERMINAL_ENTHALPY [first] + S_TERMINAL_ENTHALPY [last])) / total_entropy - 273.15;
+}
+
+
+static bool IsSelfComplementary (const uint8 *codes_p, const uint32 length)
+{
+	uint32 i;
+
+	for (i = 0; i < length; ++ i)
+		{
+			if (codes_p [i] + codes_p [length - 1 - i] != 3)
+				{
+					return false;
+				}
+		}
+
+	return true;
+}
+
+
+/*
+ * Bases i and j of two antiparallel copies of the oligo can pair when
+ * i + j is the same, so walk each of those diagonals counting the runs
+ * of complementary bases. Within a single copy the same pairs make up
+ * a hairpin stem as long as there is room for the loop between them.
+ */
+static void GetSelfComplementarity (const uint8 *codes_p, const uint32 length, uint32 *hairpin_p, uint32 *dimer_p)
+{
+	uint32 hairpin = 0;
+	uint32 dimer = 0;
+	uint32 sum;
+
+	for (sum = 1; sum < 2 * (length - 1); ++ sum)
+		{
+			const uint32 last = (sum < length) ? sum : length - 1;
+			uint32 run = 0;
+			uint32 stem = 0;
+			uint32 i;
+
+			for (i = sum - last; i <= last; ++ i)
+				{
+					const uint32 j = sum - i;
+
+					if (codes_p [i] + codes_p [j] == 3)
+						{
+							if (++ run > dimer)
+								{
+									dimer = run;
+								}
+
+							if (j > i + S_MIN_HAIRPIN_LOOP)
+								{
+									if (++ stem > hairpin)
+										{
+											hairpin = stem;
+										}
+								}
+						}
+					else
+						{
+							run = 0;
+							stem = 0;
+						}
+				}
+		}
+
+	*hairpin_p = hairpin;
+	*dimer_p = dimer;
+}
+
+
+/*
+ * Get the index of a dinucleotide in the stacking tables or -1 if either
+ * base is ambiguous.
+ */
+static inline int32 GetStackIndex (const uint8 *codes_p)
+{
+	return ((codes_p [0] | codes_p [1]) & INVALID_BASE) ? -1 : (int32) ((codes_p [0] << 2) | codes_p [1]);
+}
+
+
+static json_t *GetOligoTilingAsJSON (const OligoTiling *tiling_p, bool *complete_flag_p)
+{
+	const IndexRegion *region_p = tiling_p -> ot_region_p;
+	json_t *result_p = NULL;
+	json_t *oligos_json_p = json_array ();
+	bool success_flag = (oligos_json_p != NULL);
+	size_t num_oligos = 0;
+	size_t i;
+
+	*complete_flag_p = true;
+
+	for (i = 0; (i < tiling_p -> ot_num_blocks) && success_flag && (*complete_flag_p); ++ i)
+		{
+			const OligoBlock *block_p = tiling_p -> ot_blocks_p + i;
+			size_t j;
+
+			for (j = 0; (j < block_p -> ob_num_oligos) && success_flag; ++ j)
+				{
+					const Oligo *oligo_p = block_p -> ob_oligos_p + j;
+					json_t *oligo_json_p;
+
+					if (num_oligos == tiling_p -> ot_max_oligos)
+						{
+							*complete_flag_p = false;
+							break;
+						}
+
+					oligo_json_p = json_pack ("{s:I,s:I,s:s,s:f,s:f,s:I,s:I}",
+						"start", (json_int_t) (oligo_p -> ol_start + 1),
+						"end", (json_int_t) (oligo_p -> ol_start + tiling_p -> ot_length),
+						"sequence", oligo_p -> ol_sequence_s,
+						"tm", floor (oligo_p -> ol_tm * 100.0 + 0.5) / 100.0,
+						"gc", floor ((10000.0 * oligo_p -> ol_gc_count) / tiling_p -> ot_length + 0.5) / 100.0,
+						"hairpin", (json_int_t) (oligo_p -> ol_hairpin),
+						"dimer", (json_int_t) (oligo_p -> ol_dimer));
+
+					success_flag = (oligo_json_p != NULL) && (json_array_append_new (oligos_json_p, oligo_json_p) == 0);
+					++ num_oligos;
+				}
+
+			if (block_p -> ob_truncated_flag)
+				{
+					*complete_flag_p = false;
+				}
+		}
+
+	if (success_flag)
+		{
+			result_p = json_pack ("{s:s,s:I,s:I,s:I,s:I,s:o}",
+				"scaffold", region_p -> ir_scaffold_name_s,
+				"start", (json_int_t) (region_p -> ir_start + 1),
+				"end", (json_int_t) (region_p -> ir_end),
+				"oligo_length", (json_int_t) (tiling_p -> ot_length),
+				"oligo_step", (json_int_t) (tiling_p -> ot_step),
+				"oligos", oligos_json_p);
+
+			/* json_pack takes the array with "o" even if it fails */
+			oligos_json_p = NULL;
+		}
+
+	if (!result_p)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create the oligo results");
+		}
+
+	if (oligos_json_p)
+		{
+			json_decref (oligos_json_p);
+		}
+
+	return result_p;
+}
+
+
+static void ClearOligoTiling (OligoTiling *tiling_p)
+{
+	if (tiling_p -> ot_blocks_p)
+		{
+			size_t i;
+
+			for (i = 0; i < tiling_p -> ot_num_blocks; ++ i)
+				{
+					if (tiling_p -> ot_blocks_p [i].ob_oligos_p)
+						{
+							FreeMemory (tiling_p -> ot_blocks_p [i].ob_oligos_p);
+						}
+				}
+
+			FreeMemory (tiling_p -> ot_blocks_p);
+			tiling_p -> ot_blocks_p = NULL;
+		}
+
+	tiling_p -> ot_num_blocks = 0;
+}
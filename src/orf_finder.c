@@ -0,0 +1,625 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * orf_finder.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "orf_finder.h"
+#include "sequence_kernels.h"
+#include "worker_pool.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "audit.h"
+
+#include "string_parameter.h"
+#include "unsigned_int_parameter.h"
+#include "boolean_parameter.h"
+
+
+#ifdef _DEBUG
+	#define ORF_FINDER_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define ORF_FINDER_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * The codes that EncodeCodons gives the codons that start and end ORFs.
+ * The reverse strand ones are the reverse complements as read on the
+ * forward strand.
+ */
+#define OF_ATG (14)
+#define OF_TAA (48)
+#define OF_TAG (50)
+#define OF_TGA (56)
+
+#define OF_CAT (19)
+#define OF_TTA (60)
+#define OF_CTA (28)
+#define OF_TCA (52)
+
+
+/*
+ * The 0-based coordinates of an ORF including its stop codon.
+ */
+typedef struct OpenReadingFrame
+{
+	hts_pos_t orf_start;
+	hts_pos_t orf_end;
+	bool orf_reverse_flag;
+
+	/* The translated ORF without the stop or NULL if it was not wanted */
+	char *orf_peptide_s;
+} OpenReadingFrame;
+
+
+/*
+ * What has been seen so far on each strand of a frame. A position of -1
+ * means that there has not been one since the last stop.
+ */
+typedef struct FrameState
+{
+	/* The first ATG since the last forward stop */
+	hts_pos_t fs_forward_start;
+
+	/* The last reverse stop and the last CAT after it */
+	hts_pos_t fs_reverse_stop;
+	hts_pos_t fs_reverse_start;
+} FrameState;
+
+
+typedef struct OrfSet
+{
+	IndexData *os_index_data_p;
+	const IndexRegion *os_region_p;
+	hts_pos_t os_min_length;
+	uint32 os_max_orfs;
+
+	OpenReadingFrame *os_orfs_p;
+	size_t os_num_orfs;
+	size_t os_orfs_size;
+
+	/* Cleared once Max ORFs has been reached */
+	bool os_complete_flag;
+} OrfSet;
+
+
+static NamedParameterType S_MIN_ORF_LENGTH = { "Min ORF length", PT_UNSIGNED_INT };
+
+static NamedParameterType S_TRANSLATE_ORFS = { "Translate ORFs", PT_BOOLEAN };
+
+static NamedParameterType S_MAX_ORFS = { "Max ORFs", PT_UNSIGNED_INT };
+
+
+static const uint32 S_DEFAULT_MIN_ORF_LENGTH = 300;
+
+static const uint32 S_DEFAULT_MAX_ORFS = 10000;
+
+static const size_t S_INITIAL_ORFS_SIZE = 256;
+
+/*
+ * The region is read in windows of this many codons.
+ */
+static const hts_pos_t S_BLOCK_SIZE = 1 << 22;
+
+static const uint8 S_TARGET_CODONS [] = { OF_ATG, OF_TAA, OF_TAG, OF_TGA, OF_CAT, OF_TTA, OF_CTA, OF_TCA };
+
+/*
+ * The standard genetic code indexed by the codon codes from EncodeCodons.
+ */
+static const char * const S_GENETIC_CODE_S = "KNKNTTTTRSRSIIMIQHQHPPPPRRRRLLLLEDEDAAAAGGGGVVVV*Y*YSSSS*CWCLFLF";
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool ScanBlock (OrfSet *orfs_p, FrameState *frames_p, const uint8 *codons_p, const size_t num_codons, const hts_pos_t offset);
+
+static bool AddOrf (OrfSet *orfs_p, const hts_pos_t start, const hts_pos_t end, const bool reverse_flag);
+
+static bool TranslateOrf (const size_t task_index, void *data_p);
+
+static json_t *GetOrfSetAsJSON (const OrfSet *orfs_p);
+
+static void ClearOrfSet (OrfSet *orfs_p);
+
+static int CompareOrfs (const void *v0_p, const void *v1_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool AddOrfFinderParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	const bool def_translate_flag = false;
+
+	return ((EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MIN_ORF_LENGTH.npt_name_s, "Min ORF length", "The minimum length in bases of the ORFs to return, not counting the stop codon", &S_DEFAULT_MIN_ORF_LENGTH, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddBooleanParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_TRANSLATE_ORFS.npt_name_s, "Translate ORFs", "Include the peptide sequence of each ORF", &def_translate_flag, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MAX_ORFS.npt_name_s, "Max ORFs", "The search stops after this many ORFs", &S_DEFAULT_MAX_ORFS, PL_ADVANCED) != NULL));
+}
+
+
+bool GetOrfFinderParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_MIN_ORF_LENGTH.npt_name_s) == 0)
+		{
+			*pt_p = S_MIN_ORF_LENGTH.npt_type;
+		}
+	else if (strcmp (param_name_s, S_TRANSLATE_ORFS.npt_name_s) == 0)
+		{
+			*pt_p = S_TRANSLATE_ORFS.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MAX_ORFS.npt_name_s) == 0)
+		{
+			*pt_p = S_MAX_ORFS.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+void RunOrfFinderJob (Service *service_p, ParameterSet *param_set_p)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	IndexData *index_data_p = GetSelectedIndexData (data_p, param_set_p);
+	const char *region_s = NULL;
+
+	if (index_data_p && (index_data_p -> id_fasta_filename_s) && GetCurrentStringParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD.npt_name_s, &region_s) && region_s)
+		{
+			ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, region_s, index_data_p -> id_fasta_filename_s, NULL, NULL, NULL);
+
+			if (job_p)
+				{
+					const uint32 *value_p = NULL;
+					const bool *translate_flag_p = NULL;
+					const uint32 min_length = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MIN_ORF_LENGTH.npt_name_s, &value_p) && value_p) ? *value_p : S_DEFAULT_MIN_ORF_LENGTH;
+					const uint32 max_orfs = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MAX_ORFS.npt_name_s, &value_p) && value_p && (*value_p > 0)) ? *value_p : S_DEFAULT_MAX_ORFS;
+					const bool translate_flag = (GetCurrentBooleanParameterValueFromParameterSet (param_set_p, S_TRANSLATE_ORFS.npt_name_s, &translate_flag_p) && translate_flag_p) ? *translate_flag_p : false;
+					IndexRegion region;
+
+					LogParameterSet (param_set_p, job_p);
+
+					SetServiceJobStatus (job_p, OS_STARTED);
+					LogServiceJob (job_p);
+
+					/* Assume failure */
+					SetServiceJobStatus (job_p, OS_FAILED);
+
+					if (ParseIndexRegion (index_data_p, region_s, &region))
+						{
+							uint8 *codons_p = (uint8 *) AllocMemoryArray (sizeof (uint8), (size_t) S_BLOCK_SIZE);
+
+							if (codons_p)
+								{
+									FrameState frames [3];
+									OrfSet orfs;
+									bool success_flag = true;
+									hts_pos_t block_start = region.ir_start;
+									size_t i;
+
+									memset (&orfs, 0, sizeof (OrfSet));
+									orfs.os_index_data_p = index_data_p;
+									orfs.os_region_p = &region;
+									orfs.os_min_length = (hts_pos_t) min_length;
+									orfs.os_max_orfs = max_orfs;
+									orfs.os_complete_flag = true;
+
+									for (i = 0; i < 3; ++ i)
+										{
+											frames [i].fs_forward_start = -1;
+											frames [i].fs_reverse_stop = -1;
+											frames [i].fs_reverse_start = -1;
+										}
+
+									while ((block_start < region.ir_end) && success_flag && (orfs.os_complete_flag))
+										{
+											const hts_pos_t block_end = (region.ir_end - block_start < S_BLOCK_SIZE) ? region.ir_end : block_start + S_BLOCK_SIZE;
+											const hts_pos_t overlap_end = block_end + 2;
+											hts_pos_t length = 0;
+
+											/* Overlap the next window so that every codon starting in this one is complete */
+											char *sequence_s = FetchIndexSequence (index_data_p, region.ir_scaffold_name_s, block_start, (overlap_end < region.ir_end) ? overlap_end : region.ir_end, &length);
+
+											if (sequence_s)
+												{
+													const size_t num_codons = (length - 2 < block_end - block_start) ? ((length > 2) ? (size_t) (length - 2) : 0) : (size_t) (block_end - block_start);
+
+													EncodeCodons (sequence_s, codons_p, num_codons);
+													free (sequence_s);
+
+													success_flag = ScanBlock (&orfs, frames, codons_p, num_codons, block_start);
+												}
+											else
+												{
+													success_flag = false;
+												}
+
+											block_start = block_end;
+										}
+
+									/* Any reverse ORF still open was ended by its last CAT */
+									for (i = 0; (i < 3) && success_flag && (orfs.os_complete_flag); ++ i)
+										{
+											if ((frames [i].fs_reverse_stop >= 0) && (frames [i].fs_reverse_start >= 0))
+												{
+													success_flag = AddOrf (&orfs, frames [i].fs_reverse_stop, frames [i].fs_reverse_start + 3, true);
+												}
+										}
+
+									FreeMemory (codons_p);
+
+									if (success_flag && (orfs.os_num_orfs > 0))
+										{
+											qsort (orfs.os_orfs_p, orfs.os_num_orfs, sizeof (OpenReadingFrame), CompareOrfs);
+
+											if (translate_flag)
+												{
+													success_flag = RunWorkerPool (orfs.os_num_orfs, data_p -> stsd_num_threads, TranslateOrf, &orfs);
+												}
+										}
+
+									if (success_flag)
+										{
+											json_t *result_p = GetOrfSetAsJSON (&orfs);
+
+											if (result_p)
+												{
+													if (AddInlineResultToServiceJob (job_p, "orfs", result_p))
+														{
+															if (orfs.os_complete_flag)
+																{
+																	SetServiceJobStatus (job_p, OS_SUCCEEDED);
+																}
+															else
+																{
+																	AddGeneralErrorMessageToServiceJob (job_p, "Stopped after reaching Max ORFs");
+																	SetServiceJobStatus (job_p, OS_PARTIALLY_SUCCEEDED);
+																}
+														}
+
+													json_decref (result_p);
+												}
+										}
+									else
+										{
+											AddGeneralErrorMessageToServiceJob (job_p, "Failed to search the region for ORFs");
+										}
+
+									ClearOrfSet (&orfs);
+								}
+							else
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "Failed to allocate the codon buffer");
+								}
+						}
+					else
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "Unknown region");
+						}
+
+					LogServiceJob (job_p);
+				}		/* if (job_p) */
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get a FASTA file and region to find the ORFs in");
+		}
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+/*
+ * Jump between the start and stop codons of both strands and update the
+ * state of their frames. Forward ORFs end at their stop codon whereas
+ * reverse ones end at the last CAT before the next reverse stop, so they
+ * are only added once that stop, or the end of the region, is reached.
+ */
+static bool ScanBlock (OrfSet *orfs_p, FrameState *frames_p, const uint8 *codons_p, const size_t num_codons, const hts_pos_t offset)
+{
+	const size_t num_targets = sizeof (S_TARGET_CODONS) / sizeof (S_TARGET_CODONS [0]);
+	size_t i = FindNextTargetCodon (codons_p, 0, num_codons, S_TARGET_CODONS, num_targets);
+
+	while ((i < num_codons) && (orfs_p -> os_complete_flag))
+		{
+			const hts_pos_t pos = offset + (hts_pos_t) i;
+			FrameState *frame_p = frames_p + (pos % 3);
+
+			switch (codons_p [i])
+				{
+					case OF_ATG:
+						if (frame_p -> fs_forward_start < 0)
+							{
+								frame_p -> fs_forward_start = pos;
+							}
+						break;
+
+					case OF_TAA:
+					case OF_TAG:
+					case OF_TGA:
+						if (frame_p -> fs_forward_start >= 0)
+							{
+								if (!AddOrf (orfs_p, frame_p -> fs_forward_start, pos + 3, false))
+									{
+										return false;
+									}
+
+								frame_p -> fs_forward_start = -1;
+							}
+						break;
+
+					case OF_CAT:
+						if (frame_p -> fs_reverse_stop >= 0)
+							{
+								frame_p -> fs_reverse_start = pos;
+							}
+						break;
+
+					default:
+						if ((frame_p -> fs_reverse_stop >= 0) && (frame_p -> fs_reverse_start >= 0))
+							{
+								if (!AddOrf (orfs_p, frame_p -> fs_reverse_stop, frame_p -> fs_reverse_start + 3, true))
+									{
+										return false;
+									}
+							}
+
+						frame_p -> fs_reverse_stop = pos;
+						frame_p -> fs_reverse_start = -1;
+						break;
+				}
+
+			i = FindNextTargetCodon (codons_p, i + 1, num_codons, S_TARGET_CODONS, num_targets);
+		}
+
+	return true;
+}
+
+
+/*
+ * Add an ORF if it is long enough. Once Max ORFs has been reached, this
+ * clears os_complete_flag instead and only returns false if the ORFs
+ * can't be grown.
+ */
+static bool AddOrf (OrfSet *orfs_p, const hts_pos_t start, const hts_pos_t end, const bool reverse_flag)
+{
+	if (end - start - 3 >= orfs_p -> os_min_length)
+		{
+			OpenReadingFrame *orf_p;
+
+			if (orfs_p -> os_num_orfs >= orfs_p -> os_max_orfs)
+				{
+					orfs_p -> os_complete_flag = false;
+					return true;
+				}
+
+			if (orfs_p -> os_num_orfs == orfs_p -> os_orfs_size)
+				{
+					const size_t new_size = (orfs_p -> os_orfs_size > 0) ? (orfs_p -> os_orfs_size << 1) : S_INITIAL_ORFS_SIZE;
+					OpenReadingFrame *new_orfs_p = (OpenReadingFrame *) ReallocMemory (orfs_p -> os_orfs_p, new_size * sizeof (OpenReadingFrame), orfs_p -> os_orfs_size * sizeof (OpenReadingFrame));
+
+					if (!new_orfs_p)
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to grow ORFs to " SIZET_FMT, new_size);
+							return false;
+						}
+
+					orfs_p -> os_orfs_p = new_orfs_p;
+					orfs_p -> os_orfs_size = new_size;
+				}
+
+			orf_p = orfs_p -> os_orfs_p + orfs_p -> os_num_orfs;
+			orf_p -> orf_start = start;
+			orf_p -> orf_end = end;
+			orf_p -> orf_reverse_flag = reverse_flag;
+			orf_p -> orf_peptide_s = NULL;
+
+			++ (orfs_p -> os_num_orfs);
+		}
+
+	return true;
+}
+
+
+static bool TranslateOrf (const size_t task_index, void *data_p)
+{
+	OrfSet *orfs_p = (OrfSet *) data_p;
+	OpenReadingFrame *orf_p = orfs_p -> os_orfs_p + task_index;
+	bool success_flag = false;
+	hts_pos_t length = 0;
+	char *sequence_s = FetchIndexSequence (orfs_p -> os_index_data_p, orfs_p -> os_region_p -> ir_scaffold_name_s, orf_p -> orf_start, orf_p -> orf_end, &length);
+
+	if (sequence_s)
+		{
+			const size_t num_residues = (size_t) ((orf_p -> orf_end - orf_p -> orf_start) / 3) - 1;
+
+			if (length == orf_p -> orf_end - orf_p -> orf_start)
+				{
+					uint8 *codons_p = (uint8 *) AllocMemoryArray (sizeof (uint8), (size_t) length);
+
+					if (codons_p)
+						{
+							if ((orf_p -> orf_peptide_s = (char *) AllocMemory (num_residues + 1)) != NULL)
+								{
+									size_t i;
+
+									EncodeCodons (sequence_s, codons_p, (size_t) length - 2);
+
+									for (i = 0; i < num_residues; ++ i)
+										{
+											uint8 codon;
+
+											if (orf_p -> orf_reverse_flag)
+												{
+													/* Read the codons backwards from the CAT and complement them */
+													codon = codons_p [(size_t) length - 3 * (i + 1)];
+
+													if (codon != INVALID_CODON)
+														{
+															codon = (uint8) (((3 - (codon & 3)) << 4) | ((3 - ((codon >> 2) & 3)) << 2) | (3 - (codon >> 4)));
+														}
+												}
+											else
+												{
+													codon = codons_p [3 * i];
+												}
+
+											orf_p -> orf_peptide_s [i] = (codon != INVALID_CODON) ? S_GENETIC_CODE_S [codon] : 'X';
+										}
+
+									orf_p -> orf_peptide_s [num_residues] = '\0';
+									success_flag = true;
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate peptide of " SIZET_FMT " residues", num_residues);
+								}
+
+							FreeMemory (codons_p);
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " codons", (size_t) length);
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Got " INT64_FMT " bases for ORF at " INT64_FMT " of %s", (int64) length, (int64) (orf_p -> orf_start), orfs_p -> os_region_p -> ir_scaffold_name_s);
+				}
+
+			free (sequence_s);
+		}
+
+	return success_flag;
+}
+
+
+static json_t *GetOrfSetAsJSON (const OrfSet *orfs_p)
+{
+	const IndexRegion *region_p = orfs_p -> os_region_p;
+	json_t *result_p = NULL;
+	json_t *orfs_json_p = json_array ();
+	bool success_flag = (orfs_json_p != NULL);
+	size_t i;
+
+	for (i = 0; (i < orfs_p -> os_num_orfs) && success_flag; ++ i)
+		{
+			const OpenReadingFrame *orf_p = orfs_p -> os_orfs_p + i;
+
+			/* Frames are numbered from the start of the scaffold on their own strand */
+			const hts_pos_t frame = (orf_p -> orf_reverse_flag) ? ((region_p -> ir_scaffold_length - orf_p -> orf_end) % 3) + 1 : (orf_p -> orf_start % 3) + 1;
+			json_t *orf_json_p = json_pack ("{s:I,s:I,s:s,s:I,s:I}",
+				"start", (json_int_t) (orf_p -> orf_start + 1),
+				"end", (json_int_t) (orf_p -> orf_end),
+				"strand", (orf_p -> orf_reverse_flag) ? "-" : "+",
+				"frame", (json_int_t) frame,
+				"length", (json_int_t) ((orf_p -> orf_end - orf_p -> orf_start) / 3 - 1));
+
+			if (orf_json_p && (orf_p -> orf_peptide_s))
+				{
+					if (json_object_set_new (orf_json_p, "peptide", json_string (orf_p -> orf_peptide_s)) != 0)
+						{
+							json_decref (orf_json_p);
+							orf_json_p = NULL;
+						}
+				}
+
+			success_flag = (orf_json_p != NULL) && (json_array_append_new (orfs_json_p, orf_json_p) == 0);
+		}
+
+	if (success_flag)
+		{
+			result_p = json_pack ("{s:s,s:I,s:I,s:I,s:o}",
+				"scaffold", region_p -> ir_scaffold_name_s,
+				"start", (json_int_t) (region_p -> ir_start + 1),
+				"end", (json_int_t) (region_p -> ir_end),
+				"min_length", (json_int_t) (orfs_p -> os_min_length),
+				"orfs", orfs_json_p);
+
+			/* json_pack takes the array with "o" even if it fails */
+			orfs_json_p = NULL;
+		}
+
+	if (!result_p)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create the ORF results");
+		}
+
+	if (orfs_json_p)
+		{
+			json_decref (orfs_json_p);
+		}
+
+	return result_p;
+}
+
+
+static void ClearOrfSet (OrfSet *orfs_p)
+{
+	if (orfs_p -> os_orfs_p)
+		{
+			size_t i;
+
+			for (i = 0; i < orfs_p -> os_num_orfs; ++ i)
+				{
+					if (orfs_p -> os_orfs_p [i].orf_peptide_s)
+						{
+							FreeMemory (orfs_p -> os_orfs_p [i].orf_peptide_s);
+						}
+				}
+
+			FreeMemory (orfs_p -> os_orfs_p);
+			orfs_p -> os_orfs_p = NULL;
+		}
+
+	orfs_p -> os_num_orfs = 0;
+	orfs_p -> os_orfs_size = 0;
+}
+
+
+static int CompareOrfs (const void *v0_p, const void *v1_p)
+{
+	const OpenReadingFrame *orf0_p = (const OpenReadingFrame *) v0_p;
+	const OpenReadingFrame *orf1_p = (const OpenReadingFrame *) v1_p;
+
+	if (orf0_p -> orf_start != orf1_p -> orf_start)
+		{
+			return (orf0_p -> orf_start < orf1_p -> orf_start) ? -1 : 1;
+		}
+
+	if (orf0_p -> orf_end != orf1_p -> orf_end)
+		{
+			return (orf0_p -> orf_end < orf1_p -> orf_end) ? -1 : 1;
+		}
+
+	return (int) (orf0_p -> orf_reverse_flag) - (int) (orf1_p -> orf_reverse_flag);
+}
@@ -0,0 +1,910 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * primer_search.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "primer_search.h"
+#include "worker_pool.h"
+#include "fasta_utils.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "audit.h"
+
+#include "string_parameter.h"
+#include "unsigned_int_parameter.h"
+#include "boolean_parameter.h"
+
+
+#ifdef _DEBUG
+	#define PRIMER_SEARCH_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define PRIMER_SEARCH_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * The primers are matched with Myers' bit-parallel algorithm which
+ * keeps a whole column of the edit distance matrix in a 64-bit word.
+ */
+#define PS_MAX_PRIMER_LENGTH (64)
+
+
+typedef struct Primer
+{
+	char *pr_name_s;
+
+	/* The bases in upper case, which can include IUPAC codes */
+	char *pr_bases_s;
+
+	uint32 pr_length;
+
+	/* 1 for a palindromic primer, 2 otherwise */
+	uint32 pr_num_strands;
+
+	/*
+	 * For each strand, the bit mask of the primer positions that each
+	 * byte of the sequence matches.
+	 */
+	uint64 pr_match_masks [2][256];
+} Primer;
+
+
+typedef struct PrimerHit
+{
+	uint32 ph_primer_index;
+	uint32 ph_edits;
+
+	/* The 0-based position of the last base of the match */
+	uint64 ph_end;
+
+	char ph_strand;
+} PrimerHit;
+
+
+typedef struct PrimerSearchTask
+{
+	IndexData *pst_index_data_p;
+	const char *pst_scaffold_name_s;
+
+	/* The part of the region that this task reports matches ending in */
+	hts_pos_t pst_block_start;
+	hts_pos_t pst_block_end;
+
+	/* The whole region, which bounds how far the task can read either side of its block */
+	hts_pos_t pst_region_start;
+	hts_pos_t pst_region_end;
+
+	PrimerHit *pst_hits_p;
+	size_t pst_num_hits;
+	size_t pst_max_hits;
+	bool pst_truncated_flag;
+} PrimerSearchTask;
+
+
+typedef struct PrimerSearch
+{
+	Primer *ps_primers_p;
+	uint32 ps_num_primers;
+	uint32 ps_max_primer_length;
+	uint32 ps_max_edits;
+	uint32 ps_max_hits;
+
+	PrimerSearchTask *ps_tasks_p;
+	size_t ps_num_tasks;
+	size_t ps_max_tasks;
+} PrimerSearch;
+
+
+static NamedParameterType S_PRIMERS = { "Primers", PT_LARGE_STRING };
+
+static NamedParameterType S_MAX_EDITS = { "Max edits", PT_UNSIGNED_INT };
+
+static NamedParameterType S_MAX_PRIMER_HITS = { "Max primer hits", PT_UNSIGNED_INT };
+
+
+static const uint32 S_DEFAULT_MAX_EDITS = 2;
+
+static const uint32 S_DEFAULT_MAX_PRIMER_HITS = 100000;
+
+/*
+ * Each task searches this many bases of a scaffold, reading enough
+ * either side to find the matches that span its ends.
+ */
+static const hts_pos_t S_BLOCK_SIZE = 1 << 22;
+
+static const char * const S_PRIMER_SEPARATORS_S = ",;\r\n";
+
+static const char * const S_NAME_SEPARATORS_S = " \t";
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool ParsePrimers (const char *primers_s, const uint32 max_edits, PrimerSearch *search_p, ServiceJob *job_p);
+
+static bool ParsePrimer (const char *entry_s, const size_t entry_length, const uint32 max_edits, Primer *primer_p, ServiceJob *job_p);
+
+static void SetMatchMasks (uint64 *masks_p, const char *bases_s, const uint32 length);
+
+static bool AddIndexTasks (PrimerSearch *search_p, IndexData *index_data_p, const char *region_s, bool *found_flag_p);
+
+static bool AddSearchTask (PrimerSearch *search_p, IndexData *index_data_p, const char *scaffold_name_s, const hts_pos_t start, const hts_pos_t end);
+
+static bool SearchPrimerBlock (const size_t task_index, void *data_p);
+
+static bool SearchPrimerStrand (PrimerSearchTask *task_p, const PrimerSearch *search_p, const uint32 primer_index, const uint32 strand, const char *sequence_s, const size_t length, const size_t own_start, const size_t own_end, const uint64 offset);
+
+static bool AddPrimerHit (PrimerSearchTask *task_p, const PrimerSearch *search_p, const uint32 primer_index, const char strand, const uint64 end, const uint32 edits);
+
+static int ComparePrimerHits (const void *v0_p, const void *v1_p);
+
+static json_t *GetPrimerHitsAsJSON (const PrimerSearch *search_p, bool *complete_flag_p);
+
+static const char *GetIndexName (const IndexData *index_data_p);
+
+static void ClearPrimerSearch (PrimerSearch *search_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool AddPrimerSearchParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	return ((EasyCreateAndAddStringParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_PRIMERS.npt_type, S_PRIMERS.npt_name_s, "Primers", "The primers to search for, separated by commas or newlines. Each can be given a name before it, separated by a space, e.g. gapdh_f ACCTTGGCCAAGGTCATCCA. IUPAC codes can be used for degenerate bases.", NULL, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MAX_EDITS.npt_name_s, "Max edits", "The maximum number of mismatches, insertions and deletions for a primer match", &S_DEFAULT_MAX_EDITS, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MAX_PRIMER_HITS.npt_name_s, "Max primer hits", "The search stops after this many matches", &S_DEFAULT_MAX_PRIMER_HITS, PL_ADVANCED) != NULL));
+}
+
+
+bool GetPrimerSearchParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_PRIMERS.npt_name_s) == 0)
+		{
+			*pt_p = S_PRIMERS.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MAX_EDITS.npt_name_s) == 0)
+		{
+			*pt_p = S_MAX_EDITS.npt_type;
+		}
+	else if (strcmp (param_name_s, S_MAX_PRIMER_HITS.npt_name_s) == 0)
+		{
+			*pt_p = S_MAX_PRIMER_HITS.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+void RunPrimerSearchJob (Service *service_p, ParameterSet *param_set_p)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	const bool *all_indexes_flag_p = NULL;
+	const bool all_indexes_flag = (GetCurrentBooleanParameterValueFromParameterSet (param_set_p, SS_ALL_INDEXES.npt_name_s, &all_indexes_flag_p) && all_indexes_flag_p) ? *all_indexes_flag_p : false;
+	IndexData *index_data_p = all_indexes_flag ? NULL : GetSelectedIndexData (data_p, param_set_p);
+	const char *region_s = NULL;
+	const char *primers_s = NULL;
+
+	if ((all_indexes_flag || (index_data_p && (index_data_p -> id_fasta_filename_s))) &&
+		GetCurrentStringParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD.npt_name_s, &region_s) && region_s &&
+		GetCurrentStringParameterValueFromParameterSet (param_set_p, S_PRIMERS.npt_name_s, &primers_s) && primers_s)
+		{
+			ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, region_s, index_data_p ? index_data_p -> id_fasta_filename_s : "All indexes", NULL, NULL, NULL);
+
+			if (job_p)
+				{
+					const uint32 *max_edits_p = NULL;
+					const uint32 *max_hits_p = NULL;
+					PrimerSearch search;
+
+					memset (&search, 0, sizeof (PrimerSearch));
+					search.ps_max_edits = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MAX_EDITS.npt_name_s, &max_edits_p) && max_edits_p) ? *max_edits_p : S_DEFAULT_MAX_EDITS;
+					search.ps_max_hits = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_MAX_PRIMER_HITS.npt_name_s, &max_hits_p) && max_hits_p && (*max_hits_p > 0)) ? *max_hits_p : S_DEFAULT_MAX_PRIMER_HITS;
+
+					LogParameterSet (param_set_p, job_p);
+
+					SetServiceJobStatus (job_p, OS_STARTED);
+					LogServiceJob (job_p);
+
+					/* Assume failure */
+					SetServiceJobStatus (job_p, OS_FAILED);
+
+					if (ParsePrimers (primers_s, search.ps_max_edits, &search, job_p))
+						{
+							bool success_flag = true;
+							bool found_flag = false;
+
+							if (index_data_p)
+								{
+									success_flag = AddIndexTasks (&search, index_data_p, region_s, &found_flag);
+								}
+							else
+								{
+									size_t i;
+
+									/* Each index is searched for the region and those without it are skipped */
+									for (i = 0; (i < data_p -> stsd_index_data_size) && success_flag; ++ i)
+										{
+											IndexData *current_index_p = data_p -> stsd_index_data_p + i;
+
+											if (current_index_p -> id_fasta_filename_s)
+												{
+													success_flag = AddIndexTasks (&search, current_index_p, region_s, &found_flag);
+												}
+										}
+								}
+
+							if (success_flag && found_flag)
+								{
+									if (RunWorkerPool (search.ps_num_tasks, data_p -> stsd_num_threads, SearchPrimerBlock, &search))
+										{
+											bool complete_flag = true;
+											json_t *result_p = GetPrimerHitsAsJSON (&search, &complete_flag);
+
+											if (result_p)
+												{
+													if (AddInlineResultToServiceJob (job_p, "primer_hits", result_p))
+														{
+															if (complete_flag)
+																{
+																	SetServiceJobStatus (job_p, OS_SUCCEEDED);
+																}
+															else
+																{
+																	AddGeneralErrorMessageToServiceJob (job_p, "Stopped after reaching Max primer hits");
+																	SetServiceJobStatus (job_p, OS_PARTIALLY_SUCCEEDED);
+																}
+														}
+
+													json_decref (result_p);
+												}
+										}
+									else
+										{
+											AddGeneralErrorMessageToServiceJob (job_p, "Failed to search for the primers");
+										}
+								}
+							else if (success_flag)
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "Unknown region");
+								}
+							else
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "Failed to split the search into blocks");
+								}
+						}
+
+					ClearPrimerSearch (&search);
+
+					LogServiceJob (job_p);
+				}		/* if (job_p) */
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get a FASTA file, region and primers for the primer search");
+		}
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static bool ParsePrimers (const char *primers_s, const uint32 max_edits, PrimerSearch *search_p, ServiceJob *job_p)
+{
+	const char *start_p = primers_s;
+	size_t max_primers = 1;
+
+	/* There can't be more primers than there are separators plus one */
+	while ((start_p = strpbrk (start_p, S_PRIMER_SEPARATORS_S)) != NULL)
+		{
+			++ max_primers;
+			++ start_p;
+		}
+
+	if ((search_p -> ps_primers_p = (Primer *) AllocMemoryArray (sizeof (Primer), max_primers)) != NULL)
+		{
+			start_p = primers_s;
+
+			while (*start_p)
+				{
+					const size_t length = strcspn (start_p, S_PRIMER_SEPARATORS_S);
+
+					if (length > 0)
+						{
+							Primer *primer_p = search_p -> ps_primers_p + search_p -> ps_num_primers;
+							const size_t spaces = strspn (start_p, S_NAME_SEPARATORS_S);
+
+							/* Skip blank entries */
+							if (spaces < length)
+								{
+									if (!ParsePrimer (start_p + spaces, length - spaces, max_edits, primer_p, job_p))
+										{
+											return false;
+										}
+
+									if (primer_p -> pr_length > search_p -> ps_max_primer_length)
+										{
+											search_p -> ps_max_primer_length = primer_p -> pr_length;
+										}
+
+									++ (search_p -> ps_num_primers);
+								}
+						}
+
+					start_p += length;
+
+					if (*start_p)
+						{
+							++ start_p;
+						}
+				}
+
+			if (search_p -> ps_num_primers > 0)
+				{
+					return true;
+				}
+
+			AddGeneralErrorMessageToServiceJob (job_p, "No primers were given");
+		}
+
+	return false;
+}
+
+
+static bool ParsePrimer (const char *entry_s, const size_t entry_length, const uint32 max_edits, Primer *primer_p, ServiceJob *job_p)
+{
+	const char *error_s = NULL;
+	const char *bases_p = entry_s;
+	size_t length = entry_length;
+	size_t name_length = strcspn (entry_s, S_NAME_SEPARATORS_S);
+
+	/* Trim any trailing whitespace */
+	while ((length > 0) && (strchr (S_NAME_SEPARATORS_S, entry_s [length - 1])))
+		{
+			-- length;
+		}
+
+	if (name_length < length)
+		{
+			bases_p = entry_s + name_length;
+			bases_p += strspn (bases_p, S_NAME_SEPARATORS_S);
+			length -= (bases_p - entry_s);
+		}
+	else
+		{
+			name_length = length;
+		}
+
+	memset (primer_p, 0, sizeof (Primer));
+
+	primer_p -> pr_name_s = CopyToNewString (entry_s, name_length, false);
+	primer_p -> pr_bases_s = (char *) AllocMemory (length + 1);
+
+	if ((primer_p -> pr_name_s) && (primer_p -> pr_bases_s))
+		{
+			size_t i;
+
+			for (i = 0; i < length; ++ i)
+				{
+					primer_p -> pr_bases_s [i] = (char) toupper (bases_p [i]);
+
+					if (!GetIUPACBases (primer_p -> pr_bases_s [i]))
+						{
+							error_s = " contains bases that are not IUPAC codes";
+						}
+				}
+
+			primer_p -> pr_bases_s [length] = '\0';
+			primer_p -> pr_length = (uint32) length;
+
+			if (!error_s)
+				{
+					if (length > PS_MAX_PRIMER_LENGTH)
+						{
+							error_s = " is longer than 64 bases";
+						}
+					else if (length <= max_edits)
+						{
+							error_s = " is not longer than Max edits";
+						}
+				}
+
+			if (!error_s)
+				{
+					char *reverse_s = (char *) AllocMemory (length + 1);
+
+					if (reverse_s)
+						{
+							ReverseComplementSequence (reverse_s, primer_p -> pr_bases_s, length);
+							reverse_s [length] = '\0';
+
+							SetMatchMasks (primer_p -> pr_match_masks [0], primer_p -> pr_bases_s, primer_p -> pr_length);
+							primer_p -> pr_num_strands = 1;
+
+							/* A palindromic primer would find each site twice */
+							if (strcmp (reverse_s, primer_p -> pr_bases_s) != 0)
+								{
+									SetMatchMasks (primer_p -> pr_match_masks [1], reverse_s, primer_p -> pr_length);
+									primer_p -> pr_num_strands = 2;
+								}
+
+							FreeMemory (reverse_s);
+
+							return true;
+						}
+				}
+			else
+				{
+					char *message_s = ConcatenateVarargsStrings ("Primer ", primer_p -> pr_name_s, error_s, NULL);
+
+					AddGeneralErrorMessageToServiceJob (job_p, message_s ? message_s : "Invalid primer");
+
+					if (message_s)
+						{
+							FreeCopiedString (message_s);
+						}
+				}
+		}
+
+	/* The primer hasn't been counted so its strings have to be freed here */
+	if (primer_p -> pr_bases_s)
+		{
+			FreeMemory (primer_p -> pr_bases_s);
+		}
+
+	if (primer_p -> pr_name_s)
+		{
+			FreeCopiedString (primer_p -> pr_name_s);
+		}
+
+	return false;
+}
+
+
+static void SetMatchMasks (uint64 *masks_p, const char *bases_s, const uint32 length)
+{
+	uint32 i;
+
+	memset (masks_p, 0, 256 * sizeof (uint64));
+
+	for (i = 0; i < length; ++ i)
+		{
+			const char *matches_s = GetIUPACBases (bases_s [i]);
+
+			while (*matches_s)
+				{
+					const uint64 bit = ((uint64) 1) << i;
+
+					/* Soft-masked bases match too */
+					masks_p [(unsigned char) *matches_s] |= bit;
+					masks_p [(unsigned char) tolower (*matches_s)] |= bit;
+
+					++ matches_s;
+				}
+		}
+}
+
+
+static bool AddIndexTasks (PrimerSearch *search_p, IndexData *index_data_p, const char *region_s, bool *found_flag_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (region_s, "*") == 0)
+		{
+			faidx_t *fai_p = LockIndexFaidx (index_data_p);
+
+			if (fai_p)
+				{
+					const int num_seqs = faidx_nseq (fai_p);
+					int i;
+
+					for (i = 0; (i < num_seqs) && success_flag; ++ i)
+						{
+							/* The names belong to the index, which stays open, so the tasks can keep them */
+							const char *name_s = faidx_iseq (fai_p, i);
+
+							success_flag = AddSearchTask (search_p, index_data_p, name_s, 0, faidx_seq_len64 (fai_p, name_s));
+						}
+
+					UnlockIndexFaidx (index_data_p);
+
+					*found_flag_p = true;
+				}
+			else
+				{
+					success_flag = false;
+				}
+		}
+	else
+		{
+			IndexRegion region;
+
+			if (ParseIndexRegion (index_data_p, region_s, &region))
+				{
+					success_flag = AddSearchTask (search_p, index_data_p, region.ir_scaffold_name_s, region.ir_start, region.ir_end);
+					*found_flag_p = true;
+				}
+		}
+
+	return success_flag;
+}
+
+
+static bool AddSearchTask (PrimerSearch *search_p, IndexData *index_data_p, const char *scaffold_name_s, const hts_pos_t start, const hts_pos_t end)
+{
+	hts_pos_t block_start;
+
+	for (block_start = start; block_start < end; block_start += S_BLOCK_SIZE)
+		{
+			PrimerSearchTask *task_p;
+
+			if (search_p -> ps_num_tasks == search_p -> ps_max_tasks)
+				{
+					const size_t new_max = (search_p -> ps_max_tasks > 0) ? (search_p -> ps_max_tasks << 1) : 256;
+					PrimerSearchTask *tasks_p = (search_p -> ps_tasks_p) ?
+						(PrimerSearchTask *) ReallocMemory (search_p -> ps_tasks_p, new_max * sizeof (PrimerSearchTask), (search_p -> ps_max_tasks) * sizeof (PrimerSearchTask)) :
+						(PrimerSearchTask *) AllocMemoryArray (sizeof (PrimerSearchTask), new_max);
+
+					if (!tasks_p)
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " primer search tasks", new_max);
+							return false;
+						}
+
+					search_p -> ps_tasks_p = tasks_p;
+					search_p -> ps_max_tasks = new_max;
+				}
+
+			task_p = search_p -> ps_tasks_p + search_p -> ps_num_tasks;
+			memset (task_p, 0, sizeof (PrimerSearchTask));
+
+			task_p -> pst_index_data_p = index_data_p;
+			task_p -> pst_scaffold_name_s = scaffold_name_s;
+			task_p -> pst_block_start = block_start;
+			task_p -> pst_block_end = (end - block_start < S_BLOCK_SIZE) ? end : block_start + S_BLOCK_SIZE;
+			task_p -> pst_region_start = start;
+			task_p -> pst_region_end = end;
+
+			++ (search_p -> ps_num_tasks);
+		}
+
+	return true;
+}
+
+
+static bool SearchPrimerBlock (const size_t task_index, void *data_p)
+{
+	const PrimerSearch *search_p = (const PrimerSearch *) data_p;
+	PrimerSearchTask *task_p = search_p -> ps_tasks_p + task_index;
+
+	/*
+	 * A match spans at most this many bases, so reading this far before the block
+	 * gets the edit distances right from its first base, and this far after it
+	 * lets a run of matches that starts in the block be followed to its end.
+	 */
+	const hts_pos_t margin = (hts_pos_t) (search_p -> ps_max_primer_length + search_p -> ps_max_edits);
+	const hts_pos_t fetch_start = (task_p -> pst_block_start - task_p -> pst_region_start > margin) ? task_p -> pst_block_start - margin : task_p -> pst_region_start;
+	const hts_pos_t fetch_end = (task_p -> pst_region_end - task_p -> pst_block_end > margin) ? task_p -> pst_block_end + margin : task_p -> pst_region_end;
+	bool success_flag = false;
+	hts_pos_t length = 0;
+	char *sequence_s = FetchIndexSequence (task_p -> pst_index_data_p, task_p -> pst_scaffold_name_s, fetch_start, fetch_end, &length);
+
+	if (sequence_s)
+		{
+			const size_t own_start = (size_t) (task_p -> pst_block_start - fetch_start);
+			const size_t own_end = (size_t) (task_p -> pst_block_end - fetch_start);
+			uint32 i;
+
+			success_flag = true;
+
+			for (i = 0; (i < search_p -> ps_num_primers) && success_flag && ! (task_p -> pst_truncated_flag); ++ i)
+				{
+					uint32 j;
+
+					for (j = 0; (j < search_p -> ps_primers_p [i].pr_num_strands) && success_flag && ! (task_p -> pst_truncated_flag); ++ j)
+						{
+							success_flag = SearchPrimerStrand (task_p, search_p, i, j, sequence_s, (size_t) length, own_start, own_end, (uint64) fetch_start);
+						}
+				}
+
+			free (sequence_s);
+
+			if (task_p -> pst_num_hits > 1)
+				{
+					qsort (task_p -> pst_hits_p, task_p -> pst_num_hits, sizeof (PrimerHit), ComparePrimerHits);
+				}
+		}
+
+	return success_flag;
+}
+
+
+static bool SearchPrimerStrand (PrimerSearchTask *task_p, const PrimerSearch *search_p, const uint32 primer_index, const uint32 strand, const char *sequence_s, const size_t length, const size_t own_start, const size_t own_end, const uint64 offset)
+{
+	const Primer *primer_p = search_p -> ps_primers_p + primer_index;
+	const uint64 *masks_p = primer_p -> pr_match_masks [strand];
+	const uint64 high_bit = ((uint64) 1) << (primer_p -> pr_length - 1);
+	const uint32 max_edits = search_p -> ps_max_edits;
+	const char strand_c = (strand == 0) ? '+' : '-';
+	uint64 positive_vertical = ~((uint64) 0);
+	uint64 negative_vertical = 0;
+	uint32 edits = primer_p -> pr_length;
+	bool run_flag = false;
+	bool owned_flag = false;
+	uint32 best_edits = 0;
+	size_t best_end = 0;
+	size_t i;
+
+	for (i = 0; i < length; ++ i)
+		{
+			const uint64 match_mask = masks_p [(unsigned char) sequence_s [i]];
+			const uint64 vertical = match_mask | negative_vertical;
+			const uint64 horizontal = (((match_mask & positive_vertical) + positive_vertical) ^ positive_vertical) | match_mask;
+			uint64 positive_horizontal = negative_vertical | ~(horizontal | positive_vertical);
+			uint64 negative_horizontal = positive_vertical & horizontal;
+
+			if (positive_horizontal & high_bit)
+				{
+					++ edits;
+				}
+			else if (negative_horizontal & high_bit)
+				{
+					-- edits;
+				}
+
+			/* The top row stays at 0 so that a match can start anywhere */
+			positive_horizontal <<= 1;
+			negative_horizontal <<= 1;
+			positive_vertical = negative_horizontal | ~(vertical | positive_horizontal);
+			negative_vertical = positive_horizontal & vertical;
+
+			/*
+			 * A single site gives a run of neighbouring ends within the limit
+			 * so only the best end of each run is reported. A run belongs to
+			 * the block that it starts in.
+			 */
+			if (edits <= max_edits)
+				{
+					if (!run_flag)
+						{
+							if (i >= own_end)
+								{
+									break;
+								}
+
+							run_flag = true;
+							owned_flag = (i >= own_start);
+							best_edits = edits;
+							best_end = i;
+						}
+					else if (edits < best_edits)
+						{
+							best_edits = edits;
+							best_end = i;
+						}
+				}
+			else if (run_flag)
+				{
+					run_flag = false;
+
+					if (owned_flag && !AddPrimerHit (task_p, search_p, primer_index, strand_c, offset + best_end, best_edits))
+						{
+							/* Reaching the limit stops the search but isn't an error */
+							return (task_p -> pst_truncated_flag);
+						}
+				}
+			else if (i >= own_end)
+				{
+					break;
+				}
+		}
+
+	if (run_flag && owned_flag && !AddPrimerHit (task_p, search_p, primer_index, strand_c, offset + best_end, best_edits))
+		{
+			return (task_p -> pst_truncated_flag);
+		}
+
+	return true;
+}
+
+
+static bool AddPrimerHit (PrimerSearchTask *task_p, const PrimerSearch *search_p, const uint32 primer_index, const char strand, const uint64 end, const uint32 edits)
+{
+	PrimerHit *hit_p;
+
+	/* No single task needs to keep more hits than the whole search can return */
+	if (task_p -> pst_num_hits == search_p -> ps_max_hits)
+		{
+			task_p -> pst_truncated_flag = true;
+			return false;
+		}
+
+	if (task_p -> pst_num_hits == task_p -> pst_max_hits)
+		{
+			const size_t new_max = (task_p -> pst_max_hits > 0) ? (task_p -> pst_max_hits << 1) : 64;
+			PrimerHit *hits_p = (task_p -> pst_hits_p) ?
+				(PrimerHit *) ReallocMemory (task_p -> pst_hits_p, new_max * sizeof (PrimerHit), (task_p -> pst_max_hits) * sizeof (PrimerHit)) :
+				(PrimerHit *) AllocMemoryArray (sizeof (PrimerHit), new_max);
+
+			if (!hits_p)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " primer hits", new_max);
+					return false;
+				}
+
+			task_p -> pst_hits_p = hits_p;
+			task_p -> pst_max_hits = new_max;
+		}
+
+	hit_p = task_p -> pst_hits_p + task_p -> pst_num_hits;
+	hit_p -> ph_primer_index = primer_index;
+	hit_p -> ph_edits = edits;
+	hit_p -> ph_end = end;
+	hit_p -> ph_strand = strand;
+
+	++ (task_p -> pst_num_hits);
+
+	return true;
+}
+
+
+static int ComparePrimerHits (const void *v0_p, const void *v1_p)
+{
+	const PrimerHit *hit0_p = (const PrimerHit *) v0_p;
+	const PrimerHit *hit1_p = (const PrimerHit *) v1_p;
+
+	if (hit0_p -> ph_primer_index != hit1_p -> ph_primer_index)
+		{
+			return (hit0_p -> ph_primer_index < hit1_p -> ph_primer_index) ? -1 : 1;
+		}
+
+	if (hit0_p -> ph_end != hit1_p -> ph_end)
+		{
+			return (hit0_p -> ph_end < hit1_p -> ph_end) ? -1 : 1;
+		}
+
+	return (int) (hit0_p -> ph_strand) - (int) (hit1_p -> ph_strand);
+}
+
+
+static json_t *GetPrimerHitsAsJSON (const PrimerSearch *search_p, bool *complete_flag_p)
+{
+	json_t *result_p = json_pack ("{s:I}", "max_edits", (json_int_t) (search_p -> ps_max_edits));
+	json_t *primers_p = json_array ();
+
+	if (result_p && primers_p && (json_object_set_new (result_p, "primers", primers_p) == 0))
+		{
+			bool success_flag = true;
+			uint32 num_hits = 0;
+			size_t i;
+
+			for (i = 0; (i < search_p -> ps_num_primers) && success_flag; ++ i)
+				{
+					const Primer *primer_p = search_p -> ps_primers_p + i;
+					json_t *primer_json_p = json_pack ("{s:s,s:s,s:[]}", "name", primer_p -> pr_name_s, "primer", primer_p -> pr_bases_s, "hits");
+
+					success_flag = (primer_json_p && (json_array_append_new (primers_p, primer_json_p) == 0));
+				}
+
+			/* The tasks are in index, scaffold and position order so the hits are too */
+			for (i = 0; (i < search_p -> ps_num_tasks) && success_flag; ++ i)
+				{
+					const PrimerSearchTask *task_p = search_p -> ps_tasks_p + i;
+					const char *index_name_s = GetIndexName (task_p -> pst_index_data_p);
+					size_t j;
+
+					if (task_p -> pst_truncated_flag)
+						{
+							*complete_flag_p = false;
+						}
+
+					for (j = 0; (j < task_p -> pst_num_hits) && success_flag; ++ j)
+						{
+							const PrimerHit *hit_p = task_p -> pst_hits_p + j;
+
+							if (num_hits < search_p -> ps_max_hits)
+								{
+									json_t *hits_p = json_object_get (json_array_get (primers_p, hit_p -> ph_primer_index), "hits");
+									json_t *hit_json_p = json_pack ("{s:s,s:s,s:s,s:I,s:I}", "index", index_name_s, "scaffold", task_p -> pst_scaffold_name_s, "strand", (hit_p -> ph_strand == '+') ? "+" : "-", "end", (json_int_t) (hit_p -> ph_end + 1), "edits", (json_int_t) (hit_p -> ph_edits));
+
+									success_flag = (hit_json_p && (json_array_append_new (hits_p, hit_json_p) == 0));
+									++ num_hits;
+								}
+							else
+								{
+									*complete_flag_p = false;
+								}
+						}
+				}
+
+			if (success_flag)
+				{
+					return result_p;
+				}
+		}
+	else if (primers_p)
+		{
+			json_decref (primers_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create the primer search results");
+
+	if (result_p)
+		{
+			json_decref (result_p);
+		}
+
+	return NULL;
+}
+
+
+static const char *GetIndexName (const IndexData *index_data_p)
+{
+	return (index_data_p -> id_blast_db_name_s) ? index_data_p -> id_blast_db_name_s : index_data_p -> id_fasta_filename_s;
+}
+
+
+static void ClearPrimerSearch (PrimerSearch *search_p)
+{
+	if (search_p -> ps_primers_p)
+		{
+			uint32 i;
+
+			for (i = 0; i < search_p -> ps_num_primers; ++ i)
+				{
+					FreeCopiedString (search_p -> ps_primers_p [i].pr_name_s);
+					FreeMemory (search_p -> ps_primers_p [i].pr_bases_s);
+				}
+
+			FreeMemory (search_p -> ps_primers_p);
+			search_p -> ps_primers_p = NULL;
+		}
+
+	if (search_p -> ps_tasks_p)
+		{
+			size_t i;
+
+			for (i = 0; i < search_p -> ps_num_tasks; ++ i)
+				{
+					if (search_p -> ps_tasks_p [i].pst_hits_p)
+						{
+							FreeMemory (search_p -> ps_tasks_p [i].pst_hits_p);
+						}
+				}
+
+			FreeMemory (search_p -> ps_tasks_p);
+			search_p -> ps_tasks_p = NULL;
+		}
+
+	search_p -> ps_num_primers = 0;
+	search_p -> ps_num_tasks = 0;
+}
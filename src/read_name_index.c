@@ -0,0 +1,375 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * read_name_index.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "read_name_index.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "streams.h"
+
+#include "htslib/bgzf.h"
+
+
+#ifdef _DEBUG
+	#define READ_NAME_INDEX_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define READ_NAME_INDEX_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * The start of each index file.
+ */
+typedef struct ReadNameIndexHeader
+{
+	char rnih_magic [8];
+	uint64 rnih_num_entries;
+} ReadNameIndexHeader;
+
+
+static const char * const S_INDEX_SUFFIX_S = ".rni";
+
+static const char S_INDEX_MAGIC [8] = { 'S', 'T', 'R', 'N', 'I', 'D', 'X', '1' };
+
+/*
+ * Secondary and supplementary records are left out of the index since
+ * it is only used to find the primary record of a mate.
+ */
+static const uint16 S_NON_PRIMARY_FLAGS = BAM_FSECONDARY | BAM_FSUPPLEMENTARY;
+
+static const size_t S_INITIAL_NUM_ENTRIES = 1 << 20;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool BuildReadNameIndex (const char *filename_s, const char *index_filename_s, volatile bool *stop_flag_p);
+
+static bool MapReadNameIndex (ReadNameIndex *index_p, const char *index_filename_s);
+
+static uint64 HashReadName (const char *name_s);
+
+static int CompareReadNameEntries (const void *v0_p, const void *v1_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool BuildReadNameIndexSidecar (const char *filename_s, const char *sidecar_directory_s, volatile bool *stop_flag_p)
+{
+	bool success_flag = false;
+	char *index_filename_s = MakeSidecarFilename (sidecar_directory_s, filename_s, S_INDEX_SUFFIX_S);
+
+	if (index_filename_s)
+		{
+			success_flag = (IsSidecarFileUpToDate (index_filename_s, filename_s)) || (BuildReadNameIndex (filename_s, index_filename_s, stop_flag_p));
+
+			FreeCopiedString (index_filename_s);
+		}
+
+	return success_flag;
+}
+
+
+ReadNameIndex *LoadReadNameIndex (const char *filename_s, const char *sidecar_directory_s)
+{
+	char *index_filename_s = MakeSidecarFilename (sidecar_directory_s, filename_s, S_INDEX_SUFFIX_S);
+
+	if (index_filename_s)
+		{
+			ReadNameIndex *index_p = NULL;
+
+			/* Until the background builder has written it, there is no index */
+			if (IsSidecarFileUpToDate (index_filename_s, filename_s))
+				{
+					index_p = (ReadNameIndex *) AllocMemory (sizeof (ReadNameIndex));
+
+					if (index_p)
+						{
+							if (!MapReadNameIndex (index_p, index_filename_s))
+								{
+									FreeMemory (index_p);
+									index_p = NULL;
+								}
+						}
+				}
+
+			FreeCopiedString (index_filename_s);
+
+			return index_p;
+		}
+
+	return NULL;
+}
+
+
+void FreeReadNameIndex (ReadNameIndex *index_p)
+{
+	CloseMappedFile (& (index_p -> rni_file));
+	FreeMemory (index_p);
+}
+
+
+bool FindMateByName (const ReadNameIndex *index_p, htsFile *file_p, sam_hdr_t *header_p, const bam1_t *read_p, bam1_t *mate_p)
+{
+	const char *name_s = bam_get_qname (read_p);
+	const uint64 hash = HashReadName (name_s);
+	const uint16 mate_flag = (read_p -> core.flag & BAM_FREAD1) ? BAM_FREAD2 : BAM_FREAD1;
+	size_t lo = 0;
+	size_t hi = index_p -> rni_num_entries;
+
+	/* Find the first entry with the matching hash */
+	while (lo < hi)
+		{
+			const size_t mid = lo + ((hi - lo) >> 1);
+
+			if (index_p -> rni_entries_p [mid].rne_hash < hash)
+				{
+					lo = mid + 1;
+				}
+			else
+				{
+					hi = mid;
+				}
+		}
+
+	/* There can be more than one entry for a hash so check each of them */
+	while ((lo < index_p -> rni_num_entries) && (index_p -> rni_entries_p [lo].rne_hash == hash))
+		{
+			if (bgzf_seek (file_p -> fp.bgzf, (int64) (index_p -> rni_entries_p [lo].rne_offset), SEEK_SET) == 0)
+				{
+					if (sam_read1 (file_p, header_p, mate_p) >= 0)
+						{
+							if (((mate_p -> core.flag & mate_flag) != 0) && (strcmp (bam_get_qname (mate_p), name_s) == 0))
+								{
+									return true;
+								}
+						}
+				}
+
+			++ lo;
+		}
+
+	return false;
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static bool BuildReadNameIndex (const char *filename_s, const char *index_filename_s, volatile bool *stop_flag_p)
+{
+	bool success_flag = false;
+	htsFile *file_p = sam_open (filename_s, "r");
+
+	#if READ_NAME_INDEX_DEBUG >= STM_LEVEL_FINE
+	PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "BuildReadNameIndex - building %s", index_filename_s);
+	#endif
+
+	if (file_p)
+		{
+			if (hts_get_format (file_p) -> format == bam)
+				{
+					sam_hdr_t *header_p = sam_hdr_read (file_p);
+
+					if (header_p)
+						{
+							bam1_t *read_p = bam_init1 ();
+							size_t max_num_entries = S_INITIAL_NUM_ENTRIES;
+							ReadNameEntry *entries_p = (ReadNameEntry *) AllocMemoryArray (sizeof (ReadNameEntry), max_num_entries);
+
+							if (read_p && entries_p)
+								{
+									size_t num_entries = 0;
+									int64 offset = bgzf_tell (file_p -> fp.bgzf);
+									int res;
+
+									success_flag = true;
+
+									while (success_flag && (! (*stop_flag_p)) && ((res = sam_read1 (file_p, header_p, read_p)) >= 0))
+										{
+											if ((read_p -> core.flag & S_NON_PRIMARY_FLAGS) == 0)
+												{
+													if (num_entries == max_num_entries)
+														{
+															ReadNameEntry *new_entries_p = (ReadNameEntry *) ReallocMemory (entries_p, 2 * max_num_entries * sizeof (ReadNameEntry), max_num_entries * sizeof (ReadNameEntry));
+
+															if (new_entries_p)
+																{
+																	entries_p = new_entries_p;
+																	max_num_entries <<= 1;
+																}
+															else
+																{
+																	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to grow read name index to " SIZET_FMT " entries", 2 * max_num_entries);
+																	success_flag = false;
+																}
+														}
+
+													if (success_flag)
+														{
+															entries_p [num_entries].rne_hash = HashReadName (bam_get_qname (read_p));
+															entries_p [num_entries].rne_offset = (uint64) offset;
+															++ num_entries;
+														}
+												}
+
+											offset = bgzf_tell (file_p -> fp.bgzf);
+										}
+
+									/* A partial index is just discarded */
+									if (*stop_flag_p)
+										{
+											success_flag = false;
+										}
+
+									if (success_flag)
+										{
+											if (res < -1)
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to read \"%s\"", filename_s);
+													success_flag = false;
+												}
+											else
+												{
+													ReadNameIndexHeader header;
+
+													qsort (entries_p, num_entries, sizeof (ReadNameEntry), CompareReadNameEntries);
+
+													memcpy (header.rnih_magic, S_INDEX_MAGIC, sizeof (S_INDEX_MAGIC));
+													header.rnih_num_entries = num_entries;
+
+													success_flag = WriteSidecarFile (index_filename_s, &header, sizeof (header), entries_p, num_entries * sizeof (ReadNameEntry));
+												}
+										}
+								}
+
+							if (entries_p)
+								{
+									FreeMemory (entries_p);
+								}
+
+							if (read_p)
+								{
+									bam_destroy1 (read_p);
+								}
+
+							sam_hdr_destroy (header_p);
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to read header from \"%s\"", filename_s);
+						}
+				}
+			else
+				{
+					/* The mates can't be looked up by offset in other formats so there is nothing to build */
+					PrintErrors (STM_LEVEL_FINE, __FILE__, __LINE__, "Read name indexes can only be built for BAM files, \"%s\"", filename_s);
+					success_flag = true;
+				}
+
+			sam_close (file_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to open \"%s\"", filename_s);
+		}
+
+	return success_flag;
+}
+
+
+static bool MapReadNameIndex (ReadNameIndex *index_p, const char *index_filename_s)
+{
+	if (OpenMappedFile (& (index_p -> rni_file), index_filename_s))
+		{
+			const ReadNameIndexHeader *header_p = (const ReadNameIndexHeader *) (index_p -> rni_file.mf_data_p);
+
+			if ((index_p -> rni_file.mf_size >= sizeof (ReadNameIndexHeader)) &&
+				(memcmp (header_p -> rnih_magic, S_INDEX_MAGIC, sizeof (S_INDEX_MAGIC)) == 0) &&
+				(index_p -> rni_file.mf_size == sizeof (ReadNameIndexHeader) + (header_p -> rnih_num_entries * sizeof (ReadNameEntry))))
+				{
+					index_p -> rni_entries_p = (const ReadNameEntry *) (header_p + 1);
+					index_p -> rni_num_entries = (size_t) (header_p -> rnih_num_entries);
+
+					return true;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "\"%s\" is not a valid read name index", index_filename_s);
+				}
+
+			CloseMappedFile (& (index_p -> rni_file));
+		}
+
+	return false;
+}
+
+
+/*
+ * 64-bit FNV-1a
+ */
+static uint64 HashReadName (const char *name_s)
+{
+	uint64 hash = 14695981039346656037ULL;
+
+	while (*name_s)
+		{
+			hash ^= (uint8) *name_s;
+			hash *= 1099511628211ULL;
+			++ name_s;
+		}
+
+	return hash;
+}
+
+
+static int CompareReadNameEntries (const void *v0_p, const void *v1_p)
+{
+	const ReadNameEntry *entry0_p = (const ReadNameEntry *) v0_p;
+	const ReadNameEntry *entry1_p = (const ReadNameEntry *) v1_p;
+
+	if (entry0_p -> rne_hash < entry1_p -> rne_hash)
+		{
+			return -1;
+		}
+	else if (entry0_p -> rne_hash > entry1_p -> rne_hash)
+		{
+			return 1;
+		}
+	else if (entry0_p -> rne_offset < entry1_p -> rne_offset)
+		{
+			return -1;
+		}
+	else if (entry0_p -> rne_offset > entry1_p -> rne_offset)
+		{
+			return 1;
+		}
+
+	return 0;
+}
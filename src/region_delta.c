@@ -0,0 +1,337 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * region_delta.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "region_delta.h"
+#include "soft_mask.h"
+#include "low_complexity.h"
+#include "window_prefetch.h"
+#include "memory_allocations.h"
+#include "audit.h"
+
+#include "string_parameter.h"
+
+#include "htslib/hts.h"
+
+
+#ifdef _DEBUG
+	#define REGION_DELTA_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define REGION_DELTA_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * The length of an MD5 digest as a hex string including the terminator.
+ */
+#define RD_MD5_HEX_SIZE (33)
+
+
+static NamedParameterType S_HELD_REGION = { "Held region", PT_STRING };
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool GetSequenceMD5 (const char *sequence_s, const size_t length, char *md5_s);
+
+static json_t *GetRegionDeltaAsJSON (const IndexRegion *region_p, const IndexRegion *held_region_p, char *sequence_s, const hts_pos_t overlap_start, const hts_pos_t overlap_end);
+
+static bool AddSegment (json_t *segments_p, char *sequence_s, const hts_pos_t region_start, const hts_pos_t start, const hts_pos_t end);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool AddRegionDeltaParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	return (EasyCreateAndAddStringParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_HELD_REGION.npt_type, S_HELD_REGION.npt_name_s, "Held region", "The region of the same scaffold that the client already has, e.g. chr1:1000-2000. Only the parts of the requested region outside of it are returned", NULL, PL_ADVANCED) != NULL);
+}
+
+
+bool GetRegionDeltaParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = false;
+
+	if (strcmp (param_name_s, S_HELD_REGION.npt_name_s) == 0)
+		{
+			*pt_p = S_HELD_REGION.npt_type;
+			success_flag = true;
+		}
+
+	return success_flag;
+}
+
+
+bool HasHeldRegion (const ParameterSet *param_set_p)
+{
+	const char *held_region_s = NULL;
+
+	return (GetCurrentStringParameterValueFromParameterSet (param_set_p, S_HELD_REGION.npt_name_s, &held_region_s) && held_region_s && (*held_region_s != '\0'));
+}
+
+
+void RunRegionDeltaJob (Service *service_p, ParameterSet *param_set_p)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	IndexData *index_data_p = GetSelectedIndexData (data_p, param_set_p);
+	const char *region_s = NULL;
+	const char *held_region_s = NULL;
+
+	if (index_data_p && (index_data_p -> id_fasta_filename_s) && GetCurrentStringParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD.npt_name_s, &region_s) && region_s &&
+		GetCurrentStringParameterValueFromParameterSet (param_set_p, S_HELD_REGION.npt_name_s, &held_region_s) && held_region_s)
+		{
+			ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, region_s, index_data_p -> id_fasta_filename_s, NULL, NULL, NULL);
+
+			if (job_p)
+				{
+					const MaskMode mask_mode = GetMaskMode (param_set_p);
+					LowComplexitySettings low_complexity;
+					IndexRegion region;
+					IndexRegion held_region;
+
+					GetLowComplexitySettings (param_set_p, &low_complexity);
+
+					LogParameterSet (param_set_p, job_p);
+
+					SetServiceJobStatus (job_p, OS_STARTED);
+					LogServiceJob (job_p);
+
+					/* Assume failure */
+					SetServiceJobStatus (job_p, OS_FAILED);
+
+					if ((mask_mode == MM_INTERVALS) || (low_complexity.lcs_mode == LC_INTERVALS))
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "A held region can only be used when returning sequence");
+						}
+					else if (low_complexity.lcs_mode != LC_NONE)
+						{
+							/* The low-complexity runs near the ends depend on the window, so the overlap wouldn't match what the client holds */
+							AddGeneralErrorMessageToServiceJob (job_p, "A held region cannot be used with Low complexity masking");
+						}
+					else if (!ParseIndexRegion (index_data_p, region_s, &region))
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "Unknown region");
+						}
+					else if (!ParseIndexRegion (index_data_p, held_region_s, &held_region))
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "Unknown held region");
+						}
+					else
+						{
+							hts_pos_t length = 0;
+
+							/*
+							 * The held part is fetched again rather than skipped so that its digest
+							 * can be given, but a client panning along a scaffold asks for blocks
+							 * that the faidx cache has just read.
+							 */
+							char *sequence_s = FetchIndexSequence (index_data_p, region.ir_scaffold_name_s, region.ir_start, region.ir_end, &length);
+
+							if (index_data_p -> id_prefetcher_p)
+								{
+									PrefetchAdjacentWindow (index_data_p -> id_prefetcher_p, region.ir_scaffold_index, region.ir_start, region.ir_end);
+								}
+
+							if (sequence_s && (length == region.ir_end - region.ir_start))
+								{
+									hts_pos_t overlap_start = region.ir_end;
+									hts_pos_t overlap_end = region.ir_end;
+									json_t *result_p;
+
+									ApplyMaskMode (sequence_s, (size_t) length, mask_mode);
+
+									/* With nothing in common, the whole region is a single new segment */
+									if (held_region.ir_scaffold_index == region.ir_scaffold_index)
+										{
+											const hts_pos_t start = (held_region.ir_start > region.ir_start) ? held_region.ir_start : region.ir_start;
+											const hts_pos_t end = (held_region.ir_end < region.ir_end) ? held_region.ir_end : region.ir_end;
+
+											if (start < end)
+												{
+													overlap_start = start;
+													overlap_end = end;
+												}
+										}
+
+									if ((result_p = GetRegionDeltaAsJSON (&region, &held_region, sequence_s, overlap_start, overlap_end)) != NULL)
+										{
+											if (AddInlineResultToServiceJob (job_p, region_s, result_p))
+												{
+													SetServiceJobStatus (job_p, OS_SUCCEEDED);
+												}
+
+											json_decref (result_p);
+										}
+									else
+										{
+											AddGeneralErrorMessageToServiceJob (job_p, "Failed to create the delta response");
+										}
+								}
+							else
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "Failed to get the sequence for the region");
+								}
+
+							if (sequence_s)
+								{
+									free (sequence_s);
+								}
+						}
+
+					LogServiceJob (job_p);
+				}		/* if (job_p) */
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get a FASTA file, region and held region for the delta response");
+		}
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static bool GetSequenceMD5 (const char *sequence_s, const size_t length, char *md5_s)
+{
+	hts_md5_context *context_p = hts_md5_init ();
+
+	if (context_p)
+		{
+			unsigned char digest [16];
+
+			hts_md5_update (context_p, sequence_s, (unsigned long) length);
+			hts_md5_final (digest, context_p);
+			hts_md5_hex (md5_s, digest);
+			hts_md5_destroy (context_p);
+
+			return true;
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create MD5 context");
+	return false;
+}
+
+
+/*
+ * The digests are of the sequence exactly as it would have been returned
+ * without line breaks, so the client can check the part it keeps against
+ * "held.md5" and the assembled region against "md5".
+ */
+static json_t *GetRegionDeltaAsJSON (const IndexRegion *region_p, const IndexRegion *held_region_p, char *sequence_s, const hts_pos_t overlap_start, const hts_pos_t overlap_end)
+{
+	const size_t length = (size_t) (region_p -> ir_end - region_p -> ir_start);
+	json_t *result_p = NULL;
+	json_t *segments_p = json_array ();
+	char md5_s [RD_MD5_HEX_SIZE];
+
+	if (segments_p && GetSequenceMD5 (sequence_s, length, md5_s))
+		{
+			bool success_flag = true;
+
+			if (overlap_start < overlap_end)
+				{
+					success_flag = AddSegment (segments_p, sequence_s, region_p -> ir_start, region_p -> ir_start, overlap_start) &&
+						AddSegment (segments_p, sequence_s, region_p -> ir_start, overlap_end, region_p -> ir_end);
+				}
+			else
+				{
+					success_flag = AddSegment (segments_p, sequence_s, region_p -> ir_start, region_p -> ir_start, region_p -> ir_end);
+				}
+
+			if (success_flag)
+				{
+					result_p = json_pack ("{s:s,s:I,s:I,s:s,s:o}",
+						"scaffold", region_p -> ir_scaffold_name_s,
+						"start", (json_int_t) (region_p -> ir_start + 1),
+						"end", (json_int_t) (region_p -> ir_end),
+						"md5", md5_s,
+						"segments", segments_p);
+
+					/* json_pack takes the array with "o" even if it fails */
+					segments_p = NULL;
+
+					if (result_p && (overlap_start < overlap_end))
+						{
+							char held_md5_s [RD_MD5_HEX_SIZE];
+							json_t *held_p = NULL;
+
+							if (GetSequenceMD5 (sequence_s + (overlap_start - region_p -> ir_start), (size_t) (overlap_end - overlap_start), held_md5_s))
+								{
+									held_p = json_pack ("{s:s,s:I,s:I,s:s}",
+										"scaffold", held_region_p -> ir_scaffold_name_s,
+										"start", (json_int_t) (overlap_start + 1),
+										"end", (json_int_t) overlap_end,
+										"md5", held_md5_s);
+								}
+
+							if (!held_p || (json_object_set_new (result_p, "held", held_p) != 0))
+								{
+									json_decref (result_p);
+									result_p = NULL;
+								}
+						}
+				}
+		}
+
+	if (!result_p)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create the delta response for %s:%" PRIhts_pos "-%" PRIhts_pos, region_p -> ir_scaffold_name_s, region_p -> ir_start + 1, region_p -> ir_end);
+		}
+
+	if (segments_p)
+		{
+			json_decref (segments_p);
+		}
+
+	return result_p;
+}
+
+
+/*
+ * Empty segments are skipped. The sequence is terminated at the end of the
+ * segment while it is copied and then put back.
+ */
+static bool AddSegment (json_t *segments_p, char *sequence_s, const hts_pos_t region_start, const hts_pos_t start, const hts_pos_t end)
+{
+	bool success_flag = true;
+
+	if (start < end)
+		{
+			char *end_p = sequence_s + (end - region_start);
+			const char c = *end_p;
+			json_t *segment_p;
+
+			*end_p = '\0';
+			segment_p = json_pack ("{s:I,s:I,s:s}", "start", (json_int_t) (start + 1), "end", (json_int_t) end, "sequence", sequence_s + (start - region_start));
+			*end_p = c;
+
+			success_flag = (segment_p != NULL) && (json_array_append_new (segments_p, segment_p) == 0);
+		}
+
+	return success_flag;
+}
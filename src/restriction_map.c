@@ -0,0 +1,1098 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * restriction_map.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "restriction_map.h"
+#include "aho_corasick.h"
+#include "worker_pool.h"
+#include "fasta_utils.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "json_util.h"
+#include "audit.h"
+
+#include "string_parameter.h"
+#include "unsigned_int_parameter.h"
+#include "boolean_parameter.h"
+
+
+#ifdef _DEBUG
+	#define RESTRICTION_MAP_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define RESTRICTION_MAP_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+typedef struct RestrictionEnzyme
+{
+	char *re_name_s;
+
+	/* The site as it was configured, including the ^ */
+	char *re_site_s;
+} RestrictionEnzyme;
+
+
+/*
+ * One of the non-degenerate strings that an enzyme recognises on
+ * either strand. These are indexed by the automaton's pattern indexes.
+ */
+typedef struct RestrictionSite
+{
+	uint32 rs_enzyme_index;
+
+	/* Where the top strand is cut, relative to the start of the match */
+	uint32 rs_cut_offset;
+} RestrictionSite;
+
+
+struct RestrictionEnzymeSet
+{
+	RestrictionEnzyme *res_enzymes_p;
+	uint32 res_num_enzymes;
+
+	RestrictionSite *res_sites_p;
+	uint32 res_max_sites;
+
+	uint32 res_max_site_length;
+
+	AhoCorasickAutomaton *res_automaton_p;
+};
+
+
+typedef struct CutList
+{
+	uint64 *cl_positions_p;
+	size_t cl_num_positions;
+	size_t cl_max_positions;
+} CutList;
+
+
+typedef struct RestrictionMapper
+{
+	const RestrictionEnzymeSet *rm_enzymes_p;
+	const bool *rm_selected_p;
+	IndexData *rm_index_data_p;
+	const IndexRegion *rm_region_p;
+
+	/* The cuts found in each block, with an entry for each enzyme per block */
+	CutList *rm_cuts_p;
+} RestrictionMapper;
+
+
+typedef struct BlockScan
+{
+	const RestrictionMapper *bs_mapper_p;
+	CutList *bs_cuts_p;
+	uint64 bs_offset;
+
+	/* Only matches starting before this belong to the block, the rest are in the overlap */
+	size_t bs_num_starts;
+
+	bool bs_success_flag;
+} BlockScan;
+
+
+static NamedParameterType S_ENZYMES = { "Enzymes", PT_STRING };
+
+static NamedParameterType S_FRAGMENT_BIN_SIZE = { "Fragment bin size", PT_UNSIGNED_INT };
+
+static NamedParameterType S_CUT_POSITIONS = { "Cut positions", PT_BOOLEAN };
+
+
+static const uint32 S_DEFAULT_FRAGMENT_BIN_SIZE = 100;
+
+/*
+ * The most bins that a fragment size histogram can have. If the
+ * region is too long for the requested bin size, the bins are
+ * widened to fit.
+ */
+static const uint64 S_MAX_NUM_FRAGMENT_BINS = 100000;
+
+/*
+ * Each task scans this many bases, plus enough of the next block
+ * to find the sites that span the join.
+ */
+static const hts_pos_t S_BLOCK_SIZE = 1 << 22;
+
+/*
+ * The limit on the number of distinct strings that a single degenerate
+ * site can expand to, which is N6 or thereabouts.
+ */
+static const size_t S_MAX_SITE_EXPANSIONS = 4096;
+
+static const size_t S_INITIAL_NUM_CUTS = 1024;
+
+static const char * const S_ENZYME_SEPARATORS_S = " \t\r\n,;";
+
+
+/*
+ * The enzymes used when none are configured.
+ */
+static const char * const S_DEFAULT_ENZYMES_SS [][2] =
+{
+	{ "AluI", "AG^CT" },
+	{ "ApeKI", "G^CWGC" },
+	{ "AseI", "AT^TAAT" },
+	{ "AvaII", "G^GWCC" },
+	{ "BamHI", "G^GATCC" },
+	{ "BglII", "A^GATCT" },
+	{ "ClaI", "AT^CGAT" },
+	{ "DpnII", "^GATC" },
+	{ "EcoRI", "G^AATTC" },
+	{ "EcoRV", "GAT^ATC" },
+	{ "HaeIII", "GG^CC" },
+	{ "HindIII", "A^AGCTT" },
+	{ "HinfI", "G^ANTC" },
+	{ "KpnI", "GGTAC^C" },
+	{ "MluI", "A^CGCGT" },
+	{ "MseI", "T^TAA" },
+	{ "MspI", "C^CGG" },
+	{ "NcoI", "C^CATGG" },
+	{ "NdeI", "CA^TATG" },
+	{ "NheI", "G^CTAGC" },
+	{ "NotI", "GC^GGCCGC" },
+	{ "NsiI", "ATGCA^T" },
+	{ "PstI", "CTGCA^G" },
+	{ "PvuII", "CAG^CTG" },
+	{ "SacI", "GAGCT^C" },
+	{ "SalI", "G^TCGAC" },
+	{ "Sau96I", "G^GNCC" },
+	{ "SbfI", "CCTGCA^GG" },
+	{ "ScaI", "AGT^ACT" },
+	{ "SmaI", "CCC^GGG" },
+	{ "SpeI", "A^CTAGT" },
+	{ "TaqI", "T^CGA" },
+	{ "XbaI", "T^CTAGA" },
+	{ "XhoI", "C^TCGAG" }
+};
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool AddRestrictionEnzyme (RestrictionEnzymeSet *enzymes_p, const char *name_s, const char *site_s);
+
+static bool AddSiteExpansions (RestrictionEnzymeSet *enzymes_p, const uint32 enzyme_index, const char *site_s, const size_t length, const uint32 cut_offset);
+
+static bool AddSitePattern (RestrictionEnzymeSet *enzymes_p, const uint32 enzyme_index, const char *pattern_s, const size_t length, const uint32 cut_offset);
+
+static bool SelectEnzymes (const RestrictionEnzymeSet *enzymes_p, const char *enzymes_s, bool *selected_p, ServiceJob *job_p);
+
+static bool MapRestrictionBlock (const size_t task_index, void *data_p);
+
+static bool AddCut (const uint32 pattern_index, const size_t start, void *data_p);
+
+static bool AppendCut (CutList *cuts_p, const uint64 position);
+
+static bool AppendCutList (CutList *cuts_p, const CutList *src_p);
+
+static void SortCutList (CutList *cuts_p);
+
+static int CompareCutPositions (const void *v0_p, const void *v1_p);
+
+static void ClearCutList (CutList *cuts_p);
+
+static json_t *GetRestrictionMapAsJSON (const RestrictionMapper *mapper_p, const size_t num_blocks, const uint32 bin_size, const bool cut_positions_flag);
+
+static json_t *GetCutsAsJSON (const CutList *cuts_p, const IndexRegion *region_p, const uint32 bin_size, const bool cut_positions_flag);
+
+static uint32 FitFragmentBinSize (const IndexRegion *region_p, const uint32 bin_size);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+RestrictionEnzymeSet *CompileRestrictionEnzymes (const json_t *enzymes_config_p)
+{
+	RestrictionEnzymeSet *enzymes_p = NULL;
+	size_t num_enzymes = sizeof (S_DEFAULT_ENZYMES_SS) / sizeof (S_DEFAULT_ENZYMES_SS [0]);
+
+	if (enzymes_config_p)
+		{
+			if (json_is_array (enzymes_config_p))
+				{
+					num_enzymes = json_array_size (enzymes_config_p);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "restriction_enzymes must be an array");
+					return NULL;
+				}
+		}
+
+	if ((enzymes_p = (RestrictionEnzymeSet *) AllocMemory (sizeof (RestrictionEnzymeSet))) != NULL)
+		{
+			memset (enzymes_p, 0, sizeof (RestrictionEnzymeSet));
+
+			enzymes_p -> res_enzymes_p = (RestrictionEnzyme *) AllocMemoryArray (sizeof (RestrictionEnzyme), num_enzymes);
+			enzymes_p -> res_automaton_p = AllocateAhoCorasickAutomaton ();
+
+			if ((enzymes_p -> res_enzymes_p) && (enzymes_p -> res_automaton_p) && (num_enzymes > 0))
+				{
+					bool success_flag = true;
+					size_t i;
+
+					for (i = 0; (i < num_enzymes) && success_flag; ++ i)
+						{
+							const char *name_s = NULL;
+							const char *site_s = NULL;
+
+							if (enzymes_config_p)
+								{
+									const json_t *enzyme_config_p = json_array_get (enzymes_config_p, i);
+
+									name_s = GetJSONString (enzyme_config_p, "name");
+									site_s = GetJSONString (enzyme_config_p, "site");
+								}
+							else
+								{
+									name_s = S_DEFAULT_ENZYMES_SS [i][0];
+									site_s = S_DEFAULT_ENZYMES_SS [i][1];
+								}
+
+							if (name_s && site_s)
+								{
+									success_flag = AddRestrictionEnzyme (enzymes_p, name_s, site_s);
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Restriction enzyme " SIZET_FMT " needs a name and a site", i);
+									success_flag = false;
+								}
+						}
+
+					if (success_flag && FinishAhoCorasickAutomaton (enzymes_p -> res_automaton_p))
+						{
+							#if RESTRICTION_MAP_DEBUG >= STM_LEVEL_FINE
+							PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "Compiled %" PRIu32 " restriction enzymes into %" PRIu32 " patterns and %" PRIu32 " states", enzymes_p -> res_num_enzymes, enzymes_p -> res_automaton_p -> aca_num_patterns, enzymes_p -> res_automaton_p -> aca_num_states);
+							#endif
+
+							return enzymes_p;
+						}
+				}
+
+			FreeRestrictionEnzymeSet (enzymes_p);
+		}
+
+	return NULL;
+}
+
+
+void FreeRestrictionEnzymeSet (RestrictionEnzymeSet *enzymes_p)
+{
+	if (enzymes_p -> res_enzymes_p)
+		{
+			uint32 i;
+
+			for (i = 0; i < enzymes_p -> res_num_enzymes; ++ i)
+				{
+					FreeCopiedString (enzymes_p -> res_enzymes_p [i].re_name_s);
+					FreeCopiedString (enzymes_p -> res_enzymes_p [i].re_site_s);
+				}
+
+			FreeMemory (enzymes_p -> res_enzymes_p);
+		}
+
+	if (enzymes_p -> res_sites_p)
+		{
+			FreeMemory (enzymes_p -> res_sites_p);
+		}
+
+	if (enzymes_p -> res_automaton_p)
+		{
+			FreeAhoCorasickAutomaton (enzymes_p -> res_automaton_p);
+		}
+
+	FreeMemory (enzymes_p);
+}
+
+
+bool AddRestrictionMapParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	const bool def_cut_positions_flag = true;
+
+	return ((EasyCreateAndAddStringParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_ENZYMES.npt_type, S_ENZYMES.npt_name_s, "Enzymes", "The restriction enzymes to use, separated by commas or whitespace, e.g. PstI, MspI. If this is empty, all of the configured enzymes are used.", NULL, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_FRAGMENT_BIN_SIZE.npt_name_s, "Fragment bin size", "The width of each bin in the fragment size histograms", &S_DEFAULT_FRAGMENT_BIN_SIZE, PL_ADVANCED) != NULL) &&
+		(EasyCreateAndAddBooleanParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_CUT_POSITIONS.npt_name_s, "Cut positions", "Include the position of every cut as well as the fragment size histograms", &def_cut_positions_flag, PL_ADVANCED) != NULL));
+}
+
+
+bool GetRestrictionMapParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_ENZYMES.npt_name_s) == 0)
+		{
+			*pt_p = S_ENZYMES.npt_type;
+		}
+	else if (strcmp (param_name_s, S_FRAGMENT_BIN_SIZE.npt_name_s) == 0)
+		{
+			*pt_p = S_FRAGMENT_BIN_SIZE.npt_type;
+		}
+	else if (strcmp (param_name_s, S_CUT_POSITIONS.npt_name_s) == 0)
+		{
+			*pt_p = S_CUT_POSITIONS.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+void RunRestrictionMapJob (Service *service_p, ParameterSet *param_set_p)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	const RestrictionEnzymeSet *enzymes_p = data_p -> stsd_restriction_enzymes_p;
+	IndexData *index_data_p = GetSelectedIndexData (data_p, param_set_p);
+	const char *region_s = NULL;
+
+	if (enzymes_p && index_data_p && (index_data_p -> id_fasta_filename_s) && GetCurrentStringParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD.npt_name_s, &region_s) && region_s)
+		{
+			ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, region_s, index_data_p -> id_fasta_filename_s, NULL, NULL, NULL);
+
+			if (job_p)
+				{
+					const char *enzymes_s = NULL;
+					const uint32 *bin_size_p = NULL;
+					const bool *cut_positions_flag_p = NULL;
+					const uint32 bin_size = (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, S_FRAGMENT_BIN_SIZE.npt_name_s, &bin_size_p) && bin_size_p && (*bin_size_p > 0)) ? *bin_size_p : S_DEFAULT_FRAGMENT_BIN_SIZE;
+					const bool cut_positions_flag = (GetCurrentBooleanParameterValueFromParameterSet (param_set_p, S_CUT_POSITIONS.npt_name_s, &cut_positions_flag_p) && cut_positions_flag_p) ? *cut_positions_flag_p : true;
+					bool *selected_p = (bool *) AllocMemoryArray (sizeof (bool), enzymes_p -> res_num_enzymes);
+					IndexRegion region;
+
+					GetCurrentStringParameterValueFromParameterSet (param_set_p, S_ENZYMES.npt_name_s, &enzymes_s);
+
+					LogParameterSet (param_set_p, job_p);
+
+					SetServiceJobStatus (job_p, OS_STARTED);
+					LogServiceJob (job_p);
+
+					/* Assume failure */
+					SetServiceJobStatus (job_p, OS_FAILED);
+
+					if (selected_p)
+						{
+							if (ParseIndexRegion (index_data_p, region_s, &region))
+								{
+									if (SelectEnzymes (enzymes_p, enzymes_s, selected_p, job_p))
+										{
+											const size_t num_blocks = (size_t) ((region.ir_end - region.ir_start + S_BLOCK_SIZE - 1) / S_BLOCK_SIZE);
+											const size_t num_lists = num_blocks * (enzymes_p -> res_num_enzymes);
+											const uint32 fitted_bin_size = FitFragmentBinSize (&region, bin_size);
+											RestrictionMapper mapper;
+
+											mapper.rm_enzymes_p = enzymes_p;
+											mapper.rm_selected_p = selected_p;
+											mapper.rm_index_data_p = index_data_p;
+											mapper.rm_region_p = &region;
+
+											if ((mapper.rm_cuts_p = (CutList *) AllocMemoryArray (sizeof (CutList), num_lists)) != NULL)
+												{
+													size_t i;
+
+													memset (mapper.rm_cuts_p, 0, num_lists * sizeof (CutList));
+
+													if (RunWorkerPool (num_blocks, data_p -> stsd_num_threads, MapRestrictionBlock, &mapper))
+														{
+															json_t *result_p = GetRestrictionMapAsJSON (&mapper, num_blocks, fitted_bin_size, cut_positions_flag);
+
+															if (result_p)
+																{
+																	if (AddInlineResultToServiceJob (job_p, "restriction_map", result_p))
+																		{
+																			SetServiceJobStatus (job_p, OS_SUCCEEDED);
+																		}
+
+																	json_decref (result_p);
+																}
+														}
+													else
+														{
+															AddGeneralErrorMessageToServiceJob (job_p, "Failed to scan the region");
+														}
+
+													for (i = 0; i < num_lists; ++ i)
+														{
+															ClearCutList (mapper.rm_cuts_p + i);
+														}
+
+													FreeMemory (mapper.rm_cuts_p);
+												}
+										}
+								}
+							else
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "Unknown region");
+								}
+
+							FreeMemory (selected_p);
+						}
+
+					LogServiceJob (job_p);
+				}		/* if (job_p) */
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get the enzymes, a FASTA file and region for the restriction map");
+		}
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static bool AddRestrictionEnzyme (RestrictionEnzymeSet *enzymes_p, const char *name_s, const char *site_s)
+{
+	const char *cut_p = strchr (site_s, '^');
+	const size_t length = strlen (site_s) - (cut_p ? 1 : 0);
+	char *forward_s = NULL;
+	char *reverse_s = NULL;
+	bool success_flag = false;
+
+	if (! (cut_p && (strchr (cut_p + 1, '^') == NULL) && (length > 0)))
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "The site \"%s\" for %s needs a single ^ marking where it is cut", site_s, name_s);
+		}
+	else if (((forward_s = (char *) AllocMemory (length + 1)) != NULL) && ((reverse_s = (char *) AllocMemory (length + 1)) != NULL))
+		{
+			const uint32 cut_offset = (uint32) (cut_p - site_s);
+			size_t num_expansions = 1;
+			const char *src_p;
+			char *dest_p = forward_s;
+
+			success_flag = true;
+
+			for (src_p = site_s; *src_p && success_flag; ++ src_p)
+				{
+					if (*src_p != '^')
+						{
+							const char *bases_s;
+
+							*dest_p = (char) toupper (*src_p);
+
+							if ((bases_s = GetIUPACBases (*dest_p)) != NULL)
+								{
+									num_expansions *= strlen (bases_s);
+									++ dest_p;
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "The site \"%s\" for %s contains '%c' which is not an IUPAC base", site_s, name_s, *src_p);
+									success_flag = false;
+								}
+						}
+				}
+
+			*dest_p = '\0';
+
+			if (success_flag && (num_expansions > S_MAX_SITE_EXPANSIONS))
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "The site \"%s\" for %s is too degenerate", site_s, name_s);
+					success_flag = false;
+				}
+
+			if (success_flag)
+				{
+					const uint32 enzyme_index = enzymes_p -> res_num_enzymes;
+					RestrictionEnzyme *enzyme_p = enzymes_p -> res_enzymes_p + enzyme_index;
+
+					enzyme_p -> re_name_s = EasyCopyToNewString (name_s);
+					enzyme_p -> re_site_s = EasyCopyToNewString (site_s);
+
+					if ((enzyme_p -> re_name_s) && (enzyme_p -> re_site_s))
+						{
+							++ (enzymes_p -> res_num_enzymes);
+
+							ReverseComplementSequence (reverse_s, forward_s, length);
+							* (reverse_s + length) = '\0';
+
+							/*
+							 * The bottom strand of a palindromic site gives the same strings
+							 * so only the cut on the top strand is reported.
+							 */
+							success_flag = AddSiteExpansions (enzymes_p, enzyme_index, forward_s, length, cut_offset) &&
+								((strcmp (forward_s, reverse_s) == 0) || AddSiteExpansions (enzymes_p, enzyme_index, reverse_s, length, (uint32) length - cut_offset));
+
+							if (length > enzymes_p -> res_max_site_length)
+								{
+									enzymes_p -> res_max_site_length = (uint32) length;
+								}
+						}
+					else
+						{
+							if (enzyme_p -> re_name_s)
+								{
+									FreeCopiedString (enzyme_p -> re_name_s);
+								}
+
+							if (enzyme_p -> re_site_s)
+								{
+									FreeCopiedString (enzyme_p -> re_site_s);
+								}
+
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to copy restriction enzyme %s", name_s);
+							success_flag = false;
+						}
+				}
+		}
+
+	if (reverse_s)
+		{
+			FreeMemory (reverse_s);
+		}
+
+	if (forward_s)
+		{
+			FreeMemory (forward_s);
+		}
+
+	return success_flag;
+}
+
+
+static bool AddSiteExpansions (RestrictionEnzymeSet *enzymes_p, const uint32 enzyme_index, const char *site_s, const size_t length, const uint32 cut_offset)
+{
+	bool success_flag = false;
+	char *pattern_s = (char *) AllocMemory (length + 1);
+	size_t *choices_p = (size_t *) AllocMemoryArray (sizeof (size_t), length);
+
+	if (pattern_s && choices_p)
+		{
+			bool more_flag = true;
+			size_t i;
+
+			memset (choices_p, 0, length * sizeof (size_t));
+			pattern_s [length] = '\0';
+			success_flag = true;
+
+			/* Step through every combination of the degenerate bases like an odometer */
+			while (more_flag && success_flag)
+				{
+					for (i = 0; i < length; ++ i)
+						{
+							pattern_s [i] = GetIUPACBases (site_s [i]) [choices_p [i]];
+						}
+
+					success_flag = AddSitePattern (enzymes_p, enzyme_index, pattern_s, length, cut_offset);
+
+					more_flag = false;
+
+					for (i = length; i > 0; )
+						{
+							-- i;
+
+							if (GetIUPACBases (site_s [i]) [++ (choices_p [i])] != '\0')
+								{
+									more_flag = true;
+									break;
+								}
+
+							choices_p [i] = 0;
+						}
+				}
+		}
+
+	if (choices_p)
+		{
+			FreeMemory (choices_p);
+		}
+
+	if (pattern_s)
+		{
+			FreeMemory (pattern_s);
+		}
+
+	return success_flag;
+}
+
+
+static bool AddSitePattern (RestrictionEnzymeSet *enzymes_p, const uint32 enzyme_index, const char *pattern_s, const size_t length, const uint32 cut_offset)
+{
+	const int32 pattern_index = AddAhoCorasickPattern (enzymes_p -> res_automaton_p, pattern_s, length);
+
+	if (pattern_index >= 0)
+		{
+			RestrictionSite *site_p;
+
+			/* The automaton numbers its patterns consecutively so the array only ever needs one more entry */
+			if ((uint32) pattern_index == enzymes_p -> res_max_sites)
+				{
+					const uint32 new_max = (enzymes_p -> res_max_sites > 0) ? (enzymes_p -> res_max_sites << 1) : 64;
+					RestrictionSite *sites_p = (enzymes_p -> res_sites_p) ?
+						(RestrictionSite *) ReallocMemory (enzymes_p -> res_sites_p, new_max * sizeof (RestrictionSite), (enzymes_p -> res_max_sites) * sizeof (RestrictionSite)) :
+						(RestrictionSite *) AllocMemoryArray (sizeof (RestrictionSite), new_max);
+
+					if (!sites_p)
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " UINT32_FMT " restriction sites", new_max);
+							return false;
+						}
+
+					enzymes_p -> res_sites_p = sites_p;
+					enzymes_p -> res_max_sites = new_max;
+				}
+
+			site_p = enzymes_p -> res_sites_p + pattern_index;
+			site_p -> rs_enzyme_index = enzyme_index;
+			site_p -> rs_cut_offset = cut_offset;
+
+			return true;
+		}
+
+	return false;
+}
+
+
+
+static bool SelectEnzymes (const RestrictionEnzymeSet *enzymes_p, const char *enzymes_s, bool *selected_p, ServiceJob *job_p)
+{
+	const char *start_p = enzymes_s;
+	bool any_flag = false;
+	uint32 i;
+
+	memset (selected_p, 0, (enzymes_p -> res_num_enzymes) * sizeof (bool));
+
+	while (start_p && *start_p)
+		{
+			const size_t length = strcspn (start_p, S_ENZYME_SEPARATORS_S);
+
+			if (length > 0)
+				{
+					bool found_flag = false;
+
+					for (i = 0; i < enzymes_p -> res_num_enzymes; ++ i)
+						{
+							const char *name_s = enzymes_p -> res_enzymes_p [i].re_name_s;
+
+							if ((strncasecmp (name_s, start_p, length) == 0) && (name_s [length] == '\0'))
+								{
+									selected_p [i] = true;
+									found_flag = true;
+								}
+						}
+
+					if (found_flag)
+						{
+							any_flag = true;
+						}
+					else
+						{
+							char *name_s = CopyToNewString (start_p, length, false);
+							char *error_s = name_s ? ConcatenateVarargsStrings ("Unknown restriction enzyme ", name_s, NULL) : NULL;
+
+							AddGeneralErrorMessageToServiceJob (job_p, error_s ? error_s : "Unknown restriction enzyme");
+
+							if (error_s)
+								{
+									FreeCopiedString (error_s);
+								}
+
+							if (name_s)
+								{
+									FreeCopiedString (name_s);
+								}
+
+							return false;
+						}
+				}
+
+			start_p += length;
+
+			if (*start_p)
+				{
+					++ start_p;
+				}
+		}
+
+	/* No enzymes given means all of them */
+	if (!any_flag)
+		{
+			for (i = 0; i < enzymes_p -> res_num_enzymes; ++ i)
+				{
+					selected_p [i] = true;
+				}
+		}
+
+	return true;
+}
+
+
+static bool MapRestrictionBlock (const size_t task_index, void *data_p)
+{
+	const RestrictionMapper *mapper_p = (const RestrictionMapper *) data_p;
+	const IndexRegion *region_p = mapper_p -> rm_region_p;
+	const hts_pos_t block_start = region_p -> ir_start + ((hts_pos_t) task_index) * S_BLOCK_SIZE;
+	const hts_pos_t block_end = (region_p -> ir_end - block_start < S_BLOCK_SIZE) ? region_p -> ir_end : block_start + S_BLOCK_SIZE;
+	const hts_pos_t overlap_end = block_end + (hts_pos_t) (mapper_p -> rm_enzymes_p -> res_max_site_length) - 1;
+	bool success_flag = false;
+	hts_pos_t length = 0;
+
+	/* Overlap the next block so that sites spanning the join are found by this one */
+	char *sequence_s = FetchIndexSequence (mapper_p -> rm_index_data_p, region_p -> ir_scaffold_name_s, block_start, (overlap_end < region_p -> ir_end) ? overlap_end : region_p -> ir_end, &length);
+
+	if (sequence_s)
+		{
+			BlockScan scan;
+
+			scan.bs_mapper_p = mapper_p;
+			scan.bs_cuts_p = mapper_p -> rm_cuts_p + task_index * (mapper_p -> rm_enzymes_p -> res_num_enzymes);
+			scan.bs_offset = (uint64) block_start;
+			scan.bs_num_starts = (size_t) (block_end - block_start);
+			scan.bs_success_flag = true;
+
+			ScanWithAhoCorasick (mapper_p -> rm_enzymes_p -> res_automaton_p, sequence_s, (size_t) length, AddCut, &scan);
+
+			success_flag = scan.bs_success_flag;
+			free (sequence_s);
+		}
+
+	return success_flag;
+}
+
+
+static bool AddCut (const uint32 pattern_index, const size_t start, void *data_p)
+{
+	BlockScan *scan_p = (BlockScan *) data_p;
+
+	if (start < scan_p -> bs_num_starts)
+		{
+			const RestrictionMapper *mapper_p = scan_p -> bs_mapper_p;
+			const RestrictionSite *site_p = mapper_p -> rm_enzymes_p -> res_sites_p + pattern_index;
+
+			if (mapper_p -> rm_selected_p [site_p -> rs_enzyme_index])
+				{
+					if (!AppendCut (scan_p -> bs_cuts_p + site_p -> rs_enzyme_index, scan_p -> bs_offset + start + site_p -> rs_cut_offset))
+						{
+							scan_p -> bs_success_flag = false;
+							return false;
+						}
+				}
+		}
+
+	return true;
+}
+
+
+static bool AppendCut (CutList *cuts_p, const uint64 position)
+{
+	if (cuts_p -> cl_num_positions == cuts_p -> cl_max_positions)
+		{
+			const size_t new_max = (cuts_p -> cl_max_positions > 0) ? (cuts_p -> cl_max_positions << 1) : S_INITIAL_NUM_CUTS;
+			uint64 *positions_p = (cuts_p -> cl_positions_p) ?
+				(uint64 *) ReallocMemory (cuts_p -> cl_positions_p, new_max * sizeof (uint64), (cuts_p -> cl_max_positions) * sizeof (uint64)) :
+				(uint64 *) AllocMemoryArray (sizeof (uint64), new_max);
+
+			if (!positions_p)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " cut positions", new_max);
+					return false;
+				}
+
+			cuts_p -> cl_positions_p = positions_p;
+			cuts_p -> cl_max_positions = new_max;
+		}
+
+	cuts_p -> cl_positions_p [cuts_p -> cl_num_positions ++] = position;
+
+	return true;
+}
+
+
+static bool AppendCutList (CutList *cuts_p, const CutList *src_p)
+{
+	size_t i;
+
+	for (i = 0; i < src_p -> cl_num_positions; ++ i)
+		{
+			if (!AppendCut (cuts_p, src_p -> cl_positions_p [i]))
+				{
+					return false;
+				}
+		}
+
+	return true;
+}
+
+
+static void SortCutList (CutList *cuts_p)
+{
+	if (cuts_p -> cl_num_positions > 1)
+		{
+			size_t i;
+			size_t j = 0;
+
+			/*
+			 * A site near the end of one block can cut beyond the start of a
+			 * site in the next, and isoschizomers cut at the same place, so
+			 * sort and remove the duplicates.
+			 */
+			qsort (cuts_p -> cl_positions_p, cuts_p -> cl_num_positions, sizeof (uint64), CompareCutPositions);
+
+			for (i = 1; i < cuts_p -> cl_num_positions; ++ i)
+				{
+					if (cuts_p -> cl_positions_p [i] != cuts_p -> cl_positions_p [j])
+						{
+							cuts_p -> cl_positions_p [++ j] = cuts_p -> cl_positions_p [i];
+						}
+				}
+
+			cuts_p -> cl_num_positions = j + 1;
+		}
+}
+
+
+static int CompareCutPositions (const void *v0_p, const void *v1_p)
+{
+	const uint64 p0 = * ((const uint64 *) v0_p);
+	const uint64 p1 = * ((const uint64 *) v1_p);
+
+	return (p0 < p1) ? -1 : ((p0 > p1) ? 1 : 0);
+}
+
+
+static void ClearCutList (CutList *cuts_p)
+{
+	if (cuts_p -> cl_positions_p)
+		{
+			FreeMemory (cuts_p -> cl_positions_p);
+			cuts_p -> cl_positions_p = NULL;
+		}
+
+	cuts_p -> cl_num_positions = 0;
+	cuts_p -> cl_max_positions = 0;
+}
+
+
+static json_t *GetRestrictionMapAsJSON (const RestrictionMapper *mapper_p, const size_t num_blocks, const uint32 bin_size, const bool cut_positions_flag)
+{
+	const RestrictionEnzymeSet *enzymes_p = mapper_p -> rm_enzymes_p;
+	const IndexRegion *region_p = mapper_p -> rm_region_p;
+	json_t *result_p = json_pack ("{s:s,s:I,s:I,s:I}", "scaffold", region_p -> ir_scaffold_name_s, "start", (json_int_t) (region_p -> ir_start + 1), "end", (json_int_t) (region_p -> ir_end), "fragment_bin_size", (json_int_t) bin_size);
+	json_t *enzymes_json_p = json_array ();
+
+	if (result_p && enzymes_json_p && (json_object_set (result_p, "enzymes", enzymes_json_p) == 0))
+		{
+			CutList combined;
+			bool success_flag = true;
+			uint32 i;
+
+			memset (&combined, 0, sizeof (CutList));
+
+			for (i = 0; (i < enzymes_p -> res_num_enzymes) && success_flag; ++ i)
+				{
+					if (mapper_p -> rm_selected_p [i])
+						{
+							CutList cuts;
+							size_t j;
+
+							memset (&cuts, 0, sizeof (CutList));
+							success_flag = false;
+
+							for (j = 0; j < num_blocks; ++ j)
+								{
+									if (!AppendCutList (&cuts, mapper_p -> rm_cuts_p + j * (enzymes_p -> res_num_enzymes) + i))
+										{
+											break;
+										}
+								}
+
+							if (j == num_blocks)
+								{
+									json_t *enzyme_json_p;
+
+									SortCutList (&cuts);
+
+									if ((enzyme_json_p = GetCutsAsJSON (&cuts, region_p, bin_size, cut_positions_flag)) != NULL)
+										{
+											if ((json_object_set_new (enzyme_json_p, "name", json_string (enzymes_p -> res_enzymes_p [i].re_name_s)) == 0) &&
+												(json_object_set_new (enzyme_json_p, "site", json_string (enzymes_p -> res_enzymes_p [i].re_site_s)) == 0) &&
+												(json_array_append_new (enzymes_json_p, enzyme_json_p) == 0))
+												{
+													success_flag = AppendCutList (&combined, &cuts);
+												}
+											else
+												{
+													json_decref (enzyme_json_p);
+												}
+										}
+								}
+
+							ClearCutList (&cuts);
+						}
+				}
+
+			if (success_flag)
+				{
+					json_t *combined_json_p;
+
+					/* The fragments from digesting with all of the enzymes together */
+					SortCutList (&combined);
+
+					if ((combined_json_p = GetCutsAsJSON (&combined, region_p, bin_size, false)) != NULL)
+						{
+							if (json_object_set_new (result_p, "combined", combined_json_p) == 0)
+								{
+									ClearCutList (&combined);
+									json_decref (enzymes_json_p);
+
+									return result_p;
+								}
+						}
+				}
+
+			ClearCutList (&combined);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create the restriction map for %s", region_p -> ir_scaffold_name_s);
+
+	if (enzymes_json_p)
+		{
+			json_decref (enzymes_json_p);
+		}
+
+	if (result_p)
+		{
+			json_decref (result_p);
+		}
+
+	return NULL;
+}
+
+
+static uint32 FitFragmentBinSize (const IndexRegion *region_p, const uint32 bin_size)
+{
+	/* No fragment can be longer than the region */
+	const uint64 region_length = (uint64) (region_p -> ir_end - region_p -> ir_start);
+	const uint64 min_bin_size = (region_length + S_MAX_NUM_FRAGMENT_BINS - 2) / (S_MAX_NUM_FRAGMENT_BINS - 1);
+
+	return (bin_size < min_bin_size) ? (uint32) min_bin_size : bin_size;
+}
+
+
+static json_t *GetCutsAsJSON (const CutList *cuts_p, const IndexRegion *region_p, const uint32 bin_size, const bool cut_positions_flag)
+{
+	const uint64 region_start = (uint64) (region_p -> ir_start);
+	const uint64 region_end = (uint64) (region_p -> ir_end);
+	uint64 max_fragment_length = 0;
+	uint64 previous_cut = region_start;
+	size_t num_bins;
+	uint64 *bins_p;
+	size_t i;
+
+	/*
+	 * The first and last fragments run to the ends of the region which,
+	 * unless the region is the whole scaffold, are not real cuts.
+	 */
+	for (i = 0; i <= cuts_p -> cl_num_positions; ++ i)
+		{
+			const uint64 cut = (i < cuts_p -> cl_num_positions) ? cuts_p -> cl_positions_p [i] : region_end;
+
+			if (cut - previous_cut > max_fragment_length)
+				{
+					max_fragment_length = cut - previous_cut;
+				}
+
+			previous_cut = cut;
+		}
+
+	num_bins = (size_t) (max_fragment_length / bin_size) + 1;
+
+	if ((bins_p = (uint64 *) AllocMemoryArray (sizeof (uint64), num_bins)) != NULL)
+		{
+			json_t *cuts_json_p = json_pack ("{s:I}", "num_cuts", (json_int_t) (cuts_p -> cl_num_positions));
+			json_t *fragments_p = json_array ();
+			bool success_flag = (cuts_json_p && fragments_p);
+
+			memset (bins_p, 0, num_bins * sizeof (uint64));
+			previous_cut = region_start;
+
+			for (i = 0; i <= cuts_p -> cl_num_positions; ++ i)
+				{
+					const uint64 cut = (i < cuts_p -> cl_num_positions) ? cuts_p -> cl_positions_p [i] : region_end;
+
+					/* A cut at either end of the region doesn't make a fragment */
+					if (cut > previous_cut)
+						{
+							++ bins_p [(cut - previous_cut) / bin_size];
+						}
+
+					previous_cut = cut;
+				}
+
+			for (i = 0; (i < num_bins) && success_flag; ++ i)
+				{
+					success_flag = (json_array_append_new (fragments_p, json_integer ((json_int_t) bins_p [i])) == 0);
+				}
+
+			if (success_flag)
+				{
+					success_flag = (json_object_set (cuts_json_p, "fragments", fragments_p) == 0);
+				}
+
+			if (success_flag && cut_positions_flag)
+				{
+					json_t *positions_p = json_array ();
+
+					/* Each cut is given as the 1-based position of the base to its left */
+					if (positions_p && (json_object_set_new (cuts_json_p, "cuts", positions_p) == 0))
+						{
+							for (i = 0; (i < cuts_p -> cl_num_positions) && success_flag; ++ i)
+								{
+									success_flag = (json_array_append_new (positions_p, json_integer ((json_int_t) (cuts_p -> cl_positions_p [i]))) == 0);
+								}
+						}
+					else
+						{
+							success_flag = false;
+						}
+				}
+
+			if (fragments_p)
+				{
+					json_decref (fragments_p);
+				}
+
+			FreeMemory (bins_p);
+
+			if (success_flag)
+				{
+					return cuts_json_p;
+				}
+
+			if (cuts_json_p)
+				{
+					json_decref (cuts_json_p);
+				}
+		}
+
+	return NULL;
+}
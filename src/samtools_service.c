@@ -26,11 +26,39 @@
 #include "grassroots_server.h"
 #include "provider.h"
 #include "audit.h"
+#include "samtools_service_data.h"
+#include "allele_counter.h"
+#include "consensus.h"
+#include "variant_data.h"
+#include "fastq_extractor.h"
+#include "fasta_export.h"
+#include "scaffold_selection.h"
+#include "gap_map.h"
+#include "soft_mask.h"
+#include "composition.h"
+#include "composition_track.h"
+#include "sidecar_builder.h"
+#include "motif_search.h"
+#include "restriction_map.h"
+#include "primer_search.h"
+#include "in_silico_pcr.h"
+#include "exact_match.h"
+#include "minhash_sketch.h"
+#include "kmer_counter.h"
+#include "low_complexity.h"
+#include "orf_finder.h"
+#include "oligo_tiler.h"
+#include "locus_aligner.h"
+#include "region_delta.h"
+#include "window_prefetch.h"
+#include "fm_index.h"
+#include "fasta_utils.h"
 
 #include "htslib/faidx.h"
 
 #include "string_parameter.h"
 #include "unsigned_int_parameter.h"
+#include "boolean_parameter.h"
 
 
 #ifdef _DEBUG
@@ -40,29 +68,54 @@
 #endif
 
 
-typedef struct IndexData
-{
-	const char *id_blast_db_name_s;
-	const char *id_fasta_filename_s;
-} IndexData;
-
-typedef struct SamToolsServiceData
-{
-	ServiceData stsd_base_data;
-	IndexData *stsd_index_data_p;
-	size_t stsd_index_data_size;
-} SamToolsServiceData;
+static const uint32 S_DEFAULT_LINE_BREAK_INDEX = 60;
 
+static const uint32 S_DEFAULT_NUM_THREADS = 4;
 
-static const uint32 S_DEFAULT_LINE_BREAK_INDEX = 60;
+/*
+ * The number of bytes of each FASTA file that can be prefetched ahead of
+ * clients panning along its scaffolds.
+ */
+static const int S_DEFAULT_PREFETCH_BUDGET = 8 * 1024 * 1024;
 
 static const char * const BLASTDB_S = "Blast database";
 static const char * const FASTA_FILENAME_S = "Fasta";
 
+static const char * const ALIGNMENT_NAME_S = "name";
+static const char * const ALIGNMENT_FILENAME_S = "file";
+
+
+static const char * const S_MODE_SCAFFOLD_S = "scaffold";
+static const char * const S_MODE_ALLELE_COUNTS_S = "allele_counts";
+static const char * const S_MODE_CONSENSUS_S = "consensus";
+static const char * const S_MODE_VARIANTS_S = "variants";
+static const char * const S_MODE_FASTQ_S = "fastq";
+static const char * const S_MODE_EXPORT_S = "export";
+static const char * const S_MODE_MULTI_FASTA_S = "multi_fasta";
+static const char * const S_MODE_GAPS_S = "gaps";
+static const char * const S_MODE_COMPOSITION_S = "composition";
+static const char * const S_MODE_MOTIFS_S = "motifs";
+
+static const char * const S_MODE_RESTRICTION_MAP_S = "restriction_map";
+
+static const char * const S_MODE_PRIMER_SEARCH_S = "primer_search";
+
+static const char * const S_MODE_IN_SILICO_PCR_S = "in_silico_pcr";
+
+static const char * const S_MODE_EXACT_MATCH_S = "exact_match";
+
+static const char * const S_MODE_SKETCH_S = "sketch";
+
+static const char * const S_MODE_KMERS_S = "kmers";
+
+static const char * const S_MODE_ORFS_S = "orfs";
 
+static const char * const S_MODE_OLIGOS_S = "oligos";
 
-static NamedParameterType SS_SCAFFOLD = { "Scaffold", PT_STRING };
-static NamedParameterType SS_SCAFFOLD_LINE_BREAK = { "Scaffold line break index", PT_SIGNED_INT };
+static const char * const S_MODE_COMPARE_S = "compare";
+
+
+static NamedParameterType SS_MODE = { "Mode", PT_STRING };
 
 
 
@@ -94,17 +147,25 @@ static  ParameterSet *IsFileForSamToolsService (Service *service_p, DataResource
 static bool CloseSamToolsService (Service *service_p);
 
 
-static bool GetScaffoldData (const char * const filename_s, const char * const scaffold_name_s, int break_index, ByteBuffer *buffer_p);
+static bool GetScaffoldData (IndexData *index_data_p, const char * const scaffold_name_s, int break_index, const MaskMode mask_mode, const LowComplexitySettings *low_complexity_p, const uint32 split_gap_length, ByteBuffer *buffer_p);
 
 static bool GetSamToolsServiceConfig (SamToolsServiceData *data_p);
 
 
-static IndexData *GetSelectedIndexData (const SamToolsServiceData * const data_p, const ParameterSet *params_p);
-
 static Parameter *SetUpIndexesParamater (const SamToolsServiceData *service_data_p, ParameterSet *param_set_p, ParameterGroup *group_p);
 
 static ServiceMetadata *GetSamToolsServiceMetadata (Service *service_p);
 
+static bool GetAlignmentFilesConfig (SamToolsServiceData *data_p, const json_t *alignment_files_p);
+
+static bool GetVariantFilesConfig (SamToolsServiceData *data_p, const json_t *variant_files_p);
+
+static Parameter *SetUpModeParameter (const SamToolsServiceData *service_data_p, ParameterSet *param_set_p);
+
+static bool AddResourceToServiceJob (ServiceJob *job_p, const char *protocol_s, const char *title_s, json_t *data_p);
+
+static void RunScaffoldJob (Service *service_p, ParameterSet *param_set_p, ProvidersStateTable *providers_p);
+
 
 /*
  * API FUNCTIONS
@@ -170,11 +231,81 @@ void ReleaseServices (ServicesArray *services_p)
 }
 
 
+bool AddInlineResultToServiceJob (ServiceJob *job_p, const char *title_s, json_t *data_p)
+{
+	return AddResourceToServiceJob (job_p, PROTOCOL_INLINE_S, title_s, data_p);
+}
+
+
+bool AddFileResultToServiceJob (ServiceJob *job_p, const char *filename_s)
+{
+	return AddResourceToServiceJob (job_p, PROTOCOL_FILE_S, filename_s, NULL);
+}
+
+
+char *MakeJobOutputFilename (const SamToolsServiceData *data_p, const ServiceJob *job_p, const char *suffix_s)
+{
+	char *filename_s = NULL;
+
+	if (data_p -> stsd_output_directory_s)
+		{
+			char uuid_s [UUID_STRING_BUFFER_SIZE];
+
+			ConvertUUIDToString (job_p -> sj_id, uuid_s);
+
+			filename_s = ConcatenateVarargsStrings (data_p -> stsd_output_directory_s, "/", uuid_s, suffix_s, NULL);
+
+			if (!filename_s)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to make output filename for %s", uuid_s);
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "No \"output_directory\" has been configured");
+		}
+
+	return filename_s;
+}
+
+
 /*
  * STATIC FUNCTIONS 
  */
  
 
+static bool AddResourceToServiceJob (ServiceJob *job_p, const char *protocol_s, const char *title_s, json_t *data_p)
+{
+	bool success_flag = false;
+	json_t *result_p = GetDataResourceAsJSONByParts (protocol_s, NULL, title_s, data_p);
+
+	if (result_p)
+		{
+			if (AddResultToServiceJob (job_p, result_p))
+				{
+					success_flag = true;
+				}
+			else
+				{
+					char uuid_s [UUID_STRING_BUFFER_SIZE];
+
+					json_decref (result_p);
+					AddGeneralErrorMessageToServiceJob (job_p, "Failed to add result");
+
+					ConvertUUIDToString (job_p -> sj_id, uuid_s);
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add result for %s", uuid_s);
+				}
+		}
+	else
+		{
+			AddGeneralErrorMessageToServiceJob (job_p, "Failed to create result");
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get json result for %s", title_s);
+		}
+
+	return success_flag;
+}
+
+
 static bool GetSamToolsServiceConfig (SamToolsServiceData *data_p)
 {
 	bool success_flag = false;
@@ -197,15 +328,22 @@ static bool GetSamToolsServiceConfig (SamToolsServiceData *data_p)
 									size_t i;
 									json_t *index_file_p;
 
+									success_flag = true;
+
 									json_array_foreach (index_files_p, i, index_file_p)
 										{
-											((data_p -> stsd_index_data_p) + i) -> id_blast_db_name_s = GetJSONString (index_file_p, BLASTDB_S);
-											((data_p -> stsd_index_data_p) + i) -> id_fasta_filename_s = GetJSONString (index_file_p, FASTA_FILENAME_S);
+											if (success_flag)
+												{
+													if (InitIndexData ((data_p -> stsd_index_data_p) + i, GetJSONString (index_file_p, BLASTDB_S), GetJSONString (index_file_p, FASTA_FILENAME_S)))
+														{
+															data_p -> stsd_index_data_size = i + 1;
+														}
+													else
+														{
+															success_flag = false;
+														}
+												}
 										}
-
-									data_p -> stsd_index_data_size = size;
-
-									success_flag = true;
 								}
 
 						}
@@ -217,24 +355,237 @@ static bool GetSamToolsServiceConfig (SamToolsServiceData *data_p)
 
 									if (data_p -> stsd_index_data_p)
 										{
-											data_p -> stsd_index_data_p -> id_blast_db_name_s = GetJSONString (index_files_p, BLASTDB_S);
-											data_p -> stsd_index_data_p -> id_fasta_filename_s = GetJSONString (index_files_p, FASTA_FILENAME_S);
-
-											data_p -> stsd_index_data_size = 1;
+											if (InitIndexData (data_p -> stsd_index_data_p, GetJSONString (index_files_p, BLASTDB_S), GetJSONString (index_files_p, FASTA_FILENAME_S)))
+												{
+													data_p -> stsd_index_data_size = 1;
 
-											success_flag = true;
+													success_flag = true;
+												}
 										}
 								}
 						}
 
 				}		/* if (index_files_p) */
 
+			if (success_flag)
+				{
+					json_t *alignment_files_p = json_object_get (sam_tools_config_p, "alignment_files");
+					int num_threads;
+
+					if (alignment_files_p)
+						{
+							success_flag = GetAlignmentFilesConfig (data_p, alignment_files_p);
+						}
+
+					if (success_flag)
+						{
+							json_t *variant_files_p = json_object_get (sam_tools_config_p, "variant_files");
+
+							if (variant_files_p)
+								{
+									success_flag = GetVariantFilesConfig (data_p, variant_files_p);
+								}
+						}
+
+					data_p -> stsd_sidecar_directory_s = GetJSONString (sam_tools_config_p, "sidecar_directory");
+					data_p -> stsd_output_directory_s = GetJSONString (sam_tools_config_p, "output_directory");
+
+					if (GetJSONInteger (sam_tools_config_p, "threads", &num_threads))
+						{
+							if (num_threads > 0)
+								{
+									data_p -> stsd_num_threads = (uint32) num_threads;
+								}
+						}
+
+					if (success_flag)
+						{
+							/* The mode is just left out if the enzymes can't be compiled */
+							data_p -> stsd_restriction_enzymes_p = CompileRestrictionEnzymes (json_object_get (sam_tools_config_p, "restriction_enzymes"));
+						}
+
+					if (success_flag)
+						{
+							size_t i;
+							int prefetch_budget = S_DEFAULT_PREFETCH_BUDGET;
+
+							GetJSONInteger (sam_tools_config_p, "prefetch_budget", &prefetch_budget);
+
+							/* The FM-indexes are built offline so any that are missing are just left out */
+							for (i = 0; i < data_p -> stsd_index_data_size; ++ i)
+								{
+									IndexData *index_data_p = data_p -> stsd_index_data_p + i;
+
+									if (index_data_p -> id_fasta_filename_s)
+										{
+											index_data_p -> id_fm_index_p = LoadFmIndex (index_data_p -> id_fasta_filename_s, data_p -> stsd_sidecar_directory_s);
+
+											/* Prefetching is only a hint so the service runs without it */
+											if (prefetch_budget > 0)
+												{
+													index_data_p -> id_prefetcher_p = AllocateWindowPrefetcher (index_data_p -> id_fasta_filename_s, (uint64) prefetch_budget);
+												}
+										}
+								}
+						}
+
+					if (success_flag)
+						{
+							bool build_tracks_flag = true;
+							bool build_read_names_flag = true;
+							bool build_sketches_flag = true;
+							bool build_gap_maps_flag = true;
+							uint32 build_flags = 0;
+
+							GetJSONBoolean (sam_tools_config_p, "composition_tracks", &build_tracks_flag);
+							GetJSONBoolean (sam_tools_config_p, "read_name_indexes", &build_read_names_flag);
+							GetJSONBoolean (sam_tools_config_p, "scaffold_sketches", &build_sketches_flag);
+							GetJSONBoolean (sam_tools_config_p, "gap_maps", &build_gap_maps_flag);
+
+							if (build_tracks_flag && (data_p -> stsd_index_data_size > 0))
+								{
+									build_flags |= SB_COMPOSITION_TRACKS;
+								}
+
+							if (build_sketches_flag && (data_p -> stsd_index_data_size > 0))
+								{
+									build_flags |= SB_SCAFFOLD_SKETCHES;
+								}
+
+							if (build_gap_maps_flag && (data_p -> stsd_index_data_size > 0))
+								{
+									build_flags |= SB_GAP_MAPS;
+								}
+
+							if (build_read_names_flag && (data_p -> stsd_alignment_data_size > 0))
+								{
+									build_flags |= SB_READ_NAME_INDEXES;
+								}
+
+							if (build_flags != 0)
+								{
+									/* The service still works without the sidecar files so this isn't fatal */
+									StartSidecarBuilder (data_p, build_flags);
+								}
+						}
+				}
+
 		}		/* if (blast_config_p) */
 
 	return success_flag;
 }
 
 
+static bool GetAlignmentFilesConfig (SamToolsServiceData *data_p, const json_t *alignment_files_p)
+{
+	bool success_flag = false;
+
+	if (json_is_array (alignment_files_p))
+		{
+			const size_t size = json_array_size (alignment_files_p);
+
+			data_p -> stsd_alignment_data_p = (AlignmentData *) AllocMemoryArray (sizeof (AlignmentData), size);
+
+			if (data_p -> stsd_alignment_data_p)
+				{
+					size_t i;
+					json_t *alignment_file_p;
+					AlignmentData *alignment_data_p = data_p -> stsd_alignment_data_p;
+
+					json_array_foreach (alignment_files_p, i, alignment_file_p)
+						{
+							const char *filename_s = GetJSONString (alignment_file_p, ALIGNMENT_FILENAME_S);
+
+							if (filename_s)
+								{
+									const char *name_s = GetJSONString (alignment_file_p, ALIGNMENT_NAME_S);
+									const char *reference_s = GetJSONString (alignment_file_p, FASTA_FILENAME_S);
+									IndexData *reference_p = NULL;
+
+									if (reference_s)
+										{
+											reference_p = GetIndexDataByName (data_p, reference_s);
+
+											if (!reference_p)
+												{
+													PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "No configured index file \"%s\" for \"%s\"", reference_s, filename_s);
+												}
+										}
+
+									if (InitAlignmentData (alignment_data_p, name_s ? name_s : filename_s, filename_s, reference_p))
+										{
+											++ alignment_data_p;
+										}
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "No \"%s\" for alignment file entry " SIZET_FMT, ALIGNMENT_FILENAME_S, i);
+								}
+						}
+
+					data_p -> stsd_alignment_data_size = alignment_data_p - (data_p -> stsd_alignment_data_p);
+
+					success_flag = true;
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "\"alignment_files\" is not an array");
+		}
+
+	return success_flag;
+}
+
+
+static bool GetVariantFilesConfig (SamToolsServiceData *data_p, const json_t *variant_files_p)
+{
+	bool success_flag = false;
+
+	if (json_is_array (variant_files_p))
+		{
+			const size_t size = json_array_size (variant_files_p);
+
+			data_p -> stsd_variant_data_p = (VariantData *) AllocMemoryArray (sizeof (VariantData), size);
+
+			if (data_p -> stsd_variant_data_p)
+				{
+					size_t i;
+					json_t *variant_file_p;
+					VariantData *variant_data_p = data_p -> stsd_variant_data_p;
+
+					json_array_foreach (variant_files_p, i, variant_file_p)
+						{
+							const char *filename_s = GetJSONString (variant_file_p, ALIGNMENT_FILENAME_S);
+
+							if (filename_s)
+								{
+									const char *name_s = GetJSONString (variant_file_p, ALIGNMENT_NAME_S);
+
+									if (InitVariantData (variant_data_p, name_s ? name_s : filename_s, filename_s))
+										{
+											++ variant_data_p;
+										}
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "No \"%s\" for variant file entry " SIZET_FMT, ALIGNMENT_FILENAME_S, i);
+								}
+						}
+
+					data_p -> stsd_variant_data_size = variant_data_p - (data_p -> stsd_variant_data_p);
+
+					success_flag = true;
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "\"variant_files\" is not an array");
+		}
+
+	return success_flag;
+}
+
+
 
 static SamToolsServiceData *AllocateSamToolsServiceData (Service * UNUSED_PARAM (service_p))
 {
@@ -244,6 +595,15 @@ static SamToolsServiceData *AllocateSamToolsServiceData (Service * UNUSED_PARAM
 		{
 			data_p -> stsd_index_data_p = NULL;
 			data_p -> stsd_index_data_size = 0;
+			data_p -> stsd_alignment_data_p = NULL;
+			data_p -> stsd_alignment_data_size = 0;
+			data_p -> stsd_variant_data_p = NULL;
+			data_p -> stsd_variant_data_size = 0;
+			data_p -> stsd_sidecar_directory_s = NULL;
+			data_p -> stsd_output_directory_s = NULL;
+			data_p -> stsd_num_threads = S_DEFAULT_NUM_THREADS;
+			data_p -> stsd_sidecar_builder_p = NULL;
+			data_p -> stsd_restriction_enzymes_p = NULL;
 
 			return data_p;
 		}
@@ -254,10 +614,50 @@ static SamToolsServiceData *AllocateSamToolsServiceData (Service * UNUSED_PARAM
 
 static void FreeSamToolsServiceData (SamToolsServiceData *data_p)
 {
+	/* This uses the index data so it has to finish first */
+	StopSidecarBuilder (data_p);
+
+	if (data_p -> stsd_restriction_enzymes_p)
+		{
+			FreeRestrictionEnzymeSet (data_p -> stsd_restriction_enzymes_p);
+		}
+
 	if (data_p -> stsd_index_data_p)
 		{
+			size_t i;
+
+			for (i = 0; i < data_p -> stsd_index_data_size; ++ i)
+				{
+					ClearIndexData ((data_p -> stsd_index_data_p) + i);
+				}
+
 			FreeMemory (data_p -> stsd_index_data_p);
 		}
+
+	if (data_p -> stsd_alignment_data_p)
+		{
+			size_t i;
+
+			for (i = 0; i < data_p -> stsd_alignment_data_size; ++ i)
+				{
+					ClearAlignmentData ((data_p -> stsd_alignment_data_p) + i);
+				}
+
+			FreeMemory (data_p -> stsd_alignment_data_p);
+		}
+
+	if (data_p -> stsd_variant_data_p)
+		{
+			size_t i;
+
+			for (i = 0; i < data_p -> stsd_variant_data_size; ++ i)
+				{
+					ClearVariantData ((data_p -> stsd_variant_data_p) + i);
+				}
+
+			FreeMemory (data_p -> stsd_variant_data_p);
+		}
+
 	FreeMemory (data_p);
 }
 
@@ -297,17 +697,25 @@ static ParameterSet *GetSamToolsServiceParameters (Service *service_p, DataResou
 			SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
 			Parameter *param_p = NULL;
 
-			if ((param_p = SetUpIndexesParamater (data_p, param_set_p, NULL)) != NULL)
+			if (((param_p = SetUpModeParameter (data_p, param_set_p)) != NULL) && ((param_p = SetUpIndexesParamater (data_p, param_set_p, NULL)) != NULL))
 				{
 					if ((param_p = EasyCreateAndAddStringParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, SS_SCAFFOLD.npt_type, SS_SCAFFOLD.npt_name_s, "Scaffold name", "The name of the scaffold to find", NULL, PL_ALL)) != NULL)
 						{
 							const uint32 def_line_length = S_DEFAULT_LINE_BREAK_INDEX;
+							const bool def_all_indexes_flag = false;
 
 							param_p -> pa_required_flag = true;
 
-							if ((param_p = EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, SS_SCAFFOLD_LINE_BREAK.npt_name_s, "Max Line Length", "If this is greater than 0, then add a newline after each block of this many letters", &def_line_length, PL_ADVANCED)) != NULL)
+							if (((param_p = EasyCreateAndAddUnsignedIntParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, SS_SCAFFOLD_LINE_BREAK.npt_name_s, "Max Line Length", "If this is greater than 0, then add a newline after each block of this many letters", &def_line_length, PL_ADVANCED)) != NULL) &&
+								((param_p = EasyCreateAndAddBooleanParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, SS_ALL_INDEXES.npt_name_s, "All indexes", "For the modes that search across assemblies, use all of the configured indexes rather than just the selected one", &def_all_indexes_flag, PL_ADVANCED)) != NULL))
 								{
-									return param_set_p;
+									if ((data_p -> stsd_alignment_data_size == 0) || ((AddAlignmentParameters (data_p, param_set_p)) && (AddAlleleCountsParameters (data_p, param_set_p)) && (AddFastqParameters (data_p, param_set_p))))
+										{
+											if (((data_p -> stsd_variant_data_size == 0) || (AddVariantsParameters (data_p, param_set_p))) && (AddScaffoldSelectionParameters (data_p, param_set_p)) && (AddGapParameters (data_p, param_set_p)) && (AddSoftMaskParameters (data_p, param_set_p)) && (AddLowComplexityParameters (data_p, param_set_p)) && (AddRegionDeltaParameters (data_p, param_set_p)) && (AddCompositionParameters (data_p, param_set_p)) && (AddMotifSearchParameters (data_p, param_set_p)) && (AddPrimerSearchParameters (data_p, param_set_p)) && (AddInSilicoPcrParameters (data_p, param_set_p)) && (AddSketchParameters (data_p, param_set_p)) && (AddKmerCountParameters (data_p, param_set_p)) && (AddOrfFinderParameters (data_p, param_set_p)) && (AddOligoTilingParameters (data_p, param_set_p)) && (AddLocusAlignmentParameters (data_p, param_set_p)) && ((data_p -> stsd_restriction_enzymes_p == NULL) || (AddRestrictionMapParameters (data_p, param_set_p))) && ((!HasFmIndexes (data_p)) || (AddExactMatchParameters (data_p, param_set_p))))
+												{
+													return param_set_p;
+												}
+										}
 								}
 						}
 				}
@@ -334,6 +742,10 @@ static bool GetSamToolsServiceParameterTypesForNamedParameters (const Service *s
 		{
 			*pt_p = SS_INDEX.npt_type;
 		}
+	else if (strcmp (param_name_s, SS_MODE.npt_name_s) == 0)
+		{
+			*pt_p = SS_MODE.npt_type;
+		}
 	else if (strcmp (param_name_s, SS_SCAFFOLD.npt_name_s) == 0)
 		{
 			*pt_p = SS_SCAFFOLD.npt_type;
@@ -342,9 +754,89 @@ static bool GetSamToolsServiceParameterTypesForNamedParameters (const Service *s
 		{
 			*pt_p = SS_SCAFFOLD_LINE_BREAK.npt_type;
 		}
+	else if (strcmp (param_name_s, SS_ALL_INDEXES.npt_name_s) == 0)
+		{
+			*pt_p = SS_ALL_INDEXES.npt_type;
+		}
+	else if (GetAlignmentParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
+	else if (GetVariantsParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
+	else if (GetFastqParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
+	else if (GetScaffoldSelectionParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
+	else if (GetGapParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
+	else if (GetSoftMaskParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
+	else if (GetLowComplexityParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
+	else if (GetCompositionParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
+	else if (GetMotifSearchParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
+	else if (GetRestrictionMapParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
+	else if (GetPrimerSearchParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
+	else if (GetInSilicoPcrParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
+	else if (GetExactMatchParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
+	else if (GetSketchParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
+	else if (GetKmerCountParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
+	else if (GetOrfFinderParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
+	else if (GetOligoTilingParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
+	else if (GetLocusAlignmentParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
+	else if (GetRegionDeltaParameterTypeForNamedParameter (param_name_s, pt_p))
+		{
+			success_flag = true;
+		}
 	else
 		{
-			success_flag = false;
+			success_flag = GetAlleleCountsParameterTypeForNamedParameter (param_name_s, pt_p);
 		}
 
 	return success_flag;
@@ -407,7 +899,6 @@ static bool GetDatabaseParameterTypeForNamedParameter (SamToolsServiceData *data
 
 static ServiceJobSet *RunSamToolsService (Service *service_p, ParameterSet *param_set_p, User * UNUSED_PARAM (user_p), ProvidersStateTable *providers_p)
 {
-	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
 	service_p -> se_jobs_p = AllocateServiceJobSet (service_p);
 
 	#if SAMTOOLS_SERVICE_DEBUG >= STM_LEVEL_FINER
@@ -416,172 +907,310 @@ static ServiceJobSet *RunSamToolsService (Service *service_p, ParameterSet *para
 
 	if (service_p -> se_jobs_p)
 		{
-			IndexData *selected_index_data_p = GetSelectedIndexData (data_p, param_set_p);
+			const char *mode_s = NULL;
+
+			GetCurrentStringParameterValueFromParameterSet (param_set_p, SS_MODE.npt_name_s, &mode_s);
 
-			if (selected_index_data_p)
+			if ((mode_s == NULL) || (strcmp (mode_s, S_MODE_SCAFFOLD_S) == 0))
+				{
+					/* Regions on remote indexes are still passed on in full */
+					if (HasHeldRegion (param_set_p) && GetSelectedIndexData ((SamToolsServiceData *) (service_p -> se_data_p), param_set_p))
+						{
+							RunRegionDeltaJob (service_p, param_set_p);
+						}
+					else
+						{
+							RunScaffoldJob (service_p, param_set_p, providers_p);
+						}
+				}
+			else if (strcmp (mode_s, S_MODE_ALLELE_COUNTS_S) == 0)
+				{
+					RunAlleleCountsJob (service_p, param_set_p);
+				}
+			else if (strcmp (mode_s, S_MODE_CONSENSUS_S) == 0)
+				{
+					RunConsensusJob (service_p, param_set_p);
+				}
+			else if (strcmp (mode_s, S_MODE_VARIANTS_S) == 0)
+				{
+					RunVariantsJob (service_p, param_set_p);
+				}
+			else if (strcmp (mode_s, S_MODE_FASTQ_S) == 0)
+				{
+					RunFastqJob (service_p, param_set_p);
+				}
+			else if (strcmp (mode_s, S_MODE_EXPORT_S) == 0)
+				{
+					RunExportJob (service_p, param_set_p);
+				}
+			else if (strcmp (mode_s, S_MODE_MULTI_FASTA_S) == 0)
+				{
+					RunMultiFastaJob (service_p, param_set_p);
+				}
+			else if (strcmp (mode_s, S_MODE_GAPS_S) == 0)
+				{
+					RunGapsJob (service_p, param_set_p);
+				}
+			else if (strcmp (mode_s, S_MODE_COMPOSITION_S) == 0)
+				{
+					RunCompositionJob (service_p, param_set_p);
+				}
+			else if (strcmp (mode_s, S_MODE_MOTIFS_S) == 0)
+				{
+					RunMotifSearchJob (service_p, param_set_p);
+				}
+			else if (strcmp (mode_s, S_MODE_RESTRICTION_MAP_S) == 0)
+				{
+					RunRestrictionMapJob (service_p, param_set_p);
+				}
+			else if (strcmp (mode_s, S_MODE_PRIMER_SEARCH_S) == 0)
 				{
-					const char *scaffold_s = NULL;
+					RunPrimerSearchJob (service_p, param_set_p);
+				}
+			else if (strcmp (mode_s, S_MODE_IN_SILICO_PCR_S) == 0)
+				{
+					RunInSilicoPcrJob (service_p, param_set_p);
+				}
+			else if (strcmp (mode_s, S_MODE_EXACT_MATCH_S) == 0)
+				{
+					RunExactMatchJob (service_p, param_set_p);
+				}
+			else if (strcmp (mode_s, S_MODE_SKETCH_S) == 0)
+				{
+					RunSketchJob (service_p, param_set_p);
+				}
+			else if (strcmp (mode_s, S_MODE_KMERS_S) == 0)
+				{
+					RunKmerCountJob (service_p, param_set_p);
+				}
+			else if (strcmp (mode_s, S_MODE_ORFS_S) == 0)
+				{
+					RunOrfFinderJob (service_p, param_set_p);
+				}
+			else if (strcmp (mode_s, S_MODE_OLIGOS_S) == 0)
+				{
+					RunOligoTilingJob (service_p, param_set_p);
+				}
+			else if (strcmp (mode_s, S_MODE_COMPARE_S) == 0)
+				{
+					RunLocusAlignmentJob (service_p, param_set_p);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Unknown mode \"%s\"", mode_s);
+				}
+
+		}		/* if (service_p -> se_jobs_p) */
+
+	return service_p -> se_jobs_p;
+}
+
 
-					if (GetCurrentStringParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD.npt_name_s, &scaffold_s))
+static void RunScaffoldJob (Service *service_p, ParameterSet *param_set_p, ProvidersStateTable *providers_p)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	IndexData *selected_index_data_p = GetSelectedIndexData (data_p, param_set_p);
+
+	if (selected_index_data_p)
+		{
+			const char *scaffold_s = NULL;
+
+			if (GetCurrentStringParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD.npt_name_s, &scaffold_s))
+				{
+					if (scaffold_s)
 						{
-							if (scaffold_s)
+							ByteBuffer *buffer_p = AllocateByteBuffer (16384);
+
+							if (buffer_p)
 								{
-									ByteBuffer *buffer_p = AllocateByteBuffer (16384);
+									ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, scaffold_s, selected_index_data_p -> id_blast_db_name_s, NULL, NULL, NULL);
 
-									if (buffer_p)
+									if (job_p)
 										{
-											ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, scaffold_s, selected_index_data_p -> id_blast_db_name_s, NULL, NULL, NULL);
+											const uint32 *index_p = NULL;
+											const MaskMode mask_mode = GetMaskMode (param_set_p);
+											LowComplexitySettings low_complexity;
 
-											if (job_p)
-												{
-													const uint32 *index_p = NULL;
+											GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD_LINE_BREAK.npt_name_s, &index_p);
+											GetLowComplexitySettings (param_set_p, &low_complexity);
 
-													GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD_LINE_BREAK.npt_name_s, &index_p);
+											LogParameterSet (param_set_p, job_p);
 
-													LogParameterSet (param_set_p, job_p);
+											SetServiceJobStatus (job_p, OS_STARTED);
+											LogServiceJob (job_p);
 
-													SetServiceJobStatus (job_p, OS_STARTED);
-													LogServiceJob (job_p);
+											/* Assume failure */
+											SetServiceJobStatus (job_p, OS_FAILED);
 
-													/* Assume failure */
-													SetServiceJobStatus (job_p, OS_FAILED);
+											/* Only one set of intervals can be returned and the masks need the sequence */
+											if ((mask_mode == MM_INTERVALS) && (low_complexity.lcs_mode != LC_NONE))
+												{
+													AddGeneralErrorMessageToServiceJob (job_p, "Low complexity cannot be used with the intervals Mask mode");
+												}
+											else if (GetScaffoldData (selected_index_data_p, scaffold_s, index_p ? *index_p : S_DEFAULT_LINE_BREAK_INDEX, mask_mode, &low_complexity, GetSplitGapLength (param_set_p), buffer_p))
+												{
+													json_t *result_p = NULL;
+													const char *sequence_s = GetByteBufferData (buffer_p);
 
-													if (GetScaffoldData (selected_index_data_p -> id_fasta_filename_s, scaffold_s, index_p ? *index_p : S_DEFAULT_LINE_BREAK_INDEX, buffer_p))
+													if (sequence_s)
 														{
-															json_t *result_p = NULL;
-															const char *sequence_s = GetByteBufferData (buffer_p);
+															json_t *sequence_p = json_string (sequence_s);
 
-															if (sequence_s)
+															if (sequence_p)
 																{
-																	json_t *sequence_p = json_string (sequence_s);
+																	result_p = GetDataResourceAsJSONByParts (PROTOCOL_INLINE_S, NULL, scaffold_s, sequence_p);
 
-																	if (sequence_p)
-																		{
-																			result_p = GetDataResourceAsJSONByParts (PROTOCOL_INLINE_S, NULL, scaffold_s, sequence_p);
-
-																			if (!result_p)
-																				{
-																					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get json result for %s", sequence_s);
-																				}
-
-																			json_decref (sequence_p);
-																		}
-																	else
+																	if (!result_p)
 																		{
-																			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create json sequence from %s", sequence_s);
+																			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get json result for %s", sequence_s);
 																		}
-																}		/* if (sequence_s) */
+
+																	json_decref (sequence_p);
+																}
 															else
 																{
-																	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get sequence from buffer for %s from %s", scaffold_s, selected_index_data_p -> id_fasta_filename_s);
+																	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create json sequence from %s", sequence_s);
 																}
+														}		/* if (sequence_s) */
+													else
+														{
+															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get sequence from buffer for %s from %s", scaffold_s, selected_index_data_p -> id_fasta_filename_s);
+														}
 
 
-															if (result_p)
+													if (result_p)
+														{
+															if (AddResultToServiceJob (job_p, result_p))
 																{
-																	if (AddResultToServiceJob (job_p, result_p))
-																		{
-																			SetServiceJobStatus (job_p, OS_SUCCEEDED);
-																		}
-																	else
-																		{
-																			char uuid_s [UUID_STRING_BUFFER_SIZE];
-
-																			json_decref (result_p);
-																			AddGeneralErrorMessageToServiceJob (job_p, "Failed to add result");
-
-																			ConvertUUIDToString (job_p -> sj_id, uuid_s);
-																			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add result for %s", uuid_s);
-																		}
+																	SetServiceJobStatus (job_p, OS_SUCCEEDED);
 																}
 															else
 																{
-																	const char *prefix_s = "Create sequence error";
-																	char *error_s = ConcatenateStrings (prefix_s, scaffold_s);
+																	char uuid_s [UUID_STRING_BUFFER_SIZE];
 
-																	if (error_s)
-																		{
-																			AddGeneralErrorMessageToServiceJob (job_p, error_s);
-																			FreeCopiedString (error_s);
-																		}
-																	else
-																		{
-																			AddGeneralErrorMessageToServiceJob (job_p, prefix_s);
-																		}
+																	json_decref (result_p);
+																	AddGeneralErrorMessageToServiceJob (job_p, "Failed to add result");
+
+																	ConvertUUIDToString (job_p -> sj_id, uuid_s);
+																	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add result for %s", uuid_s);
 																}
 														}
 													else
 														{
-															if (!AddGeneralErrorMessageToServiceJob (job_p, "Failed to get scaffold data"))
+															const char *prefix_s = "Create sequence error";
+															char *error_s = ConcatenateStrings (prefix_s, scaffold_s);
+
+															if (error_s)
 																{
-																	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add error to job");
+																	AddGeneralErrorMessageToServiceJob (job_p, error_s);
+																	FreeCopiedString (error_s);
+																}
+															else
+																{
+																	AddGeneralErrorMessageToServiceJob (job_p, prefix_s);
 																}
 														}
+												}
+											else
+												{
+													if (!AddGeneralErrorMessageToServiceJob (job_p, "Failed to get scaffold data"))
+														{
+															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add error to job");
+														}
+												}
 
-													LogServiceJob (job_p);
-												}		/* if (job_p) */
-
+											LogServiceJob (job_p);
+										}		/* if (job_p) */
 
-											FreeByteBuffer (buffer_p);
 
-										}		/* if (buffer_p) */
-									else
-										{
-											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate byte buffer to store scaffold data");
-										}
+									FreeByteBuffer (buffer_p);
 
-								}		/* if (scaffold_s) */
+								}		/* if (buffer_p) */
 							else
 								{
-									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get scaffold");
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate byte buffer to store scaffold data");
 								}
 
-						}		/* if (param_p) */
+						}		/* if (scaffold_s) */
 					else
 						{
-							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get %s parameter", SS_SCAFFOLD.npt_name_s);
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get scaffold");
 						}
 
-				}		/* if (selected_index_data_p) */
+				}		/* if (param_p) */
 			else
 				{
-					/* The requested index data may be on a paired service so try those */
-					int32 num_jobs_ran = RunPairedServices (service_p, param_set_p, providers_p, SaveRemoteSamtoolsJobDetails);
-
-					if (num_jobs_ran == 0)
-						{
-							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get input filename");
-						}
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get %s parameter", SS_SCAFFOLD.npt_name_s);
 				}
 
-		}		/* if (service_p -> se_jobs_p) */
+		}		/* if (selected_index_data_p) */
+	else
+		{
+			/* The requested index data may be on a paired service so try those */
+			int32 num_jobs_ran = RunPairedServices (service_p, param_set_p, providers_p, SaveRemoteSamtoolsJobDetails);
 
-	return service_p -> se_jobs_p;
+			if (num_jobs_ran == 0)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get input filename");
+				}
+		}
 }
 
 
-static bool GetScaffoldData (const char * const filename_s, const char * const scaffold_name_s, int break_index, ByteBuffer *buffer_p)
+static bool GetScaffoldData (IndexData *index_data_p, const char * const scaffold_name_s, int break_index, const MaskMode mask_mode, const LowComplexitySettings *low_complexity_p, const uint32 split_gap_length, ByteBuffer *buffer_p)
 {
 	bool success_flag = false;
+	const char * const filename_s = index_data_p -> id_fasta_filename_s;
 	faidx_t *fai_p = NULL;
 
 	#if SAMTOOLS_SERVICE_DEBUG >= STM_LEVEL_FINER
-	PrintLog (STM_LEVEL_FINER, __FILE__, __LINE__, "SamToolsService :: GetScaffoldData - about to load %s", filename_s);
+	PrintLog (STM_LEVEL_FINER, __FILE__, __LINE__, "SamToolsService :: GetScaffoldData - about to get index for %s", filename_s);
 	#endif
 
-	fai_p = fai_load (filename_s);
-
-	#if SAMTOOLS_SERVICE_DEBUG >= STM_LEVEL_FINER
-	PrintLog (STM_LEVEL_FINER, __FILE__, __LINE__, "SamToolsService :: GetScaffoldData - loaded %s to " SIZET_FMT, filename_s, (size_t) fai_p);
-	#endif
+	fai_p = LockIndexFaidx (index_data_p);
 
 
 	if (fai_p)
 		{
-			if (AppendStringsToByteBuffer (buffer_p, ">", scaffold_name_s, "\n", NULL))
+			/*
+			 * The soft-masked and low-complexity intervals are returned as BED
+			 * rather than FASTA and each contig gets its own header.
+			 */
+			const bool intervals_flag = (mask_mode == MM_INTERVALS) || (low_complexity_p -> lcs_mode == LC_INTERVALS);
+
+			if (intervals_flag || (split_gap_length > 0) || (AppendStringsToByteBuffer (buffer_p, ">", scaffold_name_s, "\n", NULL)))
 				{
 					int seq_len;
 					char *sequence_s = fai_fetch (fai_p, scaffold_name_s, &seq_len);
+					const char *real_name_s = scaffold_name_s;
+					hts_pos_t offset = 0;
+					MaskMode line_mask_mode = mask_mode;
+
+					int tid;
+					hts_pos_t end;
+
+					/* Get the real name and start position if a region was requested */
+					if (fai_parse_region (fai_p, scaffold_name_s, &tid, &offset, &end, 0) && (tid >= 0))
+						{
+							if (intervals_flag || (split_gap_length > 0))
+								{
+									real_name_s = faidx_iseq (fai_p, tid);
+								}
+						}
+					else
+						{
+							tid = -1;
+							offset = 0;
+						}
+
+					/* We have the sequence so other jobs can use the index while we format it */
+					UnlockIndexFaidx (index_data_p);
+					fai_p = NULL;
+
+					if (sequence_s && (tid >= 0) && (index_data_p -> id_prefetcher_p))
+						{
+							PrefetchAdjacentWindow (index_data_p -> id_prefetcher_p, tid, offset, end);
+						}
 
 					#if SAMTOOLS_SERVICE_DEBUG >= STM_LEVEL_FINER
 					PrintLog (STM_LEVEL_FINER, __FILE__, __LINE__, "SamToolsService :: GetScaffoldData - fetched %s with length %d", scaffold_name_s, seq_len);
@@ -593,73 +1222,60 @@ static bool GetScaffoldData (const char * const filename_s, const char * const s
 							PrintLog (STM_LEVEL_FINER, __FILE__, __LINE__, "SamToolsService :: GetScaffoldData - breaking at %d", break_index);
 							#endif
 
-							if (break_index > 0)
+							/* The low-complexity masking goes on top of the soft-mask handling, so apply that to the whole sequence first */
+							if (((low_complexity_p -> lcs_mode == LC_SOFT) || (low_complexity_p -> lcs_mode == LC_HARD)) && (mask_mode != MM_INTERVALS))
+								{
+									ApplyMaskMode (sequence_s, (size_t) seq_len, mask_mode);
+									line_mask_mode = MM_KEEP;
+								}
+
+							if (low_complexity_p -> lcs_mode == LC_INTERVALS)
+								{
+									success_flag = AppendLowComplexityIntervals (buffer_p, real_name_s, sequence_s, (size_t) seq_len, (uint64) offset, low_complexity_p);
+								}
+							else if (mask_mode == MM_INTERVALS)
+								{
+									success_flag = AppendSoftMaskedIntervals (buffer_p, real_name_s, sequence_s, (size_t) seq_len, (uint64) offset);
+								}
+							else if ((low_complexity_p -> lcs_mode != LC_NONE) && !ApplyLowComplexityMask (sequence_s, (size_t) seq_len, low_complexity_p))
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to mask the low-complexity regions of %s", scaffold_name_s);
+								}
+							else if (split_gap_length > 0)
+								{
+									success_flag = AppendContigs (buffer_p, real_name_s, sequence_s, (size_t) seq_len, offset, split_gap_length, (break_index > 0) ? (uint32) break_index : 0, line_mask_mode);
+								}
+							else if (break_index > 0)
 								{
-									int i = 0;
-									int block_size = break_index;
-									char *current_p = sequence_s;
-									bool loop_flag = true;
+									int i;
+									uint32 column = 0;
 
 									success_flag = true;
 
-									while (loop_flag && success_flag)
+									for (i = 0; (i < seq_len) && success_flag; i += break_index)
 										{
-											if (AppendToByteBuffer (buffer_p, current_p, block_size))
-												{
-													if (AppendToByteBuffer (buffer_p, "\n", 1))
-														{
-															if (i + break_index < seq_len)
-																{
-																	i += break_index;
-																	current_p += break_index;
-																}
-															else
-																{
-																	loop_flag = false;
-																}
-														}
-													else
-														{
-															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add new line to scaffold data %s", sequence_s);
-															success_flag = false;
-														}
-												}
-											else
+											const int block_size = (seq_len - i < break_index) ? seq_len - i : break_index;
+
+											/* Convert each line as it is copied, while it is still in the cache */
+											ApplyMaskMode (sequence_s + i, (size_t) block_size, line_mask_mode);
+
+											if (!AppendWrappedSequence (buffer_p, sequence_s + i, (size_t) block_size, (uint32) break_index, &column))
 												{
-													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to split scaffold data %s with new lines", sequence_s);
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to split scaffold data %s with new lines", scaffold_name_s);
 													success_flag = false;
 												}
 										}
 
-									if (success_flag)
+									if (success_flag && !FinishWrappedSequence (buffer_p, &column))
 										{
-											if (seq_len > i)
-												{
-													success_flag = false;
-
-													if (AppendToByteBuffer (buffer_p, current_p, seq_len - i))
-														{
-															if (AppendToByteBuffer (buffer_p, "\n", 1))
-																{
-																	success_flag = true;
-																}
-															else
-																{
-																	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add new line to scaffold data %s", sequence_s);
-																	success_flag = false;
-																}
-														}
-													else
-														{
-															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to split scaffold data %s with new lines", sequence_s);
-															success_flag = false;
-														}
-												}
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add new line to scaffold data %s", scaffold_name_s);
+											success_flag = false;
 										}
-
 								}
 							else
 								{
+									ApplyMaskMode (sequence_s, (size_t) seq_len, line_mask_mode);
+
 									if (AppendToByteBuffer (buffer_p, sequence_s, (size_t) seq_len))
 										{
 											success_flag = true;
@@ -682,7 +1298,10 @@ static bool GetScaffoldData (const char * const filename_s, const char * const s
 					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add scaffold name %s to scaffold data", scaffold_name_s);
 				}
 
-			fai_destroy (fai_p);
+			if (fai_p)
+				{
+					UnlockIndexFaidx (index_data_p);
+				}
 		}
 	else
 		{
@@ -781,7 +1400,7 @@ static ServiceMetadata *GetSamToolsServiceMetadata (Service *service_p)
 }
 
 
-static IndexData *GetSelectedIndexData (const SamToolsServiceData * const data_p, const ParameterSet *params_p)
+IndexData *GetSelectedIndexData (const SamToolsServiceData * const data_p, const ParameterSet *params_p)
 {
 	const char *index_s = NULL;
 
@@ -838,6 +1457,24 @@ static IndexData *GetSelectedIndexData (const SamToolsServiceData * const data_p
 
 
 
+IndexData *GetIndexDataByName (const SamToolsServiceData * const data_p, const char *name_s)
+{
+	IndexData *index_data_p = data_p -> stsd_index_data_p;
+	size_t i;
+
+	for (i = data_p -> stsd_index_data_size; i > 0; -- i, ++ index_data_p)
+		{
+			if (((index_data_p -> id_fasta_filename_s) && (strcmp (index_data_p -> id_fasta_filename_s, name_s) == 0)) ||
+				((index_data_p -> id_blast_db_name_s) && (strcmp (index_data_p -> id_blast_db_name_s, name_s) == 0)))
+				{
+					return index_data_p;
+				}
+		}
+
+	return NULL;
+}
+
+
 static Parameter *SetUpIndexesParamater (const SamToolsServiceData *service_data_p, ParameterSet *param_set_p, ParameterGroup *group_p)
 {
 	Parameter *param_p = NULL;
@@ -902,3 +1539,62 @@ static Parameter *SetUpIndexesParamater (const SamToolsServiceData *service_data
 
 	return NULL;;
 }
+
+
+static Parameter *SetUpModeParameter (const SamToolsServiceData *service_data_p, ParameterSet *param_set_p)
+{
+	Parameter *param_p = EasyCreateAndAddStringParameterToParameterSet (& (service_data_p -> stsd_base_data), param_set_p, NULL, SS_MODE.npt_type, SS_MODE.npt_name_s, "Mode", "What to get from the available data", S_MODE_SCAFFOLD_S, PL_ADVANCED);
+
+	if (param_p)
+		{
+			if ((CreateAndAddStringParameterOption (param_p, S_MODE_SCAFFOLD_S, "Get a scaffold's sequence")) &&
+				(CreateAndAddStringParameterOption (param_p, S_MODE_GAPS_S, "Get the runs of N within a scaffold, or all scaffolds if this is *, as BED")) &&
+				(CreateAndAddStringParameterOption (param_p, S_MODE_COMPOSITION_S, "Get the GC, N, soft-masked and CpG counts in windows across a region")) &&
+				(CreateAndAddStringParameterOption (param_p, S_MODE_MOTIFS_S, "Find the positions of motifs on both strands within a region")) &&
+				(CreateAndAddStringParameterOption (param_p, S_MODE_PRIMER_SEARCH_S, "Find the sites that match primers with up to a number of mismatches and indels")) &&
+				(CreateAndAddStringParameterOption (param_p, S_MODE_IN_SILICO_PCR_S, "Find the products that pairs of primers would amplify")) &&
+				(CreateAndAddStringParameterOption (param_p, S_MODE_SKETCH_S, "Find the nearest scaffolds, or assemblies if this is *, by MinHash distance")) &&
+				(CreateAndAddStringParameterOption (param_p, S_MODE_KMERS_S, "Get the spectrum and most frequent of the canonical k-mers within a region")) &&
+				(CreateAndAddStringParameterOption (param_p, S_MODE_ORFS_S, "Find the open reading frames in all six frames of a region")) &&
+				(CreateAndAddStringParameterOption (param_p, S_MODE_OLIGOS_S, "Tile oligos across a region and keep those that pass the Tm, GC and self-complementarity thresholds")) &&
+				(CreateAndAddStringParameterOption (param_p, S_MODE_COMPARE_S, "Align a region against a region from another index and list the differences")))
+				{
+					bool success_flag = true;
+
+					if (service_data_p -> stsd_alignment_data_size > 0)
+						{
+							success_flag = (CreateAndAddStringParameterOption (param_p, S_MODE_ALLELE_COUNTS_S, "Count the alleles at SNP positions")) &&
+								(CreateAndAddStringParameterOption (param_p, S_MODE_CONSENSUS_S, "Get the majority-consensus sequence of a sample's reads over a region")) &&
+								(CreateAndAddStringParameterOption (param_p, S_MODE_FASTQ_S, "Get a sample's reads over a region, and their mates, as FASTQ"));
+						}
+
+					if (success_flag && (service_data_p -> stsd_variant_data_size > 0))
+						{
+							success_flag = CreateAndAddStringParameterOption (param_p, S_MODE_VARIANTS_S, "Get the variants within a region");
+						}
+
+					if (success_flag && (service_data_p -> stsd_restriction_enzymes_p))
+						{
+							success_flag = CreateAndAddStringParameterOption (param_p, S_MODE_RESTRICTION_MAP_S, "Get the cut positions and fragment sizes for restriction enzymes within a region");
+						}
+
+					if (success_flag && HasFmIndexes (service_data_p))
+						{
+							success_flag = CreateAndAddStringParameterOption (param_p, S_MODE_EXACT_MATCH_S, "Count and locate the exact matches of a sequence using the FM-indexes");
+						}
+
+					if (success_flag && (service_data_p -> stsd_output_directory_s))
+						{
+							success_flag = (CreateAndAddStringParameterOption (param_p, S_MODE_EXPORT_S, "Export the selected scaffolds as a new indexed, bgzipped FASTA file")) &&
+								(CreateAndAddStringParameterOption (param_p, S_MODE_MULTI_FASTA_S, "Get all of the selected scaffolds as a single multi-FASTA file"));
+						}
+
+					if (success_flag)
+						{
+							return param_p;
+						}
+				}
+		}
+
+	return NULL;
+}
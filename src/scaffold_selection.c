@@ -0,0 +1,360 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * scaffold_selection.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <fnmatch.h>
+#include <regex.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scaffold_selection.h"
+#include "worker_pool.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "streams.h"
+
+#include "string_parameter.h"
+
+
+static NamedParameterType S_SCAFFOLD_NAMES = { "Scaffold names", PT_LARGE_STRING };
+static NamedParameterType S_SCAFFOLD_PATTERN = { "Scaffold pattern", PT_STRING };
+static NamedParameterType S_SCAFFOLD_PATTERN_TYPE = { "Scaffold pattern type", PT_STRING };
+
+
+typedef struct ScaffoldMatcher
+{
+	const faidx_t *sm_fai_p;
+	size_t sm_num_seqs;
+	char **sm_sorted_names_ss;
+	size_t sm_num_names;
+	const char *sm_pattern_s;
+	bool sm_glob_flag;
+
+	/* Set to 1 for each scaffold, in file order, that matches */
+	uint8 *sm_matches_p;
+} ScaffoldMatcher;
+
+
+static const char * const S_NAME_SEPARATORS_S = " \t\r\n,";
+
+static const char * const S_PATTERN_TYPE_REGEX_S = "regex";
+static const char * const S_PATTERN_TYPE_GLOB_S = "glob";
+
+/*
+ * The names are matched in blocks of this many so that assemblies
+ * with large numbers of unplaced contigs can be matched in parallel.
+ */
+static const size_t S_NAMES_BLOCK_SIZE = 1 << 14;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static char **GetSortedNames (char *names_s, size_t *num_names_p);
+
+static int CompareNames (const void *v0_p, const void *v1_p);
+
+static bool IsValidRegularExpression (const char *pattern_s);
+
+static bool MatchScaffoldNamesBlock (const size_t block_index, void *data_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool AddScaffoldSelectionParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	bool success_flag = false;
+
+	if (EasyCreateAndAddStringParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_SCAFFOLD_NAMES.npt_type, S_SCAFFOLD_NAMES.npt_name_s, "Scaffold names", "The names of the scaffolds to use, separated by whitespace or commas.", NULL, PL_ADVANCED))
+		{
+			if (EasyCreateAndAddStringParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_SCAFFOLD_PATTERN.npt_type, S_SCAFFOLD_PATTERN.npt_name_s, "Scaffold pattern", "A pattern that the names of the scaffolds to use must match. This is used when no Scaffold names are given.", NULL, PL_ADVANCED))
+				{
+					Parameter *param_p = EasyCreateAndAddStringParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_SCAFFOLD_PATTERN_TYPE.npt_type, S_SCAFFOLD_PATTERN_TYPE.npt_name_s, "Scaffold pattern type", "How the Scaffold pattern is matched", S_PATTERN_TYPE_REGEX_S, PL_ADVANCED);
+
+					if (param_p)
+						{
+							success_flag = (CreateAndAddStringParameterOption (param_p, S_PATTERN_TYPE_REGEX_S, "Extended regular expression, e.g. ^chr3B")) &&
+								(CreateAndAddStringParameterOption (param_p, S_PATTERN_TYPE_GLOB_S, "Shell wildcards, e.g. chrUn_*"));
+						}
+				}
+		}
+
+	return success_flag;
+}
+
+
+bool GetScaffoldSelectionParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_SCAFFOLD_NAMES.npt_name_s) == 0)
+		{
+			*pt_p = S_SCAFFOLD_NAMES.npt_type;
+		}
+	else if (strcmp (param_name_s, S_SCAFFOLD_PATTERN.npt_name_s) == 0)
+		{
+			*pt_p = S_SCAFFOLD_PATTERN.npt_type;
+		}
+	else if (strcmp (param_name_s, S_SCAFFOLD_PATTERN_TYPE.npt_name_s) == 0)
+		{
+			*pt_p = S_SCAFFOLD_PATTERN_TYPE.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+bool SelectScaffolds (IndexData *index_data_p, const ParameterSet *param_set_p, const uint32 num_threads, SelectedScaffold **scaffolds_pp, size_t *num_scaffolds_p)
+{
+	bool success_flag = false;
+	ScaffoldMatcher matcher;
+	const char *names_s = NULL;
+	const char *pattern_s = NULL;
+	const char *pattern_type_s = NULL;
+	char *names_copy_s = NULL;
+
+	*scaffolds_pp = NULL;
+	*num_scaffolds_p = 0;
+
+	matcher.sm_sorted_names_ss = NULL;
+	matcher.sm_num_names = 0;
+	matcher.sm_pattern_s = NULL;
+	matcher.sm_glob_flag = false;
+
+	GetCurrentStringParameterValueFromParameterSet (param_set_p, S_SCAFFOLD_NAMES.npt_name_s, &names_s);
+	GetCurrentStringParameterValueFromParameterSet (param_set_p, S_SCAFFOLD_PATTERN.npt_name_s, &pattern_s);
+	GetCurrentStringParameterValueFromParameterSet (param_set_p, S_SCAFFOLD_PATTERN_TYPE.npt_name_s, &pattern_type_s);
+
+	if (names_s && (*names_s != '\0'))
+		{
+			/* The names are split in place so work on a copy */
+			if ((names_copy_s = EasyCopyToNewString (names_s)) != NULL)
+				{
+					matcher.sm_sorted_names_ss = GetSortedNames (names_copy_s, & (matcher.sm_num_names));
+				}
+
+			if (! (matcher.sm_sorted_names_ss))
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to parse the scaffold names");
+				}
+		}
+	else if (pattern_s && (*pattern_s != '\0'))
+		{
+			matcher.sm_glob_flag = (pattern_type_s != NULL) && (strcmp (pattern_type_s, S_PATTERN_TYPE_GLOB_S) == 0);
+
+			/* Check that the pattern is valid before setting any workers off with it */
+			if ((matcher.sm_glob_flag) || (IsValidRegularExpression (pattern_s)))
+				{
+					matcher.sm_pattern_s = pattern_s;
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Neither %s nor %s was given", S_SCAFFOLD_NAMES.npt_name_s, S_SCAFFOLD_PATTERN.npt_name_s);
+		}
+
+	if ((matcher.sm_sorted_names_ss) || (matcher.sm_pattern_s))
+		{
+			faidx_t *fai_p = LockIndexFaidx (index_data_p);
+
+			if (fai_p)
+				{
+					const int num_seqs = faidx_nseq (fai_p);
+
+					matcher.sm_fai_p = fai_p;
+					matcher.sm_num_seqs = (num_seqs > 0) ? (size_t) num_seqs : 0;
+					matcher.sm_matches_p = (uint8 *) AllocMemoryArray (sizeof (uint8), matcher.sm_num_seqs + 1);
+
+					if (matcher.sm_matches_p)
+						{
+							const size_t num_blocks = (matcher.sm_num_seqs + S_NAMES_BLOCK_SIZE - 1) / S_NAMES_BLOCK_SIZE;
+
+							if (RunWorkerPool (num_blocks, num_threads, MatchScaffoldNamesBlock, &matcher))
+								{
+									SelectedScaffold *scaffolds_p = (SelectedScaffold *) AllocMemoryArray (sizeof (SelectedScaffold), matcher.sm_num_seqs + 1);
+
+									if (scaffolds_p)
+										{
+											size_t num_scaffolds = 0;
+											size_t i;
+
+											/* Gather the matches in file order */
+											for (i = 0; i < matcher.sm_num_seqs; ++ i)
+												{
+													if (matcher.sm_matches_p [i])
+														{
+															const char *name_s = faidx_iseq (fai_p, (int) i);
+
+															scaffolds_p [num_scaffolds].ss_name_s = name_s;
+															scaffolds_p [num_scaffolds].ss_length = faidx_seq_len64 (fai_p, name_s);
+															scaffolds_p [num_scaffolds].ss_index = (int) i;
+															++ num_scaffolds;
+														}
+												}
+
+											*scaffolds_pp = scaffolds_p;
+											*num_scaffolds_p = num_scaffolds;
+											success_flag = true;
+										}
+								}
+
+							FreeMemory (matcher.sm_matches_p);
+						}
+
+					UnlockIndexFaidx (index_data_p);
+				}
+		}
+
+	if (matcher.sm_sorted_names_ss)
+		{
+			FreeMemory (matcher.sm_sorted_names_ss);
+		}
+
+	if (names_copy_s)
+		{
+			FreeCopiedString (names_copy_s);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static char **GetSortedNames (char *names_s, size_t *num_names_p)
+{
+	/* There can't be more names than half of the characters rounded up */
+	const size_t max_num_names = (strlen (names_s) + 2) / 2;
+	char **names_ss = (char **) AllocMemoryArray (sizeof (char *), max_num_names);
+
+	if (names_ss)
+		{
+			size_t num_names = 0;
+			char *save_s = NULL;
+			char *name_s = strtok_r (names_s, S_NAME_SEPARATORS_S, &save_s);
+
+			while (name_s)
+				{
+					names_ss [num_names] = name_s;
+					++ num_names;
+
+					name_s = strtok_r (NULL, S_NAME_SEPARATORS_S, &save_s);
+				}
+
+			qsort (names_ss, num_names, sizeof (char *), CompareNames);
+
+			*num_names_p = num_names;
+		}
+
+	return names_ss;
+}
+
+
+static int CompareNames (const void *v0_p, const void *v1_p)
+{
+	return strcmp (* ((const char * const *) v0_p), * ((const char * const *) v1_p));
+}
+
+
+static bool IsValidRegularExpression (const char *pattern_s)
+{
+	regex_t pattern;
+	const int res = regcomp (&pattern, pattern_s, REG_EXTENDED | REG_NOSUB);
+
+	if (res == 0)
+		{
+			regfree (&pattern);
+			return true;
+		}
+	else
+		{
+			char error_s [256];
+
+			regerror (res, &pattern, error_s, sizeof (error_s));
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Invalid scaffold pattern \"%s\": %s", pattern_s, error_s);
+		}
+
+	return false;
+}
+
+
+static bool MatchScaffoldNamesBlock (const size_t block_index, void *data_p)
+{
+	ScaffoldMatcher *matcher_p = (ScaffoldMatcher *) data_p;
+	const size_t block_start = block_index * S_NAMES_BLOCK_SIZE;
+	const size_t block_end = (matcher_p -> sm_num_seqs - block_start < S_NAMES_BLOCK_SIZE) ? matcher_p -> sm_num_seqs : block_start + S_NAMES_BLOCK_SIZE;
+	regex_t pattern;
+	bool use_regex_flag = false;
+	size_t i;
+
+	/*
+	 * Each block gets its own compiled pattern since a regex_t
+	 * serialises the threads sharing it.
+	 */
+	if ((matcher_p -> sm_pattern_s) && ! (matcher_p -> sm_glob_flag))
+		{
+			if (regcomp (&pattern, matcher_p -> sm_pattern_s, REG_EXTENDED | REG_NOSUB) == 0)
+				{
+					use_regex_flag = true;
+				}
+			else
+				{
+					return false;
+				}
+		}
+
+	for (i = block_start; i < block_end; ++ i)
+		{
+			const char *name_s = faidx_iseq (matcher_p -> sm_fai_p, (int) i);
+			bool match_flag;
+
+			if (matcher_p -> sm_sorted_names_ss)
+				{
+					match_flag = (bsearch (&name_s, matcher_p -> sm_sorted_names_ss, matcher_p -> sm_num_names, sizeof (char *), CompareNames) != NULL);
+				}
+			else if (use_regex_flag)
+				{
+					match_flag = (regexec (&pattern, name_s, 0, NULL, 0) == 0);
+				}
+			else
+				{
+					match_flag = (fnmatch (matcher_p -> sm_pattern_s, name_s, 0) == 0);
+				}
+
+			matcher_p -> sm_matches_p [i] = match_flag ? 1 : 0;
+		}
+
+	if (use_regex_flag)
+		{
+			regfree (&pattern);
+		}
+
+	return true;
+}
@@ -0,0 +1,642 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * sequence_kernels.c
+ *
+ * @file
+ * @brief
+ */
+
+#include "sequence_kernels.h"
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+
+/*
+ * Setting the 0x20 bit folds upper case letters onto lower case ones,
+ * and 'n' is the only character that 'N' and 'n' both fold to.
+ */
+#define SK_CASE_BIT (0x20)
+#define SK_GAP_BASE ('n')
+#define SK_HARD_MASK_BASE ('N')
+
+
+static inline bool IsSoftMaskedBase (const char c)
+{
+	return ((c >= 'a') && (c <= 'z'));
+}
+
+
+static inline uint8 EncodeBase (const char c)
+{
+	switch (c | SK_CASE_BIT)
+		{
+			case 'a':
+				return 0;
+
+			case 'c':
+				return 1;
+
+			case 'g':
+				return 2;
+
+			case 't':
+				return 3;
+
+			default:
+				return INVALID_BASE;
+		}
+}
+
+
+static inline bool IsPeriodicBase (const char *sequence_s, const size_t period)
+{
+	const char c = *sequence_s | SK_CASE_BIT;
+
+	return ((c != SK_GAP_BASE) && (c == (sequence_s [period] | SK_CASE_BIT)));
+}
+
+
+#ifdef __SSE2__
+
+static inline __m128i EncodeBaseBytes (const char *sequence_s)
+{
+	const __m128i folded = _mm_or_si128 (_mm_loadu_si128 ((const __m128i *) sequence_s), _mm_set1_epi8 (SK_CASE_BIT));
+	const __m128i is_a = _mm_cmpeq_epi8 (folded, _mm_set1_epi8 ('a'));
+	const __m128i is_c = _mm_cmpeq_epi8 (folded, _mm_set1_epi8 ('c'));
+	const __m128i is_g = _mm_cmpeq_epi8 (folded, _mm_set1_epi8 ('g'));
+	const __m128i is_t = _mm_cmpeq_epi8 (folded, _mm_set1_epi8 ('t'));
+	const __m128i is_base = _mm_or_si128 (_mm_or_si128 (is_a, is_c), _mm_or_si128 (is_g, is_t));
+
+	/* A is 0, C is 1, G is 2, T is 3 and anything else is INVALID_BASE */
+	return _mm_or_si128 (_mm_or_si128 (_mm_and_si128 (is_c, _mm_set1_epi8 (1)), _mm_and_si128 (is_g, _mm_set1_epi8 (2))),
+		_mm_or_si128 (_mm_and_si128 (is_t, _mm_set1_epi8 (3)), _mm_andnot_si128 (is_base, _mm_set1_epi8 (INVALID_BASE))));
+}
+
+
+/*
+ * Get a bitmask with a bit set for each of the 16 bases starting at
+ * sequence_s that is a gap base.
+ */
+static inline uint32 GetGapMask (const char *sequence_s)
+{
+	const __m128i bases = _mm_loadu_si128 ((const __m128i *) sequence_s);
+	const __m128i folded = _mm_or_si128 (bases, _mm_set1_epi8 (SK_CASE_BIT));
+
+	return (uint32) _mm_movemask_epi8 (_mm_cmpeq_epi8 (folded, _mm_set1_epi8 (SK_GAP_BASE)));
+}
+
+
+/*
+ * Get a byte mask that is 0xFF for each lower case letter. The compares
+ * are signed but that is fine since every letter is below 0x80 and
+ * anything above that counts as negative.
+ */
+static inline __m128i GetSoftMaskedBytes (const __m128i bases)
+{
+	return _mm_and_si128 (_mm_cmpgt_epi8 (bases, _mm_set1_epi8 ('a' - 1)), _mm_cmplt_epi8 (bases, _mm_set1_epi8 ('z' + 1)));
+}
+
+
+static inline uint32 GetSoftMaskedMask (const char *sequence_s)
+{
+	return (uint32) _mm_movemask_epi8 (GetSoftMaskedBytes (_mm_loadu_si128 ((const __m128i *) sequence_s)));
+}
+
+
+/*
+ * Get a bitmask with a bit set for each of the 16 bases starting at
+ * sequence_s that matches the base period positions later. Only one
+ * side needs checking for gaps since the other has to equal it.
+ */
+static inline uint32 GetPeriodicMask (const char *sequence_s, const size_t period)
+{
+	const __m128i case_bit = _mm_set1_epi8 (SK_CASE_BIT);
+	const __m128i heads = _mm_or_si128 (_mm_loadu_si128 ((const __m128i *) sequence_s), case_bit);
+	const __m128i tails = _mm_or_si128 (_mm_loadu_si128 ((const __m128i *) (sequence_s + period)), case_bit);
+
+	return (uint32) _mm_movemask_epi8 (_mm_andnot_si128 (_mm_cmpeq_epi8 (heads, _mm_set1_epi8 (SK_GAP_BASE)), _mm_cmpeq_epi8 (heads, tails)));
+}
+
+#endif
+
+
+size_t FindNextGapBase (const char *sequence_s, size_t start, const size_t length)
+{
+	#ifdef __SSE2__
+	while (start + 16 <= length)
+		{
+			const uint32 mask = GetGapMask (sequence_s + start);
+
+			if (mask)
+				{
+					return start + __builtin_ctz (mask);
+				}
+
+			start += 16;
+		}
+	#endif
+
+	while (start < length)
+		{
+			if ((sequence_s [start] | SK_CASE_BIT) == SK_GAP_BASE)
+				{
+					return start;
+				}
+
+			++ start;
+		}
+
+	return length;
+}
+
+
+size_t FindNextNonGapBase (const char *sequence_s, size_t start, const size_t length)
+{
+	#ifdef __SSE2__
+	while (start + 16 <= length)
+		{
+			const uint32 mask = (~GetGapMask (sequence_s + start)) & 0xFFFF;
+
+			if (mask)
+				{
+					return start + __builtin_ctz (mask);
+				}
+
+			start += 16;
+		}
+	#endif
+
+	while (start < length)
+		{
+			if ((sequence_s [start] | SK_CASE_BIT) != SK_GAP_BASE)
+				{
+					return start;
+				}
+
+			++ start;
+		}
+
+	return length;
+}
+
+
+size_t FindNextSoftMaskedBase (const char *sequence_s, size_t start, const size_t length)
+{
+	#ifdef __SSE2__
+	while (start + 16 <= length)
+		{
+			const uint32 mask = GetSoftMaskedMask (sequence_s + start);
+
+			if (mask)
+				{
+					return start + __builtin_ctz (mask);
+				}
+
+			start += 16;
+		}
+	#endif
+
+	while (start < length)
+		{
+			if (IsSoftMaskedBase (sequence_s [start]))
+				{
+					return start;
+				}
+
+			++ start;
+		}
+
+	return length;
+}
+
+
+size_t FindNextUnmaskedBase (const char *sequence_s, size_t start, const size_t length)
+{
+	#ifdef __SSE2__
+	while (start + 16 <= length)
+		{
+			const uint32 mask = (~GetSoftMaskedMask (sequence_s + start)) & 0xFFFF;
+
+			if (mask)
+				{
+					return start + __builtin_ctz (mask);
+				}
+
+			start += 16;
+		}
+	#endif
+
+	while (start < length)
+		{
+			if (!IsSoftMaskedBase (sequence_s [start]))
+				{
+					return start;
+				}
+
+			++ start;
+		}
+
+	return length;
+}
+
+
+void UnmaskBases (char *sequence_s, const size_t length)
+{
+	size_t i = 0;
+
+	#ifdef __SSE2__
+	const __m128i case_bit = _mm_set1_epi8 (SK_CASE_BIT);
+
+	for ( ; i + 16 <= length; i += 16)
+		{
+			const __m128i bases = _mm_loadu_si128 ((const __m128i *) (sequence_s + i));
+
+			_mm_storeu_si128 ((__m128i *) (sequence_s + i), _mm_xor_si128 (bases, _mm_and_si128 (GetSoftMaskedBytes (bases), case_bit)));
+		}
+	#endif
+
+	for ( ; i < length; ++ i)
+		{
+			if (IsSoftMaskedBase (sequence_s [i]))
+				{
+					sequence_s [i] ^= SK_CASE_BIT;
+				}
+		}
+}
+
+
+void HardMaskBases (char *sequence_s, const size_t length)
+{
+	size_t i = 0;
+
+	#ifdef __SSE2__
+	const __m128i hard_mask_base = _mm_set1_epi8 (SK_HARD_MASK_BASE);
+
+	for ( ; i + 16 <= length; i += 16)
+		{
+			const __m128i bases = _mm_loadu_si128 ((const __m128i *) (sequence_s + i));
+			const __m128i masked = GetSoftMaskedBytes (bases);
+
+			_mm_storeu_si128 ((__m128i *) (sequence_s + i), _mm_or_si128 (_mm_and_si128 (masked, hard_mask_base), _mm_andnot_si128 (masked, bases)));
+		}
+	#endif
+
+	for ( ; i < length; ++ i)
+		{
+			if (IsSoftMaskedBase (sequence_s [i]))
+				{
+					sequence_s [i] = SK_HARD_MASK_BASE;
+				}
+		}
+}
+
+
+void CountBaseComposition (const char *sequence_s, const size_t length, const char next_base, BaseComposition *composition_p)
+{
+	size_t i = 0;
+	uint64 gc = 0;
+	uint64 at = 0;
+	uint64 n = 0;
+	uint64 soft_masked = 0;
+	uint64 cpg = 0;
+
+	#ifdef __SSE2__
+	const __m128i case_bit = _mm_set1_epi8 (SK_CASE_BIT);
+	const __m128i a = _mm_set1_epi8 ('a');
+	const __m128i c = _mm_set1_epi8 ('c');
+	const __m128i g = _mm_set1_epi8 ('g');
+	const __m128i t = _mm_set1_epi8 ('t');
+	const __m128i gap = _mm_set1_epi8 (SK_GAP_BASE);
+
+	/* Stop a byte early so the shifted load for the CpG test stays in bounds */
+	for ( ; i + 17 <= length; i += 16)
+		{
+			const __m128i bases = _mm_loadu_si128 ((const __m128i *) (sequence_s + i));
+			const __m128i folded = _mm_or_si128 (bases, case_bit);
+			const __m128i next_folded = _mm_or_si128 (_mm_loadu_si128 ((const __m128i *) (sequence_s + i + 1)), case_bit);
+			const __m128i is_c = _mm_cmpeq_epi8 (folded, c);
+			const __m128i is_g = _mm_cmpeq_epi8 (folded, g);
+
+			gc += __builtin_popcount (_mm_movemask_epi8 (_mm_or_si128 (is_c, is_g)));
+			at += __builtin_popcount (_mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (folded, a), _mm_cmpeq_epi8 (folded, t))));
+			n += __builtin_popcount (_mm_movemask_epi8 (_mm_cmpeq_epi8 (folded, gap)));
+			soft_masked += __builtin_popcount (_mm_movemask_epi8 (GetSoftMaskedBytes (bases)));
+			cpg += __builtin_popcount (_mm_movemask_epi8 (_mm_and_si128 (is_c, _mm_cmpeq_epi8 (next_folded, g))));
+		}
+	#endif
+
+	for ( ; i < length; ++ i)
+		{
+			const char base = sequence_s [i] | SK_CASE_BIT;
+
+			switch (base)
+				{
+					case 'c':
+						{
+							const char next = (i + 1 < length) ? sequence_s [i + 1] : next_base;
+
+							if ((next | SK_CASE_BIT) == 'g')
+								{
+									++ cpg;
+								}
+						}
+						/* fall through */
+
+					case 'g':
+						++ gc;
+						break;
+
+					case 'a':
+					case 't':
+						++ at;
+						break;
+
+					case SK_GAP_BASE:
+						++ n;
+						break;
+
+					default:
+						break;
+				}
+
+			if (IsSoftMaskedBase (sequence_s [i]))
+				{
+					++ soft_masked;
+				}
+		}
+
+	composition_p -> bc_gc += gc;
+	composition_p -> bc_at += at;
+	composition_p -> bc_n += n;
+	composition_p -> bc_soft_masked += soft_masked;
+	composition_p -> bc_cpg += cpg;
+}
+
+
+size_t FindMotifCandidate (const char *sequence_s, size_t start, const size_t end, const char first_base, const char last_base, const size_t last_offset)
+{
+	const char first = first_base | SK_CASE_BIT;
+	const char last = last_base | SK_CASE_BIT;
+
+	#ifdef __SSE2__
+	const __m128i case_bit = _mm_set1_epi8 (SK_CASE_BIT);
+	const __m128i firsts = _mm_set1_epi8 (first);
+	const __m128i lasts = _mm_set1_epi8 (last);
+
+	/* Both loads stay in bounds since end is the sequence length minus last_offset */
+	while (start + 16 <= end)
+		{
+			const __m128i heads = _mm_or_si128 (_mm_loadu_si128 ((const __m128i *) (sequence_s + start)), case_bit);
+			const __m128i tails = _mm_or_si128 (_mm_loadu_si128 ((const __m128i *) (sequence_s + start + last_offset)), case_bit);
+			const uint32 mask = (uint32) _mm_movemask_epi8 (_mm_and_si128 (_mm_cmpeq_epi8 (heads, firsts), _mm_cmpeq_epi8 (tails, lasts)));
+
+			if (mask)
+				{
+					return start + __builtin_ctz (mask);
+				}
+
+			start += 16;
+		}
+	#endif
+
+	while (start < end)
+		{
+			if (((sequence_s [start] | SK_CASE_BIT) == first) && ((sequence_s [start + last_offset] | SK_CASE_BIT) == last))
+				{
+					return start;
+				}
+
+			++ start;
+		}
+
+	return end;
+}
+
+
+void HashKmers (const uint64 *kmers_p, uint64 *hashes_p, const size_t count, const uint64 mask)
+{
+	size_t i = 0;
+
+	#ifdef __SSE2__
+	const __m128i masks = _mm_set1_epi64x ((long long) mask);
+	const __m128i ones = _mm_set1_epi32 (-1);
+
+	while (i + 2 <= count)
+		{
+			__m128i keys = _mm_loadu_si128 ((const __m128i *) (kmers_p + i));
+
+			keys = _mm_and_si128 (_mm_add_epi64 (_mm_xor_si128 (keys, ones), _mm_slli_epi64 (keys, 21)), masks);
+			keys = _mm_xor_si128 (keys, _mm_srli_epi64 (keys, 24));
+			keys = _mm_and_si128 (_mm_add_epi64 (_mm_add_epi64 (keys, _mm_slli_epi64 (keys, 3)), _mm_slli_epi64 (keys, 8)), masks);
+			keys = _mm_xor_si128 (keys, _mm_srli_epi64 (keys, 14));
+			keys = _mm_and_si128 (_mm_add_epi64 (_mm_add_epi64 (keys, _mm_slli_epi64 (keys, 2)), _mm_slli_epi64 (keys, 4)), masks);
+			keys = _mm_xor_si128 (keys, _mm_srli_epi64 (keys, 28));
+			keys = _mm_and_si128 (_mm_add_epi64 (keys, _mm_slli_epi64 (keys, 31)), masks);
+
+			_mm_storeu_si128 ((__m128i *) (hashes_p + i), keys);
+
+			i += 2;
+		}
+	#endif
+
+	while (i < count)
+		{
+			uint64 key = kmers_p [i];
+
+			key = (~key + (key << 21)) & mask;
+			key = key ^ (key >> 24);
+			key = ((key + (key << 3)) + (key << 8)) & mask;
+			key = key ^ (key >> 14);
+			key = ((key + (key << 2)) + (key << 4)) & mask;
+			key = key ^ (key >> 28);
+			key = (key + (key << 31)) & mask;
+
+			hashes_p [i] = key;
+
+			++ i;
+		}
+}
+
+
+size_t FindNextPeriodicBase (const char *sequence_s, size_t start, const size_t end, const size_t period)
+{
+	#ifdef __SSE2__
+	/* Both loads stay in bounds since end is the sequence length minus period */
+	while (start + 16 <= end)
+		{
+			const uint32 mask = GetPeriodicMask (sequence_s + start, period);
+
+			if (mask)
+				{
+					return start + __builtin_ctz (mask);
+				}
+
+			start += 16;
+		}
+	#endif
+
+	while (start < end)
+		{
+			if (IsPeriodicBase (sequence_s + start, period))
+				{
+					return start;
+				}
+
+			++ start;
+		}
+
+	return end;
+}
+
+
+size_t FindNextAperiodicBase (const char *sequence_s, size_t start, const size_t end, const size_t period)
+{
+	#ifdef __SSE2__
+	while (start + 16 <= end)
+		{
+			const uint32 mask = (~GetPeriodicMask (sequence_s + start, period)) & 0xFFFF;
+
+			if (mask)
+				{
+					return start + __builtin_ctz (mask);
+				}
+
+			start += 16;
+		}
+	#endif
+
+	while (start < end)
+		{
+			if (!IsPeriodicBase (sequence_s + start, period))
+				{
+					return start;
+				}
+
+			++ start;
+		}
+
+	return end;
+}
+
+
+void EncodeBases (const char *sequence_s, uint8 *codes_p, const size_t length)
+{
+	size_t i = 0;
+
+	#ifdef __SSE2__
+	while (i + 16 <= length)
+		{
+			_mm_storeu_si128 ((__m128i *) (codes_p + i), EncodeBaseBytes (sequence_s + i));
+			i += 16;
+		}
+	#endif
+
+	while (i < length)
+		{
+			codes_p [i] = EncodeBase (sequence_s [i]);
+			++ i;
+		}
+}
+
+
+void EncodeCodons (const char *sequence_s, uint8 *codons_p, const size_t num_codons)
+{
+	size_t i = 0;
+
+	#ifdef __SSE2__
+	const __m128i invalid_bit = _mm_set1_epi8 (INVALID_BASE);
+
+	while (i + 16 <= num_codons)
+		{
+			const __m128i first = EncodeBaseBytes (sequence_s + i);
+			const __m128i second = EncodeBaseBytes (sequence_s + i + 1);
+			const __m128i third = EncodeBaseBytes (sequence_s + i + 2);
+
+			/* Every byte is at most 4 so the 16-bit shifts can't carry into the next byte */
+			const __m128i codons = _mm_or_si128 (_mm_or_si128 (_mm_slli_epi16 (first, 4), _mm_slli_epi16 (second, 2)), third);
+			const __m128i invalid = _mm_cmpeq_epi8 (_mm_and_si128 (_mm_or_si128 (_mm_or_si128 (first, second), third), invalid_bit), invalid_bit);
+
+			_mm_storeu_si128 ((__m128i *) (codons_p + i), _mm_or_si128 (codons, invalid));
+
+			i += 16;
+		}
+	#endif
+
+	while (i < num_codons)
+		{
+			const uint8 first = EncodeBase (sequence_s [i]);
+			const uint8 second = EncodeBase (sequence_s [i + 1]);
+			const uint8 third = EncodeBase (sequence_s [i + 2]);
+
+			codons_p [i] = ((first | second | third) & INVALID_BASE) ? INVALID_CODON : (uint8) ((first << 4) | (second << 2) | third);
+
+			++ i;
+		}
+}
+
+
+size_t FindNextTargetCodon (const uint8 *codons_p, size_t start, const size_t end, const uint8 *targets_p, const size_t num_targets)
+{
+	size_t i;
+
+	#ifdef __SSE2__
+	__m128i targets [MAX_TARGET_CODONS];
+
+	for (i = 0; i < num_targets; ++ i)
+		{
+			targets [i] = _mm_set1_epi8 ((char) (targets_p [i]));
+		}
+
+	while (start + 16 <= end)
+		{
+			const __m128i codons = _mm_loadu_si128 ((const __m128i *) (codons_p + start));
+			__m128i matches = _mm_setzero_si128 ();
+			uint32 mask;
+
+			for (i = 0; i < num_targets; ++ i)
+				{
+					matches = _mm_or_si128 (matches, _mm_cmpeq_epi8 (codons, targets [i]));
+				}
+
+			mask = (uint32) _mm_movemask_epi8 (matches);
+
+			if (mask)
+				{
+					return start + __builtin_ctz (mask);
+				}
+
+			start += 16;
+		}
+	#endif
+
+	while (start < end)
+		{
+			for (i = 0; i < num_targets; ++ i)
+				{
+					if (codons_p [start] == targets_p [i])
+						{
+							return start;
+						}
+				}
+
+			++ start;
+		}
+
+	return end;
+}
@@ -0,0 +1,172 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * sidecar_builder.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <pthread.h>
+
+#include "sidecar_builder.h"
+#include "composition_track.h"
+#include "read_name_index.h"
+#include "minhash_sketch.h"
+#include "gap_map.h"
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+typedef struct SidecarBuilder
+{
+	SamToolsServiceData *sb_data_p;
+	uint32 sb_flags;
+	pthread_t sb_thread;
+	volatile bool sb_stop_flag;
+} SidecarBuilder;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static void *RunSidecarBuilder (void *data_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool StartSidecarBuilder (SamToolsServiceData *data_p, const uint32 flags)
+{
+	SidecarBuilder *builder_p = (SidecarBuilder *) AllocMemory (sizeof (SidecarBuilder));
+
+	if (builder_p)
+		{
+			builder_p -> sb_data_p = data_p;
+			builder_p -> sb_flags = flags;
+			builder_p -> sb_stop_flag = false;
+
+			if (pthread_create (& (builder_p -> sb_thread), NULL, RunSidecarBuilder, builder_p) == 0)
+				{
+					data_p -> stsd_sidecar_builder_p = builder_p;
+					return true;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to start sidecar builder");
+				}
+
+			FreeMemory (builder_p);
+		}
+
+	return false;
+}
+
+
+void StopSidecarBuilder (SamToolsServiceData *data_p)
+{
+	SidecarBuilder *builder_p = data_p -> stsd_sidecar_builder_p;
+
+	if (builder_p)
+		{
+			builder_p -> sb_stop_flag = true;
+			pthread_join (builder_p -> sb_thread, NULL);
+
+			FreeMemory (builder_p);
+			data_p -> stsd_sidecar_builder_p = NULL;
+		}
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+/*
+ * The jobs only ever map these files once they are up to date, so
+ * nothing needs to be locked while they are written.
+ */
+static void *RunSidecarBuilder (void *data_p)
+{
+	SidecarBuilder *builder_p = (SidecarBuilder *) data_p;
+	SamToolsServiceData *service_data_p = builder_p -> sb_data_p;
+	size_t i;
+
+	if (builder_p -> sb_flags & SB_COMPOSITION_TRACKS)
+		{
+			for (i = 0; (i < service_data_p -> stsd_index_data_size) && (! (builder_p -> sb_stop_flag)); ++ i)
+				{
+					IndexData *index_data_p = service_data_p -> stsd_index_data_p + i;
+
+					if (index_data_p -> id_fasta_filename_s)
+						{
+							if (!BuildIndexCompositionTrack (index_data_p, service_data_p -> stsd_sidecar_directory_s, & (builder_p -> sb_stop_flag)))
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to build composition track for \"%s\"", index_data_p -> id_fasta_filename_s);
+								}
+						}
+				}
+		}
+
+	if (builder_p -> sb_flags & SB_GAP_MAPS)
+		{
+			for (i = 0; (i < service_data_p -> stsd_index_data_size) && (! (builder_p -> sb_stop_flag)); ++ i)
+				{
+					IndexData *index_data_p = service_data_p -> stsd_index_data_p + i;
+
+					if (index_data_p -> id_fasta_filename_s)
+						{
+							if (!BuildIndexGapMap (index_data_p, service_data_p -> stsd_sidecar_directory_s, & (builder_p -> sb_stop_flag)))
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to build gap map for \"%s\"", index_data_p -> id_fasta_filename_s);
+								}
+						}
+				}
+		}
+
+	if (builder_p -> sb_flags & SB_SCAFFOLD_SKETCHES)
+		{
+			for (i = 0; (i < service_data_p -> stsd_index_data_size) && (! (builder_p -> sb_stop_flag)); ++ i)
+				{
+					IndexData *index_data_p = service_data_p -> stsd_index_data_p + i;
+
+					if (index_data_p -> id_fasta_filename_s)
+						{
+							if (!BuildIndexScaffoldSketches (index_data_p, service_data_p -> stsd_sidecar_directory_s, & (builder_p -> sb_stop_flag)))
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to build scaffold sketches for \"%s\"", index_data_p -> id_fasta_filename_s);
+								}
+						}
+				}
+		}
+
+	if (builder_p -> sb_flags & SB_READ_NAME_INDEXES)
+		{
+			for (i = 0; (i < service_data_p -> stsd_alignment_data_size) && (! (builder_p -> sb_stop_flag)); ++ i)
+				{
+					const AlignmentData *alignment_data_p = service_data_p -> stsd_alignment_data_p + i;
+
+					if (!BuildReadNameIndexSidecar (alignment_data_p -> ad_filename_s, service_data_p -> stsd_sidecar_directory_s, & (builder_p -> sb_stop_flag)))
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to build read name index for \"%s\"", alignment_data_p -> ad_filename_s);
+						}
+				}
+		}
+
+	return NULL;
+}
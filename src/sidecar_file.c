@@ -0,0 +1,217 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * sidecar_file.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sidecar_file.h"
+#include "string_utils.h"
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+static const char * const S_TEMP_SUFFIX_S = ".tmp";
+
+
+char *MakeSidecarFilename (const char *directory_s, const char *filename_s, const char *suffix_s)
+{
+	char *sidecar_filename_s = NULL;
+
+	if (directory_s)
+		{
+			const char *basename_s = strrchr (filename_s, '/');
+
+			basename_s = basename_s ? basename_s + 1 : filename_s;
+
+			sidecar_filename_s = ConcatenateVarargsStrings (directory_s, "/", basename_s, suffix_s, NULL);
+		}
+	else
+		{
+			sidecar_filename_s = ConcatenateStrings (filename_s, suffix_s);
+		}
+
+	if (!sidecar_filename_s)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to make sidecar filename for \"%s\"", filename_s);
+		}
+
+	return sidecar_filename_s;
+}
+
+
+bool IsSidecarFileUpToDate (const char *sidecar_filename_s, const char *filename_s)
+{
+	struct stat sidecar_info;
+
+	if (stat (sidecar_filename_s, &sidecar_info) == 0)
+		{
+			struct stat info;
+
+			if (stat (filename_s, &info) == 0)
+				{
+					return (sidecar_info.st_mtime >= info.st_mtime);
+				}
+		}
+
+	return false;
+}
+
+
+bool WriteSidecarFile (const char *sidecar_filename_s, const void *header_p, const size_t header_size, const void *data_p, const size_t data_size)
+{
+	SidecarWriter *writer_p = OpenSidecarWriter (sidecar_filename_s);
+
+	if (writer_p)
+		{
+			const bool written_flag = (WriteSidecarData (writer_p, header_p, header_size)) && (WriteSidecarData (writer_p, data_p, data_size));
+
+			return CloseSidecarWriter (writer_p, written_flag);
+		}
+
+	return false;
+}
+
+
+SidecarWriter *OpenSidecarWriter (const char *sidecar_filename_s)
+{
+	SidecarWriter *writer_p = (SidecarWriter *) AllocMemory (sizeof (SidecarWriter));
+
+	if (writer_p)
+		{
+			writer_p -> sw_filename_s = EasyCopyToNewString (sidecar_filename_s);
+
+			if (writer_p -> sw_filename_s)
+				{
+					writer_p -> sw_temp_filename_s = ConcatenateStrings (sidecar_filename_s, S_TEMP_SUFFIX_S);
+
+					if (writer_p -> sw_temp_filename_s)
+						{
+							writer_p -> sw_out_f = fopen (writer_p -> sw_temp_filename_s, "wb");
+
+							if (writer_p -> sw_out_f)
+								{
+									return writer_p;
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to open \"%s\" for writing", writer_p -> sw_temp_filename_s);
+								}
+
+							FreeCopiedString (writer_p -> sw_temp_filename_s);
+						}
+
+					FreeCopiedString (writer_p -> sw_filename_s);
+				}
+
+			FreeMemory (writer_p);
+		}
+
+	return NULL;
+}
+
+
+bool WriteSidecarData (SidecarWriter *writer_p, const void *data_p, const size_t data_size)
+{
+	return (fwrite (data_p, 1, data_size, writer_p -> sw_out_f) == data_size);
+}
+
+
+bool CloseSidecarWriter (SidecarWriter *writer_p, bool keep_flag)
+{
+	bool success_flag = false;
+
+	if (fclose (writer_p -> sw_out_f) != 0)
+		{
+			keep_flag = false;
+		}
+
+	if (keep_flag && (rename (writer_p -> sw_temp_filename_s, writer_p -> sw_filename_s) == 0))
+		{
+			success_flag = true;
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to write \"%s\"", writer_p -> sw_filename_s);
+			remove (writer_p -> sw_temp_filename_s);
+		}
+
+	FreeCopiedString (writer_p -> sw_temp_filename_s);
+	FreeCopiedString (writer_p -> sw_filename_s);
+	FreeMemory (writer_p);
+
+	return success_flag;
+}
+
+
+bool OpenMappedFile (MappedFile *mapped_file_p, const char *filename_s)
+{
+	bool success_flag = false;
+	int fd = open (filename_s, O_RDONLY);
+
+	mapped_file_p -> mf_data_p = NULL;
+	mapped_file_p -> mf_size = 0;
+
+	if (fd != -1)
+		{
+			struct stat info;
+
+			if ((fstat (fd, &info) == 0) && (info.st_size > 0))
+				{
+					void *data_p = mmap (NULL, (size_t) info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+					if (data_p != MAP_FAILED)
+						{
+							mapped_file_p -> mf_data_p = data_p;
+							mapped_file_p -> mf_size = (size_t) info.st_size;
+							success_flag = true;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to map \"%s\"", filename_s);
+						}
+				}
+
+			/* The mapping stays valid after the file is closed */
+			close (fd);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to open \"%s\"", filename_s);
+		}
+
+	return success_flag;
+}
+
+
+void CloseMappedFile (MappedFile *mapped_file_p)
+{
+	if (mapped_file_p -> mf_data_p)
+		{
+			munmap ((void *) (mapped_file_p -> mf_data_p), mapped_file_p -> mf_size);
+			mapped_file_p -> mf_data_p = NULL;
+			mapped_file_p -> mf_size = 0;
+		}
+}
@@ -0,0 +1,144 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * soft_mask.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <string.h>
+
+#include "soft_mask.h"
+#include "sequence_kernels.h"
+#include "streams.h"
+
+#include "string_parameter.h"
+
+
+static NamedParameterType S_MASK_MODE = { "Mask mode", PT_STRING };
+
+
+static const char * const S_MASK_MODE_KEEP_S = "keep";
+static const char * const S_MASK_MODE_UPPER_S = "upper";
+static const char * const S_MASK_MODE_HARD_S = "hard";
+static const char * const S_MASK_MODE_INTERVALS_S = "intervals";
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool AddSoftMaskParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	bool success_flag = false;
+	Parameter *param_p = EasyCreateAndAddStringParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_MASK_MODE.npt_type, S_MASK_MODE.npt_name_s, "Mask mode", "What to do with the soft-masked, lower case, bases of a scaffold", S_MASK_MODE_KEEP_S, PL_ADVANCED);
+
+	if (param_p)
+		{
+			success_flag = (CreateAndAddStringParameterOption (param_p, S_MASK_MODE_KEEP_S, "Leave them as they are")) &&
+				(CreateAndAddStringParameterOption (param_p, S_MASK_MODE_UPPER_S, "Convert them to upper case")) &&
+				(CreateAndAddStringParameterOption (param_p, S_MASK_MODE_HARD_S, "Replace them with N")) &&
+				(CreateAndAddStringParameterOption (param_p, S_MASK_MODE_INTERVALS_S, "Get their intervals as BED instead of the sequence"));
+		}
+
+	return success_flag;
+}
+
+
+bool GetSoftMaskParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_MASK_MODE.npt_name_s) == 0)
+		{
+			*pt_p = S_MASK_MODE.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+MaskMode GetMaskMode (const ParameterSet *param_set_p)
+{
+	MaskMode mode = MM_KEEP;
+	const char *mode_s = NULL;
+
+	if (GetCurrentStringParameterValueFromParameterSet (param_set_p, S_MASK_MODE.npt_name_s, &mode_s) && mode_s)
+		{
+			if (strcmp (mode_s, S_MASK_MODE_UPPER_S) == 0)
+				{
+					mode = MM_UPPER;
+				}
+			else if (strcmp (mode_s, S_MASK_MODE_HARD_S) == 0)
+				{
+					mode = MM_HARD;
+				}
+			else if (strcmp (mode_s, S_MASK_MODE_INTERVALS_S) == 0)
+				{
+					mode = MM_INTERVALS;
+				}
+			else if (strcmp (mode_s, S_MASK_MODE_KEEP_S) != 0)
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Unknown mask mode \"%s\", keeping the soft-masking", mode_s);
+				}
+		}
+
+	return mode;
+}
+
+
+void ApplyMaskMode (char *sequence_s, const size_t length, const MaskMode mode)
+{
+	switch (mode)
+		{
+			case MM_UPPER:
+				UnmaskBases (sequence_s, length);
+				break;
+
+			case MM_HARD:
+				HardMaskBases (sequence_s, length);
+				break;
+
+			default:
+				break;
+		}
+}
+
+
+bool AppendSoftMaskedIntervals (ByteBuffer *buffer_p, const char *scaffold_name_s, const char *sequence_s, const size_t length, const uint64 offset)
+{
+	size_t i = 0;
+
+	while ((i = FindNextSoftMaskedBase (sequence_s, i, length)) < length)
+		{
+			const size_t end = FindNextUnmaskedBase (sequence_s, i, length);
+
+			if (!AppendVarArgsToByteBuffer (buffer_p, "%s\t" UINT64_FMT "\t" UINT64_FMT "\n", scaffold_name_s, offset + i, offset + end))
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add soft-masked interval for %s", scaffold_name_s);
+					return false;
+				}
+
+			i = end;
+		}
+
+	return true;
+}
@@ -0,0 +1,591 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * variant_data.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <string.h>
+
+#include "variant_data.h"
+#include "samtools_service_data.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "byte_buffer.h"
+#include "audit.h"
+
+#include "string_parameter.h"
+
+#include "htslib/kstring.h"
+
+
+#ifdef _DEBUG
+	#define VARIANT_DATA_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define VARIANT_DATA_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+static NamedParameterType S_VARIANT_FILE = { "Variant file", PT_STRING };
+static NamedParameterType S_VARIANT_SAMPLES = { "Variant samples", PT_STRING };
+
+
+/*
+ * The value of the Variant samples parameter that requests the
+ * genotypes for all of the samples.
+ */
+static const char * const S_ALL_SAMPLES_S = "*";
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool OpenVariantData (VariantData *variant_data_p);
+
+static bool LockVariantData (VariantData *variant_data_p);
+
+static void UnlockVariantData (VariantData *variant_data_p);
+
+static VariantData *GetRequestedVariantData (const SamToolsServiceData *data_p, const ParameterSet *param_set_p);
+
+static bcf_hdr_t *CreateQueryHeader (const VariantData *variant_data_p, const char *samples_s);
+
+static json_t *GetVariantsInRegion (VariantData *variant_data_p, bcf_hdr_t *header_p, const char *region_s);
+
+static json_t *GetVariantAsJSON (const bcf_hdr_t *header_p, bcf1_t *record_p, int32 **genotypes_pp, int *genotypes_size_p, ByteBuffer *buffer_p);
+
+static json_t *GetSampleNamesAsJSON (const bcf_hdr_t *header_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool InitVariantData (VariantData *variant_data_p, const char *name_s, const char *filename_s)
+{
+	variant_data_p -> vd_name_s = name_s;
+	variant_data_p -> vd_filename_s = filename_s;
+	variant_data_p -> vd_file_p = NULL;
+	variant_data_p -> vd_header_p = NULL;
+	variant_data_p -> vd_tbx_p = NULL;
+	variant_data_p -> vd_index_p = NULL;
+
+	if (pthread_mutex_init (& (variant_data_p -> vd_mutex), NULL) == 0)
+		{
+			return true;
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise mutex for \"%s\"", filename_s);
+		}
+
+	return false;
+}
+
+
+void ClearVariantData (VariantData *variant_data_p)
+{
+	if (variant_data_p -> vd_tbx_p)
+		{
+			tbx_destroy (variant_data_p -> vd_tbx_p);
+			variant_data_p -> vd_tbx_p = NULL;
+		}
+
+	if (variant_data_p -> vd_index_p)
+		{
+			hts_idx_destroy (variant_data_p -> vd_index_p);
+			variant_data_p -> vd_index_p = NULL;
+		}
+
+	if (variant_data_p -> vd_header_p)
+		{
+			bcf_hdr_destroy (variant_data_p -> vd_header_p);
+			variant_data_p -> vd_header_p = NULL;
+		}
+
+	if (variant_data_p -> vd_file_p)
+		{
+			bcf_close (variant_data_p -> vd_file_p);
+			variant_data_p -> vd_file_p = NULL;
+		}
+
+	pthread_mutex_destroy (& (variant_data_p -> vd_mutex));
+}
+
+
+bool AddVariantsParameters (SamToolsServiceData *data_p, ParameterSet *param_set_p)
+{
+	bool success_flag = false;
+	const VariantData *variant_data_p = data_p -> stsd_variant_data_p;
+	Parameter *param_p = EasyCreateAndAddStringParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_VARIANT_FILE.npt_type, S_VARIANT_FILE.npt_name_s, "Variant file", "The variant file to get the variants from", variant_data_p -> vd_name_s, PL_ADVANCED);
+
+	if (param_p)
+		{
+			size_t i;
+
+			success_flag = true;
+
+			for (i = 0; (i < data_p -> stsd_variant_data_size) && success_flag; ++ i, ++ variant_data_p)
+				{
+					success_flag = CreateAndAddStringParameterOption (param_p, variant_data_p -> vd_name_s, variant_data_p -> vd_name_s);
+				}
+
+			if (success_flag)
+				{
+					success_flag = (EasyCreateAndAddStringParameterToParameterSet (& (data_p -> stsd_base_data), param_set_p, NULL, S_VARIANT_SAMPLES.npt_type, S_VARIANT_SAMPLES.npt_name_s, "Variant samples",
+						"A comma-separated list of the samples to get genotypes for. Use * for all of the samples. If this is empty, then no genotypes are returned.", NULL, PL_ADVANCED) != NULL);
+				}
+		}
+
+	return success_flag;
+}
+
+
+bool GetVariantsParameterTypeForNamedParameter (const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, S_VARIANT_FILE.npt_name_s) == 0)
+		{
+			*pt_p = S_VARIANT_FILE.npt_type;
+		}
+	else if (strcmp (param_name_s, S_VARIANT_SAMPLES.npt_name_s) == 0)
+		{
+			*pt_p = S_VARIANT_SAMPLES.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+void RunVariantsJob (Service *service_p, ParameterSet *param_set_p)
+{
+	SamToolsServiceData *data_p = (SamToolsServiceData *) (service_p -> se_data_p);
+	const char *region_s = NULL;
+
+	if (GetCurrentStringParameterValueFromParameterSet (param_set_p, SS_SCAFFOLD.npt_name_s, &region_s) && region_s)
+		{
+			VariantData *variant_data_p = GetRequestedVariantData (data_p, param_set_p);
+
+			if (variant_data_p)
+				{
+					ServiceJob *job_p = CreateAndAddServiceJobToService (service_p, region_s, variant_data_p -> vd_name_s, NULL, NULL, NULL);
+
+					if (job_p)
+						{
+							LogParameterSet (param_set_p, job_p);
+
+							SetServiceJobStatus (job_p, OS_STARTED);
+							LogServiceJob (job_p);
+
+							/* Assume failure */
+							SetServiceJobStatus (job_p, OS_FAILED);
+
+							if (LockVariantData (variant_data_p))
+								{
+									const char *samples_s = NULL;
+									bcf_hdr_t *header_p;
+
+									GetCurrentStringParameterValueFromParameterSet (param_set_p, S_VARIANT_SAMPLES.npt_name_s, &samples_s);
+
+									header_p = CreateQueryHeader (variant_data_p, samples_s);
+
+									if (header_p)
+										{
+											json_t *variants_p = GetVariantsInRegion (variant_data_p, header_p, region_s);
+
+											if (variants_p)
+												{
+													json_t *result_p = json_object ();
+
+													if (result_p)
+														{
+															if ((json_object_set_new (result_p, "columns", json_pack ("[s,s,s,s,s,s,s,s]", "chromosome", "position", "id", "ref", "alt", "qual", "filter", "genotypes")) == 0) &&
+																(json_object_set_new (result_p, "samples", GetSampleNamesAsJSON (header_p)) == 0) &&
+																(json_object_set (result_p, "variants", variants_p) == 0))
+																{
+																	if (AddInlineResultToServiceJob (job_p, region_s, result_p))
+																		{
+																			SetServiceJobStatus (job_p, OS_SUCCEEDED);
+																		}
+																}
+
+															json_decref (result_p);
+														}
+
+													json_decref (variants_p);
+												}
+											else
+												{
+													AddGeneralErrorMessageToServiceJob (job_p, "Failed to get variants");
+												}
+
+											bcf_hdr_destroy (header_p);
+										}
+									else
+										{
+											AddGeneralErrorMessageToServiceJob (job_p, "Failed to select samples");
+										}
+
+									UnlockVariantData (variant_data_p);
+								}
+							else
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "Failed to open variant file");
+								}
+
+							LogServiceJob (job_p);
+						}		/* if (job_p) */
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get %s parameter", S_VARIANT_FILE.npt_name_s);
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get %s parameter", SS_SCAFFOLD.npt_name_s);
+		}
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static bool OpenVariantData (VariantData *variant_data_p)
+{
+	variant_data_p -> vd_file_p = bcf_open (variant_data_p -> vd_filename_s, "r");
+
+	if (variant_data_p -> vd_file_p)
+		{
+			variant_data_p -> vd_header_p = bcf_hdr_read (variant_data_p -> vd_file_p);
+
+			if (variant_data_p -> vd_header_p)
+				{
+					if (hts_get_format (variant_data_p -> vd_file_p) -> format == bcf)
+						{
+							variant_data_p -> vd_index_p = bcf_index_load (variant_data_p -> vd_filename_s);
+						}
+					else
+						{
+							variant_data_p -> vd_tbx_p = tbx_index_load (variant_data_p -> vd_filename_s);
+						}
+
+					if ((variant_data_p -> vd_index_p) || (variant_data_p -> vd_tbx_p))
+						{
+							return true;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to load index for \"%s\"", variant_data_p -> vd_filename_s);
+						}
+
+					bcf_hdr_destroy (variant_data_p -> vd_header_p);
+					variant_data_p -> vd_header_p = NULL;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to read header from \"%s\"", variant_data_p -> vd_filename_s);
+				}
+
+			bcf_close (variant_data_p -> vd_file_p);
+			variant_data_p -> vd_file_p = NULL;
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to open \"%s\"", variant_data_p -> vd_filename_s);
+		}
+
+	return false;
+}
+
+
+static bool LockVariantData (VariantData *variant_data_p)
+{
+	pthread_mutex_lock (& (variant_data_p -> vd_mutex));
+
+	if ((variant_data_p -> vd_header_p) || (OpenVariantData (variant_data_p)))
+		{
+			return true;
+		}
+
+	pthread_mutex_unlock (& (variant_data_p -> vd_mutex));
+
+	return false;
+}
+
+
+static void UnlockVariantData (VariantData *variant_data_p)
+{
+	pthread_mutex_unlock (& (variant_data_p -> vd_mutex));
+}
+
+
+static VariantData *GetRequestedVariantData (const SamToolsServiceData *data_p, const ParameterSet *param_set_p)
+{
+	const char *name_s = NULL;
+
+	if (GetCurrentStringParameterValueFromParameterSet (param_set_p, S_VARIANT_FILE.npt_name_s, &name_s) && name_s)
+		{
+			VariantData *variant_data_p = data_p -> stsd_variant_data_p;
+			size_t i;
+
+			for (i = data_p -> stsd_variant_data_size; i > 0; -- i, ++ variant_data_p)
+				{
+					if (strcmp (variant_data_p -> vd_name_s, name_s) == 0)
+						{
+							return variant_data_p;
+						}
+				}
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Copy the file's header and restrict it to the requested samples so that
+ * the genotypes of any other samples are never decoded.
+ */
+static bcf_hdr_t *CreateQueryHeader (const VariantData *variant_data_p, const char *samples_s)
+{
+	bcf_hdr_t *header_p = bcf_hdr_dup (variant_data_p -> vd_header_p);
+
+	if (header_p)
+		{
+			int res;
+
+			if ((samples_s == NULL) || (*samples_s == '\0'))
+				{
+					res = bcf_hdr_set_samples (header_p, NULL, 0);
+				}
+			else if (strcmp (samples_s, S_ALL_SAMPLES_S) == 0)
+				{
+					res = bcf_hdr_set_samples (header_p, "-", 0);
+				}
+			else
+				{
+					res = bcf_hdr_set_samples (header_p, samples_s, 0);
+				}
+
+			if (res == 0)
+				{
+					return header_p;
+				}
+			else if (res > 0)
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Sample %d of \"%s\" is not in \"%s\"", res, samples_s, variant_data_p -> vd_filename_s);
+					return header_p;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set samples to \"%s\" for \"%s\"", samples_s, variant_data_p -> vd_filename_s);
+				}
+
+			bcf_hdr_destroy (header_p);
+		}
+
+	return NULL;
+}
+
+
+static json_t *GetVariantsInRegion (VariantData *variant_data_p, bcf_hdr_t *header_p, const char *region_s)
+{
+	json_t *variants_p = json_array ();
+
+	if (variants_p)
+		{
+			bcf1_t *record_p = bcf_init ();
+
+			if (record_p)
+				{
+					ByteBuffer *buffer_p = AllocateByteBuffer (1024);
+
+					if (buffer_p)
+						{
+							int32 *genotypes_p = NULL;
+							int genotypes_size = 0;
+							bool success_flag = true;
+
+							if (variant_data_p -> vd_tbx_p)
+								{
+									hts_itr_t *itr_p = tbx_itr_querys (variant_data_p -> vd_tbx_p, region_s);
+
+									if (itr_p)
+										{
+											kstring_t line = KS_INITIALIZE;
+
+											while (success_flag && (tbx_itr_next (variant_data_p -> vd_file_p, variant_data_p -> vd_tbx_p, itr_p, &line) >= 0))
+												{
+													if (vcf_parse (&line, header_p, record_p) == 0)
+														{
+															success_flag = (json_array_append_new (variants_p, GetVariantAsJSON (header_p, record_p, &genotypes_p, &genotypes_size, buffer_p)) == 0);
+														}
+												}
+
+											ks_free (&line);
+											tbx_itr_destroy (itr_p);
+										}
+								}
+							else
+								{
+									hts_itr_t *itr_p = bcf_itr_querys (variant_data_p -> vd_index_p, variant_data_p -> vd_header_p, region_s);
+
+									if (itr_p)
+										{
+											while (success_flag && (bcf_itr_next (variant_data_p -> vd_file_p, itr_p, record_p) >= 0))
+												{
+													/* Reading through an iterator doesn't subset the samples itself */
+													if ((header_p -> keep_samples == NULL) || (bcf_subset_format (header_p, record_p) == 0))
+														{
+															success_flag = (json_array_append_new (variants_p, GetVariantAsJSON (header_p, record_p, &genotypes_p, &genotypes_size, buffer_p)) == 0);
+														}
+												}
+
+											bcf_itr_destroy (itr_p);
+										}
+								}
+
+							if (genotypes_p)
+								{
+									free (genotypes_p);
+								}
+
+							FreeByteBuffer (buffer_p);
+
+							if (success_flag)
+								{
+									bcf_destroy (record_p);
+									return variants_p;
+								}
+						}
+
+					bcf_destroy (record_p);
+				}
+
+			json_decref (variants_p);
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Each variant is stored as an array rather than an object to keep
+ * the output compact. The columns are listed in the result.
+ */
+static json_t *GetVariantAsJSON (const bcf_hdr_t *header_p, bcf1_t *record_p, int32 **genotypes_pp, int *genotypes_size_p, ByteBuffer *buffer_p)
+{
+	json_t *variant_p = json_array ();
+
+	if (variant_p)
+		{
+			json_t *alts_p = json_array ();
+			json_t *filters_p = json_array ();
+			const int num_samples = bcf_hdr_nsamples (header_p);
+			uint32 i;
+
+			bcf_unpack (record_p, BCF_UN_STR | BCF_UN_FLT);
+
+			for (i = 1; i < record_p -> n_allele; ++ i)
+				{
+					json_array_append_new (alts_p, json_string (record_p -> d.allele [i]));
+				}
+
+			for (i = 0; i < (uint32) (record_p -> d.n_flt); ++ i)
+				{
+					json_array_append_new (filters_p, json_string (bcf_hdr_int2id (header_p, BCF_DT_ID, record_p -> d.flt [i])));
+				}
+
+			json_array_append_new (variant_p, json_string (bcf_seqname (header_p, record_p)));
+			json_array_append_new (variant_p, json_integer (record_p -> pos + 1));
+			json_array_append_new (variant_p, json_string (record_p -> d.id));
+			json_array_append_new (variant_p, json_string (record_p -> d.allele [0]));
+			json_array_append_new (variant_p, alts_p);
+			json_array_append_new (variant_p, bcf_float_is_missing (record_p -> qual) ? json_null () : json_real (record_p -> qual));
+			json_array_append_new (variant_p, filters_p);
+
+			if (num_samples > 0)
+				{
+					json_t *genotypes_p = json_array ();
+					const int num_values = bcf_get_genotypes (header_p, record_p, genotypes_pp, genotypes_size_p);
+					const int ploidy = (num_values > 0) ? num_values / num_samples : 0;
+					int j;
+
+					for (j = 0; j < num_samples; ++ j)
+						{
+							const int32 *sample_gt_p = (*genotypes_pp) + (j * ploidy);
+							int k;
+
+							ResetByteBuffer (buffer_p);
+
+							for (k = 0; (k < ploidy) && (sample_gt_p [k] != bcf_int32_vector_end); ++ k)
+								{
+									char allele_s [16];
+
+									if (k > 0)
+										{
+											AppendToByteBuffer (buffer_p, bcf_gt_is_phased (sample_gt_p [k]) ? "|" : "/", 1);
+										}
+
+									if (bcf_gt_is_missing (sample_gt_p [k]))
+										{
+											strcpy (allele_s, ".");
+										}
+									else
+										{
+											snprintf (allele_s, sizeof (allele_s), "%d", bcf_gt_allele (sample_gt_p [k]));
+										}
+
+									AppendStringToByteBuffer (buffer_p, allele_s);
+								}
+
+							json_array_append_new (genotypes_p, json_string ((k > 0) ? GetByteBufferData (buffer_p) : "."));
+						}
+
+					json_array_append_new (variant_p, genotypes_p);
+				}
+		}
+
+	return variant_p;
+}
+
+
+static json_t *GetSampleNamesAsJSON (const bcf_hdr_t *header_p)
+{
+	json_t *samples_p = json_array ();
+
+	if (samples_p)
+		{
+			const int num_samples = bcf_hdr_nsamples (header_p);
+			int i;
+
+			for (i = 0; i < num_samples; ++ i)
+				{
+					json_array_append_new (samples_p, json_string (header_p -> samples [i]));
+				}
+		}
+
+	return samples_p;
+}
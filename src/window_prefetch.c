@@ -0,0 +1,588 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * window_prefetch.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "window_prefetch.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "streams.h"
+
+#include "htslib/hts_endian.h"
+
+
+#ifdef _DEBUG
+	#define WINDOW_PREFETCH_DEBUG	(STM_LEVEL_FINEST)
+#else
+	#define WINDOW_PREFETCH_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * The number of runs of requests that are followed at once. A request
+ * that doesn't continue any of them replaces the least recently used one.
+ */
+#define WP_NUM_STREAMS (16)
+
+
+/*
+ * Where a scaffold's bases are in the FASTA file, from its .fai entry.
+ */
+typedef struct ScaffoldLayout
+{
+	hts_pos_t sl_length;
+	uint64 sl_offset;
+	uint64 sl_line_bases;
+	uint64 sl_line_width;
+} ScaffoldLayout;
+
+
+/*
+ * An entry from a .gzi index.
+ */
+typedef struct BgzfBlockOffset
+{
+	uint64 bbo_compressed;
+	uint64 bbo_uncompressed;
+} BgzfBlockOffset;
+
+
+/*
+ * A run of requests moving along a scaffold. Its prefetched window counts
+ * against the budget until a request reaches it.
+ */
+typedef struct AccessStream
+{
+	int as_scaffold_index;
+	hts_pos_t as_start;
+	hts_pos_t as_end;
+	uint64 as_last_used;
+
+	hts_pos_t as_prefetch_start;
+	hts_pos_t as_prefetch_end;
+	uint64 as_prefetch_bytes;
+} AccessStream;
+
+
+struct WindowPrefetcher
+{
+	int wpf_fd;
+	uint64 wpf_file_size;
+	uint64 wpf_budget;
+
+	ScaffoldLayout *wpf_scaffolds_p;
+	size_t wpf_num_scaffolds;
+
+	/* These are NULL for an uncompressed FASTA file */
+	BgzfBlockOffset *wpf_blocks_p;
+	size_t wpf_num_blocks;
+
+	pthread_mutex_t wpf_mutex;
+	AccessStream wpf_streams [WP_NUM_STREAMS];
+	uint64 wpf_clock;
+};
+
+
+static const char * const S_FAI_SUFFIX_S = ".fai";
+
+static const char * const S_GZI_SUFFIX_S = ".gzi";
+
+static const size_t S_INITIAL_SCAFFOLDS_SIZE = 1024;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static bool LoadScaffoldLayouts (WindowPrefetcher *prefetcher_p, const char *fasta_filename_s);
+
+static bool LoadBgzfBlockOffsets (WindowPrefetcher *prefetcher_p, const char *fasta_filename_s);
+
+static bool IsBgzipped (const int fd);
+
+static uint64 GetFileOffset (const WindowPrefetcher *prefetcher_p, const ScaffoldLayout *scaffold_p, const hts_pos_t pos, const bool end_flag);
+
+static AccessStream *GetAccessStream (WindowPrefetcher *prefetcher_p, const int scaffold_index, const hts_pos_t start, const hts_pos_t end);
+
+static void AdviseWindow (WindowPrefetcher *prefetcher_p, AccessStream *stream_p, const ScaffoldLayout *scaffold_p, hts_pos_t window_start, hts_pos_t window_end, const bool forward_flag);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+WindowPrefetcher *AllocateWindowPrefetcher (const char *fasta_filename_s, const uint64 budget)
+{
+	WindowPrefetcher *prefetcher_p = (WindowPrefetcher *) AllocMemory (sizeof (WindowPrefetcher));
+
+	if (prefetcher_p)
+		{
+			memset (prefetcher_p, 0, sizeof (WindowPrefetcher));
+			prefetcher_p -> wpf_budget = budget;
+			prefetcher_p -> wpf_fd = open (fasta_filename_s, O_RDONLY);
+
+			if (prefetcher_p -> wpf_fd != -1)
+				{
+					struct stat info;
+
+					if (fstat (prefetcher_p -> wpf_fd, &info) == 0)
+						{
+							prefetcher_p -> wpf_file_size = (uint64) info.st_size;
+
+							if (LoadScaffoldLayouts (prefetcher_p, fasta_filename_s))
+								{
+									if ((!IsBgzipped (prefetcher_p -> wpf_fd)) || LoadBgzfBlockOffsets (prefetcher_p, fasta_filename_s))
+										{
+											if (pthread_mutex_init (& (prefetcher_p -> wpf_mutex), NULL) == 0)
+												{
+													size_t i;
+
+													for (i = 0; i < WP_NUM_STREAMS; ++ i)
+														{
+															prefetcher_p -> wpf_streams [i].as_scaffold_index = -1;
+														}
+
+													return prefetcher_p;
+												}
+										}
+								}
+						}
+
+					close (prefetcher_p -> wpf_fd);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to open \"%s\" for prefetching", fasta_filename_s);
+				}
+
+			if (prefetcher_p -> wpf_blocks_p)
+				{
+					FreeMemory (prefetcher_p -> wpf_blocks_p);
+				}
+
+			if (prefetcher_p -> wpf_scaffolds_p)
+				{
+					FreeMemory (prefetcher_p -> wpf_scaffolds_p);
+				}
+
+			FreeMemory (prefetcher_p);
+		}
+
+	return NULL;
+}
+
+
+void FreeWindowPrefetcher (WindowPrefetcher *prefetcher_p)
+{
+	pthread_mutex_destroy (& (prefetcher_p -> wpf_mutex));
+	close (prefetcher_p -> wpf_fd);
+
+	if (prefetcher_p -> wpf_blocks_p)
+		{
+			FreeMemory (prefetcher_p -> wpf_blocks_p);
+		}
+
+	FreeMemory (prefetcher_p -> wpf_scaffolds_p);
+	FreeMemory (prefetcher_p);
+}
+
+
+void PrefetchAdjacentWindow (WindowPrefetcher *prefetcher_p, const int scaffold_index, const hts_pos_t start, hts_pos_t end)
+{
+	if ((scaffold_index >= 0) && ((size_t) scaffold_index < prefetcher_p -> wpf_num_scaffolds) && (prefetcher_p -> wpf_budget > 0))
+		{
+			const ScaffoldLayout *scaffold_p = prefetcher_p -> wpf_scaffolds_p + scaffold_index;
+
+			if (end > scaffold_p -> sl_length)
+				{
+					end = scaffold_p -> sl_length;
+				}
+
+			if ((start >= 0) && (start < end))
+				{
+					AccessStream *stream_p;
+
+					pthread_mutex_lock (& (prefetcher_p -> wpf_mutex));
+
+					stream_p = GetAccessStream (prefetcher_p, scaffold_index, start, end);
+
+					if (stream_p)
+						{
+							const hts_pos_t length = end - start;
+
+							/* Once a request reaches the prefetched window, it is in the page cache */
+							if ((start < stream_p -> as_prefetch_end) && (end > stream_p -> as_prefetch_start))
+								{
+									stream_p -> as_prefetch_bytes = 0;
+								}
+
+							if ((start > stream_p -> as_start) && (end > stream_p -> as_end))
+								{
+									AdviseWindow (prefetcher_p, stream_p, scaffold_p, end, (scaffold_p -> sl_length - end > length) ? end + length : scaffold_p -> sl_length, true);
+								}
+							else if ((start < stream_p -> as_start) && (end < stream_p -> as_end))
+								{
+									AdviseWindow (prefetcher_p, stream_p, scaffold_p, (start > length) ? start - length : 0, start, false);
+								}
+
+							stream_p -> as_start = start;
+							stream_p -> as_end = end;
+						}
+
+					pthread_mutex_unlock (& (prefetcher_p -> wpf_mutex));
+				}
+		}
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+/*
+ * The scaffolds are kept in the order of the .fai file, which is the
+ * order that faidx numbers them in.
+ */
+static bool LoadScaffoldLayouts (WindowPrefetcher *prefetcher_p, const char *fasta_filename_s)
+{
+	bool success_flag = false;
+	char *fai_filename_s = ConcatenateStrings (fasta_filename_s, S_FAI_SUFFIX_S);
+
+	if (fai_filename_s)
+		{
+			FILE *fai_f = fopen (fai_filename_s, "r");
+
+			if (fai_f)
+				{
+					size_t scaffolds_size = S_INITIAL_SCAFFOLDS_SIZE;
+					char *line_s = NULL;
+					size_t line_size = 0;
+
+					prefetcher_p -> wpf_scaffolds_p = (ScaffoldLayout *) AllocMemoryArray (sizeof (ScaffoldLayout), scaffolds_size);
+					success_flag = (prefetcher_p -> wpf_scaffolds_p != NULL);
+
+					while (success_flag && (getline (&line_s, &line_size, fai_f) != -1))
+						{
+							const char *tab_s = strchr (line_s, '\t');
+							long long length;
+							unsigned long long offset;
+							unsigned long long line_bases;
+							unsigned long long line_width;
+
+							if (tab_s && (sscanf (tab_s + 1, "%lld\t%llu\t%llu\t%llu", &length, &offset, &line_bases, &line_width) == 4) && (length >= 0) && (line_bases > 0) && (line_width >= line_bases))
+								{
+									ScaffoldLayout *scaffold_p;
+
+									if (prefetcher_p -> wpf_num_scaffolds == scaffolds_size)
+										{
+											ScaffoldLayout *new_scaffolds_p = (ScaffoldLayout *) ReallocMemory (prefetcher_p -> wpf_scaffolds_p, 2 * scaffolds_size * sizeof (ScaffoldLayout), scaffolds_size * sizeof (ScaffoldLayout));
+
+											if (new_scaffolds_p)
+												{
+													prefetcher_p -> wpf_scaffolds_p = new_scaffolds_p;
+													scaffolds_size *= 2;
+												}
+											else
+												{
+													success_flag = false;
+												}
+										}
+
+									if (success_flag)
+										{
+											scaffold_p = prefetcher_p -> wpf_scaffolds_p + prefetcher_p -> wpf_num_scaffolds;
+											scaffold_p -> sl_length = (hts_pos_t) length;
+											scaffold_p -> sl_offset = (uint64) offset;
+											scaffold_p -> sl_line_bases = (uint64) line_bases;
+											scaffold_p -> sl_line_width = (uint64) line_width;
+
+											++ (prefetcher_p -> wpf_num_scaffolds);
+										}
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Invalid line in \"%s\": %s", fai_filename_s, line_s);
+									success_flag = false;
+								}
+						}
+
+					if (line_s)
+						{
+							free (line_s);
+						}
+
+					fclose (fai_f);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to open \"%s\" for prefetching", fai_filename_s);
+				}
+
+			FreeCopiedString (fai_filename_s);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * A .gzi file is a little-endian count followed by that many pairs of
+ * compressed and uncompressed offsets, leaving out the first block at 0.
+ */
+static bool LoadBgzfBlockOffsets (WindowPrefetcher *prefetcher_p, const char *fasta_filename_s)
+{
+	bool success_flag = false;
+	char *gzi_filename_s = ConcatenateStrings (fasta_filename_s, S_GZI_SUFFIX_S);
+
+	if (gzi_filename_s)
+		{
+			FILE *gzi_f = fopen (gzi_filename_s, "rb");
+
+			if (gzi_f)
+				{
+					uint8 buffer [16];
+
+					if (fread (buffer, 8, 1, gzi_f) == 1)
+						{
+							const uint64 num_blocks = le_to_u64 (buffer) + 1;
+
+							prefetcher_p -> wpf_blocks_p = (BgzfBlockOffset *) AllocMemoryArray (sizeof (BgzfBlockOffset), (size_t) num_blocks);
+
+							if (prefetcher_p -> wpf_blocks_p)
+								{
+									size_t i;
+
+									prefetcher_p -> wpf_blocks_p [0].bbo_compressed = 0;
+									prefetcher_p -> wpf_blocks_p [0].bbo_uncompressed = 0;
+
+									success_flag = true;
+
+									for (i = 1; (i < num_blocks) && success_flag; ++ i)
+										{
+											if (fread (buffer, 16, 1, gzi_f) == 1)
+												{
+													prefetcher_p -> wpf_blocks_p [i].bbo_compressed = le_to_u64 (buffer);
+													prefetcher_p -> wpf_blocks_p [i].bbo_uncompressed = le_to_u64 (buffer + 8);
+												}
+											else
+												{
+													success_flag = false;
+												}
+										}
+
+									prefetcher_p -> wpf_num_blocks = (size_t) num_blocks;
+								}
+						}
+
+					if (!success_flag)
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to read \"%s\" for prefetching", gzi_filename_s);
+						}
+
+					fclose (gzi_f);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to open \"%s\" for prefetching", gzi_filename_s);
+				}
+
+			FreeCopiedString (gzi_filename_s);
+		}
+
+	return success_flag;
+}
+
+
+static bool IsBgzipped (const int fd)
+{
+	uint8 magic [2];
+
+	return ((pread (fd, magic, 2, 0) == 2) && (magic [0] == 0x1F) && (magic [1] == 0x8B));
+}
+
+
+/*
+ * Get where a base is in the file or, if end_flag is set, where the base
+ * before it ends. For a bgzipped file these are widened out to the start
+ * and end of the blocks that hold them.
+ */
+static uint64 GetFileOffset (const WindowPrefetcher *prefetcher_p, const ScaffoldLayout *scaffold_p, const hts_pos_t pos, const bool end_flag)
+{
+	const uint64 base = end_flag ? (uint64) (pos - 1) : (uint64) pos;
+	uint64 offset = scaffold_p -> sl_offset + (base / scaffold_p -> sl_line_bases) * (scaffold_p -> sl_line_width) + (base % scaffold_p -> sl_line_bases);
+
+	if (end_flag)
+		{
+			++ offset;
+		}
+
+	if (prefetcher_p -> wpf_blocks_p)
+		{
+			const BgzfBlockOffset *blocks_p = prefetcher_p -> wpf_blocks_p;
+			size_t low = 0;
+			size_t high = prefetcher_p -> wpf_num_blocks;
+
+			/* Find the first block that starts after the offset */
+			while (low < high)
+				{
+					const size_t mid = low + ((high - low) >> 1);
+
+					if (blocks_p [mid].bbo_uncompressed <= (end_flag ? offset - 1 : offset))
+						{
+							low = mid + 1;
+						}
+					else
+						{
+							high = mid;
+						}
+				}
+
+			if (end_flag)
+				{
+					offset = (low < prefetcher_p -> wpf_num_blocks) ? blocks_p [low].bbo_compressed : prefetcher_p -> wpf_file_size;
+				}
+			else
+				{
+					offset = blocks_p [low - 1].bbo_compressed;
+				}
+		}
+
+	return offset;
+}
+
+
+/*
+ * A request continues a run if it is on the same scaffold and no more
+ * than the run's window width away from it. Anything else starts a new
+ * run, which is returned as NULL since there is no direction to
+ * prefetch in yet.
+ */
+static AccessStream *GetAccessStream (WindowPrefetcher *prefetcher_p, const int scaffold_index, const hts_pos_t start, const hts_pos_t end)
+{
+	AccessStream *oldest_p = prefetcher_p -> wpf_streams;
+	size_t i;
+
+	++ (prefetcher_p -> wpf_clock);
+
+	for (i = 0; i < WP_NUM_STREAMS; ++ i)
+		{
+			AccessStream *stream_p = prefetcher_p -> wpf_streams + i;
+
+			if (stream_p -> as_scaffold_index == scaffold_index)
+				{
+					const hts_pos_t width = stream_p -> as_end - stream_p -> as_start;
+
+					if ((start <= stream_p -> as_end + width) && (end >= stream_p -> as_start - width))
+						{
+							stream_p -> as_last_used = prefetcher_p -> wpf_clock;
+							return stream_p;
+						}
+				}
+
+			if (stream_p -> as_last_used < oldest_p -> as_last_used)
+				{
+					oldest_p = stream_p;
+				}
+		}
+
+	oldest_p -> as_scaffold_index = scaffold_index;
+	oldest_p -> as_start = start;
+	oldest_p -> as_end = end;
+	oldest_p -> as_last_used = prefetcher_p -> wpf_clock;
+	oldest_p -> as_prefetch_start = 0;
+	oldest_p -> as_prefetch_end = 0;
+	oldest_p -> as_prefetch_bytes = 0;
+
+	return NULL;
+}
+
+
+/*
+ * The window is shrunk, keeping the end next to the current request,
+ * until it fits in what is left of the budget.
+ */
+static void AdviseWindow (WindowPrefetcher *prefetcher_p, AccessStream *stream_p, const ScaffoldLayout *scaffold_p, hts_pos_t window_start, hts_pos_t window_end, const bool forward_flag)
+{
+	if ((window_start < window_end) && ((window_start < stream_p -> as_prefetch_start) || (window_end > stream_p -> as_prefetch_end)))
+		{
+			uint64 outstanding = 0;
+			size_t i;
+
+			for (i = 0; i < WP_NUM_STREAMS; ++ i)
+				{
+					if (prefetcher_p -> wpf_streams + i != stream_p)
+						{
+							outstanding += prefetcher_p -> wpf_streams [i].as_prefetch_bytes;
+						}
+				}
+
+			if (outstanding < prefetcher_p -> wpf_budget)
+				{
+					const uint64 available = prefetcher_p -> wpf_budget - outstanding;
+					uint64 file_start = GetFileOffset (prefetcher_p, scaffold_p, window_start, false);
+					uint64 file_end = GetFileOffset (prefetcher_p, scaffold_p, window_end, true);
+
+					while ((file_end - file_start > available) && (window_end - window_start > 1))
+						{
+							const hts_pos_t half = (window_end - window_start) >> 1;
+
+							if (forward_flag)
+								{
+									window_end = window_start + half;
+									file_end = GetFileOffset (prefetcher_p, scaffold_p, window_end, true);
+								}
+							else
+								{
+									window_start = window_end - half;
+									file_start = GetFileOffset (prefetcher_p, scaffold_p, window_start, false);
+								}
+						}
+
+					if (file_end - file_start <= available)
+						{
+							/* The kernel starts reading the pages in the background, so this doesn't block the job */
+							int res = posix_fadvise (prefetcher_p -> wpf_fd, (off_t) file_start, (off_t) (file_end - file_start), POSIX_FADV_WILLNEED);
+
+							if (res == 0)
+								{
+									stream_p -> as_prefetch_start = window_start;
+									stream_p -> as_prefetch_end = window_end;
+									stream_p -> as_prefetch_bytes = file_end - file_start;
+
+									#if WINDOW_PREFETCH_DEBUG >= STM_LEVEL_FINEST
+									PrintLog (STM_LEVEL_FINEST, __FILE__, __LINE__, "Prefetching " UINT64_FMT " bytes for %" PRIhts_pos "-%" PRIhts_pos, file_end - file_start, window_start + 1, window_end);
+									#endif
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "posix_fadvise failed with %d", res);
+								}
+						}
+				}
+		}
+}
@@ -0,0 +1,170 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/**
+ * worker_pool.c
+ *
+ * @file
+ * @brief
+ */
+
+#include <pthread.h>
+
+#include "worker_pool.h"
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+typedef struct WorkerPool
+{
+	pthread_mutex_t wp_mutex;
+	size_t wp_next_task;
+	size_t wp_num_tasks;
+	RunWorkerTask wp_run_task_fn;
+	void *wp_data_p;
+	bool wp_success_flag;
+} WorkerPool;
+
+
+/*
+ * STATIC PROTOTYPES
+ */
+
+static void *RunWorker (void *data_p);
+
+static bool GetNextTask (WorkerPool *pool_p, size_t *task_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+
+bool RunWorkerPool (const size_t num_tasks, const uint32 num_threads, RunWorkerTask run_task_fn, void *data_p)
+{
+	bool success_flag = true;
+
+	if ((num_threads <= 1) || (num_tasks <= 1))
+		{
+			size_t i;
+
+			for (i = 0; i < num_tasks; ++ i)
+				{
+					if (!run_task_fn (i, data_p))
+						{
+							success_flag = false;
+						}
+				}
+		}
+	else
+		{
+			WorkerPool pool;
+			const size_t num_extra_threads = ((num_tasks < num_threads) ? num_tasks : num_threads) - 1;
+			pthread_t *threads_p = (pthread_t *) AllocMemoryArray (sizeof (pthread_t), num_extra_threads);
+
+			pool.wp_next_task = 0;
+			pool.wp_num_tasks = num_tasks;
+			pool.wp_run_task_fn = run_task_fn;
+			pool.wp_data_p = data_p;
+			pool.wp_success_flag = true;
+
+			if (pthread_mutex_init (& (pool.wp_mutex), NULL) == 0)
+				{
+					size_t num_started = 0;
+
+					if (threads_p)
+						{
+							while (num_started < num_extra_threads)
+								{
+									if (pthread_create (threads_p + num_started, NULL, RunWorker, &pool) == 0)
+										{
+											++ num_started;
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Only started " SIZET_FMT " of " SIZET_FMT " worker threads", num_started, num_extra_threads);
+											break;
+										}
+								}
+						}
+
+					/* The calling thread does its share of the work too */
+					RunWorker (&pool);
+
+					while (num_started > 0)
+						{
+							-- num_started;
+							pthread_join (threads_p [num_started], NULL);
+						}
+
+					pthread_mutex_destroy (& (pool.wp_mutex));
+
+					success_flag = pool.wp_success_flag;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise worker pool mutex");
+					success_flag = false;
+				}
+
+			if (threads_p)
+				{
+					FreeMemory (threads_p);
+				}
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * STATIC FUNCTIONS
+ */
+
+static void *RunWorker (void *data_p)
+{
+	WorkerPool *pool_p = (WorkerPool *) data_p;
+	size_t task;
+
+	while (GetNextTask (pool_p, &task))
+		{
+			if (!pool_p -> wp_run_task_fn (task, pool_p -> wp_data_p))
+				{
+					pthread_mutex_lock (& (pool_p -> wp_mutex));
+					pool_p -> wp_success_flag = false;
+					pthread_mutex_unlock (& (pool_p -> wp_mutex));
+				}
+		}
+
+	return NULL;
+}
+
+
+static bool GetNextTask (WorkerPool *pool_p, size_t *task_p)
+{
+	bool got_task_flag = false;
+
+	pthread_mutex_lock (& (pool_p -> wp_mutex));
+
+	if (pool_p -> wp_next_task < pool_p -> wp_num_tasks)
+		{
+			*task_p = pool_p -> wp_next_task;
+			++ (pool_p -> wp_next_task);
+			got_task_flag = true;
+		}
+
+	pthread_mutex_unlock (& (pool_p -> wp_mutex));
+
+	return got_task_flag;
+}